@@ -14,7 +14,18 @@
 
 package com.google.iosdevicecontrol;
 
+import com.google.common.collect.ImmutableList;
 import com.google.common.collect.ImmutableSet;
+import com.google.common.io.MoreFiles;
+import com.google.common.io.RecursiveDeleteOption;
+import com.google.iosdevicecontrol.crash.CrashBucket;
+import com.google.iosdevicecontrol.crash.CrashBucketStore;
+import com.google.iosdevicecontrol.image.FrameSource;
+import com.google.iosdevicecontrol.image.ScreenRecorder;
+import com.google.iosdevicecontrol.syslog.SyslogStore;
+import java.io.IOException;
+import java.io.OutputStream;
+import java.nio.file.Files;
 import java.nio.file.Path;
 
 /**
@@ -89,6 +100,51 @@ public interface IosDevice {
    */
   IosDeviceResource startSystemLogger(Path logPath) throws IosDeviceException;
 
+  /**
+   * Starts capturing the system log like {@link #startSystemLogger}, but parses the messages into
+   * records and stores them in a {@link SyslogStore} in the provided directory, which can be
+   * queried by time range and process without scanning the whole log. Returns an {@link
+   * IosDeviceResource} that stops capturing and stores the last records when closed.
+   *
+   * <p>This implementation captures the log as text and parses it when closed; devices that can
+   * stream the log parse it as it arrives instead.
+   *
+   * @throws IosDeviceException - if there was an error communicating with the device
+   * @throws IllegalStateException - if system log capturing is already started
+   */
+  default IosDeviceResource startSystemLogStore(Path storeDirectory) throws IosDeviceException {
+    Path textDirectory;
+    try {
+      textDirectory = Files.createTempDirectory("syslog");
+    } catch (IOException e) {
+      throw new IosDeviceException(this, e);
+    }
+    Path textLog = textDirectory.resolve("syslog.txt");
+    IosDeviceResource logger = startSystemLogger(textLog);
+    return new IosDeviceResource(this) {
+      @Override
+      public void close() throws IosDeviceException {
+        try {
+          logger.close();
+          try (SyslogStore store = SyslogStore.inDirectory(storeDirectory);
+              OutputStream ingest = store.ingestSink().openStream()) {
+            if (Files.exists(textLog)) {
+              Files.copy(textLog, ingest);
+            }
+          }
+        } catch (IOException e) {
+          throw new IosDeviceException(device(), e);
+        } finally {
+          try {
+            MoreFiles.deleteRecursively(textDirectory, RecursiveDeleteOption.ALLOW_INSECURE);
+          } catch (IOException e) {
+            // Only a temporary file is left behind.
+          }
+        }
+      }
+    };
+  }
+
   /**
    * Copies the crash logs to the specified directory and removes them from the device.
    *
@@ -96,6 +152,29 @@ public interface IosDevice {
    */
   void pullCrashLogs(Path directory) throws IosDeviceException;
 
+  /**
+   * Pulls the crash logs into the buckets of the specified store, which only keeps one log per
+   * crash signature, and returns the buckets that are new, which hold the logs of the crashes that
+   * had not been seen before.
+   *
+   * @throws IosDeviceException - if there was an error communicating with the device or writing to
+   *     the store
+   */
+  default ImmutableList<CrashBucket> pullCrashLogs(CrashBucketStore store)
+      throws IosDeviceException {
+    try {
+      Path pullDirectory = Files.createTempDirectory("crashlogs");
+      try {
+        pullCrashLogs(pullDirectory);
+        return store.ingest(pullDirectory);
+      } finally {
+        MoreFiles.deleteRecursively(pullDirectory, RecursiveDeleteOption.ALLOW_INSECURE);
+      }
+    } catch (IOException e) {
+      throw new IosDeviceException(this, e);
+    }
+  }
+
   /**
    * Clears the crash logs on the device.
    *
@@ -123,4 +202,16 @@ public interface IosDevice {
    * @throws IosDeviceException - if there is an error communicating with the device
    */
   byte[] takeScreenshot() throws IosDeviceException;
+
+  /**
+   * Starts recording the screen to a Motion JPEG AVI video at the provided path, from screenshots
+   * taken as fast as the device allows, up to the default frame rate of {@link ScreenRecorder}.
+   * Returns an {@link IosDeviceResource} that stops the recording and finishes the video when
+   * closed, which can be used in a try-with-resources block.
+   *
+   * @throws IosDeviceException - if there was an error communicating with the device
+   */
+  default IosDeviceResource startScreenRecording(Path videoPath) throws IosDeviceException {
+    return ScreenRecorder.withDefaults().record(this, FrameSource.fromScreenshots(this), videoPath);
+  }
 }
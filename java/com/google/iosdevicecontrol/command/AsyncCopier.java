@@ -14,6 +14,8 @@
 
 package com.google.iosdevicecontrol.command;
 
+import static java.util.concurrent.TimeUnit.SECONDS;
+
 import com.google.common.annotations.VisibleForTesting;
 import com.google.common.base.Supplier;
 import com.google.iosdevicecontrol.util.FluentLogger;
@@ -97,7 +99,7 @@ final class AsyncCopier {
       try {
         copyStrategy.copy(source, sink);
       } catch (IOException e) {
-        logger.at(ioExceptionLogLevel.get()).withCause(e).log();
+        logger.at(ioExceptionLogLevel.get()).withCause(e).atMostEvery(1, SECONDS).log();
       } finally {
         closeStreams();
       }
@@ -138,7 +140,7 @@ final class AsyncCopier {
         sink.close();
       }
     } catch (IOException e) {
-      logger.at(ioExceptionLogLevel.get()).withCause(e).log();
+      logger.at(ioExceptionLogLevel.get()).withCause(e).atMostEvery(1, SECONDS).log();
     }
   }
 }
@@ -35,7 +35,7 @@ import java.util.Arrays;
  * from at the same time, but it does NOT ensure concurrent writes to the CapturingOutputStream or
  * concurrent reads from the individual input stream are thread safe.
  */
-final class CapturingOutputStream extends OutputStream {
+public final class CapturingOutputStream extends OutputStream {
   // Same value as ArrayList.MAX_ARRAY_SIZE - see the comment there for details.
   private static final int MAX_BUFFER_SIZE = Integer.MAX_VALUE - 8;
 
@@ -51,15 +51,15 @@ final class CapturingOutputStream extends OutputStream {
   private volatile int size = 0;
   private volatile boolean closed;
 
-  InputStream openInputStream() {
+  public InputStream openInputStream() {
     return new CapturedInputStream();
   }
 
-  byte[] toByteArray() {
+  public byte[] toByteArray() {
     return Arrays.copyOf(data, size);
   }
 
-  String toString(Charset charset) {
+  public String toString(Charset charset) {
     return new String(data, 0, size, charset);
   }
 
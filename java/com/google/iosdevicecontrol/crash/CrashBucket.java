@@ -0,0 +1,38 @@
+// Copyright 2017 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+package com.google.iosdevicecontrol.crash;
+
+import com.google.auto.value.AutoValue;
+import java.nio.file.Path;
+
+/** The crash reports with the same signature, of which only the first one is kept. */
+@AutoValue
+public abstract class CrashBucket {
+  static CrashBucket create(CrashSignature signature, Path report, int count) {
+    return new AutoValue_CrashBucket(signature, report, count);
+  }
+
+  public abstract CrashSignature signature();
+
+  /** The path of the report that represents the bucket. */
+  public abstract Path report();
+
+  /** The number of reports with the signature, including the representative. */
+  public abstract int count();
+
+  CrashBucket withCount(int count) {
+    return create(signature(), report(), count);
+  }
+}
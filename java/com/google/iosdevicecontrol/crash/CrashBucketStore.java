@@ -0,0 +1,207 @@
+// Copyright 2017 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+package com.google.iosdevicecontrol.crash;
+
+import static com.google.common.base.Preconditions.checkNotNull;
+import static java.nio.charset.StandardCharsets.UTF_8;
+
+import com.dd.plist.NSArray;
+import com.dd.plist.NSDictionary;
+import com.dd.plist.NSNumber;
+import com.dd.plist.NSObject;
+import com.dd.plist.NSString;
+import com.google.common.collect.ImmutableList;
+import com.google.common.io.MoreFiles;
+import com.google.iosdevicecontrol.util.AtomicFiles;
+import com.google.iosdevicecontrol.util.FluentLogger;
+import com.google.iosdevicecontrol.util.PlistParser;
+import com.google.iosdevicecontrol.util.PlistParser.PlistParseException;
+import java.io.IOException;
+import java.nio.file.Files;
+import java.nio.file.Path;
+import java.nio.file.StandardCopyOption;
+import java.util.ArrayList;
+import java.util.Comparator;
+import java.util.HashMap;
+import java.util.LinkedHashSet;
+import java.util.List;
+import java.util.Map;
+import java.util.Optional;
+import java.util.Set;
+import java.util.stream.Collectors;
+import java.util.stream.Stream;
+
+/**
+ * A store of crash reports that keeps one report per {@link CrashSignature}, so that reports which
+ * are repeats of the same crash only add to the count of their bucket. Each bucket is a directory
+ * named by the id of its signature, with the representative report and an XML plist of the
+ * signature and count.
+ */
+public final class CrashBucketStore {
+  private static final FluentLogger logger = FluentLogger.forEnclosingClass();
+
+  /**
+   * Increased whenever the layout of a bucket file changes. Buckets written with a different value
+   * are skipped when the store is loaded and rebuilt as reports come in again.
+   */
+  static final int VERSION = 1;
+
+  static final String BUCKET_FILE_NAME = "bucket.plist";
+
+  private static final String VERSION_KEY = "StoreVersion";
+  private static final String PROCESS_KEY = "Process";
+  private static final String EXCEPTION_TYPE_KEY = "ExceptionType";
+  private static final String FRAMES_KEY = "Frames";
+  private static final String REPORT_KEY = "Report";
+  private static final String COUNT_KEY = "Count";
+
+  /** Returns a store of the buckets in the specified directory. */
+  public static CrashBucketStore inDirectory(Path directory) {
+    return new CrashBucketStore(directory);
+  }
+
+  private final Path directory;
+  /** The buckets by the ids of their signatures, loaded the first time they are needed. */
+  private Map<String, CrashBucket> buckets;
+
+  private CrashBucketStore(Path directory) {
+    this.directory = checkNotNull(directory);
+  }
+
+  /**
+   * Returns all buckets, the ones with the most reports first.
+   *
+   * @throws IOException - if the directory cannot be read
+   */
+  public synchronized ImmutableList<CrashBucket> buckets() throws IOException {
+    loadBuckets();
+    return buckets
+        .values()
+        .stream()
+        .sorted(Comparator.comparingInt(CrashBucket::count).reversed())
+        .collect(ImmutableList.toImmutableList());
+  }
+
+  /**
+   * Buckets the reports in the specified directory and its subdirectories: the first report of a
+   * signature that has no bucket yet is moved into a new bucket, and every other report is deleted
+   * after adding it to the count of its bucket. Only the new buckets are returned, since they are
+   * the only reports that have not been seen before.
+   *
+   * @throws IOException - if a report cannot be read, moved or deleted, or a bucket written
+   */
+  public synchronized ImmutableList<CrashBucket> ingest(Path reportsDirectory)
+      throws IOException {
+    loadBuckets();
+    List<Path> reports;
+    try (Stream<Path> paths = Files.walk(reportsDirectory)) {
+      // Report names start with the process and the time, so this keeps the earliest of a bucket.
+      reports = paths.filter(Files::isRegularFile).sorted().collect(Collectors.toList());
+    }
+
+    List<String> newIds = new ArrayList<>();
+    Set<String> countedIds = new LinkedHashSet<>();
+    for (Path report : reports) {
+      byte[] content = Files.readAllBytes(report);
+      CrashSignature signature =
+          CrashReportParser.parse(new String(content, UTF_8))
+              .orElseGet(() -> CrashSignature.unparsed(content));
+      CrashBucket bucket = buckets.get(signature.id());
+      if (bucket == null) {
+        Path bucketDirectory = directory.resolve(signature.id());
+        Files.createDirectories(bucketDirectory);
+        Path representative = bucketDirectory.resolve(report.getFileName().toString());
+        Files.move(report, representative, StandardCopyOption.REPLACE_EXISTING);
+        bucket = CrashBucket.create(signature, representative, 1);
+        // Written right away, so the moved report is never left without its bucket.
+        writeBucket(bucket);
+        newIds.add(signature.id());
+      } else {
+        Files.delete(report);
+        bucket = bucket.withCount(bucket.count() + 1);
+        countedIds.add(signature.id());
+      }
+      buckets.put(signature.id(), bucket);
+    }
+    for (String id : countedIds) {
+      writeBucket(buckets.get(id));
+    }
+    return newIds.stream().map(buckets::get).collect(ImmutableList.toImmutableList());
+  }
+
+  private void loadBuckets() throws IOException {
+    if (buckets != null) {
+      return;
+    }
+    Map<String, CrashBucket> loaded = new HashMap<>();
+    if (Files.isDirectory(directory)) {
+      for (Path bucketDirectory : MoreFiles.listFiles(directory)) {
+        Path bucketFile = bucketDirectory.resolve(BUCKET_FILE_NAME);
+        if (Files.isRegularFile(bucketFile)) {
+          readBucket(bucketFile).ifPresent(bucket -> loaded.put(bucket.signature().id(), bucket));
+        }
+      }
+    }
+    buckets = loaded;
+  }
+
+  private static Optional<CrashBucket> readBucket(Path bucketFile) {
+    String id = bucketFile.getParent().getFileName().toString();
+    try {
+      NSDictionary entry = (NSDictionary) PlistParser.fromPath(bucketFile);
+      if (!entry.containsKey(VERSION_KEY)
+          || ((NSNumber) entry.get(VERSION_KEY)).intValue() != VERSION) {
+        logger.atInfo().log("skipping %s, written in an older or newer layout", bucketFile);
+        return Optional.empty();
+      }
+      Path report = bucketFile.resolveSibling(entry.get(REPORT_KEY).toString());
+      ImmutableList<String> frames =
+          Stream.of(((NSArray) entry.get(FRAMES_KEY)).getArray())
+              .map(NSObject::toString)
+              .collect(ImmutableList.toImmutableList());
+      String process = entry.get(PROCESS_KEY).toString();
+      CrashSignature signature =
+          process.isEmpty()
+              ? CrashSignature.unparsed(Files.readAllBytes(report))
+              : CrashSignature.create(process, entry.get(EXCEPTION_TYPE_KEY).toString(), frames);
+      if (!signature.id().equals(id)) {
+        logger.atInfo().log("skipping %s, its signature does not match its directory", bucketFile);
+        return Optional.empty();
+      }
+      return Optional.of(
+          CrashBucket.create(signature, report, ((NSNumber) entry.get(COUNT_KEY)).intValue()));
+    } catch (PlistParseException | IOException | ClassCastException | NullPointerException e) {
+      logger.atWarning().withCause(e).log("skipping unreadable %s", bucketFile);
+      return Optional.empty();
+    }
+  }
+
+  private static void writeBucket(CrashBucket bucket) throws IOException {
+    NSDictionary entry = new NSDictionary();
+    entry.put(VERSION_KEY, VERSION);
+    entry.put(PROCESS_KEY, bucket.signature().process());
+    entry.put(EXCEPTION_TYPE_KEY, bucket.signature().exceptionType());
+    entry.put(
+        FRAMES_KEY,
+        new NSArray(
+            bucket.signature().frames().stream().map(NSString::new).toArray(NSObject[]::new)));
+    entry.put(REPORT_KEY, bucket.report().getFileName().toString());
+    entry.put(COUNT_KEY, bucket.count());
+
+    AtomicFiles.write(
+        bucket.report().resolveSibling(BUCKET_FILE_NAME),
+        entry.toXMLPropertyList().getBytes(UTF_8));
+  }
+}
@@ -0,0 +1,165 @@
+// Copyright 2017 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+package com.google.iosdevicecontrol.crash;
+
+import com.google.common.collect.ImmutableList;
+import com.google.common.collect.ImmutableSet;
+import com.google.iosdevicecontrol.util.JsonParser;
+import java.util.ArrayList;
+import java.util.List;
+import java.util.Optional;
+import java.util.regex.Matcher;
+import java.util.regex.Pattern;
+import javax.json.JsonArray;
+import javax.json.JsonException;
+import javax.json.JsonObject;
+import javax.json.JsonValue;
+
+/**
+ * Computes the signatures of crash reports, both of the classic text format and of the JSON format
+ * of iOS 15 and later.
+ */
+final class CrashReportParser {
+  /** Number of frames of the crashed thread that make up the signature. */
+  static final int FRAME_COUNT = 5;
+
+  /**
+   * Images whose frames at the top of the crashed thread are just the way down to abort(), which is
+   * the same for every crash that ends there, so they are left out of the signature.
+   */
+  private static final ImmutableSet<String> ABORT_IMAGES =
+      ImmutableSet.of(
+          "libsystem_kernel.dylib",
+          "libsystem_pthread.dylib",
+          "libsystem_c.dylib",
+          "libc++abi.dylib");
+
+  private static final Pattern PROCESS_PATTERN =
+      Pattern.compile("^Process:\\s+(.+?)\\s+\\[\\d+\\]", Pattern.MULTILINE);
+  private static final Pattern EXCEPTION_TYPE_PATTERN =
+      Pattern.compile("^Exception Type:\\s+(.+?)\\s*$", Pattern.MULTILINE);
+  private static final Pattern CRASHED_THREAD_PATTERN =
+      Pattern.compile("^Thread \\d+ Crashed:.*$", Pattern.MULTILINE);
+  // "3   MyApp   0x0000000100abc123 -[Foo bar] + 36" or "... 0x100a00000 + 700707".
+  private static final Pattern FRAME_PATTERN =
+      Pattern.compile("^\\d+\\s+(.+?)\\s+0x\\p{XDigit}+\\s+(.+)$");
+  private static final Pattern UNSYMBOLICATED_PATTERN =
+      Pattern.compile("^0x\\p{XDigit}+ \\+ (\\d+)$");
+  // A trailing "+ 36" offset into the function, "(in MyApp)" or "(Foo.m:42)" location.
+  private static final Pattern SYMBOL_SUFFIX_PATTERN =
+      Pattern.compile("(?:\\s+\\+\\s+\\d+|\\s+\\((?:in [^()]*|[^()]*:\\d+)\\))+$");
+
+  /** Returns the signature of the report, or empty if it is of neither format. */
+  static Optional<CrashSignature> parse(String report) {
+    int firstLineEnd = report.indexOf('\n');
+    if (report.startsWith("{") && firstLineEnd > 0) {
+      try {
+        return parseJson(report.substring(firstLineEnd + 1));
+      } catch (JsonException | ClassCastException | NullPointerException e) {
+        // Not all JSON reports are crashes of a process, e.g. those of jetsam events.
+        return Optional.empty();
+      }
+    }
+    return parseText(report);
+  }
+
+  private static Optional<CrashSignature> parseText(String report) {
+    Matcher process = PROCESS_PATTERN.matcher(report);
+    Matcher exceptionType = EXCEPTION_TYPE_PATTERN.matcher(report);
+    Matcher crashedThread = CRASHED_THREAD_PATTERN.matcher(report);
+    if (!process.find() || !exceptionType.find() || !crashedThread.find()) {
+      return Optional.empty();
+    }
+
+    List<String> frames = new ArrayList<>();
+    String[] lines = report.substring(crashedThread.end()).split("\r?\n");
+    // The first element is the rest of the "Thread 0 Crashed:" line, which is empty.
+    for (int i = 1; i < lines.length && !lines[i].trim().isEmpty(); i++) {
+      Matcher frame = FRAME_PATTERN.matcher(lines[i].trim());
+      if (frame.matches()) {
+        frames.add(normalizeFrame(frame.group(1), frame.group(2)));
+      }
+    }
+    return Optional.of(
+        CrashSignature.create(process.group(1), exceptionType.group(1), topFrames(frames)));
+  }
+
+  private static Optional<CrashSignature> parseJson(String body) {
+    JsonObject report = JsonParser.parseObject(body);
+    JsonObject exception = report.getJsonObject("exception");
+    String exceptionType = exception.getString("type");
+    if (exception.containsKey("signal")) {
+      exceptionType += " (" + exception.getString("signal") + ")";
+    }
+
+    JsonArray images = report.getJsonArray("usedImages");
+    JsonObject thread =
+        report.getJsonArray("threads").getJsonObject(report.getInt("faultingThread"));
+    List<String> frames = new ArrayList<>();
+    for (JsonValue value : thread.getJsonArray("frames")) {
+      JsonObject frame = (JsonObject) value;
+      int imageIndex = frame.getInt("imageIndex");
+      String image =
+          imageIndex < images.size()
+              ? images.getJsonObject(imageIndex).getString("name", "???")
+              : "???";
+      String symbol =
+          frame.containsKey("symbol")
+              ? frame.getString("symbol")
+              : "0x0 + " + frame.getJsonNumber("imageOffset").longValue();
+      frames.add(normalizeFrame(image, symbol));
+    }
+    return Optional.of(
+        CrashSignature.create(report.getString("procName"), exceptionType, topFrames(frames)));
+  }
+
+  /**
+   * Returns the frame without its addresses: "image`symbol" without the offset into the symbol, or
+   * "image + offset" with the offset into the image if the frame is not symbolicated, since that
+   * offset does not depend on where the image was loaded.
+   */
+  private static String normalizeFrame(String image, String symbol) {
+    Matcher unsymbolicated = UNSYMBOLICATED_PATTERN.matcher(symbol);
+    if (unsymbolicated.matches()) {
+      return image + " + " + unsymbolicated.group(1);
+    }
+    return image + '`' + SYMBOL_SUFFIX_PATTERN.matcher(symbol).replaceFirst("");
+  }
+
+  /** Returns the top frames of the crashed thread that are not on the way down to abort(). */
+  private static ImmutableList<String> topFrames(List<String> frames) {
+    int start = 0;
+    while (start < frames.size() && isAbortFrame(frames.get(start))) {
+      start++;
+    }
+    if (start == frames.size()) {
+      // Crashed inside the abort machinery itself, so it is all there is to go by.
+      start = 0;
+    }
+    int end = Math.min(frames.size(), start + FRAME_COUNT);
+    return ImmutableList.copyOf(frames.subList(start, end));
+  }
+
+  private static boolean isAbortFrame(String frame) {
+    for (String image : ABORT_IMAGES) {
+      if (frame.startsWith(image + '`') || frame.startsWith(image + " + ")) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  private CrashReportParser() {}
+}
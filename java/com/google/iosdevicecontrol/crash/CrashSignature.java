@@ -0,0 +1,65 @@
+// Copyright 2017 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+package com.google.iosdevicecontrol.crash;
+
+import static java.nio.charset.StandardCharsets.UTF_8;
+
+import com.google.auto.value.AutoValue;
+import com.google.common.base.Joiner;
+import com.google.common.collect.ImmutableList;
+import com.google.common.hash.Hashing;
+
+/**
+ * What identifies a crash regardless of when and where it happened: the crashed process, the type
+ * of the exception and the top frames of the thread that crashed, without the addresses that vary
+ * from run to run. Reports with the same signature are considered repeats of the same crash.
+ */
+@AutoValue
+public abstract class CrashSignature {
+  /** Length of the {@link #id} in hexadecimal digits. */
+  private static final int ID_LENGTH = 16;
+
+  /**
+   * Creates a signature from the normalized frames of the crashed thread, innermost first, each of
+   * the form "image`symbol" or "image + offset" if the frame is not symbolicated.
+   */
+  public static CrashSignature create(
+      String process, String exceptionType, ImmutableList<String> frames) {
+    String key = process + '\0' + exceptionType + '\0' + Joiner.on('\n').join(frames);
+    String id = Hashing.sha256().hashString(key, UTF_8).toString().substring(0, ID_LENGTH);
+    return new AutoValue_CrashSignature(id, process, exceptionType, frames);
+  }
+
+  /**
+   * Creates the signature of a report that could not be parsed, which is only shared by reports
+   * with the same contents.
+   */
+  static CrashSignature unparsed(byte[] report) {
+    String id = Hashing.sha256().hashBytes(report).toString().substring(0, ID_LENGTH);
+    return new AutoValue_CrashSignature(id, "", "", ImmutableList.of());
+  }
+
+  /** A hash of the signature that is safe to use as a file name. */
+  public abstract String id();
+
+  /** The name of the crashed process, or empty if the report could not be parsed. */
+  public abstract String process();
+
+  /** The type of the exception, e.g. "EXC_BAD_ACCESS (SIGSEGV)". */
+  public abstract String exceptionType();
+
+  /** The normalized top frames of the crashed thread, innermost first. */
+  public abstract ImmutableList<String> frames();
+}
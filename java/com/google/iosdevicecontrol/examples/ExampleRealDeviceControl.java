@@ -31,6 +31,8 @@ public class ExampleRealDeviceControl {
     RealDeviceHost.Configuration config = RealDeviceHost.withDeveloperDiskImagesFromXcode();
     // Set a supervision identity for more control over the device.
     // config = config.withSupervisionIdentity(Paths.get("path/to/cert"), Paths.get("path/to/key"));
+    // Cache device metadata on disk to make restarts of the host faster.
+    // config = config.withMetadataCache(Paths.get("path/to/cache"));
     RealDeviceHost realHost = config.initialize();
 
     // Pick an arbitrary device
@@ -0,0 +1,67 @@
+// Copyright 2017 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+package com.google.iosdevicecontrol.image;
+
+import com.google.iosdevicecontrol.IosDevice;
+import com.google.iosdevicecontrol.IosDeviceException;
+import java.awt.image.BufferedImage;
+import java.io.ByteArrayInputStream;
+import java.io.Closeable;
+import java.io.IOException;
+import javax.imageio.ImageIO;
+
+/** A source of frames for a {@link ScreenRecorder}, such as the screen of a device. */
+@FunctionalInterface
+public interface FrameSource extends Closeable {
+  /**
+   * Captures a frame, blocking until it is available. A {@link ScreenRecorder} only calls this from
+   * one thread at a time, and closes the source on that thread after the last capture.
+   *
+   * @throws IOException - if the frame cannot be captured
+   */
+  BufferedImage captureFrame() throws IOException;
+
+  /** Releases any connection the source holds. The default does nothing. */
+  @Override
+  default void close() throws IOException {}
+
+  /** Returns a source that takes a screenshot of the device for each frame. */
+  static FrameSource fromScreenshots(IosDevice device) {
+    return () -> {
+      try {
+        return decodeFrame(device.takeScreenshot());
+      } catch (IosDeviceException e) {
+        throw new IOException(e);
+      }
+    };
+  }
+
+  /**
+   * Decodes a screenshot into a frame. PNG screenshots are decoded by ImageIO and any other format
+   * through {@link RawImage}, whose pixels the frame shares.
+   *
+   * @throws IOException - if the screenshot cannot be decoded
+   */
+  static BufferedImage decodeFrame(byte[] screenshot) throws IOException {
+    if (RawImage.isPng(screenshot)) {
+      BufferedImage image = ImageIO.read(new ByteArrayInputStream(screenshot));
+      if (image == null) {
+        throw new IOException("Unreadable PNG screenshot");
+      }
+      return image;
+    }
+    return RawImage.decode(screenshot).toBufferedImage();
+  }
+}
@@ -0,0 +1,260 @@
+// Copyright 2017 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+package com.google.iosdevicecontrol.image;
+
+import static com.google.common.base.Preconditions.checkArgument;
+import static com.google.common.base.Preconditions.checkState;
+import static java.nio.charset.StandardCharsets.US_ASCII;
+
+import java.io.ByteArrayOutputStream;
+import java.io.Closeable;
+import java.io.IOException;
+import java.nio.ByteBuffer;
+import java.nio.ByteOrder;
+import java.nio.channels.FileChannel;
+import java.nio.file.Path;
+import java.nio.file.StandardOpenOption;
+
+/**
+ * Writes JPEG frames into an AVI file as a Motion JPEG video with a constant frame rate, which
+ * every common player can play without any codec library on the host.
+ *
+ * <p>Frames are written to the file as they come, so memory use does not grow with the length of
+ * the video. The frame counts in the headers and the index at the end are written on close.
+ *
+ * <p>The sizes and offsets in an AVI file are 32-bit, so a frame that would make the file larger
+ * than {@link #MAX_FILE_BYTES} is refused; the frames written until then still make a valid video.
+ */
+final class MjpegAviWriter implements Closeable {
+  // Offsets in the fixed layout of the headers, mostly of the fields that are only known on close.
+  private static final int RIFF_SIZE_OFFSET = 4;
+  private static final int MAX_BYTES_PER_SEC_OFFSET = 36;
+  private static final int TOTAL_FRAMES_OFFSET = 48;
+  private static final int AVIH_BUFFER_SIZE_OFFSET = 60;
+  private static final int STREAM_LENGTH_OFFSET = 140;
+  private static final int STRH_BUFFER_SIZE_OFFSET = 144;
+  private static final int HDRL_OFFSET = 20;
+  private static final int STRL_OFFSET = 96;
+  private static final int MOVI_LIST_OFFSET = 212;
+  private static final int MOVI_SIZE_OFFSET = 216;
+  private static final int MOVI_OFFSET = 220;
+  private static final int HEADER_BYTES = 224;
+
+  // Some players read the sizes as signed, so stay below 2 GiB rather than 4 GiB.
+  static final long MAX_FILE_BYTES = Integer.MAX_VALUE;
+
+  private static final int AVIF_HASINDEX = 0x10;
+  private static final int AVIIF_KEYFRAME = 0x10;
+
+  private final FileChannel channel;
+  private final int framesPerSecond;
+  private final ByteArrayOutputStream index = new ByteArrayOutputStream();
+  private long position = HEADER_BYTES;
+  private int frameCount;
+  private int maxFrameBytes;
+  private boolean closed;
+
+  /**
+   * Creates or replaces the video file.
+   *
+   * @throws IOException - if the file cannot be written
+   */
+  MjpegAviWriter(Path path, int width, int height, int framesPerSecond) throws IOException {
+    checkArgument(width > 0 && height > 0, "Invalid dimensions %sx%s", width, height);
+    checkArgument(framesPerSecond > 0, "Invalid frame rate: %s", framesPerSecond);
+    this.framesPerSecond = framesPerSecond;
+    this.channel =
+        FileChannel.open(
+            path,
+            StandardOpenOption.CREATE,
+            StandardOpenOption.TRUNCATE_EXISTING,
+            StandardOpenOption.WRITE);
+    try {
+      writeFully(header(width, height), 0);
+    } catch (IOException e) {
+      channel.close();
+      throw e;
+    }
+  }
+
+  private ByteBuffer header(int width, int height) {
+    ByteBuffer header = ByteBuffer.allocate(HEADER_BYTES).order(ByteOrder.LITTLE_ENDIAN);
+    putFourCc(header, "RIFF");
+    header.putInt(0);
+    putFourCc(header, "AVI ");
+
+    putFourCc(header, "LIST");
+    header.putInt(MOVI_LIST_OFFSET - HDRL_OFFSET);
+    putFourCc(header, "hdrl");
+    putFourCc(header, "avih");
+    header.putInt(56);
+    header.putInt(1_000_000 / framesPerSecond);
+    header.putInt(0); // Max bytes per second.
+    header.putInt(0); // Padding granularity.
+    header.putInt(AVIF_HASINDEX);
+    header.putInt(0); // Total frames.
+    header.putInt(0); // Initial frames.
+    header.putInt(1); // Streams.
+    header.putInt(0); // Suggested buffer size.
+    header.putInt(width);
+    header.putInt(height);
+    header.position(header.position() + 16);
+
+    putFourCc(header, "LIST");
+    header.putInt(MOVI_LIST_OFFSET - STRL_OFFSET);
+    putFourCc(header, "strl");
+    putFourCc(header, "strh");
+    header.putInt(56);
+    putFourCc(header, "vids");
+    putFourCc(header, "MJPG");
+    header.putInt(0); // Flags.
+    header.putShort((short) 0); // Priority.
+    header.putShort((short) 0); // Language.
+    header.putInt(0); // Initial frames.
+    header.putInt(1); // Scale.
+    header.putInt(framesPerSecond); // Rate.
+    header.putInt(0); // Start.
+    header.putInt(0); // Length.
+    header.putInt(0); // Suggested buffer size.
+    header.putInt(-1); // Quality.
+    header.putInt(0); // Sample size.
+    header.putShort((short) 0);
+    header.putShort((short) 0);
+    header.putShort((short) width);
+    header.putShort((short) height);
+    putFourCc(header, "strf");
+    header.putInt(40);
+    header.putInt(40);
+    header.putInt(width);
+    header.putInt(height);
+    header.putShort((short) 1); // Planes.
+    header.putShort((short) 24); // Bit count.
+    putFourCc(header, "MJPG");
+    header.putInt(width * height * 3);
+    header.position(header.position() + 16);
+
+    putFourCc(header, "LIST");
+    header.putInt(0);
+    putFourCc(header, "movi");
+    checkState(header.position() == HEADER_BYTES);
+    header.flip();
+    return header;
+  }
+
+  /** Returns the number of frames written so far, including repeated frames. */
+  int frameCount() {
+    return frameCount;
+  }
+
+  /**
+   * Appends a JPEG frame.
+   *
+   * @throws IOException - if the file cannot be written or the frame would make it too large
+   */
+  void writeFrame(byte[] jpeg) throws IOException {
+    writeChunk(jpeg);
+  }
+
+  /**
+   * Appends an empty frame, which players show as a repeat of the frame before it. This keeps the
+   * frame rate constant when frames could not be captured in time.
+   *
+   * @throws IOException - if the file cannot be written or would become too large
+   */
+  void repeatFrame() throws IOException {
+    writeChunk(new byte[0]);
+  }
+
+  private void writeChunk(byte[] data) throws IOException {
+    checkState(!closed, "Writer is closed");
+    int paddedLength = data.length + (data.length & 1);
+    // The chunk, its entry in the index and the header of the index, which is written on close.
+    long fileBytes = position + 8 + paddedLength + index.size() + 16 + 8;
+    if (fileBytes > MAX_FILE_BYTES) {
+      throw new IOException(
+          String.format(
+              "Video would exceed %s bytes after %s frames", MAX_FILE_BYTES, frameCount));
+    }
+    ByteBuffer chunk = ByteBuffer.allocate(8 + paddedLength).order(ByteOrder.LITTLE_ENDIAN);
+    putFourCc(chunk, "00dc");
+    chunk.putInt(data.length);
+    chunk.put(data);
+    chunk.flip();
+    chunk.limit(8 + paddedLength);
+    writeFully(chunk, position);
+
+    ByteBuffer entry = ByteBuffer.allocate(16).order(ByteOrder.LITTLE_ENDIAN);
+    putFourCc(entry, "00dc");
+    entry.putInt(AVIIF_KEYFRAME);
+    entry.putInt((int) (position - MOVI_OFFSET));
+    entry.putInt(data.length);
+    index.write(entry.array(), 0, 16);
+
+    position += chunk.limit();
+    frameCount++;
+    maxFrameBytes = Math.max(maxFrameBytes, data.length);
+  }
+
+  /**
+   * Writes the index and the frame counts, and closes the file.
+   *
+   * @throws IOException - if the file cannot be written
+   */
+  @Override
+  public void close() throws IOException {
+    if (closed) {
+      return;
+    }
+    closed = true;
+    try {
+      ByteBuffer indexChunk = ByteBuffer.allocate(8 + index.size()).order(ByteOrder.LITTLE_ENDIAN);
+      putFourCc(indexChunk, "idx1");
+      indexChunk.putInt(index.size());
+      indexChunk.put(index.toByteArray());
+      indexChunk.flip();
+      writeFully(indexChunk, position);
+
+      patchInt(RIFF_SIZE_OFFSET, position + indexChunk.limit() - 8);
+      patchInt(
+          MAX_BYTES_PER_SEC_OFFSET,
+          Math.min((long) maxFrameBytes * framesPerSecond, MAX_FILE_BYTES));
+      patchInt(TOTAL_FRAMES_OFFSET, frameCount);
+      patchInt(AVIH_BUFFER_SIZE_OFFSET, maxFrameBytes);
+      patchInt(STREAM_LENGTH_OFFSET, frameCount);
+      patchInt(STRH_BUFFER_SIZE_OFFSET, maxFrameBytes);
+      patchInt(MOVI_SIZE_OFFSET, position - MOVI_OFFSET);
+    } finally {
+      channel.close();
+    }
+  }
+
+  private void patchInt(int offset, long value) throws IOException {
+    ByteBuffer buffer = ByteBuffer.allocate(4).order(ByteOrder.LITTLE_ENDIAN);
+    buffer.putInt((int) value);
+    buffer.flip();
+    writeFully(buffer, offset);
+  }
+
+  private void writeFully(ByteBuffer buffer, long offset) throws IOException {
+    long at = offset;
+    while (buffer.hasRemaining()) {
+      at += channel.write(buffer, at);
+    }
+  }
+
+  private static void putFourCc(ByteBuffer buffer, String fourCc) {
+    buffer.put(fourCc.getBytes(US_ASCII));
+  }
+}
@@ -0,0 +1,315 @@
+// Copyright 2017 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+package com.google.iosdevicecontrol.image;
+
+import static com.google.common.base.Preconditions.checkArgument;
+import static com.google.common.base.Preconditions.checkNotNull;
+import static java.nio.charset.StandardCharsets.US_ASCII;
+
+import com.google.common.base.Throwables;
+import java.io.ByteArrayOutputStream;
+import java.io.DataOutputStream;
+import java.io.IOException;
+import java.io.UncheckedIOException;
+import java.util.ArrayList;
+import java.util.List;
+import java.util.concurrent.CompletableFuture;
+import java.util.concurrent.CompletionException;
+import java.util.concurrent.Executor;
+import java.util.concurrent.ForkJoinPool;
+import java.util.zip.Adler32;
+import java.util.zip.CRC32;
+import java.util.zip.Deflater;
+import javax.annotation.Nullable;
+
+/**
+ * Encodes {@link RawImage}s as PNG images, filtering and compressing the rows in parallel.
+ *
+ * <p>The rows are split into chunks of about 128KB that are each filtered and deflated on their
+ * own, like pigz does, with the end of the preceding chunk as the dictionary so that the
+ * compression ratio barely suffers. The chunks are then joined into a single zlib stream. Images
+ * that fit in one chunk are encoded on the calling thread.
+ *
+ * <p>Instances are immutable and can be shared by threads.
+ */
+public final class PngEncoder {
+  private static final byte[] SIGNATURE = {
+    (byte) 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'
+  };
+  private static final int CHUNK_BYTES = 128 * 1024;
+  private static final int WINDOW_BYTES = 32 * 1024;
+
+  private static final int FILTER_NONE = 0;
+  private static final int FILTER_SUB = 1;
+  private static final int FILTER_UP = 2;
+  private static final int FILTER_AVERAGE = 3;
+  private static final int FILTER_PAETH = 4;
+
+  private static final PngEncoder DEFAULT =
+      new PngEncoder(Deflater.DEFAULT_COMPRESSION, ForkJoinPool.commonPool());
+
+  /** Returns an encoder with the default compression level that uses the common fork join pool. */
+  public static PngEncoder create() {
+    return DEFAULT;
+  }
+
+  private final int compressionLevel;
+  private final Executor executor;
+
+  private PngEncoder(int compressionLevel, Executor executor) {
+    this.compressionLevel = compressionLevel;
+    this.executor = checkNotNull(executor);
+  }
+
+  /**
+   * Returns an encoder with the specified compression level, from 0 for none to 9 for the best, or
+   * -1 for the deflate default. Level 0 also skips the filtering of rows.
+   */
+  public PngEncoder withCompressionLevel(int compressionLevel) {
+    checkArgument(
+        compressionLevel >= Deflater.DEFAULT_COMPRESSION
+            && compressionLevel <= Deflater.BEST_COMPRESSION,
+        "Invalid compression level: %s",
+        compressionLevel);
+    return new PngEncoder(compressionLevel, executor);
+  }
+
+  /** Returns an encoder that filters and compresses the chunks of an image on the executor. */
+  public PngEncoder withExecutor(Executor executor) {
+    return new PngEncoder(compressionLevel, executor);
+  }
+
+  /** Encodes the image as a PNG image. */
+  public byte[] encode(RawImage image) {
+    int rowsPerChunk = Math.max(1, CHUNK_BYTES / (image.stride() + 1));
+    int chunkCount = (image.height() + rowsPerChunk - 1) / rowsPerChunk;
+
+    List<byte[]> filteredChunks = new ArrayList<>(chunkCount);
+    List<byte[]> deflatedChunks = new ArrayList<>(chunkCount);
+    if (chunkCount == 1) {
+      byte[] filtered = filterRows(image, 0, image.height());
+      filteredChunks.add(filtered);
+      deflatedChunks.add(deflate(filtered, null, true));
+    } else {
+      // Each chunk needs the filtered chunk before it as the dictionary, but not its deflated form.
+      List<CompletableFuture<byte[]>> filtering = new ArrayList<>(chunkCount);
+      List<CompletableFuture<byte[]>> deflating = new ArrayList<>(chunkCount);
+      for (int chunk = 0; chunk < chunkCount; chunk++) {
+        int firstRow = chunk * rowsPerChunk;
+        int endRow = Math.min(firstRow + rowsPerChunk, image.height());
+        filtering.add(
+            CompletableFuture.supplyAsync(() -> filterRows(image, firstRow, endRow), executor));
+      }
+      for (int chunk = 0; chunk < chunkCount; chunk++) {
+        CompletableFuture<byte[]> previous =
+            chunk == 0 ? CompletableFuture.completedFuture(null) : filtering.get(chunk - 1);
+        boolean last = chunk == chunkCount - 1;
+        deflating.add(
+            filtering
+                .get(chunk)
+                .thenCombineAsync(previous, (data, dict) -> deflate(data, dict, last), executor));
+      }
+      for (int chunk = 0; chunk < chunkCount; chunk++) {
+        filteredChunks.add(join(filtering.get(chunk)));
+        deflatedChunks.add(join(deflating.get(chunk)));
+      }
+    }
+
+    try {
+      ByteArrayOutputStream zlibStream = new ByteArrayOutputStream();
+      zlibStream.write(0x78);
+      zlibStream.write(zlibFlags());
+      Adler32 adler = new Adler32();
+      for (int chunk = 0; chunk < chunkCount; chunk++) {
+        adler.update(filteredChunks.get(chunk));
+        zlibStream.write(deflatedChunks.get(chunk));
+      }
+      new DataOutputStream(zlibStream).writeInt((int) adler.getValue());
+
+      ByteArrayOutputStream png = new ByteArrayOutputStream(zlibStream.size() + 64);
+      png.write(SIGNATURE);
+      ByteArrayOutputStream header = new ByteArrayOutputStream(13);
+      DataOutputStream headerData = new DataOutputStream(header);
+      headerData.writeInt(image.width());
+      headerData.writeInt(image.height());
+      headerData.writeByte(8);
+      headerData.writeByte(image.channels() == 4 ? 6 : 2);
+      headerData.writeByte(0);
+      headerData.writeByte(0);
+      headerData.writeByte(0);
+      writeChunk(png, "IHDR", header.toByteArray());
+      writeChunk(png, "IDAT", zlibStream.toByteArray());
+      writeChunk(png, "IEND", new byte[0]);
+      return png.toByteArray();
+    } catch (IOException e) {
+      // Byte array streams do not throw.
+      throw new UncheckedIOException(e);
+    }
+  }
+
+  /** Returns the second byte of the zlib header, which announces the compression level. */
+  private int zlibFlags() {
+    if (compressionLevel == Deflater.DEFAULT_COMPRESSION || compressionLevel == 6) {
+      return 0x9c;
+    } else if (compressionLevel <= 1) {
+      return 0x01;
+    } else if (compressionLevel <= 5) {
+      return 0x5e;
+    }
+    return 0xda;
+  }
+
+  private static void writeChunk(ByteArrayOutputStream png, String type, byte[] data)
+      throws IOException {
+    DataOutputStream out = new DataOutputStream(png);
+    byte[] typeBytes = type.getBytes(US_ASCII);
+    CRC32 crc = new CRC32();
+    crc.update(typeBytes);
+    crc.update(data);
+    out.writeInt(data.length);
+    out.write(typeBytes);
+    out.write(data);
+    out.writeInt((int) crc.getValue());
+  }
+
+  private byte[] filterRows(RawImage image, int firstRow, int endRow) {
+    int stride = image.stride();
+    byte[] pixels = image.pixels();
+    byte[] filtered = new byte[(endRow - firstRow) * (stride + 1)];
+    for (int row = firstRow; row < endRow; row++) {
+      int rowOffset = row * stride;
+      int filteredOffset = (row - firstRow) * (stride + 1);
+      if (compressionLevel == Deflater.NO_COMPRESSION) {
+        System.arraycopy(pixels, rowOffset, filtered, filteredOffset + 1, stride);
+      } else {
+        filterRow(pixels, rowOffset, row > 0, stride, image.channels(), filtered, filteredOffset);
+      }
+    }
+    return filtered;
+  }
+
+  /**
+   * Filters a row with the filter whose output has the smallest sum of absolute values, which is
+   * the heuristic the PNG specification recommends.
+   */
+  private static void filterRow(
+      byte[] pixels,
+      int rowOffset,
+      boolean hasPrevious,
+      int stride,
+      int bytesPerPixel,
+      byte[] filtered,
+      int filteredOffset) {
+    int above = rowOffset - stride;
+    long[] sums = new long[5];
+    for (int i = 0; i < stride; i++) {
+      int x = pixels[rowOffset + i] & 0xff;
+      int a = i >= bytesPerPixel ? pixels[rowOffset + i - bytesPerPixel] & 0xff : 0;
+      int b = hasPrevious ? pixels[above + i] & 0xff : 0;
+      int c = hasPrevious && i >= bytesPerPixel ? pixels[above + i - bytesPerPixel] & 0xff : 0;
+      sums[FILTER_NONE] += Math.abs((byte) x);
+      sums[FILTER_SUB] += Math.abs((byte) (x - a));
+      sums[FILTER_UP] += Math.abs((byte) (x - b));
+      sums[FILTER_AVERAGE] += Math.abs((byte) (x - ((a + b) >> 1)));
+      sums[FILTER_PAETH] += Math.abs((byte) (x - paeth(a, b, c)));
+    }
+    int filter = FILTER_NONE;
+    for (int f = FILTER_SUB; f <= FILTER_PAETH; f++) {
+      if (sums[f] < sums[filter]) {
+        filter = f;
+      }
+    }
+
+    filtered[filteredOffset] = (byte) filter;
+    for (int i = 0; i < stride; i++) {
+      int x = pixels[rowOffset + i] & 0xff;
+      int a = i >= bytesPerPixel ? pixels[rowOffset + i - bytesPerPixel] & 0xff : 0;
+      int b = hasPrevious ? pixels[above + i] & 0xff : 0;
+      int c = hasPrevious && i >= bytesPerPixel ? pixels[above + i - bytesPerPixel] & 0xff : 0;
+      int predicted;
+      switch (filter) {
+        case FILTER_SUB:
+          predicted = a;
+          break;
+        case FILTER_UP:
+          predicted = b;
+          break;
+        case FILTER_AVERAGE:
+          predicted = (a + b) >> 1;
+          break;
+        case FILTER_PAETH:
+          predicted = paeth(a, b, c);
+          break;
+        default:
+          predicted = 0;
+          break;
+      }
+      filtered[filteredOffset + 1 + i] = (byte) (x - predicted);
+    }
+  }
+
+  private static int paeth(int a, int b, int c) {
+    int p = a + b - c;
+    int pa = Math.abs(p - a);
+    int pb = Math.abs(p - b);
+    int pc = Math.abs(p - c);
+    if (pa <= pb && pa <= pc) {
+      return a;
+    }
+    return pb <= pc ? b : c;
+  }
+
+  /**
+   * Deflates a chunk into raw deflate blocks. All but the last chunk end with a sync flush, so the
+   * next chunk starts on a byte boundary.
+   */
+  private byte[] deflate(byte[] data, @Nullable byte[] dictionary, boolean last) {
+    Deflater deflater = new Deflater(compressionLevel, true /* nowrap */);
+    try {
+      if (dictionary != null) {
+        int length = Math.min(WINDOW_BYTES, dictionary.length);
+        deflater.setDictionary(dictionary, dictionary.length - length, length);
+      }
+      deflater.setInput(data);
+      ByteArrayOutputStream out = new ByteArrayOutputStream(data.length / 2 + 64);
+      byte[] buffer = new byte[64 * 1024];
+      if (last) {
+        deflater.finish();
+        while (!deflater.finished()) {
+          int length = deflater.deflate(buffer);
+          out.write(buffer, 0, length);
+        }
+      } else {
+        int length;
+        do {
+          length = deflater.deflate(buffer, 0, buffer.length, Deflater.SYNC_FLUSH);
+          out.write(buffer, 0, length);
+        } while (length == buffer.length);
+      }
+      return out.toByteArray();
+    } finally {
+      deflater.end();
+    }
+  }
+
+  private static byte[] join(CompletableFuture<byte[]> future) {
+    try {
+      return future.join();
+    } catch (CompletionException e) {
+      Throwables.throwIfUnchecked(e.getCause());
+      throw e;
+    }
+  }
+}
@@ -0,0 +1,265 @@
+// Copyright 2017 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+package com.google.iosdevicecontrol.image;
+
+import static com.google.common.base.Preconditions.checkArgument;
+
+import com.google.common.base.MoreObjects;
+import java.awt.Transparency;
+import java.awt.color.ColorSpace;
+import java.awt.image.BufferedImage;
+import java.awt.image.ComponentColorModel;
+import java.awt.image.DataBuffer;
+import java.awt.image.DataBufferByte;
+import java.awt.image.Raster;
+import java.awt.image.WritableRaster;
+import java.io.ByteArrayInputStream;
+import java.io.IOException;
+import java.util.Arrays;
+import java.util.Optional;
+import javax.imageio.ImageIO;
+
+/**
+ * An image as rows of 8-bit RGB or RGBA pixels, with no padding between rows. This is the layout
+ * of uncompressed device screenshots, so they can be converted and scaled without the overhead of
+ * a {@link BufferedImage}.
+ */
+public final class RawImage {
+  private static final byte[] PNG_SIGNATURE = {
+    (byte) 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'
+  };
+
+  /**
+   * Decodes an image in any format that ImageIO can read. Uncompressed TIFF images, which older
+   * iOS versions return as screenshots, are decoded directly.
+   *
+   * @throws IOException - if the image cannot be decoded
+   */
+  public static RawImage decode(byte[] imageBytes) throws IOException {
+    Optional<RawImage> tiffImage = TiffReader.read(imageBytes);
+    if (tiffImage.isPresent()) {
+      return tiffImage.get();
+    }
+    BufferedImage image = ImageIO.read(new ByteArrayInputStream(imageBytes));
+    if (image == null) {
+      throw new IOException("Unsupported image format");
+    }
+    return fromBufferedImage(image);
+  }
+
+  /** Returns whether the bytes are a PNG image, judging by its signature. */
+  public static boolean isPng(byte[] imageBytes) {
+    if (imageBytes.length < PNG_SIGNATURE.length) {
+      return false;
+    }
+    for (int i = 0; i < PNG_SIGNATURE.length; i++) {
+      if (imageBytes[i] != PNG_SIGNATURE[i]) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  /** Returns the pixels of a buffered image, with an alpha channel only if it has one. */
+  public static RawImage fromBufferedImage(BufferedImage image) {
+    int width = image.getWidth();
+    int height = image.getHeight();
+    int channels = image.getColorModel().hasAlpha() ? 4 : 3;
+    byte[] pixels = new byte[width * height * channels];
+    int[] row = new int[width];
+    int i = 0;
+    for (int y = 0; y < height; y++) {
+      image.getRGB(0, y, width, 1, row, 0, width);
+      for (int argb : row) {
+        pixels[i++] = (byte) (argb >> 16);
+        pixels[i++] = (byte) (argb >> 8);
+        pixels[i++] = (byte) argb;
+        if (channels == 4) {
+          pixels[i++] = (byte) (argb >>> 24);
+        }
+      }
+    }
+    return new RawImage(width, height, channels, pixels);
+  }
+
+  /**
+   * Wraps pixels without copying them, so they must not be modified afterwards.
+   *
+   * @param channels - 3 for RGB pixels or 4 for RGBA pixels with unpremultiplied alpha
+   */
+  public static RawImage wrap(int width, int height, int channels, byte[] pixels) {
+    return new RawImage(width, height, channels, pixels);
+  }
+
+  private final int width;
+  private final int height;
+  private final int channels;
+  private final byte[] pixels;
+
+  private RawImage(int width, int height, int channels, byte[] pixels) {
+    checkArgument(width > 0 && height > 0, "Invalid dimensions %sx%s", width, height);
+    checkArgument(channels == 3 || channels == 4, "Invalid number of channels: %s", channels);
+    checkArgument(
+        pixels.length == (long) width * height * channels,
+        "Expected %s bytes of pixels for %sx%sx%s, got %s",
+        (long) width * height * channels,
+        width,
+        height,
+        channels,
+        pixels.length);
+    this.width = width;
+    this.height = height;
+    this.channels = channels;
+    this.pixels = pixels;
+  }
+
+  public int width() {
+    return width;
+  }
+
+  public int height() {
+    return height;
+  }
+
+  /** The number of bytes per pixel: 3 for RGB or 4 for RGBA. */
+  public int channels() {
+    return channels;
+  }
+
+  /** The number of bytes per row. */
+  public int stride() {
+    return width * channels;
+  }
+
+  /** Returns the pixels, which must not be modified. */
+  byte[] pixels() {
+    return pixels;
+  }
+
+  /** Returns a copy of the pixels. */
+  public byte[] copyPixels() {
+    return pixels.clone();
+  }
+
+  /**
+   * Returns an opaque buffered image that shares the pixels of this image, ignoring any alpha
+   * channel, so it must not be modified.
+   */
+  public BufferedImage toBufferedImage() {
+    WritableRaster raster =
+        Raster.createInterleavedRaster(
+            new DataBufferByte(pixels, pixels.length),
+            width,
+            height,
+            stride(),
+            channels,
+            new int[] {0, 1, 2},
+            null);
+    ComponentColorModel colorModel =
+        new ComponentColorModel(
+            ColorSpace.getInstance(ColorSpace.CS_sRGB),
+            false /* hasAlpha */,
+            false /* isAlphaPremultiplied */,
+            Transparency.OPAQUE,
+            DataBuffer.TYPE_BYTE);
+    return new BufferedImage(colorModel, raster, false, null);
+  }
+
+  /**
+   * Returns this image scaled down to fit within the specified dimensions, keeping its aspect
+   * ratio, or this image itself if it already fits. Each pixel of the scaled image is the average
+   * of the pixels it covers, which suits thumbnails of screenshots.
+   */
+  public RawImage scaledToFit(int maxWidth, int maxHeight) {
+    checkArgument(maxWidth > 0 && maxHeight > 0, "Invalid dimensions %sx%s", maxWidth, maxHeight);
+    if (width <= maxWidth && height <= maxHeight) {
+      return this;
+    }
+    double scale = Math.min((double) maxWidth / width, (double) maxHeight / height);
+    int scaledWidth = Math.max(1, Math.min(maxWidth, (int) Math.round(width * scale)));
+    int scaledHeight = Math.max(1, Math.min(maxHeight, (int) Math.round(height * scale)));
+    return resized(scaledWidth, scaledHeight);
+  }
+
+  /**
+   * Returns this image resized to the specified dimensions by averaging the pixels that each
+   * resized pixel covers. A dimension that gets larger repeats pixels instead.
+   */
+  RawImage resized(int scaledWidth, int scaledHeight) {
+    checkArgument(
+        scaledWidth > 0 && scaledHeight > 0, "Invalid dimensions %sx%s", scaledWidth, scaledHeight);
+
+    // Sum whole source pixels into each scaled pixel. The boxes differ by at most a pixel in each
+    // dimension, which is not visible at the scale of a thumbnail.
+    int[] columnStarts = boxStarts(width, scaledWidth);
+    int[] columnEnds = boxEnds(columnStarts, width, scaledWidth);
+    int[] rowStarts = boxStarts(height, scaledHeight);
+    int[] rowEnds = boxEnds(rowStarts, height, scaledHeight);
+    byte[] scaled = new byte[scaledWidth * scaledHeight * channels];
+    long[] sums = new long[scaledWidth * channels];
+    int stride = stride();
+    for (int sy = 0; sy < scaledHeight; sy++) {
+      int yStart = rowStarts[sy];
+      int yEnd = rowEnds[sy];
+      Arrays.fill(sums, 0);
+      for (int y = yStart; y < yEnd; y++) {
+        int rowOffset = y * stride;
+        for (int sx = 0; sx < scaledWidth; sx++) {
+          int sumOffset = sx * channels;
+          for (int x = columnStarts[sx]; x < columnEnds[sx]; x++) {
+            int offset = rowOffset + x * channels;
+            for (int c = 0; c < channels; c++) {
+              sums[sumOffset + c] += pixels[offset + c] & 0xff;
+            }
+          }
+        }
+      }
+      int scaledOffset = sy * scaledWidth * channels;
+      for (int sx = 0; sx < scaledWidth; sx++) {
+        long count = (long) (yEnd - yStart) * (columnEnds[sx] - columnStarts[sx]);
+        for (int c = 0; c < channels; c++) {
+          int i = sx * channels + c;
+          scaled[scaledOffset + i] = (byte) ((sums[i] + count / 2) / count);
+        }
+      }
+    }
+    return new RawImage(scaledWidth, scaledHeight, channels, scaled);
+  }
+
+  private static int[] boxStarts(int length, int scaledLength) {
+    int[] starts = new int[scaledLength];
+    for (int i = 0; i < scaledLength; i++) {
+      starts[i] = (int) ((long) i * length / scaledLength);
+    }
+    return starts;
+  }
+
+  private static int[] boxEnds(int[] starts, int length, int scaledLength) {
+    int[] ends = new int[scaledLength];
+    for (int i = 0; i < scaledLength; i++) {
+      ends[i] = Math.max(starts[i] + 1, (int) ((long) (i + 1) * length / scaledLength));
+    }
+    return ends;
+  }
+
+  @Override
+  public String toString() {
+    return MoreObjects.toStringHelper(this)
+        .add("width", width)
+        .add("height", height)
+        .add("channels", channels)
+        .toString();
+  }
+}
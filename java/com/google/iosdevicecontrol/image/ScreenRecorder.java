@@ -0,0 +1,375 @@
+// Copyright 2017 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+package com.google.iosdevicecontrol.image;
+
+import static com.google.common.base.Preconditions.checkArgument;
+import static com.google.common.base.Preconditions.checkNotNull;
+import static java.util.concurrent.TimeUnit.NANOSECONDS;
+
+import com.google.common.util.concurrent.Uninterruptibles;
+import com.google.iosdevicecontrol.IosDevice;
+import com.google.iosdevicecontrol.IosDeviceException;
+import com.google.iosdevicecontrol.IosDeviceResource;
+import java.awt.Graphics2D;
+import java.awt.RenderingHints;
+import java.awt.image.BufferedImage;
+import java.io.ByteArrayOutputStream;
+import java.io.Closeable;
+import java.io.IOException;
+import java.nio.file.Path;
+import java.time.Duration;
+import java.util.concurrent.ArrayBlockingQueue;
+import java.util.concurrent.BlockingQueue;
+import java.util.concurrent.CountDownLatch;
+import java.util.concurrent.TimeUnit;
+import java.util.concurrent.atomic.AtomicBoolean;
+import java.util.concurrent.atomic.AtomicInteger;
+import javax.annotation.Nullable;
+import javax.imageio.IIOImage;
+import javax.imageio.ImageIO;
+import javax.imageio.ImageWriteParam;
+import javax.imageio.ImageWriter;
+import javax.imageio.stream.ImageOutputStream;
+
+/**
+ * Records frames from a {@link FrameSource} into a Motion JPEG AVI video until it is closed.
+ *
+ * <p>One thread captures frames as fast as the source delivers them, up to the frame rate, while
+ * another encodes them. The two are joined by a queue of a few frames, so memory use is bounded:
+ * when the encoder falls behind, the oldest queued frame is dropped, and captures slow down to the
+ * rate at which frames are being encoded. Each frame is placed in the video at the time it was
+ * captured, and the gaps are filled by repeating the frame before, so the video plays back in
+ * real time however irregular the captures were. The video has the size of the first frame, and
+ * frames of another size, such as after the device was rotated, are scaled to fit it.
+ */
+public final class ScreenRecorder implements Closeable {
+  private static final Configuration DEFAULT_CONFIGURATION =
+      new Configuration(10, 0.75f, 4, Duration.ofSeconds(10));
+
+  /** The frame rate, JPEG quality, queue length and stop timeout of a recording. */
+  public static final class Configuration {
+    private final int framesPerSecond;
+    private final float jpegQuality;
+    private final int maxQueuedFrames;
+    private final Duration stopTimeout;
+
+    private Configuration(
+        int framesPerSecond, float jpegQuality, int maxQueuedFrames, Duration stopTimeout) {
+      this.framesPerSecond = framesPerSecond;
+      this.jpegQuality = jpegQuality;
+      this.maxQueuedFrames = maxQueuedFrames;
+      this.stopTimeout = stopTimeout;
+    }
+
+    /** Returns a configuration with the specified frame rate of the video. The default is 10. */
+    public Configuration withFrameRate(int framesPerSecond) {
+      checkArgument(framesPerSecond > 0, "Invalid frame rate: %s", framesPerSecond);
+      return new Configuration(framesPerSecond, jpegQuality, maxQueuedFrames, stopTimeout);
+    }
+
+    /**
+     * Returns a configuration with the specified JPEG quality of the frames, from 0 to 1. The
+     * default is 0.75.
+     */
+    public Configuration withJpegQuality(float jpegQuality) {
+      checkArgument(jpegQuality >= 0 && jpegQuality <= 1, "Invalid quality: %s", jpegQuality);
+      return new Configuration(framesPerSecond, jpegQuality, maxQueuedFrames, stopTimeout);
+    }
+
+    /**
+     * Returns a configuration that keeps at most the specified number of captured frames waiting
+     * to be encoded. The default is 4.
+     */
+    public Configuration withMaxQueuedFrames(int maxQueuedFrames) {
+      checkArgument(maxQueuedFrames > 0, "Invalid queue length: %s", maxQueuedFrames);
+      return new Configuration(framesPerSecond, jpegQuality, maxQueuedFrames, stopTimeout);
+    }
+
+    /**
+     * Returns a configuration in which closing the recorder waits at most the specified time for a
+     * capture in progress, such as one blocked on an unresponsive device. The default is 10
+     * seconds.
+     */
+    public Configuration withStopTimeout(Duration stopTimeout) {
+      checkArgument(!stopTimeout.isNegative(), "Invalid stop timeout: %s", stopTimeout);
+      return new Configuration(framesPerSecond, jpegQuality, maxQueuedFrames, stopTimeout);
+    }
+
+    /**
+     * Starts recording frames from the source into a video at the specified path, which is only
+     * created once the first frame is captured. The source is closed once the recorder is closed
+     * and the last capture returned.
+     */
+    public ScreenRecorder start(FrameSource source, Path videoPath) {
+      ScreenRecorder recorder = new ScreenRecorder(this, source, videoPath);
+      recorder.captureThread.start();
+      recorder.encodeThread.start();
+      return recorder;
+    }
+
+    /**
+     * Starts recording frames from the source into a video at the specified path, as a resource of
+     * the device that stops the recording when closed.
+     */
+    public IosDeviceResource record(IosDevice device, FrameSource source, Path videoPath) {
+      ScreenRecorder recorder = start(source, videoPath);
+      return new IosDeviceResource(device) {
+        @Override
+        public void close() throws IosDeviceException {
+          try {
+            recorder.close();
+          } catch (IOException e) {
+            throw new IosDeviceException(device, e);
+          }
+        }
+      };
+    }
+  }
+
+  /** Returns the default configuration. */
+  public static Configuration withDefaults() {
+    return DEFAULT_CONFIGURATION;
+  }
+
+  /** A captured frame and when it was captured, or the end of the captures if it has no image. */
+  private static final class Frame {
+    @Nullable final BufferedImage image;
+    final long nanoTime;
+
+    Frame(@Nullable BufferedImage image, long nanoTime) {
+      this.image = image;
+      this.nanoTime = nanoTime;
+    }
+  }
+
+  private final Configuration configuration;
+  private final FrameSource source;
+  private final Path videoPath;
+  private final long frameNanos;
+  private final BlockingQueue<Frame> queue;
+  private final CountDownLatch stopped = new CountDownLatch(1);
+  private final AtomicBoolean capturesEnded = new AtomicBoolean(false);
+  private final Thread captureThread;
+  private final Thread encodeThread;
+  private final AtomicInteger framesCaptured = new AtomicInteger();
+  private final AtomicInteger framesDropped = new AtomicInteger();
+  private final AtomicInteger framesEncoded = new AtomicInteger();
+  private volatile long averageEncodeNanos;
+  private volatile Throwable captureFailure;
+  private volatile Throwable encodeFailure;
+
+  private ScreenRecorder(Configuration configuration, FrameSource source, Path videoPath) {
+    this.configuration = configuration;
+    this.source = checkNotNull(source);
+    this.videoPath = checkNotNull(videoPath);
+    this.frameNanos = TimeUnit.SECONDS.toNanos(1) / configuration.framesPerSecond;
+    this.queue = new ArrayBlockingQueue<>(configuration.maxQueuedFrames);
+    this.captureThread = new Thread(this::capture, "screen-capture-" + videoPath.getFileName());
+    this.encodeThread = new Thread(this::encode, "screen-encode-" + videoPath.getFileName());
+    captureThread.setDaemon(true);
+    encodeThread.setDaemon(true);
+  }
+
+  /** Returns the number of frames captured from the source so far. */
+  public int framesCaptured() {
+    return framesCaptured.get();
+  }
+
+  /**
+   * Returns the number of captured frames that were not encoded, because the encoder fell behind
+   * or because a later frame was captured for the same time in the video.
+   */
+  public int framesDropped() {
+    return framesDropped.get();
+  }
+
+  /** Returns the number of frames encoded into the video so far, not counting repeated frames. */
+  public int framesEncoded() {
+    return framesEncoded.get();
+  }
+
+  private void capture() {
+    try {
+      long nextCapture = System.nanoTime();
+      while (!isStopped(nextCapture - System.nanoTime())) {
+        long started = System.nanoTime();
+        BufferedImage image = source.captureFrame();
+        framesCaptured.incrementAndGet();
+        Frame frame = new Frame(image, started);
+        // This is the only thread that adds frames, so there is room after removing one.
+        if (!queue.offer(frame)) {
+          if (queue.poll() != null) {
+            framesDropped.incrementAndGet();
+          }
+          queue.add(frame);
+        }
+        // Capturing faster than the encoder keeps up with would only drop more frames.
+        nextCapture = started + Math.max(frameNanos, averageEncodeNanos);
+      }
+    } catch (IOException | RuntimeException e) {
+      captureFailure = e;
+    } finally {
+      endCaptures();
+      // Closed on this thread, as a capture still in progress may use the source until it returns.
+      try {
+        source.close();
+      } catch (IOException | RuntimeException e) {
+        if (captureFailure == null) {
+          captureFailure = e;
+        }
+      }
+    }
+  }
+
+  /**
+   * Queues the end of the captures, unless it already was. The encoder keeps taking frames until
+   * then, even after it fails, so this cannot block for long.
+   */
+  private void endCaptures() {
+    if (capturesEnded.compareAndSet(false, true)) {
+      Uninterruptibles.putUninterruptibly(queue, new Frame(null, 0));
+    }
+  }
+
+  /** Waits up to the specified time for the recorder to be stopped, and returns whether it was. */
+  private boolean isStopped(long waitNanos) {
+    if (encodeFailure != null) {
+      return true;
+    }
+    return waitNanos > 0
+        ? Uninterruptibles.awaitUninterruptibly(stopped, waitNanos, NANOSECONDS)
+        : stopped.getCount() == 0;
+  }
+
+  private void encode() {
+    ImageWriter jpegWriter = ImageIO.getImageWritersByFormatName("jpeg").next();
+    ImageWriteParam param = jpegWriter.getDefaultWriteParam();
+    param.setCompressionMode(ImageWriteParam.MODE_EXPLICIT);
+    param.setCompressionQuality(configuration.jpegQuality);
+    MjpegAviWriter video = null;
+    int width = 0;
+    int height = 0;
+    long firstNanoTime = 0;
+    try {
+      for (Frame frame = queue.take(); frame.image != null; frame = queue.take()) {
+        if (encodeFailure != null) {
+          continue;
+        }
+        try {
+          long started = System.nanoTime();
+          if (video == null) {
+            width = frame.image.getWidth();
+            height = frame.image.getHeight();
+            video = new MjpegAviWriter(videoPath, width, height, configuration.framesPerSecond);
+            firstNanoTime = frame.nanoTime;
+          }
+          long slot = Math.round((double) (frame.nanoTime - firstNanoTime) / frameNanos);
+          if (slot < video.frameCount()) {
+            framesDropped.incrementAndGet();
+            continue;
+          }
+          byte[] jpeg = encodeJpeg(jpegWriter, param, frame.image, width, height);
+          while (video.frameCount() < slot) {
+            video.repeatFrame();
+          }
+          video.writeFrame(jpeg);
+          framesEncoded.incrementAndGet();
+          long elapsed = System.nanoTime() - started;
+          averageEncodeNanos =
+              averageEncodeNanos == 0 ? elapsed : (averageEncodeNanos * 7 + elapsed) / 8;
+        } catch (IOException | RuntimeException e) {
+          encodeFailure = e;
+        }
+      }
+    } catch (InterruptedException e) {
+      Thread.currentThread().interrupt();
+      encodeFailure = e;
+    } finally {
+      jpegWriter.dispose();
+      if (video != null) {
+        try {
+          video.close();
+        } catch (IOException e) {
+          if (encodeFailure == null) {
+            encodeFailure = e;
+          }
+        }
+      }
+    }
+  }
+
+  private static byte[] encodeJpeg(
+      ImageWriter writer, ImageWriteParam param, BufferedImage image, int width, int height)
+      throws IOException {
+    // JPEG has no alpha channel, and ImageIO either rejects images with one or writes them in a
+    // color space that players misread. A frame of another size is scaled to fit the video, keeping
+    // its aspect ratio, with black bars around it.
+    BufferedImage opaque = image;
+    if (image.getColorModel().hasAlpha()
+        || image.getWidth() != width
+        || image.getHeight() != height) {
+      opaque = new BufferedImage(width, height, BufferedImage.TYPE_3BYTE_BGR);
+      double scale =
+          Math.min((double) width / image.getWidth(), (double) height / image.getHeight());
+      int scaledWidth = (int) Math.round(image.getWidth() * scale);
+      int scaledHeight = (int) Math.round(image.getHeight() * scale);
+      Graphics2D graphics = opaque.createGraphics();
+      graphics.setRenderingHint(
+          RenderingHints.KEY_INTERPOLATION, RenderingHints.VALUE_INTERPOLATION_BILINEAR);
+      graphics.drawImage(
+          image,
+          (width - scaledWidth) / 2,
+          (height - scaledHeight) / 2,
+          scaledWidth,
+          scaledHeight,
+          null);
+      graphics.dispose();
+    }
+    ByteArrayOutputStream jpeg = new ByteArrayOutputStream();
+    try (ImageOutputStream output = ImageIO.createImageOutputStream(jpeg)) {
+      writer.setOutput(output);
+      writer.write(null, new IIOImage(opaque, null, null), param);
+    }
+    return jpeg.toByteArray();
+  }
+
+  /**
+   * Stops capturing, waits for the captured frames to be encoded and finishes the video. The source
+   * is closed once the capture in progress returns; if it does not return within the stop timeout,
+   * the video is finished without it.
+   *
+   * @throws IOException - if capturing or encoding failed at any point during the recording, or
+   *     the capture in progress did not return in time
+   */
+  @Override
+  public void close() throws IOException {
+    stopped.countDown();
+    Uninterruptibles.joinUninterruptibly(
+        captureThread, configuration.stopTimeout.toNanos(), NANOSECONDS);
+    boolean captureHung = captureThread.isAlive();
+    if (captureHung) {
+      endCaptures();
+    }
+    Uninterruptibles.joinUninterruptibly(encodeThread);
+    if (captureHung) {
+      throw new IOException(
+          "Screen capture did not return within " + configuration.stopTimeout, encodeFailure);
+    }
+    Throwable failure = captureFailure != null ? captureFailure : encodeFailure;
+    if (failure != null) {
+      throw new IOException("Screen recording failed", failure);
+    }
+  }
+}
@@ -0,0 +1,178 @@
+// Copyright 2017 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+package com.google.iosdevicecontrol.image;
+
+import static com.google.common.base.Preconditions.checkArgument;
+import static com.google.common.base.Preconditions.checkNotNull;
+import static java.nio.charset.StandardCharsets.UTF_8;
+
+import com.google.auto.value.AutoValue;
+import com.google.common.hash.Hashing;
+import com.google.iosdevicecontrol.util.AtomicFiles;
+import java.io.IOException;
+import java.nio.file.Files;
+import java.nio.file.Path;
+import java.nio.file.StandardOpenOption;
+import java.util.LinkedHashMap;
+import java.util.Map;
+import java.util.Optional;
+
+/**
+ * Stores screenshots in a directory by the SHA-256 hash of their bytes, so a screenshot that is
+ * taken again exactly as before is only stored once. Each screenshot also gets a difference hash of
+ * its pixels, which is used to flag a screenshot as unchanged if it looks the same as the one added
+ * before it.
+ *
+ * <p>Every screenshot added is appended to an index file in the directory, with its name, content
+ * hash, difference hash and whether it was unchanged, separated by tabs.
+ */
+public final class ScreenshotStore {
+  /** The name of the index file in the directory of the store. */
+  public static final String INDEX_FILE_NAME = "index.tsv";
+
+  private static final int HASH_COLUMNS = 9;
+  private static final int HASH_ROWS = 8;
+  // Difference hashes kept for screenshots seen recently, so they need not be decoded again.
+  private static final int MAX_CACHED_HASHES = 256;
+
+  /** A screenshot added to the store. */
+  @AutoValue
+  public abstract static class StoredScreenshot {
+    /** The name the screenshot was added with. */
+    public abstract String name();
+
+    /** The file that has the bytes of the screenshot, which other screenshots may share. */
+    public abstract Path path();
+
+    /** The SHA-256 hash of the bytes of the screenshot, in lowercase hex. */
+    public abstract String contentHash();
+
+    /** The 64-bit difference hash of the pixels of the screenshot. */
+    public abstract long perceptualHash();
+
+    /** Whether an identical screenshot was already stored, so this one took no more space. */
+    public abstract boolean duplicate();
+
+    /** Whether the screenshot looks the same as the screenshot added before it. */
+    public abstract boolean unchanged();
+  }
+
+  /**
+   * Returns a store in the specified directory, which it creates when needed. A screenshot is only
+   * unchanged if its difference hash equals that of the previous screenshot.
+   */
+  public static ScreenshotStore inDirectory(Path directory) {
+    return inDirectory(directory, 0);
+  }
+
+  /**
+   * Returns a store in the specified directory that considers a screenshot unchanged if its
+   * difference hash differs from that of the previous screenshot in at most the specified number of
+   * bits.
+   */
+  public static ScreenshotStore inDirectory(Path directory, int maxUnchangedDistance) {
+    checkArgument(
+        maxUnchangedDistance >= 0 && maxUnchangedDistance < 64,
+        "Invalid distance: %s",
+        maxUnchangedDistance);
+    return new ScreenshotStore(directory, maxUnchangedDistance);
+  }
+
+  private final Path directory;
+  private final int maxUnchangedDistance;
+  private final Map<String, Long> perceptualHashes =
+      new LinkedHashMap<String, Long>(16, 0.75f, true) {
+        @Override
+        protected boolean removeEldestEntry(Map.Entry<String, Long> eldest) {
+          return size() > MAX_CACHED_HASHES;
+        }
+      };
+  private Optional<StoredScreenshot> previous = Optional.empty();
+
+  private ScreenshotStore(Path directory, int maxUnchangedDistance) {
+    this.directory = checkNotNull(directory);
+    this.maxUnchangedDistance = maxUnchangedDistance;
+  }
+
+  /**
+   * Adds a PNG screenshot, like those {@link com.google.iosdevicecontrol.IosDevice#takeScreenshot}
+   * returns.
+   *
+   * @throws IOException - if the screenshot cannot be decoded or written
+   */
+  public synchronized StoredScreenshot add(String name, byte[] screenshot) throws IOException {
+    String contentHash = Hashing.sha256().hashBytes(screenshot).toString();
+    Path path = directory.resolve(contentHash.substring(0, 2)).resolve(contentHash + ".png");
+
+    boolean duplicate = Files.exists(path);
+    if (!duplicate) {
+      Files.createDirectories(path.getParent());
+      AtomicFiles.write(path, screenshot);
+    }
+
+    // Identical bytes have identical pixels, so only decode screenshots not seen recently.
+    Long perceptualHash = perceptualHashes.get(contentHash);
+    if (perceptualHash == null) {
+      perceptualHash = differenceHash(RawImage.decode(screenshot));
+      perceptualHashes.put(contentHash, perceptualHash);
+    }
+    boolean unchanged =
+        previous.isPresent()
+            && Long.bitCount(previous.get().perceptualHash() ^ perceptualHash)
+                <= maxUnchangedDistance;
+
+    StoredScreenshot stored =
+        new AutoValue_ScreenshotStore_StoredScreenshot(
+            name, path, contentHash, perceptualHash, duplicate, unchanged);
+    String indexLine =
+        String.format(
+            "%s\t%s\t%016x\t%s\n",
+            name.replaceAll("[\t\r\n]", " "), contentHash, perceptualHash, unchanged ? 1 : 0);
+    Files.write(
+        directory.resolve(INDEX_FILE_NAME),
+        indexLine.getBytes(UTF_8),
+        StandardOpenOption.CREATE,
+        StandardOpenOption.APPEND);
+    previous = Optional.of(stored);
+    return stored;
+  }
+
+  /**
+   * Returns the difference hash of an image: whether the brightness increases from left to right
+   * between each pair of neighboring pixels of the image scaled to 9x8. Small changes such as an
+   * updated clock or a blinking cursor rarely change the hash.
+   */
+  static long differenceHash(RawImage image) {
+    RawImage scaled = image.resized(HASH_COLUMNS, HASH_ROWS);
+    byte[] pixels = scaled.pixels();
+    int channels = scaled.channels();
+    long hash = 0;
+    for (int y = 0; y < HASH_ROWS; y++) {
+      int left = luma(pixels, y * HASH_COLUMNS * channels);
+      for (int x = 1; x < HASH_COLUMNS; x++) {
+        int right = luma(pixels, (y * HASH_COLUMNS + x) * channels);
+        hash = (hash << 1) | (right > left ? 1 : 0);
+        left = right;
+      }
+    }
+    return hash;
+  }
+
+  private static int luma(byte[] pixels, int offset) {
+    return 299 * (pixels[offset] & 0xff)
+        + 587 * (pixels[offset + 1] & 0xff)
+        + 114 * (pixels[offset + 2] & 0xff);
+  }
+}
@@ -0,0 +1,269 @@
+// Copyright 2017 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+package com.google.iosdevicecontrol.image;
+
+import java.nio.BufferUnderflowException;
+import java.nio.ByteBuffer;
+import java.nio.ByteOrder;
+import java.util.Optional;
+
+/**
+ * Reads the uncompressed or PackBits compressed 8-bit RGB and RGBA TIFF images that the
+ * screenshot service of iOS versions before 9 returns, straight into a {@link RawImage}. Any other
+ * kind of TIFF is left to ImageIO.
+ */
+final class TiffReader {
+  private static final int TAG_IMAGE_WIDTH = 256;
+  private static final int TAG_IMAGE_LENGTH = 257;
+  private static final int TAG_BITS_PER_SAMPLE = 258;
+  private static final int TAG_COMPRESSION = 259;
+  private static final int TAG_PHOTOMETRIC_INTERPRETATION = 262;
+  private static final int TAG_STRIP_OFFSETS = 273;
+  private static final int TAG_SAMPLES_PER_PIXEL = 277;
+  private static final int TAG_ROWS_PER_STRIP = 278;
+  private static final int TAG_STRIP_BYTE_COUNTS = 279;
+  private static final int TAG_PLANAR_CONFIGURATION = 284;
+  private static final int TAG_PREDICTOR = 317;
+  private static final int TAG_EXTRA_SAMPLES = 338;
+
+  private static final int TYPE_BYTE = 1;
+  private static final int TYPE_SHORT = 3;
+  private static final int TYPE_LONG = 4;
+
+  private static final int COMPRESSION_NONE = 1;
+  private static final int COMPRESSION_PACKBITS = 32773;
+  private static final int PHOTOMETRIC_RGB = 2;
+  private static final int EXTRA_SAMPLES_ASSOCIATED_ALPHA = 1;
+
+  /** Returns the image, or empty if the bytes are not a TIFF image of a supported kind. */
+  static Optional<RawImage> read(byte[] tiffBytes) {
+    try {
+      return new TiffReader(tiffBytes).read();
+    } catch (BufferUnderflowException
+        | IndexOutOfBoundsException
+        | IllegalArgumentException
+        | ArithmeticException e) {
+      // Truncated or inconsistent, so let ImageIO report what is wrong with it.
+      return Optional.empty();
+    }
+  }
+
+  private final ByteBuffer buffer;
+  private int width;
+  private int height;
+  private int samplesPerPixel = 1;
+  private int compression = COMPRESSION_NONE;
+  private int photometric = -1;
+  private int planarConfiguration = 1;
+  private int predictor = 1;
+  private int extraSamples;
+  private boolean eightBitSamples = true;
+  private long rowsPerStrip = Integer.MAX_VALUE;
+  private long[] stripOffsets;
+  private long[] stripByteCounts;
+
+  private TiffReader(byte[] tiffBytes) {
+    this.buffer = ByteBuffer.wrap(tiffBytes);
+  }
+
+  private Optional<RawImage> read() {
+    if (buffer.remaining() < 8) {
+      return Optional.empty();
+    }
+    short byteOrder = buffer.getShort(0);
+    if (byteOrder == 0x4949) {
+      buffer.order(ByteOrder.LITTLE_ENDIAN);
+    } else if (byteOrder != 0x4d4d) {
+      return Optional.empty();
+    }
+    if (buffer.getShort(2) != 42) {
+      return Optional.empty();
+    }
+    readDirectory(unsignedInt(buffer.getInt(4)));
+
+    if (width <= 0
+        || height <= 0
+        || !eightBitSamples
+        || (compression != COMPRESSION_NONE && compression != COMPRESSION_PACKBITS)
+        || photometric != PHOTOMETRIC_RGB
+        || (samplesPerPixel != 3 && samplesPerPixel != 4)
+        || planarConfiguration != 1
+        || predictor != 1
+        || stripOffsets == null
+        || stripByteCounts == null
+        || stripOffsets.length != stripByteCounts.length) {
+      return Optional.empty();
+    }
+
+    int stride = Math.multiplyExact(width, samplesPerPixel);
+    byte[] pixels = new byte[Math.multiplyExact(stride, height)];
+    int offset = 0;
+    for (int strip = 0; strip < stripOffsets.length && offset < pixels.length; strip++) {
+      int length = (int) Math.min(rowsPerStrip * stride, pixels.length - offset);
+      int stripOffset = Math.toIntExact(stripOffsets[strip]);
+      int stripLength = Math.toIntExact(stripByteCounts[strip]);
+      if (compression == COMPRESSION_NONE) {
+        System.arraycopy(buffer.array(), stripOffset, pixels, offset, length);
+      } else {
+        unpackBits(stripOffset, stripLength, pixels, offset, length);
+      }
+      offset += length;
+    }
+    if (offset != pixels.length) {
+      return Optional.empty();
+    }
+    if (samplesPerPixel == 4 && extraSamples == EXTRA_SAMPLES_ASSOCIATED_ALPHA) {
+      unpremultiply(pixels);
+    }
+    return Optional.of(RawImage.wrap(width, height, samplesPerPixel, pixels));
+  }
+
+  private void readDirectory(int directoryOffset) {
+    int entries = Short.toUnsignedInt(buffer.getShort(directoryOffset));
+    for (int i = 0; i < entries; i++) {
+      int entryOffset = directoryOffset + 2 + i * 12;
+      int tag = Short.toUnsignedInt(buffer.getShort(entryOffset));
+      int type = Short.toUnsignedInt(buffer.getShort(entryOffset + 2));
+      int count = unsignedInt(buffer.getInt(entryOffset + 4));
+      switch (tag) {
+        case TAG_IMAGE_WIDTH:
+          width = (int) value(type, count, entryOffset, 0);
+          break;
+        case TAG_IMAGE_LENGTH:
+          height = (int) value(type, count, entryOffset, 0);
+          break;
+        case TAG_BITS_PER_SAMPLE:
+          for (int sample = 0; sample < count; sample++) {
+            eightBitSamples &= value(type, count, entryOffset, sample) == 8;
+          }
+          break;
+        case TAG_COMPRESSION:
+          compression = (int) value(type, count, entryOffset, 0);
+          break;
+        case TAG_PHOTOMETRIC_INTERPRETATION:
+          photometric = (int) value(type, count, entryOffset, 0);
+          break;
+        case TAG_STRIP_OFFSETS:
+          stripOffsets = values(type, count, entryOffset);
+          break;
+        case TAG_SAMPLES_PER_PIXEL:
+          samplesPerPixel = (int) value(type, count, entryOffset, 0);
+          break;
+        case TAG_ROWS_PER_STRIP:
+          rowsPerStrip = value(type, count, entryOffset, 0);
+          break;
+        case TAG_STRIP_BYTE_COUNTS:
+          stripByteCounts = values(type, count, entryOffset);
+          break;
+        case TAG_PLANAR_CONFIGURATION:
+          planarConfiguration = (int) value(type, count, entryOffset, 0);
+          break;
+        case TAG_PREDICTOR:
+          predictor = (int) value(type, count, entryOffset, 0);
+          break;
+        case TAG_EXTRA_SAMPLES:
+          extraSamples = (int) value(type, count, entryOffset, 0);
+          break;
+        default:
+          break;
+      }
+    }
+  }
+
+  private long[] values(int type, int count, int entryOffset) {
+    if (count > buffer.capacity()) {
+      throw new IllegalArgumentException("Too many values: " + count);
+    }
+    long[] values = new long[count];
+    for (int i = 0; i < count; i++) {
+      values[i] = value(type, count, entryOffset, i);
+    }
+    return values;
+  }
+
+  /** Returns a value of an entry, which is inline if it fits in four bytes. */
+  private long value(int type, int count, int entryOffset, int index) {
+    int size;
+    switch (type) {
+      case TYPE_BYTE:
+        size = 1;
+        break;
+      case TYPE_SHORT:
+        size = 2;
+        break;
+      case TYPE_LONG:
+        size = 4;
+        break;
+      default:
+        throw new IllegalArgumentException("Unexpected field type " + type);
+    }
+    int valuesOffset =
+        (long) count * size <= 4
+            ? entryOffset + 8
+            : unsignedInt(buffer.getInt(entryOffset + 8));
+    int offset = valuesOffset + index * size;
+    switch (size) {
+      case 1:
+        return Byte.toUnsignedInt(buffer.get(offset));
+      case 2:
+        return Short.toUnsignedInt(buffer.getShort(offset));
+      default:
+        return Integer.toUnsignedLong(buffer.getInt(offset));
+    }
+  }
+
+  private static int unsignedInt(int value) {
+    if (value < 0) {
+      throw new IllegalArgumentException("Offset out of range: " + Integer.toUnsignedString(value));
+    }
+    return value;
+  }
+
+  private void unpackBits(int from, int fromLength, byte[] to, int toOffset, int toLength) {
+    byte[] packed = buffer.array();
+    int p = from;
+    int end = from + fromLength;
+    int t = toOffset;
+    int toEnd = toOffset + toLength;
+    while (p < end && t < toEnd) {
+      int n = packed[p++];
+      if (n >= 0) {
+        System.arraycopy(packed, p, to, t, n + 1);
+        p += n + 1;
+        t += n + 1;
+      } else if (n != -128) {
+        byte value = packed[p++];
+        for (int i = 0; i < 1 - n; i++) {
+          to[t++] = value;
+        }
+      }
+    }
+    if (t != toEnd) {
+      throw new IllegalArgumentException("Strip unpacked to " + (t - toOffset) + " bytes");
+    }
+  }
+
+  private static void unpremultiply(byte[] pixels) {
+    for (int i = 0; i < pixels.length; i += 4) {
+      int alpha = pixels[i + 3] & 0xff;
+      if (alpha != 0 && alpha != 0xff) {
+        for (int c = 0; c < 3; c++) {
+          int value = ((pixels[i + c] & 0xff) * 0xff + alpha / 2) / alpha;
+          pixels[i + c] = (byte) Math.min(value, 0xff);
+        }
+      }
+    }
+  }
+}
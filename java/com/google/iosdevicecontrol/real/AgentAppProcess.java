@@ -0,0 +1,211 @@
+// Copyright 2017 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+package com.google.iosdevicecontrol.real;
+
+import static com.google.common.base.Preconditions.checkNotNull;
+import static java.nio.charset.StandardCharsets.UTF_8;
+import static java.util.concurrent.TimeUnit.NANOSECONDS;
+
+import com.google.common.collect.ObjectArrays;
+import com.google.common.util.concurrent.SettableFuture;
+import com.google.iosdevicecontrol.IosAppBundleId;
+import com.google.iosdevicecontrol.IosAppProcess;
+import com.google.iosdevicecontrol.IosDevice;
+import com.google.iosdevicecontrol.IosDeviceException;
+import com.google.iosdevicecontrol.command.CapturingOutputStream;
+import com.google.iosdevicecontrol.util.FluentLogger;
+import java.io.IOException;
+import java.io.InputStreamReader;
+import java.io.Reader;
+import java.nio.ByteBuffer;
+import java.time.Duration;
+import java.util.Optional;
+import java.util.concurrent.ExecutionException;
+import java.util.concurrent.TimeoutException;
+
+/**
+ * Implementation of {@link IosAppProcess} that runs the app on a channel of an {@link
+ * IdeviceAgent}, which reuses the lockdown session of the agent to start debugserver. The app's
+ * output and exit are delivered as events, like those of {@link NativeAppProcess}.
+ */
+final class AgentAppProcess implements IosAppProcess {
+  private static final FluentLogger logger = FluentLogger.forEnclosingClass();
+
+  // Must match app_runner_error_t in app_runner.h.
+  private static final int E_DEBUGSERVER_FAILED = -4;
+
+  // Must match app_runner_event_type_t in app_runner.h, and EVENT_CONNECTED in idevice-agent.c.
+  private static final int EVENT_OUTPUT = 0;
+  private static final int EVENT_EXIT = 1;
+  private static final int EVENT_STOPPED = 2;
+  private static final int EVENT_ERROR = 3;
+  private static final int EVENT_CONNECTED = 0xFF;
+
+  /** The event type and exit code before the data of each event. */
+  private static final int EVENT_HEADER_BYTES = 5;
+
+  /**
+   * Starts the app with the specified arguments, or returns empty if debugserver could not be
+   * started, which usually means the developer image is not mounted.
+   */
+  static Optional<AgentAppProcess> start(
+      IosDevice device, IdeviceAgent agent, IosAppBundleId bundleId, String... args)
+      throws IosDeviceException {
+    try {
+      String[] runArgs = ObjectArrays.concat(bundleId.toString(), args);
+      AgentAppProcess process = new AgentAppProcess(device, agent.open("run", runArgs));
+      // Events of connecting, if any, come before the runner is connected.
+      while (process.handleNextEvent()) {
+        if (process.connected) {
+          Thread thread = new Thread(process::run, "agent-app-runner-" + bundleId);
+          thread.setDaemon(true);
+          thread.start();
+          return Optional.of(process);
+        }
+      }
+      int error = process.channel.status();
+      if (error == E_DEBUGSERVER_FAILED) {
+        return Optional.empty();
+      }
+      throw RealAppProcess.mapApprunnerFailure(
+          device, new IOException("app_runner_connect failed: " + error), process.errors());
+    } catch (IOException e) {
+      throw new IosDeviceException(device, e);
+    } catch (InterruptedException e) {
+      Thread.currentThread().interrupt();
+      throw new IosDeviceException(device, e);
+    }
+  }
+
+  private final IosDevice device;
+  private final IdeviceAgent.Channel channel;
+  private final CapturingOutputStream output = new CapturingOutputStream();
+  private final StringBuilder errors = new StringBuilder();
+  private final SettableFuture<String> result = SettableFuture.create();
+  private boolean connected = false;
+
+  private AgentAppProcess(IosDevice device, IdeviceAgent.Channel channel) {
+    this.device = checkNotNull(device);
+    this.channel = checkNotNull(channel);
+  }
+
+  private void run() {
+    int exitCode = -1;
+    try {
+      while (handleNextEvent()) {}
+      exitCode = channel.status();
+    } catch (IOException e) {
+      logger.atWarning().withCause(e).log("Event handling failed for %s", device);
+      kill();
+    } catch (InterruptedException e) {
+      // Only this thread waits on the channel, so nobody else interrupts it.
+      Thread.currentThread().interrupt();
+    } finally {
+      try {
+        output.close();
+      } catch (IOException e) {
+        logger.atWarning().withCause(e).log("Could not close the output of %s", device);
+      }
+    }
+
+    if (exitCode == 0) {
+      result.set(output.toString(UTF_8));
+    } else {
+      result.setException(
+          RealAppProcess.mapApprunnerFailure(
+              device, new IOException("app_runner_run exited with " + exitCode), errors()));
+    }
+  }
+
+  /** Handles the next event and returns true, or returns false once the runner is done. */
+  private boolean handleNextEvent() throws IOException, InterruptedException {
+    Optional<byte[]> event = channel.read();
+    if (!event.isPresent()) {
+      return false;
+    }
+    ByteBuffer buffer = ByteBuffer.wrap(event.get());
+    if (buffer.remaining() < EVENT_HEADER_BYTES) {
+      throw new IOException("Truncated app runner event of " + buffer.remaining() + " bytes");
+    }
+    int type = buffer.get() & 0xFF;
+    int exitCode = buffer.getInt();
+    byte[] data = new byte[buffer.remaining()];
+    buffer.get(data);
+    switch (type) {
+      case EVENT_OUTPUT:
+        output.write(data);
+        break;
+      case EVENT_EXIT:
+        logger.atInfo().log("App on %s exited with %s", device, exitCode);
+        break;
+      case EVENT_STOPPED:
+        logger.atInfo().log("App on %s stopped: %s", device, new String(data, UTF_8));
+        break;
+      case EVENT_ERROR:
+        synchronized (errors) {
+          errors.append(new String(data, UTF_8)).append('\n');
+        }
+        break;
+      case EVENT_CONNECTED:
+        connected = true;
+        break;
+      default:
+        break;
+    }
+    return true;
+  }
+
+  private String errors() {
+    synchronized (errors) {
+      return errors.toString();
+    }
+  }
+
+  @Override
+  public AgentAppProcess kill() {
+    try {
+      channel.close();
+    } catch (IOException e) {
+      // The connection is gone, which stops the app as well.
+      logger.atFine().withCause(e).log("Could not stop the app on %s", device);
+    }
+    return this;
+  }
+
+  @Override
+  public String await() throws IosDeviceException, InterruptedException {
+    try {
+      return result.get();
+    } catch (ExecutionException e) {
+      throw (IosDeviceException) e.getCause();
+    }
+  }
+
+  @Override
+  public String await(Duration timeout)
+      throws IosDeviceException, InterruptedException, TimeoutException {
+    try {
+      return result.get(timeout.toNanos(), NANOSECONDS);
+    } catch (ExecutionException e) {
+      throw (IosDeviceException) e.getCause();
+    }
+  }
+
+  @Override
+  public Reader outputReader() {
+    return new InputStreamReader(output.openInputStream(), UTF_8);
+  }
+}
@@ -0,0 +1,67 @@
+// Copyright 2017 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+package com.google.iosdevicecontrol.real;
+
+import com.google.auto.value.AutoValue;
+import java.time.Duration;
+import java.time.Instant;
+
+/**
+ * An estimate of a device clock in terms of the host's {@link System#nanoTime}, for putting device
+ * timestamps on the same timeline as host ones.
+ */
+@AutoValue
+public abstract class DeviceClockEstimate {
+  /**
+   * Creates an estimate from the device time at a reference point on the host clock and the rate
+   * at which the device clock gains on the host clock, in microseconds per second.
+   */
+  public static DeviceClockEstimate create(
+      long referenceNanoTime,
+      Instant deviceTimeAtReference,
+      double driftPpm,
+      Duration uncertainty) {
+    return new AutoValue_DeviceClockEstimate(
+        referenceNanoTime, deviceTimeAtReference, driftPpm, uncertainty);
+  }
+
+  /** The {@link System#nanoTime} at which the device clock read {@link #deviceTimeAtReference}. */
+  public abstract long referenceNanoTime();
+
+  public abstract Instant deviceTimeAtReference();
+
+  public abstract double driftPpm();
+
+  /** How far off the device time at the reference may be. */
+  public abstract Duration uncertainty();
+
+  /** Returns what the device clock read at the specified {@link System#nanoTime}. */
+  public Instant deviceTimeAt(long nanoTime) {
+    long elapsedNanos = nanoTime - referenceNanoTime();
+    long driftNanos = Math.round(elapsedNanos * driftPpm() / 1e6);
+    return deviceTimeAtReference().plusNanos(elapsedNanos + driftNanos);
+  }
+
+  /** Returns the {@link System#nanoTime} at which the device clock read the specified time. */
+  public long nanoTimeAt(Instant deviceTime) {
+    Duration sinceReference = Duration.between(deviceTimeAtReference(), deviceTime);
+    return referenceNanoTime() + Math.round(sinceReference.toNanos() / (1 + driftPpm() / 1e6));
+  }
+
+  /** Returns how far the device clock is ahead of the host's system clock right now. */
+  public Duration offsetFromSystemTime() {
+    return Duration.between(Instant.now(), deviceTimeAt(System.nanoTime()));
+  }
+}
@@ -0,0 +1,211 @@
+// Copyright 2017 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+package com.google.iosdevicecontrol.real;
+
+import static java.nio.charset.StandardCharsets.UTF_8;
+
+import com.dd.plist.NSArray;
+import com.dd.plist.NSDictionary;
+import com.dd.plist.NSNumber;
+import com.dd.plist.NSObject;
+import com.dd.plist.NSString;
+import com.google.auto.value.AutoValue;
+import com.google.common.collect.ImmutableMap;
+import com.google.common.collect.ImmutableSet;
+import com.google.iosdevicecontrol.IosAppBundleId;
+import com.google.iosdevicecontrol.util.AtomicFiles;
+import com.google.iosdevicecontrol.util.FluentLogger;
+import com.google.iosdevicecontrol.util.PlistParser;
+import com.google.iosdevicecontrol.util.PlistParser.PlistParseException;
+import java.io.IOException;
+import java.nio.file.Files;
+import java.nio.file.Path;
+import java.util.Optional;
+
+/**
+ * An on-disk cache of the metadata of real devices, so that a restarted host process does not have
+ * to query every attached device for it again. Each device has an XML plist file named by its UDID.
+ * Entries written by another version of the cache or that cannot be parsed are ignored, and writes
+ * are best effort, since the device can always be queried instead.
+ */
+final class DeviceMetadataCache {
+  private static final FluentLogger logger = FluentLogger.forEnclosingClass();
+
+  /** Version of the entry format; entries of any other version are ignored. */
+  static final int VERSION = 1;
+
+  /** The ideviceinfo keys whose values only change when the device is updated or restored. */
+  static final ImmutableSet<String> STATIC_INFO_KEYS =
+      ImmutableSet.of("BuildVersion", "CPUArchitecture", "ProductType", "ProductVersion");
+
+  private static final String VERSION_KEY = "CacheVersion";
+  private static final String UDID_KEY = "UniqueDeviceID";
+  private static final String ECID_KEY = "UniqueChipID";
+  private static final String INFO_KEY = "Info";
+  private static final String APPLICATIONS_KEY = "Applications";
+  private static final String ENTRY_EXTENSION = ".plist";
+
+  private static final DeviceMetadataCache DISABLED = new DeviceMetadataCache(Optional.empty());
+
+  /** Returns a cache that stores its entries in the specified directory. */
+  static DeviceMetadataCache inDirectory(Path directory) {
+    return new DeviceMetadataCache(Optional.of(directory));
+  }
+
+  /** Returns a cache that never has an entry and discards all writes. */
+  static DeviceMetadataCache disabled() {
+    return DISABLED;
+  }
+
+  /** The cached metadata of a single device. */
+  @AutoValue
+  abstract static class DeviceMetadata {
+    static DeviceMetadata create(String udid, String ecid) {
+      return create(udid, ecid, ImmutableMap.of(), Optional.empty());
+    }
+
+    private static DeviceMetadata create(
+        String udid,
+        String ecid,
+        ImmutableMap<String, String> info,
+        Optional<ImmutableSet<IosAppBundleId>> applications) {
+      return new AutoValue_DeviceMetadataCache_DeviceMetadata(udid, ecid, info, applications);
+    }
+
+    abstract String udid();
+
+    /** The ECID of the device in hexadecimal, as cfgutil expects it. */
+    abstract String ecid();
+
+    /** The values of the {@link DeviceMetadataCache#STATIC_INFO_KEYS}, or empty if unknown. */
+    abstract ImmutableMap<String, String> info();
+
+    /** The applications last seen installed on the device, if they have ever been listed. */
+    abstract Optional<ImmutableSet<IosAppBundleId>> applications();
+
+    DeviceMetadata withInfo(ImmutableMap<String, String> info) {
+      return create(udid(), ecid(), info, applications());
+    }
+
+    DeviceMetadata withApplications(ImmutableSet<IosAppBundleId> applications) {
+      return create(udid(), ecid(), info(), Optional.of(applications));
+    }
+
+    /** Returns only the metadata that no update or restore of the device can change. */
+    DeviceMetadata withoutMutableMetadata() {
+      return create(udid(), ecid());
+    }
+  }
+
+  private final Optional<Path> directory;
+
+  private DeviceMetadataCache(Optional<Path> directory) {
+    this.directory = directory;
+  }
+
+  /** Returns the cached metadata of the device with the specified UDID, if there is any. */
+  Optional<DeviceMetadata> read(String udid) {
+    if (!directory.isPresent()) {
+      return Optional.empty();
+    }
+    Path entryPath = entryPath(directory.get(), udid);
+    if (!Files.exists(entryPath)) {
+      return Optional.empty();
+    }
+    try {
+      NSDictionary entry = (NSDictionary) PlistParser.fromPath(entryPath);
+      if (!entry.containsKey(VERSION_KEY)
+          || ((NSNumber) entry.get(VERSION_KEY)).intValue() != VERSION
+          || !udid.equals(entry.get(UDID_KEY).toString())) {
+        logger.atInfo().log("ignoring stale device metadata in %s", entryPath);
+        return Optional.empty();
+      }
+      return Optional.of(fromPlist(udid, entry));
+    } catch (PlistParseException | ClassCastException | NullPointerException e) {
+      logger.atWarning().withCause(e).log("ignoring malformed device metadata in %s", entryPath);
+      return Optional.empty();
+    }
+  }
+
+  /** Writes the metadata of a device, replacing any previous entry for it. */
+  void write(DeviceMetadata metadata) {
+    if (!directory.isPresent()) {
+      return;
+    }
+    Path entryPath = entryPath(directory.get(), metadata.udid());
+    try {
+      Files.createDirectories(directory.get());
+      AtomicFiles.write(entryPath, toPlist(metadata).toXMLPropertyList().getBytes(UTF_8));
+    } catch (IOException e) {
+      logger.atWarning().withCause(e).log("failed to write device metadata to %s", entryPath);
+    }
+  }
+
+  private static Path entryPath(Path directory, String udid) {
+    return directory.resolve(udid + ENTRY_EXTENSION);
+  }
+
+  private static NSDictionary toPlist(DeviceMetadata metadata) {
+    NSDictionary entry = new NSDictionary();
+    entry.put(VERSION_KEY, VERSION);
+    entry.put(UDID_KEY, metadata.udid());
+    entry.put(ECID_KEY, metadata.ecid());
+    NSDictionary info = new NSDictionary();
+    metadata.info().forEach(info::put);
+    entry.put(INFO_KEY, info);
+    if (metadata.applications().isPresent()) {
+      entry.put(
+          APPLICATIONS_KEY,
+          new NSArray(
+              metadata
+                  .applications()
+                  .get()
+                  .stream()
+                  .map(bundleId -> new NSString(bundleId.toString()))
+                  .toArray(NSObject[]::new)));
+    }
+    return entry;
+  }
+
+  private static DeviceMetadata fromPlist(String udid, NSDictionary entry) {
+    DeviceMetadata metadata = DeviceMetadata.create(udid, entry.get(ECID_KEY).toString());
+
+    // Only use the static info if all of it is there, so a partial entry is fetched again.
+    NSDictionary infoDict = (NSDictionary) entry.get(INFO_KEY);
+    ImmutableMap.Builder<String, String> info = ImmutableMap.builder();
+    boolean complete = true;
+    for (String key : STATIC_INFO_KEYS) {
+      NSObject value = infoDict.get(key);
+      if (value instanceof NSString) {
+        info.put(key, ((NSString) value).getContent());
+      } else {
+        complete = false;
+      }
+    }
+    if (complete) {
+      metadata = metadata.withInfo(info.build());
+    }
+
+    NSArray applicationsArray = (NSArray) entry.get(APPLICATIONS_KEY);
+    if (applicationsArray != null) {
+      ImmutableSet.Builder<IosAppBundleId> applications = ImmutableSet.builder();
+      for (NSObject bundleId : applicationsArray.getArray()) {
+        applications.add(new IosAppBundleId(bundleId.toString()));
+      }
+      metadata = metadata.withApplications(applications.build());
+    }
+    return metadata;
+  }
+}
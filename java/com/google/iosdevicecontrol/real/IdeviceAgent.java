@@ -0,0 +1,389 @@
+// Copyright 2017 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+package com.google.iosdevicecontrol.real;
+
+import static com.google.common.base.Preconditions.checkNotNull;
+import static java.nio.charset.StandardCharsets.UTF_8;
+
+import com.google.iosdevicecontrol.command.CommandProcess;
+import com.google.iosdevicecontrol.util.FluentLogger;
+import java.io.BufferedInputStream;
+import java.io.BufferedOutputStream;
+import java.io.BufferedReader;
+import java.io.ByteArrayOutputStream;
+import java.io.Closeable;
+import java.io.DataInputStream;
+import java.io.DataOutputStream;
+import java.io.IOException;
+import java.io.InputStream;
+import java.io.InterruptedIOException;
+import java.net.InetAddress;
+import java.net.Socket;
+import java.nio.ByteBuffer;
+import java.security.SecureRandom;
+import java.util.Map;
+import java.util.Optional;
+import java.util.concurrent.BlockingQueue;
+import java.util.concurrent.ConcurrentHashMap;
+import java.util.concurrent.CountDownLatch;
+import java.util.concurrent.LinkedBlockingQueue;
+import java.util.concurrent.atomic.AtomicBoolean;
+import java.util.concurrent.atomic.AtomicInteger;
+
+/**
+ * A connection to idevice-agent, which serves one device for as long as the connection stays open:
+ * lockdown values, screenshots, the system log, the web inspector and running apps, each on its own
+ * channel of the connection. The agent keeps one lockdown session for all of them, so unlike the
+ * idevice commands, a call does not connect to usbmuxd and lockdown again. The protocol is
+ * described in idevice-agent.c.
+ */
+final class IdeviceAgent implements Closeable {
+  private static final FluentLogger logger = FluentLogger.forEnclosingClass();
+
+  static final String TOKEN_ENVIRONMENT_VARIABLE = "IDEVICE_AGENT_TOKEN";
+
+  // Must match frame_type_t in idevice-agent.c.
+  private static final int FRAME_HELLO = 0;
+  private static final int FRAME_OPEN = 1;
+  private static final int FRAME_DATA = 2;
+  private static final int FRAME_CLOSE = 3;
+
+  private static final int MAX_FRAME_BYTES = 64 * 1024 * 1024;
+  private static final String PORT_LINE_PREFIX = "port ";
+  private static final int TOKEN_BYTES = 16;
+
+  /** Queued after the last data of a channel. */
+  private static final byte[] END_OF_CHANNEL = new byte[0];
+
+  /** Returns whether idevice-agent is installed. */
+  static boolean isAvailable() {
+    return IdeviceCommands.isInstalled(IdeviceCommands.AGENT);
+  }
+
+  /** Starts an agent for the device of the commands and connects to it. */
+  static IdeviceAgent start(IdeviceCommands idevice) throws IOException {
+    byte[] tokenBytes = new byte[TOKEN_BYTES];
+    new SecureRandom().nextBytes(tokenBytes);
+    StringBuilder token = new StringBuilder();
+    for (byte b : tokenBytes) {
+      token.append(String.format("%02x", b));
+    }
+
+    CommandProcess process = idevice.agent(token.toString());
+    try {
+      // The agent prints the port once it is connected to the device.
+      String line = new BufferedReader(process.stdoutReaderUtf8()).readLine();
+      if (line == null || !line.startsWith(PORT_LINE_PREFIX)) {
+        throw new IOException("idevice-agent did not start: " + line);
+      }
+      int port = Integer.parseInt(line.substring(PORT_LINE_PREFIX.length()).trim());
+      Socket socket = new Socket(InetAddress.getLoopbackAddress(), port);
+      return connect(socket, token.toString(), process::kill);
+    } catch (IOException | RuntimeException e) {
+      process.kill();
+      throw e instanceof IOException ? (IOException) e : new IOException(e);
+    }
+  }
+
+  /**
+   * Authenticates over a connected socket with the token and returns the agent, which runs
+   * onClose when it is closed.
+   */
+  static IdeviceAgent connect(Socket socket, String token, Runnable onClose) throws IOException {
+    IdeviceAgent agent = new IdeviceAgent(socket, onClose);
+    byte[] hello = token.getBytes(UTF_8);
+    try {
+      agent.sendFrame(0, FRAME_HELLO, hello, 0, hello.length);
+    } catch (IOException e) {
+      agent.close();
+      throw e;
+    }
+    Thread reader = new Thread(agent::readFrames, "idevice-agent-" + socket.getPort());
+    reader.setDaemon(true);
+    reader.start();
+    return agent;
+  }
+
+  private final Socket socket;
+  private final Runnable onClose;
+  private final DataOutputStream out;
+  private final Map<Integer, Channel> channels = new ConcurrentHashMap<>();
+  private final AtomicInteger nextChannelId = new AtomicInteger(1);
+  private final AtomicBoolean closed = new AtomicBoolean(false);
+  /** Why the connection ended, once it has. */
+  private volatile IOException failure;
+
+  private IdeviceAgent(Socket socket, Runnable onClose) throws IOException {
+    this.socket = checkNotNull(socket);
+    this.onClose = checkNotNull(onClose);
+    out = new DataOutputStream(new BufferedOutputStream(socket.getOutputStream()));
+  }
+
+  /** Returns whether the connection to the agent is still open. */
+  boolean isOpen() {
+    return failure == null && !closed.get();
+  }
+
+  /**
+   * Calls the method with the arguments and returns all data of its channel.
+   *
+   * @throws CallException - if the method failed
+   * @throws IOException - if the connection to the agent failed
+   */
+  byte[] call(String method, String... args) throws IOException, InterruptedException {
+    Channel channel = open(method, args);
+    try {
+      ByteArrayOutputStream result = new ByteArrayOutputStream();
+      for (Optional<byte[]> data = channel.read(); data.isPresent(); data = channel.read()) {
+        result.write(data.get());
+      }
+      if (channel.status() != 0) {
+        throw new CallException(method, channel.status(), channel.message());
+      }
+      return result.toByteArray();
+    } catch (InterruptedException e) {
+      channel.close();
+      throw e;
+    }
+  }
+
+  /** Opens a channel that runs the method with the arguments. */
+  Channel open(String method, String... args) throws IOException {
+    ByteArrayOutputStream request = new ByteArrayOutputStream();
+    request.write(method.getBytes(UTF_8));
+    request.write(0);
+    for (String arg : args) {
+      request.write(arg.getBytes(UTF_8));
+      request.write(0);
+    }
+
+    Channel channel = new Channel(nextChannelId.getAndIncrement());
+    channels.put(channel.id, channel);
+    // The reader ends the channels after it sets the failure, so checking it after adding the
+    // channel makes sure the channel ends either way.
+    IOException cause = failure;
+    if (cause != null) {
+      channels.remove(channel.id);
+      throw new IOException("The connection to idevice-agent was lost", cause);
+    }
+    try {
+      sendFrame(channel.id, FRAME_OPEN, request.toByteArray(), 0, request.size());
+    } catch (IOException e) {
+      channels.remove(channel.id);
+      throw e;
+    }
+    return channel;
+  }
+
+  @Override
+  public void close() {
+    if (closed.getAndSet(true)) {
+      return;
+    }
+    try {
+      socket.close();
+    } catch (IOException e) {
+      logger.atFine().withCause(e).log("Could not close the connection to idevice-agent");
+    }
+    onClose.run();
+  }
+
+  private void sendFrame(int channel, int type, byte[] bytes, int offset, int length)
+      throws IOException {
+    synchronized (out) {
+      out.writeInt(length);
+      out.writeInt(channel);
+      out.writeByte(type);
+      out.write(bytes, offset, length);
+      out.flush();
+    }
+  }
+
+  private void readFrames() {
+    IOException cause;
+    try (DataInputStream in =
+        new DataInputStream(new BufferedInputStream(socket.getInputStream()))) {
+      while (true) {
+        int length = in.readInt();
+        int id = in.readInt();
+        int type = in.readUnsignedByte();
+        if (length < 0 || length > MAX_FRAME_BYTES) {
+          throw new IOException("Frame of " + (length & 0xFFFFFFFFL) + " bytes is too long");
+        }
+        byte[] payload = new byte[length];
+        in.readFully(payload);
+        Channel channel = channels.get(id);
+        if (channel == null) {
+          logger.atFine().log("Ignoring frame of type %s for unknown channel %s", type, id);
+        } else if (type == FRAME_DATA) {
+          channel.received.add(payload);
+        } else if (type == FRAME_CLOSE) {
+          channels.remove(id);
+          ByteBuffer close = ByteBuffer.wrap(payload);
+          int status = close.remaining() >= 4 ? close.getInt() : -1;
+          channel.end(status, new String(payload, close.position(), close.remaining(), UTF_8));
+        }
+      }
+    } catch (IOException e) {
+      cause = e;
+    }
+    if (!closed.get()) {
+      logger.atWarning().withCause(cause).log("Lost the connection to idevice-agent");
+    }
+    failure = cause;
+    close();
+    for (Channel channel : channels.values()) {
+      channel.fail(cause);
+    }
+    channels.clear();
+  }
+
+  /**
+   * A channel of the agent, which receives data until the method is done, and can also send data
+   * to it. Closing the channel stops the method.
+   */
+  final class Channel implements Closeable {
+    private final int id;
+    private final BlockingQueue<byte[]> received = new LinkedBlockingQueue<>();
+    private final CountDownLatch ended = new CountDownLatch(1);
+    private final AtomicBoolean closeSent = new AtomicBoolean(false);
+    private volatile int status;
+    private volatile String message = "";
+    private volatile IOException failure;
+    /** Whether read has returned the end; only used by the reader of the channel. */
+    private boolean endRead;
+
+    private Channel(int id) {
+      this.id = id;
+    }
+
+    /**
+     * Returns the next data the agent sent on the channel, or empty once the method is done.
+     *
+     * @throws IOException - if the connection to the agent was lost
+     */
+    Optional<byte[]> read() throws IOException, InterruptedException {
+      if (!endRead) {
+        byte[] data = received.take();
+        if (data != END_OF_CHANNEL) {
+          return Optional.of(data);
+        }
+        endRead = true;
+      }
+      status();
+      return Optional.empty();
+    }
+
+    /** Returns the data of the channel as a stream, which ends when the method is done. */
+    InputStream inputStream() {
+      return new InputStream() {
+        private ByteBuffer data = ByteBuffer.allocate(0);
+
+        @Override
+        public int read() throws IOException {
+          byte[] b = new byte[1];
+          return read(b, 0, 1) == -1 ? -1 : b[0] & 0xFF;
+        }
+
+        @Override
+        public int read(byte[] b, int off, int len) throws IOException {
+          if (len == 0) {
+            return 0;
+          }
+          while (!data.hasRemaining()) {
+            Optional<byte[]> next;
+            try {
+              next = Channel.this.read();
+            } catch (InterruptedException e) {
+              Thread.currentThread().interrupt();
+              throw new InterruptedIOException();
+            }
+            if (!next.isPresent()) {
+              return -1;
+            }
+            data = ByteBuffer.wrap(next.get());
+          }
+          int n = Math.min(len, data.remaining());
+          data.get(b, off, n);
+          return n;
+        }
+      };
+    }
+
+    /** Sends the bytes to the method. */
+    void write(byte[] bytes) throws IOException {
+      sendFrame(id, FRAME_DATA, bytes, 0, bytes.length);
+    }
+
+    /**
+     * Waits for the method to be done and returns its status, which is 0 if it succeeded.
+     *
+     * @throws IOException - if the connection to the agent was lost
+     */
+    int status() throws IOException, InterruptedException {
+      ended.await();
+      if (failure != null) {
+        throw new IOException("The connection to idevice-agent was lost", failure);
+      }
+      return status;
+    }
+
+    /** Returns the message of the status, once the method is done. */
+    String message() {
+      return message;
+    }
+
+    /** Stops the method, if it is not done yet; it still ends the channel as usual. */
+    @Override
+    public void close() throws IOException {
+      if (ended.getCount() > 0 && !closeSent.getAndSet(true) && isOpen()) {
+        sendFrame(id, FRAME_CLOSE, new byte[0], 0, 0);
+      }
+    }
+
+    private synchronized void end(int status, String message) {
+      if (ended.getCount() > 0) {
+        this.status = status;
+        this.message = message;
+        received.add(END_OF_CHANNEL);
+        ended.countDown();
+      }
+    }
+
+    private synchronized void fail(IOException failure) {
+      if (ended.getCount() > 0) {
+        this.failure = failure;
+        received.add(END_OF_CHANNEL);
+        ended.countDown();
+      }
+    }
+  }
+
+  /** Thrown if a method of the agent failed. */
+  static final class CallException extends IOException {
+    private final int status;
+
+    private CallException(String method, int status, String message) {
+      super(method + " failed with status " + status + ": " + message);
+      this.status = status;
+    }
+
+    /** The status the method ended with. */
+    int status() {
+      return status;
+    }
+  }
+}
@@ -17,11 +17,13 @@ package com.google.iosdevicecontrol.real;
 import static com.google.iosdevicecontrol.command.Command.command;
 
 import com.google.common.collect.ImmutableList;
-import com.google.common.collect.ImmutableMap;
+import com.google.common.io.ByteSink;
 import com.google.iosdevicecontrol.command.Command;
 import com.google.iosdevicecontrol.command.CommandExecutor;
 import com.google.iosdevicecontrol.command.CommandProcess;
 import com.google.iosdevicecontrol.command.CommandStartException;
+import com.google.iosdevicecontrol.usb.UsbUsageReporter;
+import java.nio.file.Files;
 import java.nio.file.Path;
 import java.nio.file.Paths;
 import java.util.Arrays;
@@ -30,10 +32,21 @@ import java.util.function.UnaryOperator;
 
 /** The binaries provided by libimobiledevice and friends. */
 final class IdeviceCommands {
+  /** The agent that serves a device over one connection, see {@link IdeviceAgent}. */
+  static final String AGENT = "idevice-agent";
+
+  // TODO(user): Install idevice commands to temp on the fly.
+  private static final Path INSTALL_DIRECTORY = Paths.get("/usr/local/bin");
+
   static CommandProcess id(CommandExecutor executor, String... args) {
     return exec(executor, "idevice_id", ImmutableList.copyOf(args), UnaryOperator.identity());
   }
 
+  /** Returns whether the idevice command is installed. */
+  static boolean isInstalled(String filename) {
+    return Files.isExecutable(INSTALL_DIRECTORY.resolve(filename));
+  }
+
   static CommandProcess exec(Command command) {
     try {
       return command.start();
@@ -50,6 +63,14 @@ final class IdeviceCommands {
     this.udid = udid;
   }
 
+  /** Starts an agent for the device, which expects the token from its client. */
+  CommandProcess agent(String token) {
+    return exec(
+        AGENT,
+        new String[0],
+        c -> c.withEnvironmentUpdated(IdeviceAgent.TOKEN_ENVIRONMENT_VARIABLE, token));
+  }
+
   CommandProcess apprunner(String... args) {
     return exec("idevice-app-runner", args);
   }
@@ -86,6 +107,10 @@ final class IdeviceCommands {
     return exec("idevicesyslog", args, c -> c.withStdoutTo(logPath));
   }
 
+  CommandProcess syslog(ByteSink logSink, String... args) {
+    return exec("idevicesyslog", args, c -> c.withStdoutTo(logSink));
+  }
+
   CommandProcess webinspectorproxy(String... args) {
     return exec("idevicewebinspectorproxy", args);
   }
@@ -110,13 +135,12 @@ final class IdeviceCommands {
       String filename,
       List<String> commandArgs,
       UnaryOperator<Command> transform) {
-    // TODO(user): Install idevice commands to temp on the fly.
-    Path path = Paths.get("/usr/local/bin", filename);
+    Path path = INSTALL_DIRECTORY.resolve(filename);
     Command command =
         command(path)
             .withExecutor(executor)
             .withArguments(commandArgs)
-            .withEnvironment(ImmutableMap.of());
+            .withEnvironment(UsbUsageReporter.toolEnvironment());
     command = transform.apply(command);
     return exec(command);
   }
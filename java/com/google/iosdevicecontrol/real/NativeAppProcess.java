@@ -0,0 +1,241 @@
+// Copyright 2017 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+package com.google.iosdevicecontrol.real;
+
+import static com.google.common.base.Preconditions.checkNotNull;
+import static java.nio.charset.StandardCharsets.UTF_8;
+import static java.util.concurrent.TimeUnit.NANOSECONDS;
+
+import com.google.common.util.concurrent.SettableFuture;
+import com.google.iosdevicecontrol.IosAppBundleId;
+import com.google.iosdevicecontrol.IosAppProcess;
+import com.google.iosdevicecontrol.IosDevice;
+import com.google.iosdevicecontrol.IosDeviceException;
+import com.google.iosdevicecontrol.command.CapturingOutputStream;
+import com.google.iosdevicecontrol.util.FluentLogger;
+import com.google.iosdevicecontrol.util.NativeLibraries;
+import java.io.IOException;
+import java.io.InputStreamReader;
+import java.io.Reader;
+import java.io.UncheckedIOException;
+import java.time.Duration;
+import java.time.Instant;
+import java.util.Optional;
+import java.util.concurrent.ExecutionException;
+import java.util.concurrent.TimeoutException;
+
+/**
+ * Implementation of {@link IosAppProcess} that runs the idevice-app-runner logic in-process through
+ * JNI, instead of spawning idevice-app-runner and scraping its stdout and stderr. The app's output
+ * and exit are delivered as events from a thread that drives the debugserver connection.
+ */
+final class NativeAppProcess implements IosAppProcess {
+  private static final FluentLogger logger = FluentLogger.forEnclosingClass();
+
+  private static final String LIBRARY_NAME = "apprunner";
+
+  // Must match app_runner_error_t in app_runner.h.
+  private static final int E_SUCCESS = 0;
+  private static final int E_DEBUGSERVER_FAILED = -4;
+
+  // Must match app_runner_event_type_t in app_runner.h.
+  private static final int EVENT_OUTPUT = 0;
+  private static final int EVENT_EXIT = 1;
+  private static final int EVENT_STOPPED = 2;
+  private static final int EVENT_ERROR = 3;
+
+  /** Returns whether the native app runner library is installed. */
+  static boolean isAvailable() {
+    return NativeLibraries.load(LIBRARY_NAME);
+  }
+
+  /**
+   * Starts the app with the specified arguments, or returns empty if debugserver could not be
+   * started, which usually means the developer image is not mounted.
+   */
+  static Optional<NativeAppProcess> start(
+      IosDevice device, IosAppBundleId bundleId, String... args) throws IosDeviceException {
+    long handle;
+    try {
+      handle = nativeNew(device.udid(), bundleId.toString(), args);
+    } catch (IOException e) {
+      throw new IosDeviceException(device, e);
+    }
+
+    NativeAppProcess process = new NativeAppProcess(device, handle);
+    int error = process.nativeConnect(handle);
+    if (error != E_SUCCESS) {
+      nativeFree(handle);
+      if (error == E_DEBUGSERVER_FAILED) {
+        return Optional.empty();
+      }
+      throw RealAppProcess.mapApprunnerFailure(
+          device, new IOException("app_runner_connect failed: " + error), process.errors());
+    }
+
+    Thread thread = new Thread(process::run, "app-runner-" + bundleId);
+    thread.setDaemon(true);
+    thread.start();
+    return Optional.of(process);
+  }
+
+  private final IosDevice device;
+  private final long handle;
+  private final CapturingOutputStream output = new CapturingOutputStream();
+  private final StringBuilder errors = new StringBuilder();
+  private final SettableFuture<String> result = SettableFuture.create();
+
+  // Guards the handle against being stopped after the run thread has freed it.
+  private final Object handleLock = new Object();
+  private boolean freed = false;
+
+  private NativeAppProcess(IosDevice device, long handle) {
+    this.device = checkNotNull(device);
+    this.handle = handle;
+  }
+
+  private void run() {
+    int exitCode = -1;
+    try {
+      exitCode = nativeRun(handle);
+    } catch (RuntimeException e) {
+      logger.atWarning().withCause(e).log("Event handling failed for %s", device);
+    } finally {
+      synchronized (handleLock) {
+        freed = true;
+        nativeFree(handle);
+      }
+      try {
+        output.close();
+      } catch (IOException e) {
+        logger.atWarning().withCause(e).log("Could not close the output of %s", device);
+      }
+    }
+
+    if (exitCode == 0) {
+      result.set(output.toString(UTF_8));
+    } else {
+      result.setException(
+          RealAppProcess.mapApprunnerFailure(
+              device, new IOException("app_runner_run exited with " + exitCode), errors()));
+    }
+  }
+
+  /** Called by the native runner on the thread of nativeConnect or nativeRun. */
+  @SuppressWarnings("unused")
+  private void onEvent(int type, byte[] data, int exitCode) {
+    switch (type) {
+      case EVENT_OUTPUT:
+        try {
+          output.write(data);
+        } catch (IOException e) {
+          // Stops the runner, and the exception is logged once nativeRun returns.
+          throw new UncheckedIOException(e);
+        }
+        break;
+      case EVENT_EXIT:
+        logger.atInfo().log("App on %s exited with %s", device, exitCode);
+        break;
+      case EVENT_STOPPED:
+        logger.atInfo().log("App on %s stopped: %s", device, new String(data, UTF_8));
+        break;
+      case EVENT_ERROR:
+        synchronized (errors) {
+          errors.append(new String(data, UTF_8)).append('\n');
+        }
+        break;
+      default:
+        break;
+    }
+  }
+
+  private String errors() {
+    synchronized (errors) {
+      return errors.toString();
+    }
+  }
+
+  @Override
+  public NativeAppProcess kill() {
+    synchronized (handleLock) {
+      if (!freed) {
+        nativeStop(handle);
+      }
+    }
+    return this;
+  }
+
+  @Override
+  public String await() throws IosDeviceException, InterruptedException {
+    try {
+      return result.get();
+    } catch (ExecutionException e) {
+      throw (IosDeviceException) e.getCause();
+    }
+  }
+
+  @Override
+  public String await(Duration timeout)
+      throws IosDeviceException, InterruptedException, TimeoutException {
+    try {
+      return result.get(timeout.toNanos(), NANOSECONDS);
+    } catch (ExecutionException e) {
+      throw (IosDeviceException) e.getCause();
+    }
+  }
+
+  @Override
+  public Reader outputReader() {
+    return new InputStreamReader(output.openInputStream(), UTF_8);
+  }
+
+  /**
+   * Estimates the clock of the device from the specified number of time queries, or returns empty
+   * if the device could not be reached.
+   */
+  static Optional<DeviceClockEstimate> estimateClock(IosDevice device, int probes) {
+    double[] estimate = nativeEstimateClock(device.udid(), probes);
+    long nanoTime = System.nanoTime();
+    if (estimate == null) {
+      return Optional.empty();
+    }
+    // The native estimate is relative to when it returned, as System.nanoTime may use another
+    // clock.
+    long referenceNanoTime = nanoTime - Math.round(estimate[0] * 1000);
+    Instant deviceTime = Instant.EPOCH.plusNanos(Math.round(estimate[1] * 1000));
+    Duration uncertainty = Duration.ofNanos(Math.round(estimate[3] * 1000));
+    return Optional.of(
+        DeviceClockEstimate.create(referenceNanoTime, deviceTime, estimate[2], uncertainty));
+  }
+
+  private static native long nativeNew(String udid, String appId, String[] args)
+      throws IOException;
+
+  /** Returns an app_runner_error_t; errors are also reported as events. */
+  private native int nativeConnect(long handle);
+
+  /** Returns the exit code idevice-app-runner would exit with. */
+  private native int nativeRun(long handle);
+
+  private static native void nativeStop(long handle);
+
+  private static native void nativeFree(long handle);
+
+  /**
+   * Returns the microseconds since the reference point, the device time then in microseconds since
+   * the epoch, the drift in ppm and the uncertainty in microseconds; or null on failure.
+   */
+  private static native double[] nativeEstimateClock(String udid, int probes);
+}
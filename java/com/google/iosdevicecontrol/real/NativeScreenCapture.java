@@ -0,0 +1,71 @@
+// Copyright 2017 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+package com.google.iosdevicecontrol.real;
+
+import static com.google.common.base.Preconditions.checkState;
+
+import com.google.iosdevicecontrol.IosDevice;
+import com.google.iosdevicecontrol.IosDeviceException;
+import com.google.iosdevicecontrol.image.FrameSource;
+import java.awt.image.BufferedImage;
+import java.io.IOException;
+import java.util.Optional;
+
+/**
+ * A {@link FrameSource} that keeps one connection to the screenshot service open through the app
+ * runner library, instead of spawning idevicescreenshot and reconnecting for every frame.
+ */
+final class NativeScreenCapture implements FrameSource {
+  /**
+   * Connects to the screenshot service of the device, or returns empty if the service could not be
+   * started, which usually means the developer image is not mounted. The caller must have checked
+   * that {@link NativeAppProcess#isAvailable}, which loads the library.
+   */
+  static Optional<NativeScreenCapture> open(IosDevice device) throws IosDeviceException {
+    long handle;
+    try {
+      handle = nativeOpen(device.udid());
+    } catch (IOException e) {
+      throw new IosDeviceException(device, e);
+    }
+    return handle == 0 ? Optional.empty() : Optional.of(new NativeScreenCapture(handle));
+  }
+
+  private long handle;
+
+  private NativeScreenCapture(long handle) {
+    this.handle = handle;
+  }
+
+  @Override
+  public synchronized BufferedImage captureFrame() throws IOException {
+    checkState(handle != 0, "Screen capture is closed");
+    return FrameSource.decodeFrame(nativeTake(handle));
+  }
+
+  @Override
+  public synchronized void close() {
+    if (handle != 0) {
+      nativeFree(handle);
+      handle = 0;
+    }
+  }
+
+  private static native long nativeOpen(String udid) throws IOException;
+
+  private static native byte[] nativeTake(long handle) throws IOException;
+
+  private static native void nativeFree(long handle);
+}
@@ -91,16 +91,24 @@ final class RealAppProcess implements IosAppProcess {
   }
 
   private IosDeviceException mapCommandFailureException(CommandFailureException e) {
-    String stderr = e.result().stderrStringUtf8().trim();
+    return mapApprunnerFailure(device, e, e.result().stderrStringUtf8());
+  }
+
+  /**
+   * Maps a failure to run an app to an exception, with a remedy suggested by the last line of the
+   * apprunner's error output if one is known.
+   */
+  static IosDeviceException mapApprunnerFailure(IosDevice device, Throwable cause, String stderr) {
+    stderr = stderr.trim();
     int lastLineIndex = stderr.lastIndexOf('\n');
     String lastLine = lastLineIndex < 0 ? stderr : stderr.substring(lastLineIndex);
     // See if there's a suggested remedy for this error.
     for (Entry<Pattern, Remedy> entry : LAST_LINE_PATTERN_TO_REMEDY.entrySet()) {
       if (entry.getKey().matcher(lastLine).find()) {
-        return new IosDeviceException(device, e, entry.getValue());
+        return new IosDeviceException(device, cause, entry.getValue());
       }
     }
 
-    return new IosDeviceException(device, e);
+    return new IosDeviceException(device, cause);
   }
 }
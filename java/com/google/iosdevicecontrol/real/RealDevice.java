@@ -15,9 +15,12 @@
 package com.google.iosdevicecontrol.real;
 
 import com.google.common.collect.ImmutableList;
+import com.google.common.collect.ImmutableSet;
+import com.google.iosdevicecontrol.IosAppInfo;
 import com.google.iosdevicecontrol.IosDevice;
 import com.google.iosdevicecontrol.IosDeviceException;
 import java.nio.file.Path;
+import java.util.Optional;
 
 /** Interface that extends {@link IosDevice} for real device specific commands and operations */
 public interface RealDevice extends IosDevice {
@@ -30,6 +33,13 @@ public interface RealDevice extends IosDevice {
   /** Removes a configuration profile with the specified identifier. */
   void removeProfile(String identifier) throws IosDeviceException;
 
+  /**
+   * Returns the applications installed on the device the last time they were listed, possibly by an
+   * earlier host process, without querying the device. Returns empty if they were never listed.
+   * Unlike {@link #listApplications}, this does not see changes made by other hosts.
+   */
+  Optional<ImmutableSet<IosAppInfo>> lastKnownApplications();
+
   /** Returns a list of the installed configuration profiles. */
   ImmutableList<ConfigurationProfile> listConfigurationProfiles() throws IosDeviceException;
 
@@ -40,6 +50,14 @@ public interface RealDevice extends IosDevice {
    */
   void syncToSystemTime() throws IosDeviceException;
 
+  /**
+   * Estimates how the device's clock relates to the host's, from round trips of device time
+   * queries, without changing either clock.
+   *
+   * @throws IosDeviceException - if there is an error communicating with the device
+   */
+  DeviceClockEstimate estimateClock() throws IosDeviceException;
+
   /**
    * Returns the battery level of the device as an integer percentage in the range [0, 100].
    *
@@ -28,9 +28,11 @@ import com.google.iosdevicecontrol.command.CommandProcess;
 import com.google.iosdevicecontrol.IosDevice;
 import com.google.iosdevicecontrol.IosDeviceHost;
 import com.google.iosdevicecontrol.real.CfgutilCommands.SupervisionIdentity;
+import com.google.iosdevicecontrol.real.DeviceMetadataCache.DeviceMetadata;
 import java.io.IOException;
 import java.nio.file.Path;
 import java.nio.file.Paths;
+import java.util.List;
 import java.util.Map;
 import java.util.Optional;
 import java.util.concurrent.ConcurrentHashMap;
@@ -55,23 +57,38 @@ public final class RealDeviceHost implements IosDeviceHost {
     private final DevDiskImages devDiskImages;
     private final CommandExecutor executor;
     private final Optional<SupervisionIdentity> supervisionId;
+    private final DeviceMetadataCache metadataCache;
 
     private Configuration(
         DevDiskImages devDiskImages,
         CommandExecutor executor,
-        Optional<SupervisionIdentity> supervisionId) {
+        Optional<SupervisionIdentity> supervisionId,
+        DeviceMetadataCache metadataCache) {
       this.devDiskImages = checkNotNull(devDiskImages);
       this.executor = checkNotNull(executor);
       this.supervisionId = checkNotNull(supervisionId);
+      this.metadataCache = checkNotNull(metadataCache);
     }
 
     public Configuration withExecutor(CommandExecutor executor) {
-      return new Configuration(devDiskImages, executor, supervisionId);
+      return new Configuration(devDiskImages, executor, supervisionId, metadataCache);
     }
 
     public Configuration withSupervisionIdentity(Path certPath, Path keyPath) {
       return new Configuration(
-          devDiskImages, executor, Optional.of(SupervisionIdentity.create(certPath, keyPath)));
+          devDiskImages,
+          executor,
+          Optional.of(SupervisionIdentity.create(certPath, keyPath)),
+          metadataCache);
+    }
+
+    /**
+     * Caches the metadata of devices in the specified directory, so that the host can skip most
+     * device queries after it restarts. The directory should not be shared by concurrent hosts.
+     */
+    public Configuration withMetadataCache(Path cacheDir) {
+      return new Configuration(
+          devDiskImages, executor, supervisionId, DeviceMetadataCache.inDirectory(cacheDir));
     }
 
     public RealDeviceHost initialize() {
@@ -86,11 +103,14 @@ public final class RealDeviceHost implements IosDeviceHost {
 
   public static Configuration withDeveloperDiskImagesFrom(Path rootImagesDir) {
     return new Configuration(
-        DevDiskImages.inDirectory(rootImagesDir), Command.NATIVE_EXECUTOR, Optional.empty());
+        DevDiskImages.inDirectory(rootImagesDir),
+        Command.NATIVE_EXECUTOR,
+        Optional.empty(),
+        DeviceMetadataCache.disabled());
   }
 
   private final Configuration configuration;
-  private final Map<String, IosDevice> udid2Device = new ConcurrentHashMap<>();
+  private final Map<String, RealDeviceImpl> udid2Device = new ConcurrentHashMap<>();
 
   private RealDeviceHost(Configuration configuration) {
     this.configuration = checkNotNull(configuration);
@@ -99,28 +119,55 @@ public final class RealDeviceHost implements IosDeviceHost {
   @Override
   public ImmutableSet<IosDevice> connectedDevices() throws IOException {
     String devicesList = await(IdeviceCommands.id(configuration.executor, "-l"));
+    List<String> udids = LINE_SPLITTER.splitToList(devicesList);
+    // Devices that disconnected keep their instance, but not the agent serving them.
+    udid2Device.forEach(
+        (udid, device) -> {
+          if (!udids.contains(udid)) {
+            device.closeAgent();
+          }
+        });
     try {
-      return LINE_SPLITTER
-          .splitToList(devicesList)
+      return udids
           .stream()
           .map(u -> udid2Device.computeIfAbsent(u, udid -> tunnel(() -> toDevice(udid))))
-          .collect(ImmutableSet.toImmutableSet());
+          .collect(ImmutableSet.<IosDevice>toImmutableSet());
     } catch (TunnelException e) {
       throw e.getCauseAs(IOException.class);
     }
   }
 
-  private IosDevice toDevice(String udid) throws IOException {
+  private RealDeviceImpl toDevice(String udid) throws IOException {
     IdeviceCommands idevice = new IdeviceCommands(configuration.executor, udid);
-    CfgutilCommands cfgutil = toCfgutil(idevice);
-    return new RealDeviceImpl(udid, idevice, cfgutil, configuration.devDiskImages);
+    DeviceMetadata metadata = toMetadata(udid, idevice);
+    CfgutilCommands cfgutil =
+        new CfgutilCommands(configuration.executor, metadata.ecid(), configuration.supervisionId);
+    return new RealDeviceImpl(
+        udid, idevice, cfgutil, configuration.devDiskImages, configuration.metadataCache, metadata);
   }
 
-  private CfgutilCommands toCfgutil(IdeviceCommands idevice) throws IOException {
+  private DeviceMetadata toMetadata(String udid, IdeviceCommands idevice) throws IOException {
+    Optional<DeviceMetadata> cached = configuration.metadataCache.read(udid);
+    if (cached.isPresent()) {
+      // The ECID never changes for a UDID, but an update or restore can change everything else,
+      // which a change of the build version reveals.
+      DeviceMetadata metadata = cached.get();
+      String cachedBuild = metadata.info().get("BuildVersion");
+      if (cachedBuild == null
+          || cachedBuild.equals(await(idevice.info("--simple", "-k", "BuildVersion")).trim())) {
+        return metadata;
+      }
+      metadata = metadata.withoutMutableMetadata();
+      configuration.metadataCache.write(metadata);
+      return metadata;
+    }
+
     // Using --simple means no pairing with the device is required.
     String ecidDecimal = await(idevice.info("--simple", "-k", "UniqueChipID")).trim();
     String ecidHex = Long.toHexString(Long.parseLong(ecidDecimal));
-    return new CfgutilCommands(configuration.executor, ecidHex, configuration.supervisionId);
+    DeviceMetadata metadata = DeviceMetadata.create(udid, ecidHex);
+    configuration.metadataCache.write(metadata);
+    return metadata;
   }
 
   private static String await(CommandProcess process) throws IOException {
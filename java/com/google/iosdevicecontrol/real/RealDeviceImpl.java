@@ -17,6 +17,8 @@ package com.google.iosdevicecontrol.real;
 import static com.google.common.base.Preconditions.checkArgument;
 import static com.google.common.base.Preconditions.checkNotNull;
 import static com.google.common.base.Preconditions.checkState;
+import static java.nio.charset.StandardCharsets.UTF_8;
+import static java.util.concurrent.TimeUnit.MILLISECONDS;
 
 import com.dd.plist.NSArray;
 import com.dd.plist.NSDictionary;
@@ -29,6 +31,8 @@ import com.google.common.base.MoreObjects;
 import com.google.common.collect.ImmutableList;
 import com.google.common.collect.ImmutableMap;
 import com.google.common.collect.ImmutableSet;
+import com.google.common.io.ByteSink;
+import com.google.common.io.ByteStreams;
 import com.google.iosdevicecontrol.util.FluentLogger;
 import com.google.common.io.MoreFiles;
 import com.google.common.io.RecursiveDeleteOption;
@@ -45,28 +49,41 @@ import com.google.iosdevicecontrol.IosDeviceResource;
 import com.google.iosdevicecontrol.IosDeviceSocket;
 import com.google.iosdevicecontrol.IosModel;
 import com.google.iosdevicecontrol.IosVersion;
+import com.google.iosdevicecontrol.image.PngEncoder;
+import com.google.iosdevicecontrol.image.RawImage;
+import com.google.iosdevicecontrol.image.ScreenRecorder;
 import com.google.iosdevicecontrol.real.DevDiskImages.DiskImage;
+import com.google.iosdevicecontrol.real.DeviceMetadataCache.DeviceMetadata;
+import com.google.iosdevicecontrol.syslog.SyslogStore;
+import com.google.iosdevicecontrol.usb.UsbUsageReporter;
 import com.google.iosdevicecontrol.util.CheckedCallable;
 import com.google.iosdevicecontrol.util.CheckedCallables;
 import com.google.iosdevicecontrol.util.ForwardingSocket;
 import com.google.iosdevicecontrol.util.PlistParser;
+import com.google.iosdevicecontrol.util.PlistParser.PlistParseException;
 import com.google.iosdevicecontrol.util.RetryCallable;
-import java.awt.image.BufferedImage;
 import java.io.BufferedReader;
-import java.io.ByteArrayOutputStream;
 import java.io.Closeable;
+import java.io.FilterOutputStream;
 import java.io.IOException;
+import java.io.InputStream;
+import java.io.OutputStream;
 import java.net.ServerSocket;
 import java.net.Socket;
 import java.nio.charset.StandardCharsets;
 import java.nio.file.Files;
 import java.nio.file.Path;
 import java.nio.file.Paths;
+import java.nio.file.attribute.BasicFileAttributes;
 import java.text.ParseException;
+import java.util.Map;
+import java.util.Optional;
 import java.util.Set;
 import java.util.concurrent.atomic.AtomicBoolean;
-import javax.imageio.ImageIO;
-import javax.imageio.stream.ImageInputStream;
+import java.util.concurrent.atomic.LongAdder;
+import java.util.function.Supplier;
+import java.util.function.UnaryOperator;
+import java.util.stream.Stream;
 import javax.xml.parsers.ParserConfigurationException;
 import org.joda.time.Duration;
 import org.xml.sax.SAXException;
@@ -79,26 +96,49 @@ import org.xml.sax.SAXException;
 final class RealDeviceImpl implements RealDevice {
   private static final FluentLogger logger = FluentLogger.forEnclosingClass();
 
+  /** Enough device time queries to find a few fast round trips, in well under a second. */
+  private static final int CLOCK_PROBES = 16;
+
+  /** How long the idevice commands are used after idevice-agent failed to start. */
+  private static final Duration AGENT_RETRY_DELAY = Duration.standardMinutes(1);
+
+  // The services of the transfers that the libimobiledevice tools don't account for themselves, so
+  // their bytes are reported from the sizes of what the tools read and write.
+  private static final String AFC_SERVICE = "com.apple.afc";
+  private static final String CRASH_REPORT_SERVICE = "com.apple.crashreportcopymobile";
+  private static final String SCREENSHOT_SERVICE = "com.apple.mobile.screenshotr";
+  private static final String SYSLOG_SERVICE = "com.apple.syslog_relay";
+
+  // Must match screen_capture_error_t in screen_capture.h.
+  private static final int SCREEN_CAPTURE_E_SERVICE_FAILED = -3;
+
   private final String udid;
+  private final UsbUsageReporter usbUsage = UsbUsageReporter.forHost();
   private final IdeviceCommands idevice;
   private final CfgutilCommands cfgutil;
   private final DevDiskImages devDiskImages;
+  private final DeviceMetadataCache metadataCache;
+  private DeviceMetadata metadata;
 
   // All the ideviceinfo values are constant for the lifetime a device is attached to a host, the
   // only exception being TimeIntervalSince1970, which we don't use or care about.
   private final CheckedCallable<NSDictionary, IosDeviceException> getIdeviceInfo =
       CheckedCallables.memoize(this::callIdeviceInfo);
 
+  // The static values are in the metadata cache if an earlier host process fetched them already.
+  private final CheckedCallable<ImmutableMap<String, String>, IosDeviceException> getStaticInfo =
+      CheckedCallables.memoize(this::callStaticInfo);
+
   private final CheckedCallable<IosModel, IosDeviceException> getModel =
       CheckedCallables.memoize(
           () -> {
-            NSDictionary info = getIdeviceInfo.call();
-            String identifier = getNSString(info, "ProductType");
+            ImmutableMap<String, String> info = getStaticInfo.call();
+            String identifier = info.get("ProductType");
             String productName = ID_TO_PRODUCT_NAME.get(identifier);
             checkState(productName != null, "No product name found for %s", identifier);
             return IosModel.builder()
-                .architecture(getNSString(info, "CPUArchitecture"))
-                .identifier(getNSString(info, "ProductType"))
+                .architecture(info.get("CPUArchitecture"))
+                .identifier(identifier)
                 .productName(productName)
                 .build();
           });
@@ -106,22 +146,39 @@ final class RealDeviceImpl implements RealDevice {
   private final CheckedCallable<IosVersion, IosDeviceException> getVersion =
       CheckedCallables.memoize(
           () -> {
-            NSDictionary info = getIdeviceInfo.call();
+            ImmutableMap<String, String> info = getStaticInfo.call();
             return IosVersion.builder()
-                .buildVersion(getNSString(info, "BuildVersion"))
-                .productVersion(getNSString(info, "ProductVersion"))
+                .buildVersion(info.get("BuildVersion"))
+                .productVersion(info.get("ProductVersion"))
                 .build();
           });
 
   private final AtomicBoolean systemLoggerStarted = new AtomicBoolean(false);
   private volatile boolean restarting = false;
 
+  // The agent serving the device if idevice-agent is installed, started when it is first needed and
+  // again whenever its connection was lost. The host closes it when the device disconnects. After
+  // an agent failed to start, the idevice commands are used without trying again for a while, so
+  // that not every call waits for another agent to fail.
+  private final Object agentLock = new Object();
+  private IdeviceAgent currentAgent;
+  private long agentFailedNanos;
+  private boolean agentFailed;
+
   RealDeviceImpl(
-      String udid, IdeviceCommands idevice, CfgutilCommands cfgutil, DevDiskImages devDiskImages) {
+      String udid,
+      IdeviceCommands idevice,
+      CfgutilCommands cfgutil,
+      DevDiskImages devDiskImages,
+      DeviceMetadataCache metadataCache,
+      DeviceMetadata metadata) {
+    checkArgument(metadata.udid().equals(udid), "Metadata is for another device: %s", metadata);
     this.udid = checkNotNull(udid);
     this.idevice = checkNotNull(idevice);
     this.cfgutil = checkNotNull(cfgutil);
     this.devDiskImages = checkNotNull(devDiskImages);
+    this.metadataCache = checkNotNull(metadataCache);
+    this.metadata = metadata;
   }
 
   @Override
@@ -145,6 +202,16 @@ final class RealDeviceImpl implements RealDevice {
 
   @Override
   public int batteryLevel() throws IosDeviceException {
+    Optional<IdeviceAgent> agent = agent();
+    if (agent.isPresent()) {
+      NSObject level =
+          callAgentInfo(agent.get(), "com.apple.mobile.battery", "BatteryCurrentCapacity");
+      if (!(level instanceof NSNumber)) {
+        throw new IosDeviceException(this, "Unexpected battery level: " + level);
+      }
+      return ((NSNumber) level).intValue();
+    }
+
     String batteryLevel =
         await(idevice.info("-k", "BatteryCurrentCapacity", "-q", "com.apple.mobile.battery"));
     try {
@@ -183,7 +250,23 @@ final class RealDeviceImpl implements RealDevice {
     for (NSObject app : appArray.getArray()) {
       appInfos.add(IosAppInfo.readFromPlistDictionary((NSDictionary) app));
     }
-    return appInfos.build();
+    ImmutableSet<IosAppInfo> apps = appInfos.build();
+    ImmutableSet<IosAppBundleId> bundleIds =
+        apps.stream().map(IosAppInfo::bundleId).collect(ImmutableSet.toImmutableSet());
+    updateMetadata(m -> m.withApplications(bundleIds));
+    return apps;
+  }
+
+  @Override
+  public Optional<ImmutableSet<IosAppInfo>> lastKnownApplications() {
+    return metadata()
+        .applications()
+        .map(
+            bundleIds ->
+                bundleIds
+                    .stream()
+                    .map(bundleId -> IosAppInfo.builder().bundleId(bundleId).build())
+                    .collect(ImmutableSet.toImmutableSet()));
   }
 
   @Override
@@ -193,8 +276,10 @@ final class RealDeviceImpl implements RealDevice {
 
     // Get the bundle id of the provided ipa.
     IosAppBundleId bundleId;
+    long ipaBytes;
     try {
       bundleId = IosAppBundleId.readFromIpa(ipaPath);
+      ipaBytes = Files.size(ipaPath);
     } catch (IOException e) {
       throw new IosDeviceException(this, e);
     }
@@ -213,6 +298,8 @@ final class RealDeviceImpl implements RealDevice {
         throw e;
       }
     }
+    // The ipa is uploaded to the staging directory of the device before it is installed.
+    usbUsage.report(udid, AFC_SERVICE, 0, ipaBytes);
 
     // Check that the application successfully installed. This has the dual benefit of possibly
     // catching a failed installation early, but also the mere act of checking whether it's
@@ -227,12 +314,36 @@ final class RealDeviceImpl implements RealDevice {
   public void uninstallApplication(IosAppBundleId bundleId) throws IosDeviceException {
     if (isApplicationInstalled(bundleId)) {
       await(idevice.installer("-U", bundleId.toString()));
+      // Checking that the application was installed just listed the applications.
+      updateMetadata(
+          m ->
+              m.withApplications(
+                  m.applications()
+                      .get()
+                      .stream()
+                      .filter(b -> !b.equals(bundleId))
+                      .collect(ImmutableSet.toImmutableSet())));
     }
   }
 
   @Override
   public IosAppProcess runApplication(IosAppBundleId bundleId, String... args)
       throws IosDeviceException {
+    if (NativeAppProcess.isAvailable()) {
+      // The debugserver service used by the app runner requires the developer image.
+      return retryMountingDeveloperImage(
+          () ->
+              NativeAppProcess.start(this, bundleId, args)
+                  .orElseThrow(NoDeveloperImageMountedException::new));
+    }
+    Optional<IdeviceAgent> agent = agent();
+    if (agent.isPresent()) {
+      return retryMountingDeveloperImage(
+          () ->
+              AgentAppProcess.start(this, agent.get(), bundleId, args)
+                  .orElseThrow(NoDeveloperImageMountedException::new));
+    }
+
     ImmutableList<String> apprunnerArgs =
         ImmutableList.<String>builder()
             .add("-d", "-s", bundleId.toString(), "--args")
@@ -249,19 +360,115 @@ final class RealDeviceImpl implements RealDevice {
   @Override
   public IosDeviceResource startSystemLogger(Path logPath) throws IosDeviceException {
     checkState(!systemLoggerStarted.getAndSet(true), "System logger has already been started.");
-    CommandProcess syslog = idevice.syslog(logPath);
+    IosDeviceResource syslog =
+        startSyslog(MoreFiles.asByteSink(logPath), () -> idevice.syslog(logPath));
     return new IosDeviceResource(this) {
       @Override
       public void close() throws IosDeviceException {
         checkState(systemLoggerStarted.getAndSet(false), "System logger has already been stopped.");
-        await(syslog.kill(), 0, 143, 255);
+        syslog.close();
+        try {
+          usbUsage.report(udid, SYSLOG_SERVICE, Files.size(logPath), 0);
+        } catch (IOException e) {
+          logger.atFine().withCause(e).log("Could not account for the system log of %s", udid);
+        }
+      }
+    };
+  }
+
+  @Override
+  public IosDeviceResource startSystemLogStore(Path storeDirectory) throws IosDeviceException {
+    checkState(!systemLoggerStarted.getAndSet(true), "System logger has already been started.");
+    SyslogStore store = SyslogStore.inDirectory(storeDirectory);
+    LongAdder syslogBytes = new LongAdder();
+    ByteSink sink = counting(store.ingestSink(), syslogBytes);
+    IosDeviceResource syslog = startSyslog(sink, () -> idevice.syslog(sink));
+    return new IosDeviceResource(this) {
+      @Override
+      public void close() throws IosDeviceException {
+        checkState(systemLoggerStarted.getAndSet(false), "System logger has already been stopped.");
+        try {
+          syslog.close();
+        } finally {
+          usbUsage.report(udid, SYSLOG_SERVICE, syslogBytes.sum(), 0);
+          try {
+            store.close();
+          } catch (IOException e) {
+            throw new IosDeviceException(device(), e);
+          }
+        }
+      }
+    };
+  }
+
+  /**
+   * Starts copying the system log to the sink, over a channel of the agent if there is one, or else
+   * with the command. Closing the returned resource stops it.
+   */
+  private IosDeviceResource startSyslog(ByteSink sink, Supplier<CommandProcess> command)
+      throws IosDeviceException {
+    Optional<IdeviceAgent> agent = agent();
+    if (!agent.isPresent()) {
+      CommandProcess syslog = command.get();
+      return new IosDeviceResource(this) {
+        @Override
+        public void close() throws IosDeviceException {
+          await(syslog.kill(), 0, 143, 255);
+        }
+      };
+    }
+
+    IdeviceAgent.Channel channel;
+    try {
+      channel = agent.get().open("syslog");
+    } catch (IOException e) {
+      throw new IosDeviceException(this, e);
+    }
+    Thread copier =
+        new Thread(
+            () -> {
+              try (InputStream in = channel.inputStream();
+                  OutputStream out = sink.openStream()) {
+                ByteStreams.copy(in, out);
+              } catch (IOException e) {
+                logger.atWarning().withCause(e).log("Could not copy the system log of %s", udid);
+                try {
+                  channel.close();
+                } catch (IOException ce) {
+                  logger.atFine().withCause(ce).log("Could not stop the system log of %s", udid);
+                }
+              }
+            },
+            "syslog-" + udid);
+    copier.setDaemon(true);
+    copier.start();
+    return new IosDeviceResource(this) {
+      @Override
+      public void close() throws IosDeviceException {
+        try {
+          channel.close();
+          copier.join();
+          if (channel.status() != 0) {
+            throw new IosDeviceException(device(), "System log failed: " + channel.message());
+          }
+        } catch (IOException e) {
+          throw new IosDeviceException(device(), e);
+        } catch (InterruptedException e) {
+          throw propagateInterrupt(e);
+        }
       }
     };
   }
 
   @Override
   public void pullCrashLogs(Path directory) throws IosDeviceException {
-    await(idevice.crashreport(directory.toString()));
+    try {
+      ImmutableMap<Path, BasicFileAttributes> filesBefore = fileAttributes(directory);
+      await(idevice.crashreport(directory.toString()));
+      usbUsage.report(udid, CRASH_REPORT_SERVICE, bytesWritten(filesBefore, directory), 0);
+    } catch (IOException e) {
+      throw new IosDeviceException(this, e);
+    }
   }
 
   @Override
@@ -383,34 +590,74 @@ final class RealDeviceImpl implements RealDevice {
     await(idevice.date("--sync"));
   }
 
+  @Override
+  public DeviceClockEstimate estimateClock() throws IosDeviceException {
+    if (!NativeAppProcess.isAvailable()) {
+      throw new IosDeviceException(this, "Clock estimation requires the native app runner library");
+    }
+    return NativeAppProcess.estimateClock(this, CLOCK_PROBES)
+        .orElseThrow(() -> new IosDeviceException(this, "Could not read the device clock"));
+  }
+
   @Override
   public byte[] takeScreenshot() throws IosDeviceException {
+    Optional<IdeviceAgent> agent = agent();
     try {
-      Path screenshotPath = Files.createTempFile("screenshot", ".out");
-      try {
-        // The screenshot service used by idevicescreenshot requires the developer image.
-        CommandProcess screenshotProcess =
-            retryWithDeveloperImageMount(
-                true /* error message goes to stdout */,
-                () -> idevice.screenshot(screenshotPath.toString()));
-        await(screenshotProcess);
-        ImageInputStream iis = ImageIO.createImageInputStream(screenshotPath.toFile());
-        String format = ImageIO.getImageReaders(iis).next().getFormatName();
-        // iOS versions < 9 return TIFF images instead of PNG.
-        return format.equals("png") ? Files.readAllBytes(screenshotPath) : convertToPng(iis);
-      } finally {
-        Files.deleteIfExists(screenshotPath);
+      byte[] screenshot;
+      if (agent.isPresent()) {
+        // The screenshot service requires the developer image. The agent accounts for the bytes of
+        // the screenshot itself.
+        screenshot = retryMountingDeveloperImage(() -> callAgentScreenshot(agent.get()));
+      } else {
+        Path screenshotPath = Files.createTempFile("screenshot", ".out");
+        try {
+          // The screenshot service used by idevicescreenshot requires the developer image.
+          CommandProcess screenshotProcess =
+              retryWithDeveloperImageMount(
+                  true /* error message goes to stdout */,
+                  () -> idevice.screenshot(screenshotPath.toString()));
+          await(screenshotProcess);
+          screenshot = Files.readAllBytes(screenshotPath);
+          usbUsage.report(udid, SCREENSHOT_SERVICE, screenshot.length, 0);
+        } finally {
+          Files.deleteIfExists(screenshotPath);
+        }
       }
+      // iOS versions < 9 return TIFF images instead of PNG.
+      return RawImage.isPng(screenshot)
+          ? screenshot
+          : PngEncoder.create().encode(RawImage.decode(screenshot));
     } catch (IOException e) {
       throw new IosDeviceException(this, e);
     }
   }
 
-  private byte[] convertToPng(ImageInputStream iis) throws IOException {
-    ByteArrayOutputStream pngOut = new ByteArrayOutputStream();
-    BufferedImage image = ImageIO.read(iis);
-    ImageIO.write(image, "png", pngOut);
-    return pngOut.toByteArray();
+  @Override
+  public IosDeviceResource startScreenRecording(Path videoPath) throws IosDeviceException {
+    if (!NativeAppProcess.isAvailable()) {
+      return RealDevice.super.startScreenRecording(videoPath);
+    }
+    // The screenshot service requires the developer image.
+    NativeScreenCapture capture =
+        retryMountingDeveloperImage(
+            () ->
+                NativeScreenCapture.open(this).orElseThrow(NoDeveloperImageMountedException::new));
+    return ScreenRecorder.withDefaults().record(this, capture, videoPath);
+  }
+
+  private byte[] callAgentScreenshot(IdeviceAgent agent) throws IosDeviceException {
+    try {
+      return agent.call("screenshot");
+    } catch (IdeviceAgent.CallException e) {
+      if (e.status() == SCREEN_CAPTURE_E_SERVICE_FAILED) {
+        throw new NoDeveloperImageMountedException();
+      }
+      throw new IosDeviceException(this, e);
+    } catch (IOException e) {
+      throw new IosDeviceException(this, e);
+    } catch (InterruptedException e) {
+      throw propagateInterrupt(e);
+    }
   }
 
   private static String getNSString(NSDictionary nsDict, String key) {
@@ -419,6 +666,66 @@ final class RealDeviceImpl implements RealDevice {
     return ((NSString) value).getContent();
   }
 
+  /** Returns the attributes of the files in the directory and its subdirectories. */
+  private static ImmutableMap<Path, BasicFileAttributes> fileAttributes(Path directory)
+      throws IOException {
+    if (!Files.isDirectory(directory)) {
+      return ImmutableMap.of();
+    }
+    ImmutableMap.Builder<Path, BasicFileAttributes> files = ImmutableMap.builder();
+    try (Stream<Path> paths = Files.walk(directory)) {
+      for (Path path : (Iterable<Path>) paths::iterator) {
+        BasicFileAttributes attributes = Files.readAttributes(path, BasicFileAttributes.class);
+        if (attributes.isRegularFile()) {
+          files.put(path, attributes);
+        }
+      }
+    }
+    return files.build();
+  }
+
+  /**
+   * Returns the total size of the files in the directory that were created or rewritten since their
+   * attributes were read before, which is what a tool wrote there regardless of the files that
+   * were already there or that it removed.
+   */
+  private static long bytesWritten(ImmutableMap<Path, BasicFileAttributes> before, Path directory)
+      throws IOException {
+    long bytes = 0;
+    for (Map.Entry<Path, BasicFileAttributes> file : fileAttributes(directory).entrySet()) {
+      BasicFileAttributes old = before.get(file.getKey());
+      BasicFileAttributes now = file.getValue();
+      if (old == null
+          || old.size() != now.size()
+          || !old.lastModifiedTime().equals(now.lastModifiedTime())) {
+        bytes += now.size();
+      }
+    }
+    return bytes;
+  }
+
+  /** Returns a sink that writes to the sink and adds the number of bytes written to bytes. */
+  private static ByteSink counting(ByteSink sink, LongAdder bytes) {
+    return new ByteSink() {
+      @Override
+      public OutputStream openStream() throws IOException {
+        return new FilterOutputStream(sink.openStream()) {
+          @Override
+          public void write(int b) throws IOException {
+            out.write(b);
+            bytes.increment();
+          }
+
+          @Override
+          public void write(byte[] b, int off, int len) throws IOException {
+            out.write(b, off, len);
+            bytes.add(len);
+          }
+        };
+      }
+    };
+  }
+
   /**
    * Mounts the developer image on the device.
    *
@@ -443,27 +750,36 @@ final class RealDeviceImpl implements RealDevice {
     // use `ideviceimagemounter -l` to check if an image is mounted, but (1) it usually is already
     // mounted so this is faster; and (2) `ideviceimagemounter -l` lies on iOS7
     // (see: https://github.com/libimobiledevice/libimobiledevice/issues/207).
-    return RetryCallable.retry(
-            () -> {
-              CommandProcess process = callable.call();
-              BufferedReader output =
-                  new BufferedReader(
-                      errorToStdout ? process.stdoutReaderUtf8() : process.stderrReaderUtf8());
+    return retryMountingDeveloperImage(
+        () -> {
+          CommandProcess process = callable.call();
+          BufferedReader output =
+              new BufferedReader(
+                  errorToStdout ? process.stdoutReaderUtf8() : process.stderrReaderUtf8());
 
-              // The first output line may indicate the developer image isn't mounted.
-              String firstLine;
-              try {
-                firstLine = output.readLine();
-              } catch (IOException e) {
-                throw new IosDeviceException(RealDeviceImpl.this, e);
-              }
-              if (firstLine.startsWith("Could not start")) {
-                await(process, 255);
-                throw new NoDeveloperImageMountedException();
-              }
+          // The first output line may indicate the developer image isn't mounted.
+          String firstLine;
+          try {
+            firstLine = output.readLine();
+          } catch (IOException e) {
+            throw new IosDeviceException(RealDeviceImpl.this, e);
+          }
+          if (firstLine.startsWith("Could not start")) {
+            await(process, 255);
+            throw new NoDeveloperImageMountedException();
+          }
 
-              return process;
-            })
+          return process;
+        });
+  }
+
+  /**
+   * Retries the specified callable while it throws {@link NoDeveloperImageMountedException},
+   * mounting the developer image before each retry.
+   */
+  private <T> T retryMountingDeveloperImage(CheckedCallable<T, IosDeviceException> callable)
+      throws IosDeviceException {
+    return RetryCallable.retry(callable)
         .withMaxAttempts(10)
         .withDelay(Duration.standardSeconds(3))
         .withExceptionHandler(
@@ -490,6 +806,11 @@ final class RealDeviceImpl implements RealDevice {
   @SuppressWarnings("Finally") // b/64321948
   @Override
   public IosDeviceSocket openWebInspectorSocket() throws IosDeviceException {
+    Optional<IdeviceAgent> agent = agent();
+    if (agent.isPresent()) {
+      return openAgentInspectorSocket(agent.get());
+    }
+
     int inspectorPort;
     try (ServerSocket socket = new ServerSocket(0)) {
       inspectorPort = socket.getLocalPort();
@@ -544,6 +865,45 @@ final class RealDeviceImpl implements RealDevice {
         });
   }
 
+  /** Opens a web inspector channel of the agent, which carries messages like the proxy socket. */
+  private IosDeviceSocket openAgentInspectorSocket(IdeviceAgent agent) throws IosDeviceException {
+    IdeviceAgent.Channel channel;
+    try {
+      channel = agent.open("inspector");
+    } catch (IOException e) {
+      throw new IosDeviceException(this, e);
+    }
+    InputStream in = channel.inputStream();
+    return new IosDeviceSocket(this) {
+      @Override
+      public int read(byte[] bytes) throws IosDeviceException {
+        try {
+          return ByteStreams.read(in, bytes, 0, bytes.length);
+        } catch (IOException e) {
+          throw new IosDeviceException(device(), e);
+        }
+      }
+
+      @Override
+      public void write(byte[] bytes) throws IosDeviceException {
+        try {
+          channel.write(bytes);
+        } catch (IOException e) {
+          throw new IosDeviceException(device(), e);
+        }
+      }
+
+      @Override
+      public void close() throws IosDeviceException {
+        try {
+          channel.close();
+        } catch (IOException e) {
+          throw new IosDeviceException(device(), e);
+        }
+      }
+    };
+  }
+
   @Override
   public void restart() throws IosDeviceException {
     await(idevice.diagnostics("restart"));
@@ -575,7 +935,107 @@ final class RealDeviceImpl implements RealDevice {
     return MoreObjects.toStringHelper(IosDevice.class).add("udid", udid).toString();
   }
 
+  private ImmutableMap<String, String> callStaticInfo() throws IosDeviceException {
+    ImmutableMap<String, String> cachedInfo = metadata().info();
+    if (!cachedInfo.isEmpty()) {
+      return cachedInfo;
+    }
+    NSDictionary info = getIdeviceInfo.call();
+    ImmutableMap.Builder<String, String> staticInfo = ImmutableMap.builder();
+    for (String key : DeviceMetadataCache.STATIC_INFO_KEYS) {
+      staticInfo.put(key, getNSString(info, key));
+    }
+    ImmutableMap<String, String> fetchedInfo = staticInfo.build();
+    updateMetadata(m -> m.withInfo(fetchedInfo));
+    return fetchedInfo;
+  }
+
+  private synchronized DeviceMetadata metadata() {
+    return metadata;
+  }
+
+  /** Updates the metadata of the device, and writes it to the cache if it changed. */
+  private synchronized void updateMetadata(UnaryOperator<DeviceMetadata> update) {
+    DeviceMetadata updated = update.apply(metadata);
+    if (!updated.equals(metadata)) {
+      metadata = updated;
+      metadataCache.write(updated);
+    }
+  }
+
+  /**
+   * Returns the agent of the device, starting it if it is not running, or empty if idevice-agent
+   * is not installed or could not be started, in which case the idevice commands are used.
+   */
+  private Optional<IdeviceAgent> agent() {
+    if (!IdeviceAgent.isAvailable()) {
+      return Optional.empty();
+    }
+    synchronized (agentLock) {
+      if (currentAgent == null || !currentAgent.isOpen()) {
+        if (agentFailed
+            && System.nanoTime() - agentFailedNanos
+                < MILLISECONDS.toNanos(AGENT_RETRY_DELAY.getMillis())) {
+          return Optional.empty();
+        }
+        try {
+          currentAgent = IdeviceAgent.start(idevice);
+          agentFailed = false;
+        } catch (IOException e) {
+          logger.atWarning().withCause(e).log(
+              "Could not start idevice-agent for %s, trying again in %s", udid, AGENT_RETRY_DELAY);
+          currentAgent = null;
+          agentFailed = true;
+          agentFailedNanos = System.nanoTime();
+          return Optional.empty();
+        }
+      }
+      return Optional.of(currentAgent);
+    }
+  }
+
+  /** Closes the agent of the device, if one is running; the next use starts a new one. */
+  void closeAgent() {
+    synchronized (agentLock) {
+      agentFailed = false;
+      if (currentAgent != null) {
+        currentAgent.close();
+        currentAgent = null;
+      }
+    }
+  }
+
+  /**
+   * Gets the lockdown value of the key in the domain from the agent, or all values if there is no
+   * key. The agent retries requests whose lockdown session broke, so a failed request leaves the
+   * agent open; only a lost connection closes it, so that the next call starts a new one.
+   */
+  private NSObject callAgentInfo(IdeviceAgent agent, String... domainAndKey)
+      throws IosDeviceException {
+    try {
+      return PlistParser.fromXml(new String(agent.call("info", domainAndKey), UTF_8));
+    } catch (IdeviceAgent.CallException e) {
+      throw new IosDeviceException(this, e);
+    } catch (IOException e) {
+      agent.close();
+      throw new IosDeviceException(this, e);
+    } catch (PlistParseException e) {
+      throw new IosDeviceException(this, e);
+    } catch (InterruptedException e) {
+      throw propagateInterrupt(e);
+    }
+  }
+
   private NSDictionary callIdeviceInfo() throws IosDeviceException {
+    Optional<IdeviceAgent> agent = agent();
+    if (agent.isPresent()) {
+      NSObject info = callAgentInfo(agent.get());
+      if (!(info instanceof NSDictionary)) {
+        throw new IosDeviceException(this, "Unexpected device info: " + info);
+      }
+      return (NSDictionary) info;
+    }
+
     String infoText = await(idevice.info("-x"));
     byte[] infoBytes = infoText.getBytes(StandardCharsets.UTF_8);
     try {
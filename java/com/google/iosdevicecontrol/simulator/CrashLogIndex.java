@@ -0,0 +1,321 @@
+// Copyright 2017 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+package com.google.iosdevicecontrol.simulator;
+
+import static com.google.common.base.Preconditions.checkNotNull;
+import static java.nio.charset.StandardCharsets.UTF_8;
+import static java.nio.file.StandardWatchEventKinds.ENTRY_CREATE;
+import static java.nio.file.StandardWatchEventKinds.ENTRY_DELETE;
+import static java.nio.file.StandardWatchEventKinds.ENTRY_MODIFY;
+import static java.nio.file.StandardWatchEventKinds.OVERFLOW;
+
+import com.google.auto.value.AutoValue;
+import com.google.common.base.Ascii;
+import com.google.common.collect.HashMultimap;
+import com.google.common.collect.ImmutableSet;
+import com.google.common.collect.SetMultimap;
+import com.google.common.io.ByteStreams;
+import com.google.common.io.MoreFiles;
+import com.google.iosdevicecontrol.util.FluentLogger;
+import java.io.Closeable;
+import java.io.IOException;
+import java.io.InputStream;
+import java.nio.file.Files;
+import java.nio.file.NoSuchFileException;
+import java.nio.file.Path;
+import java.nio.file.StandardCopyOption;
+import java.nio.file.WatchEvent;
+import java.nio.file.WatchKey;
+import java.nio.file.WatchService;
+import java.nio.file.attribute.FileTime;
+import java.util.HashMap;
+import java.util.Map;
+import java.util.Optional;
+import java.util.Set;
+import java.util.regex.Matcher;
+import java.util.regex.Pattern;
+
+/**
+ * An index of the crash reports in the directory that the host writes them to, which is shared by
+ * all simulators. Each report is attributed to a simulator by the path of the crashed process,
+ * which is inside the data directory of the simulator.
+ *
+ * <p>The index is kept up to date by a watch service on the directory, so bringing it up to date
+ * only reads the reports that were created or modified since the last time. The directory is
+ * scanned in full only the first time and when the watch service overflows. The watch service of
+ * the JDK on macOS polls the directory only every few seconds, so pulling and clearing reports
+ * also lists the directory, which is a cheap comparison of file names, and reads the reports the
+ * watch service has not reported yet.
+ */
+final class CrashLogIndex implements Closeable {
+  private static final FluentLogger logger = FluentLogger.forEnclosingClass();
+
+  /** The process and simulator named in the header are well within this many bytes. */
+  private static final int HEADER_BYTES = 16 * 1024;
+
+  private static final Pattern SIMULATOR_PATH_PATTERN =
+      Pattern.compile(
+          "/CoreSimulator/Devices/(\\p{XDigit}{8}(?:-\\p{XDigit}{4}){3}-\\p{XDigit}{12})/");
+  private static final Pattern PROCESS_PATTERN =
+      Pattern.compile("^Process:\\s+(.+?)\\s+\\[(\\d{1,9})\\]", Pattern.MULTILINE);
+  // Reports in the JSON format of newer versions of macOS.
+  private static final Pattern JSON_PROCESS_PATTERN =
+      Pattern.compile("\"procName\"\\s*:\\s*\"([^\"]+)\"");
+  private static final Pattern JSON_PID_PATTERN = Pattern.compile("\"pid\"\\s*:\\s*(\\d{1,9})");
+
+  /** A crash report of a simulator process. */
+  @AutoValue
+  abstract static class CrashReport {
+    abstract Path path();
+
+    /** The udid of the simulator the crashed process ran on. */
+    abstract String udid();
+
+    /** The name of the crashed process. */
+    abstract String process();
+
+    /** The process id of the crashed process. */
+    abstract int pid();
+  }
+
+  private final Path directory;
+  private final Map<Path, CrashReport> reports = new HashMap<>();
+  private final SetMultimap<String, Path> udid2Reports = HashMultimap.create();
+  // Files that are not reports of a simulator process, or not yet, by when they were modified.
+  private final Map<Path, FileTime> otherFiles = new HashMap<>();
+  private WatchService watchService;
+  private boolean closed;
+
+  CrashLogIndex(Path directory) {
+    this.directory = checkNotNull(directory);
+  }
+
+  /**
+   * Returns the indexed reports of the simulator, after bringing the index up to date.
+   *
+   * @throws IOException - if the directory cannot be watched or scanned
+   */
+  synchronized ImmutableSet<CrashReport> reports(String udid) throws IOException {
+    update();
+    return indexedReports(udid);
+  }
+
+  private ImmutableSet<CrashReport> indexedReports(String udid) {
+    return udid2Reports
+        .get(udid)
+        .stream()
+        .map(reports::get)
+        .collect(ImmutableSet.toImmutableSet());
+  }
+
+  /**
+   * Moves the reports of the simulator into the target directory.
+   *
+   * @throws IOException - if a report cannot be moved
+   */
+  synchronized void pull(String udid, Path targetDirectory) throws IOException {
+    update();
+    relist();
+    for (CrashReport report : indexedReports(udid)) {
+      try {
+        Files.move(
+            report.path(),
+            targetDirectory.resolve(report.path().getFileName().toString()),
+            StandardCopyOption.REPLACE_EXISTING);
+      } catch (NoSuchFileException e) {
+        // Removed since the index was updated, which the next update would notice.
+      }
+      remove(report.path());
+    }
+  }
+
+  /**
+   * Deletes the reports of the simulator.
+   *
+   * @throws IOException - if a report cannot be deleted
+   */
+  synchronized void clear(String udid) throws IOException {
+    update();
+    relist();
+    for (CrashReport report : indexedReports(udid)) {
+      Files.deleteIfExists(report.path());
+      remove(report.path());
+    }
+  }
+
+  /** Stops watching the directory. */
+  @Override
+  public synchronized void close() throws IOException {
+    closed = true;
+    if (watchService != null) {
+      watchService.close();
+      watchService = null;
+    }
+  }
+
+  private void update() throws IOException {
+    if (closed) {
+      throw new IOException("Crash log index is closed");
+    }
+    if (watchService == null) {
+      if (!Files.isDirectory(directory)) {
+        // Created on the first crash, so there is nothing to index or watch yet.
+        return;
+      }
+      // Watch before scanning, so that reports written during the scan are not missed.
+      watchService = directory.getFileSystem().newWatchService();
+      directory.register(watchService, ENTRY_CREATE, ENTRY_DELETE, ENTRY_MODIFY);
+      rescan();
+    }
+
+    boolean overflowed = false;
+    for (WatchKey key = watchService.poll(); key != null; key = watchService.poll()) {
+      for (WatchEvent<?> event : key.pollEvents()) {
+        if (event.kind() == OVERFLOW) {
+          overflowed = true;
+          continue;
+        }
+        Path path = directory.resolve((Path) event.context());
+        if (event.kind() == ENTRY_DELETE) {
+          remove(path);
+        } else {
+          index(path);
+        }
+      }
+      if (!key.reset()) {
+        // The directory itself was deleted, so start over once it is created again.
+        watchService.close();
+        watchService = null;
+        reports.clear();
+        udid2Reports.clear();
+        otherFiles.clear();
+        return;
+      }
+    }
+    if (overflowed) {
+      rescan();
+    }
+  }
+
+  private void rescan() throws IOException {
+    reports.clear();
+    udid2Reports.clear();
+    otherFiles.clear();
+    for (Path path : MoreFiles.listFiles(directory)) {
+      index(path);
+    }
+  }
+
+  /**
+   * Indexes the files that were created or modified, and forgets those that were removed, since the
+   * index was last updated, whether or not the watch service has reported them yet.
+   */
+  private void relist() throws IOException {
+    if (watchService == null) {
+      return;
+    }
+    Set<Path> listed = ImmutableSet.copyOf(MoreFiles.listFiles(directory));
+    for (Path path : ImmutableSet.copyOf(reports.keySet())) {
+      if (!listed.contains(path)) {
+        remove(path);
+      }
+    }
+    otherFiles.keySet().retainAll(listed);
+    for (Path path : listed) {
+      if (reports.containsKey(path)) {
+        continue;
+      }
+      FileTime modified = otherFiles.get(path);
+      try {
+        if (modified != null && modified.equals(Files.getLastModifiedTime(path))) {
+          continue;
+        }
+      } catch (NoSuchFileException e) {
+        continue;
+      }
+      index(path);
+    }
+  }
+
+  private void index(Path path) {
+    remove(path);
+    Optional<CrashReport> report;
+    try {
+      // Taken before reading, so that a write during the read makes the file be read again.
+      FileTime modified = Files.getLastModifiedTime(path);
+      report = parse(path);
+      if (!report.isPresent()) {
+        otherFiles.put(path, modified);
+      }
+    } catch (NoSuchFileException e) {
+      return;
+    } catch (IOException e) {
+      logger.atWarning().withCause(e).log("Could not read crash report %s", path);
+      return;
+    }
+    if (report.isPresent()) {
+      reports.put(path, report.get());
+      udid2Reports.put(report.get().udid(), path);
+    }
+  }
+
+  private void remove(Path path) {
+    otherFiles.remove(path);
+    CrashReport report = reports.remove(path);
+    if (report != null) {
+      udid2Reports.remove(report.udid(), path);
+    }
+  }
+
+  /**
+   * Parses the header of a crash report, or returns empty if it is not a report of a simulator
+   * process or has not been written far enough yet, in which case it is parsed again when it is
+   * modified.
+   */
+  static Optional<CrashReport> parse(Path path) throws IOException {
+    if (!Files.isRegularFile(path)) {
+      return Optional.empty();
+    }
+    byte[] buffer = new byte[HEADER_BYTES];
+    int length;
+    try (InputStream in = Files.newInputStream(path)) {
+      length = ByteStreams.read(in, buffer, 0, buffer.length);
+    }
+    String header = new String(buffer, 0, length, UTF_8);
+
+    Matcher simulatorPath = SIMULATOR_PATH_PATTERN.matcher(header);
+    if (!simulatorPath.find()) {
+      return Optional.empty();
+    }
+    String processName;
+    String pid;
+    Matcher process = PROCESS_PATTERN.matcher(header);
+    if (process.find()) {
+      processName = process.group(1);
+      pid = process.group(2);
+    } else {
+      Matcher jsonProcess = JSON_PROCESS_PATTERN.matcher(header);
+      Matcher jsonPid = JSON_PID_PATTERN.matcher(header);
+      if (!jsonProcess.find() || !jsonPid.find()) {
+        return Optional.empty();
+      }
+      processName = jsonProcess.group(1);
+      pid = jsonPid.group(1);
+    }
+    return Optional.of(
+        new AutoValue_CrashLogIndex_CrashReport(
+            path, Ascii.toUpperCase(simulatorPath.group(1)), processName, Integer.parseInt(pid)));
+  }
+}
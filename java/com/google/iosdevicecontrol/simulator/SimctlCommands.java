@@ -19,7 +19,9 @@ import static com.google.iosdevicecontrol.command.Command.command;
 
 import com.google.common.collect.ImmutableList;
 import com.google.common.collect.ImmutableMap;
+import com.google.common.io.ByteSink;
 import com.google.iosdevicecontrol.command.Command;
+import com.google.iosdevicecontrol.command.CommandExecutor;
 import com.google.iosdevicecontrol.command.CommandProcess;
 import com.google.iosdevicecontrol.command.CommandStartException;
 import java.nio.file.Path;
@@ -34,8 +36,8 @@ final class SimctlCommands {
               "/Applications/Xcode.app/Contents/Developer"
                   + "/Applications/Simulator.app/Contents/MacOS/Simulator"));
 
-  static CommandProcess list() {
-    return exec("list", "--json", "devices");
+  static CommandProcess list(CommandExecutor executor) {
+    return exec(simctl("list", "--json", "devices").withExecutor(executor));
   }
 
   static CommandProcess shutdownAll() {
@@ -84,6 +86,12 @@ final class SimctlCommands {
             .withStdoutTo(syslogPath));
   }
 
+  CommandProcess syslog(ByteSink syslogSink) {
+    return exec(
+        simctl("spawn", udid, "log", "stream", "--level=debug", "--system")
+            .withStdoutTo(syslogSink));
+  }
+
   /** Boot the device and open it in the simulator for debugging. */
   CommandProcess open() {
     return exec(SIMULATOR.withArguments("-CurrentDeviceUDID", udid));
@@ -22,14 +22,13 @@ import static com.google.common.collect.ImmutableSet.toImmutableSet;
 import com.dd.plist.NSArray;
 import com.dd.plist.NSDictionary;
 import com.google.common.annotations.VisibleForTesting;
-import com.google.common.base.Predicate;
-import com.google.common.base.Predicates;
 import com.google.iosdevicecontrol.util.TunnelException;
 import com.google.common.collect.BiMap;
 import com.google.common.collect.HashBiMap;
 import com.google.common.collect.ImmutableSet;
 import com.google.common.collect.MoreCollectors;
 import com.google.common.io.MoreFiles;
+import com.google.iosdevicecontrol.command.Command;
 import com.google.iosdevicecontrol.command.CommandFailureException;
 import com.google.iosdevicecontrol.command.CommandProcess;
 import com.google.iosdevicecontrol.command.CommandResult;
@@ -40,22 +39,18 @@ import com.google.iosdevicecontrol.IosModel;
 import com.google.iosdevicecontrol.IosModel.Architecture;
 import com.google.iosdevicecontrol.IosVersion;
 import com.google.iosdevicecontrol.simulator.SimctlCommands.ShellCommands;
-import com.google.iosdevicecontrol.util.CheckedCallable;
-import com.google.iosdevicecontrol.util.CheckedCallables;
-import com.google.iosdevicecontrol.util.JsonParser;
 import com.google.iosdevicecontrol.util.PlistParser;
 import java.io.IOException;
 import java.nio.file.Files;
 import java.nio.file.NoSuchFileException;
 import java.nio.file.Path;
 import java.nio.file.Paths;
+import java.time.Duration;
 import java.util.Optional;
 import java.util.Set;
 import java.util.concurrent.ConcurrentHashMap;
 import java.util.concurrent.ConcurrentMap;
 import java.util.regex.Pattern;
-import javax.json.JsonArray;
-import javax.json.JsonObject;
 
 /** Implementation of {@link IosDeviceHost} that returns simulator devices. */
 public class SimulatorDeviceHost implements IosDeviceHost {
@@ -65,22 +60,44 @@ public class SimulatorDeviceHost implements IosDeviceHost {
   public static final Path CRASH_LOG_PATH =
       checkNotNull(Paths.get(System.getProperty("user.home"), "Library/Logs/DiagnosticReports"));
 
+  private static final CrashLogIndex crashLogIndex = new CrashLogIndex(CRASH_LOG_PATH);
+
   private static final Pattern GENERATION_PATTERN =
       Pattern.compile("\\((\\d+)\\p{Alpha}{2} generation\\)");
 
+  /** How long {@link #connectedDevices} trusts the last listing of the simulators. */
+  private static final Duration MAX_DEVICES_AGE = Duration.ofSeconds(10);
+
   private static final ConcurrentMap<String, ImmutableSet<IosAppInfo>> runtime2SystemApps =
       new ConcurrentHashMap<>();
 
-  private final BiMap<String, IosDevice> udid2Device = HashBiMap.create();
+  private final ConcurrentMap<String, IosVersion> productVersion2Version =
+      new ConcurrentHashMap<>();
   private final BiMap<String, IosModel> deviceType2Model = HashBiMap.create();
 
+  private final SimulatorInventory inventory =
+      new SimulatorInventory(
+          Command.NATIVE_EXECUTOR,
+          (udid, productVersion) -> new SimulatorDeviceImpl(udid, getVersion(productVersion)),
+          this::forgetRemovedRuntimes);
+
+  private SimulatorDeviceHost() {}
+
   /**
-   * Device list does not change during runtime, so it can be lazily evaluated on subsequent calls.
+   * Lists the simulators again, so that {@link #connectedDevices} sees simulators that were
+   * created or deleted since. Simulators that are still there keep their device instance.
    */
-  private final CheckedCallable<ImmutableSet<IosDevice>, IOException> connectedDevices =
-      CheckedCallables.memoize(() -> collectDevices(Predicates.alwaysTrue()));
+  public void refreshDevices() throws IOException {
+    inventory.refresh();
+  }
 
-  private SimulatorDeviceHost() {}
+  /**
+   * Keeps the simulators up to date on a background thread with the specified period, so that
+   * {@link #connectedDevices} never waits for simctl.
+   */
+  public void refreshDevicesInBackground(Duration period) {
+    inventory.refreshInBackground(period);
+  }
 
   /**
    * Clear crash logs of all devices on the host (including those that are not currently booted).
@@ -123,6 +140,16 @@ public class SimulatorDeviceHost implements IosDeviceHost {
     }
   }
 
+  /** Moves the crash logs of one device into the given directory. */
+  void pullCrashLogs(String udid, Path directory) throws IOException {
+    crashLogIndex.pull(udid, directory);
+  }
+
+  /** Clears the crash logs of one device. */
+  void clearCrashLogs(String udid) throws IOException {
+    crashLogIndex.clear(udid);
+  }
+
   /** Returns the device that is currently using the inspector port or empty if no such device. */
   public Optional<IosDevice> deviceOnInspectorPort() throws IOException {
     // 27753 is the port that the Simulator uses for the inspector.
@@ -140,46 +167,37 @@ public class SimulatorDeviceHost implements IosDeviceHost {
     await(SimctlCommands.shutdownAll());
   }
 
+  /**
+   * Returns the simulators on the host as of a listing at most a few seconds old, or as of the
+   * latest background refresh if {@link #refreshDevicesInBackground} was called.
+   */
   @Override
   public ImmutableSet<IosDevice> connectedDevices() throws IOException {
-    return connectedDevices.call();
+    return inventory.devices(MAX_DEVICES_AGE);
   }
 
   public ImmutableSet<IosDevice> bootedDevices() throws IOException {
-    return collectDevices(data -> data.getString("state").equals("Booted"));
+    inventory.refresh();
+    return inventory.devicesInState("Booted");
   }
 
-  private ImmutableSet<IosDevice> collectDevices(Predicate<JsonObject> test) throws IOException {
-    String devices = await(SimctlCommands.list()).stdoutStringUtf8();
-    JsonObject jsonOutput = JsonParser.parseObject(devices).getJsonObject("devices");
-    return jsonOutput
-        .entrySet()
-        .stream()
-        .filter(e -> e.getKey().startsWith("iOS"))
-        .flatMap(
-            e -> {
-              IosVersion version = getVersion(e.getKey().substring(4));
-              return ((JsonArray) e.getValue())
-                  .stream()
-                  .map(v -> (JsonObject) v)
-                  .filter(test)
-                  .map(data -> toDevice(version, data));
-            })
-        .collect(toImmutableSet());
+  /** Forgets what was read from runtimes that are gone, in case they are reinstalled. */
+  private void forgetRemovedRuntimes(ImmutableSet<String> productVersions) {
+    productVersion2Version.keySet().retainAll(productVersions);
+    runtime2SystemApps.keySet().retainAll(productVersions);
   }
 
   /** Build a single version for simulated devices that share a runtime. */
   private IosVersion getVersion(String productVersion) {
-    Path systemVersionFile =
-        runtimeRootPath(productVersion).resolve("System/Library/CoreServices/SystemVersion.plist");
-    NSDictionary resultDict = (NSDictionary) PlistParser.fromPath(systemVersionFile);
-    String buildVersion = resultDict.get("ProductBuildVersion").toString();
-    return IosVersion.builder().buildVersion(buildVersion).productVersion(productVersion).build();
-  }
-
-  private IosDevice toDevice(IosVersion version, JsonObject data) {
-    return udid2Device.computeIfAbsent(
-        data.getString("udid"), u -> new SimulatorDeviceImpl(u, version));
+    return productVersion2Version.computeIfAbsent(
+        productVersion,
+        p -> {
+          Path systemVersionFile =
+              runtimeRootPath(p).resolve("System/Library/CoreServices/SystemVersion.plist");
+          NSDictionary resultDict = (NSDictionary) PlistParser.fromPath(systemVersionFile);
+          String buildVersion = resultDict.get("ProductBuildVersion").toString();
+          return IosVersion.builder().buildVersion(buildVersion).productVersion(p).build();
+        });
   }
 
   static ImmutableSet<IosAppInfo> listSystemApps(String productVersion) throws IOException {
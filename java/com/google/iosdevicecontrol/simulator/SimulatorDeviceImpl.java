@@ -37,6 +37,7 @@ import com.google.iosdevicecontrol.IosDeviceResource;
 import com.google.iosdevicecontrol.IosDeviceSocket;
 import com.google.iosdevicecontrol.IosModel;
 import com.google.iosdevicecontrol.IosVersion;
+import com.google.iosdevicecontrol.syslog.SyslogStore;
 import com.google.iosdevicecontrol.util.CheckedCallable;
 import com.google.iosdevicecontrol.util.CheckedCallables;
 import com.google.iosdevicecontrol.util.PlistParser;
@@ -231,14 +232,44 @@ final class SimulatorDeviceImpl implements SimulatorDevice {
     };
   }
 
+  @Override
+  public IosDeviceResource startSystemLogStore(Path storeDirectory) throws IosDeviceException {
+    checkState(!systemLoggerStarted.getAndSet(true), "System logger has already been started.");
+    SyslogStore store = SyslogStore.inDirectory(storeDirectory);
+    CommandProcess syslog = simctl.syslog(store.ingestSink());
+    return new IosDeviceResource(this) {
+      @Override
+      public void close() throws IosDeviceException {
+        checkState(systemLoggerStarted.getAndSet(false), "System logger has already been stopped.");
+        try {
+          await(syslog.kill(), 0, 143, 255);
+        } finally {
+          try {
+            store.close();
+          } catch (IOException e) {
+            throw new IosDeviceException(device(), e);
+          }
+        }
+      }
+    };
+  }
+
   @Override
   public void pullCrashLogs(Path directory) throws IosDeviceException {
-    throw new UnsupportedOperationException();
+    try {
+      SimulatorDeviceHost.INSTANCE.pullCrashLogs(udid, directory);
+    } catch (IOException e) {
+      throw new IosDeviceException(this, e);
+    }
   }
 
   @Override
   public void clearCrashLogs() throws IosDeviceException {
-    throw new UnsupportedOperationException();
+    try {
+      SimulatorDeviceHost.INSTANCE.clearCrashLogs(udid);
+    } catch (IOException e) {
+      throw new IosDeviceException(this, e);
+    }
   }
 
   @Override
@@ -0,0 +1,214 @@
+// Copyright 2017 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+package com.google.iosdevicecontrol.simulator;
+
+import static com.google.common.base.Preconditions.checkArgument;
+import static com.google.common.base.Preconditions.checkNotNull;
+import static com.google.common.collect.ImmutableSet.toImmutableSet;
+
+import com.google.auto.value.AutoValue;
+import com.google.common.collect.ImmutableMap;
+import com.google.common.collect.ImmutableSet;
+import com.google.common.util.concurrent.ThreadFactoryBuilder;
+import com.google.iosdevicecontrol.IosDevice;
+import com.google.iosdevicecontrol.command.CommandExecutor;
+import com.google.iosdevicecontrol.command.CommandFailureException;
+import com.google.iosdevicecontrol.util.FluentLogger;
+import com.google.iosdevicecontrol.util.JsonParser;
+import java.io.IOException;
+import java.time.Duration;
+import java.util.Map;
+import java.util.concurrent.Executors;
+import java.util.concurrent.ScheduledExecutorService;
+import java.util.concurrent.TimeUnit;
+import java.util.function.BiFunction;
+import java.util.function.Consumer;
+import javax.json.JsonArray;
+import javax.json.JsonException;
+import javax.json.JsonObject;
+
+/**
+ * The simulators that simctl lists, kept up to date by refreshing. A refresh lists the devices
+ * again and only updates the entries that changed: simulators that are still listed keep their
+ * device instance, and only new simulators are created. A refresh that lists exactly what the last
+ * one did costs no more than running simctl.
+ */
+final class SimulatorInventory {
+  private static final FluentLogger logger = FluentLogger.forEnclosingClass();
+
+  private static final String RUNTIME_PREFIX = "iOS ";
+
+  /** A listed simulator and the state it was listed in. */
+  @AutoValue
+  abstract static class Entry {
+    abstract IosDevice device();
+
+    /** The iOS version of the runtime of the simulator, such as "10.3". */
+    abstract String productVersion();
+
+    /** The state of the simulator, such as "Booted" or "Shutdown". */
+    abstract String state();
+  }
+
+  private final CommandExecutor executor;
+  private final BiFunction<String, String, IosDevice> deviceFactory;
+  private final Consumer<ImmutableSet<String>> changeListener;
+  // Serializes refreshes, which run simctl without holding the lock on the entries.
+  private final Object refreshLock = new Object();
+  private ImmutableMap<String, Entry> entries = ImmutableMap.of();
+  private String lastListing;
+  private long lastRefreshNanos;
+  private ScheduledExecutorService refresher;
+
+  /**
+   * Creates an empty inventory.
+   *
+   * @param executor - the executor that runs simctl
+   * @param deviceFactory - creates the device for a newly listed udid and product version
+   * @param changeListener - called with the product versions of the runtimes after every refresh
+   *     that changed the inventory, however the refresh was started
+   */
+  SimulatorInventory(
+      CommandExecutor executor,
+      BiFunction<String, String, IosDevice> deviceFactory,
+      Consumer<ImmutableSet<String>> changeListener) {
+    this.executor = checkNotNull(executor);
+    this.deviceFactory = checkNotNull(deviceFactory);
+    this.changeListener = checkNotNull(changeListener);
+  }
+
+  /**
+   * Lists the simulators and updates the inventory to match. Returns whether anything changed.
+   *
+   * @throws IOException - if simctl fails or its output cannot be parsed
+   */
+  boolean refresh() throws IOException {
+    synchronized (refreshLock) {
+      String listing;
+      try {
+        listing = SimctlCommands.list(executor).await().stdoutStringUtf8();
+      } catch (CommandFailureException e) {
+        throw new IOException(e);
+      } catch (InterruptedException e) {
+        Thread.currentThread().interrupt();
+        throw new IOException(e);
+      }
+      boolean changed = update(listing);
+      if (changed) {
+        changeListener.accept(productVersions());
+      }
+      return changed;
+    }
+  }
+
+  private synchronized boolean update(String listing) throws IOException {
+    lastRefreshNanos = System.nanoTime();
+    if (listing.equals(lastListing)) {
+      return false;
+    }
+
+    ImmutableMap.Builder<String, Entry> refreshed = ImmutableMap.builder();
+    try {
+      JsonObject runtimes = JsonParser.parseObject(listing).getJsonObject("devices");
+      for (Map.Entry<String, ?> runtime : runtimes.entrySet()) {
+        if (!runtime.getKey().startsWith(RUNTIME_PREFIX)) {
+          continue;
+        }
+        String productVersion = runtime.getKey().substring(RUNTIME_PREFIX.length());
+        for (JsonObject data : ((JsonArray) runtime.getValue()).getValuesAs(JsonObject.class)) {
+          String udid = data.getString("udid");
+          Entry previous = entries.get(udid);
+          IosDevice device =
+              previous != null && previous.productVersion().equals(productVersion)
+                  ? previous.device()
+                  : deviceFactory.apply(udid, productVersion);
+          refreshed.put(
+              udid,
+              new AutoValue_SimulatorInventory_Entry(
+                  device, productVersion, data.getString("state")));
+        }
+      }
+    } catch (JsonException | ClassCastException | NullPointerException e) {
+      throw new IOException("Unexpected simctl output: " + listing, e);
+    }
+    ImmutableMap<String, Entry> previousEntries = entries;
+    entries = refreshed.build();
+    lastListing = listing;
+    return !entries.equals(previousEntries);
+  }
+
+  /**
+   * Returns the listed simulators, refreshing first if the last refresh is older than the maximum
+   * age or there has been none.
+   *
+   * @throws IOException - if a refresh was needed and failed
+   */
+  ImmutableSet<IosDevice> devices(Duration maxAge) throws IOException {
+    if (isOlderThan(maxAge)) {
+      refresh();
+    }
+    synchronized (this) {
+      return entries.values().stream().map(Entry::device).collect(toImmutableSet());
+    }
+  }
+
+  private synchronized boolean isOlderThan(Duration maxAge) {
+    return lastListing == null || System.nanoTime() - lastRefreshNanos > maxAge.toNanos();
+  }
+
+  /** Returns the simulators that were in the specified state as of the last refresh. */
+  synchronized ImmutableSet<IosDevice> devicesInState(String state) {
+    return entries
+        .values()
+        .stream()
+        .filter(e -> e.state().equals(state))
+        .map(Entry::device)
+        .collect(toImmutableSet());
+  }
+
+  /** Returns the product versions of the runtimes of the simulators as of the last refresh. */
+  synchronized ImmutableSet<String> productVersions() {
+    return entries.values().stream().map(Entry::productVersion).collect(toImmutableSet());
+  }
+
+  /**
+   * Refreshes the inventory on a background thread with the specified period, until the JVM exits.
+   * Failed refreshes are logged and retried on the next period.
+   */
+  synchronized void refreshInBackground(Duration period) {
+    checkArgument(!period.isNegative() && !period.isZero(), "Invalid period: %s", period);
+    if (refresher != null) {
+      refresher.shutdownNow();
+    }
+    refresher =
+        Executors.newSingleThreadScheduledExecutor(
+            new ThreadFactoryBuilder()
+                .setNameFormat("simulator-inventory-%d")
+                .setDaemon(true)
+                .build());
+    refresher.scheduleWithFixedDelay(
+        () -> {
+          try {
+            refresh();
+          } catch (IOException | RuntimeException e) {
+            logger.atWarning().withCause(e).atMostEvery(1, TimeUnit.MINUTES).log(
+                "Could not refresh the simulators");
+          }
+        },
+        0,
+        period.toNanos(),
+        TimeUnit.NANOSECONDS);
+  }
+}
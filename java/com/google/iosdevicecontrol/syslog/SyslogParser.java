@@ -0,0 +1,186 @@
+// Copyright 2017 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+package com.google.iosdevicecontrol.syslog;
+
+import static com.google.common.base.Preconditions.checkNotNull;
+
+import com.google.common.base.Strings;
+import java.time.Clock;
+import java.time.DateTimeException;
+import java.time.Instant;
+import java.time.LocalDateTime;
+import java.time.OffsetDateTime;
+import java.time.ZonedDateTime;
+import java.time.format.DateTimeFormatter;
+import java.time.format.DateTimeFormatterBuilder;
+import java.time.format.DateTimeParseException;
+import java.time.temporal.ChronoField;
+import java.util.Optional;
+import java.util.regex.Matcher;
+import java.util.regex.Pattern;
+
+/**
+ * Parses the lines that idevicesyslog and {@code log stream} print into records. A line that does
+ * not start a message continues the message before it, so a record is only complete once the next
+ * one starts or the input ends.
+ */
+final class SyslogParser {
+  /** Continuation lines beyond this many characters of a message are dropped. */
+  private static final int MAX_MESSAGE_LENGTH = 64 * 1024;
+
+  private static final String[] MONTHS = {
+    "Jan", "Feb", "Mar", "Apr", "May", "Jun", "Jul", "Aug", "Sep", "Oct", "Nov", "Dec"
+  };
+
+  // idevicesyslog: "Oct 18 12:34:56 iPhone SpringBoard(UIKitCore)[57] <Notice>: message"
+  private static final Pattern IDEVICESYSLOG_PATTERN =
+      Pattern.compile(
+          "^(\\w{3}) +(\\d{1,2}) (\\d{2}):(\\d{2}):(\\d{2}) \\S+ "
+              + "(.+?)(?:\\(([^()]*)\\))?\\[(\\d{1,9})\\] <(\\w+)>: ?(.*)$");
+
+  // log stream: "2017-10-18 12:34:56.123456-0700  0x1f2  Default  0x0  57  0  SpringBoard:
+  // (UIKitCore) [com.apple.UIKit:Foo] message", where older versions have no TTL column.
+  private static final Pattern LOG_STREAM_PATTERN =
+      Pattern.compile(
+          "^(\\d{4}-\\d{2}-\\d{2} \\d{2}:\\d{2}:\\d{2}(?:\\.\\d+)?[-+]\\d{4})\\s+0x\\p{XDigit}+\\s+"
+              + "(\\w+)\\s+0x\\p{XDigit}+\\s+(\\d{1,9})\\s+(?:\\d+\\s+)?(.+?): "
+              + "(?:\\(([^()]*)\\) )?(?:\\[([^\\]]*)\\] )?(.*)$");
+
+  private static final DateTimeFormatter LOG_STREAM_TIME_FORMAT =
+      new DateTimeFormatterBuilder()
+          .appendPattern("yyyy-MM-dd HH:mm:ss")
+          .optionalStart()
+          .appendFraction(ChronoField.NANO_OF_SECOND, 0, 9, true)
+          .optionalEnd()
+          .appendOffset("+HHMM", "+0000")
+          .toFormatter();
+
+  private final Clock clock;
+  private Optional<SyslogRecord> pending = Optional.empty();
+  private final StringBuilder pendingMessage = new StringBuilder();
+
+  /**
+   * Creates a parser that takes the year, which idevicesyslog leaves out, and the time zone of the
+   * device from the clock.
+   */
+  SyslogParser(Clock clock) {
+    this.clock = checkNotNull(clock);
+  }
+
+  /** Parses a line without its line terminator and returns the record that it completes, if any. */
+  Optional<SyslogRecord> add(String line) {
+    Optional<SyslogRecord> record = parseHeader(line);
+    if (!record.isPresent()) {
+      if (pending.isPresent() && pendingMessage.length() < MAX_MESSAGE_LENGTH) {
+        pendingMessage.append('\n').append(line);
+      }
+      return Optional.empty();
+    }
+    Optional<SyslogRecord> completed = finish();
+    pending = record;
+    pendingMessage.append(record.get().message());
+    return completed;
+  }
+
+  /** Returns the last record, which the end of the input completes. */
+  Optional<SyslogRecord> finish() {
+    String message = pendingMessage.toString();
+    Optional<SyslogRecord> completed =
+        pending.map(
+            r ->
+                SyslogRecord.create(
+                    r.time(), r.process(), r.pid(), r.level(), r.subsystem(), message));
+    pending = Optional.empty();
+    pendingMessage.setLength(0);
+    return completed;
+  }
+
+  private Optional<SyslogRecord> parseHeader(String line) {
+    Matcher matcher = IDEVICESYSLOG_PATTERN.matcher(line);
+    if (matcher.matches()) {
+      Optional<Instant> time = syslogTime(matcher);
+      if (time.isPresent()) {
+        return Optional.of(
+            SyslogRecord.create(
+                time.get(),
+                matcher.group(6),
+                Integer.parseInt(matcher.group(8)),
+                matcher.group(9),
+                Strings.nullToEmpty(matcher.group(7)),
+                matcher.group(10)));
+      }
+    }
+    matcher = LOG_STREAM_PATTERN.matcher(line);
+    if (matcher.matches()) {
+      Instant time;
+      try {
+        time = OffsetDateTime.parse(matcher.group(1), LOG_STREAM_TIME_FORMAT).toInstant();
+      } catch (DateTimeParseException e) {
+        return Optional.empty();
+      }
+      // "[subsystem:category]" names the subsystem, and "(library)" is the next best thing.
+      String subsystem = Strings.nullToEmpty(matcher.group(6));
+      int colon = subsystem.indexOf(':');
+      if (colon >= 0) {
+        subsystem = subsystem.substring(0, colon);
+      }
+      if (subsystem.isEmpty()) {
+        subsystem = Strings.nullToEmpty(matcher.group(5));
+      }
+      return Optional.of(
+          SyslogRecord.create(
+              time,
+              matcher.group(4),
+              Integer.parseInt(matcher.group(3)),
+              matcher.group(2),
+              subsystem,
+              matcher.group(7)));
+    }
+    return Optional.empty();
+  }
+
+  /**
+   * Returns the time of an idevicesyslog line in the current year, or the year before if that would
+   * be more than a day in the future, as it is for messages from December read in January.
+   */
+  private Optional<Instant> syslogTime(Matcher matcher) {
+    int month = 0;
+    while (month < MONTHS.length && !MONTHS[month].equals(matcher.group(1))) {
+      month++;
+    }
+    if (month == MONTHS.length) {
+      return Optional.empty();
+    }
+    ZonedDateTime now = ZonedDateTime.now(clock);
+    try {
+      LocalDateTime time =
+          LocalDateTime.of(
+              now.getYear(),
+              month + 1,
+              Integer.parseInt(matcher.group(2)),
+              Integer.parseInt(matcher.group(3)),
+              Integer.parseInt(matcher.group(4)),
+              Integer.parseInt(matcher.group(5)));
+      ZonedDateTime zonedTime = time.atZone(clock.getZone());
+      if (zonedTime.isAfter(now.plusDays(1))) {
+        zonedTime = zonedTime.minusYears(1);
+      }
+      return Optional.of(zonedTime.toInstant());
+    } catch (DateTimeException e) {
+      // E.g. Feb 29 in a year that has none.
+      return Optional.empty();
+    }
+  }
+}
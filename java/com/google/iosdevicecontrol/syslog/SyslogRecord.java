@@ -0,0 +1,47 @@
+// Copyright 2017 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+package com.google.iosdevicecontrol.syslog;
+
+import com.google.auto.value.AutoValue;
+import java.time.Instant;
+
+/** A message of the system log of a device. */
+@AutoValue
+public abstract class SyslogRecord {
+  public static SyslogRecord create(
+      Instant time, String process, int pid, String level, String subsystem, String message) {
+    return new AutoValue_SyslogRecord(time, process, pid, level, subsystem, message);
+  }
+
+  /** When the message was logged, to the microsecond at best. */
+  public abstract Instant time();
+
+  /** The name of the process that logged the message. */
+  public abstract String process();
+
+  public abstract int pid();
+
+  /** The level of the message as the device names it, e.g. "Notice" or "Error". */
+  public abstract String level();
+
+  /**
+   * The subsystem that logged the message, e.g. "com.apple.UIKit", or the library if the log only
+   * names that, or empty if it names neither.
+   */
+  public abstract String subsystem();
+
+  /** The text of the message, whose lines are separated by newlines. */
+  public abstract String message();
+}
@@ -0,0 +1,629 @@
+// Copyright 2017 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+package com.google.iosdevicecontrol.syslog;
+
+import static com.google.common.base.Preconditions.checkNotNull;
+import static java.nio.charset.StandardCharsets.UTF_8;
+import static java.util.concurrent.TimeUnit.SECONDS;
+
+import com.google.auto.value.AutoValue;
+import com.google.common.collect.ImmutableList;
+import com.google.common.collect.Range;
+import com.google.common.io.ByteSink;
+import java.io.ByteArrayOutputStream;
+import java.io.Closeable;
+import java.io.EOFException;
+import java.io.IOException;
+import java.io.OutputStream;
+import java.nio.ByteBuffer;
+import java.nio.channels.FileChannel;
+import java.nio.file.Files;
+import java.nio.file.Path;
+import java.nio.file.StandardOpenOption;
+import java.time.Clock;
+import java.time.Instant;
+import java.util.ArrayList;
+import java.util.HashMap;
+import java.util.List;
+import java.util.Map;
+import java.util.Optional;
+import java.util.zip.DataFormatException;
+import java.util.zip.Deflater;
+import java.util.zip.Inflater;
+
+/**
+ * Stores system log records in a directory in compressed, columnar blocks, so they can be queried
+ * by time range and process without scanning the whole log.
+ *
+ * <p>Records are buffered in memory and written as a block of a few thousand. Each column of a
+ * block (time, process, pid, level, subsystem and message) is deflated on its own, and the block
+ * header has the time range of the block and the names of the processes in it. A query only reads
+ * the headers, which are indexed in memory, and the blocks that may have matching records, and of
+ * those only the time and process columns unless some records match.
+ *
+ * <p>A block that was cut short, because the process writing it died, is ignored and overwritten.
+ */
+public final class SyslogStore implements Closeable {
+  /** The name of the file in the directory of the store that has the blocks. */
+  public static final String BLOCKS_FILE_NAME = "syslog.blocks";
+
+  private static final int MAGIC = 0x534c4231; // "SLB1"
+  private static final int BLOCK_PREFIX_BYTES = 12;
+
+  private static final int BLOCK_RECORDS = 8192;
+  private static final int BLOCK_MESSAGE_CHARS = 4 * 1024 * 1024;
+  private static final long MAX_BLOCK_AGE_NANOS = SECONDS.toNanos(30);
+
+  private static final int TIME_COLUMN = 0;
+  private static final int PROCESS_COLUMN = 1;
+  private static final int PID_COLUMN = 2;
+  private static final int LEVEL_COLUMN = 3;
+  private static final int SUBSYSTEM_COLUMN = 4;
+  private static final int MESSAGE_COLUMN = 5;
+  private static final int COLUMN_COUNT = 6;
+
+  /** The header of a block in the blocks file. */
+  @AutoValue
+  abstract static class BlockHeader {
+    /** The offset of the first column in the blocks file. */
+    abstract long columnsOffset();
+
+    abstract int recordCount();
+
+    abstract long minMicros();
+
+    abstract long maxMicros();
+
+    /** The process dictionary; the process column has indexes into it. */
+    abstract ImmutableList<String> processes();
+
+    abstract ImmutableList<Integer> compressedLengths();
+
+    abstract ImmutableList<Integer> lengths();
+  }
+
+  /** Returns a store in the specified directory, which it creates when needed. */
+  public static SyslogStore inDirectory(Path directory) {
+    return new SyslogStore(directory);
+  }
+
+  private final Path blocksFile;
+  private final List<SyslogRecord> buffer = new ArrayList<>();
+  private int bufferMessageChars;
+  private long bufferStartNanos;
+  private List<BlockHeader> index;
+  private long validLength;
+  private FileChannel writeChannel;
+
+  private SyslogStore(Path directory) {
+    this.blocksFile = checkNotNull(directory).resolve(BLOCKS_FILE_NAME);
+  }
+
+  /**
+   * Returns a sink for the output of idevicesyslog or {@code log stream}, for example to pass to
+   * {@link com.google.iosdevicecontrol.command.Command#withStdoutTo}. Each stream it opens parses
+   * the lines written to it and appends the records, and completes the last record when closed.
+   */
+  public ByteSink ingestSink() {
+    return new ByteSink() {
+      @Override
+      public OutputStream openStream() {
+        return new IngestStream(new SyslogParser(Clock.systemDefaultZone()));
+      }
+    };
+  }
+
+  /**
+   * Appends a record. It is written to disk with the records appended after it, at the latest when
+   * the store is flushed or closed, and is included in queries right away.
+   */
+  public synchronized void append(SyslogRecord record) throws IOException {
+    if (buffer.isEmpty()) {
+      bufferStartNanos = System.nanoTime();
+    }
+    buffer.add(record);
+    bufferMessageChars += record.message().length();
+    if (buffer.size() >= BLOCK_RECORDS
+        || bufferMessageChars >= BLOCK_MESSAGE_CHARS
+        || System.nanoTime() - bufferStartNanos >= MAX_BLOCK_AGE_NANOS) {
+      flush();
+    }
+  }
+
+  /** Writes the records appended since the last flush as a block. */
+  public synchronized void flush() throws IOException {
+    if (buffer.isEmpty()) {
+      return;
+    }
+    loadIndex();
+    if (writeChannel == null) {
+      Files.createDirectories(blocksFile.getParent());
+      writeChannel =
+          FileChannel.open(blocksFile, StandardOpenOption.CREATE, StandardOpenOption.WRITE);
+      // Drop a block that was cut short.
+      writeChannel.truncate(validLength);
+    }
+    byte[] block = encodeBlock(buffer);
+    ByteBuffer blockBuffer = ByteBuffer.wrap(block);
+    long position = validLength;
+    while (blockBuffer.hasRemaining()) {
+      position += writeChannel.write(blockBuffer, position);
+    }
+    index.add(readHeader(ByteBuffer.wrap(block), validLength));
+    validLength = position;
+    buffer.clear();
+    bufferMessageChars = 0;
+  }
+
+  /**
+   * Returns the records logged in the specified time range, in the order they were appended.
+   *
+   * @throws IOException - if the blocks file cannot be read
+   */
+  public ImmutableList<SyslogRecord> query(Range<Instant> timeRange) throws IOException {
+    return find(timeRange, Optional.empty());
+  }
+
+  /**
+   * Returns the records that the specified process logged in the specified time range, in the order
+   * they were appended.
+   *
+   * @throws IOException - if the blocks file cannot be read
+   */
+  public ImmutableList<SyslogRecord> query(Range<Instant> timeRange, String process)
+      throws IOException {
+    return find(timeRange, Optional.of(checkNotNull(process)));
+  }
+
+  private synchronized ImmutableList<SyslogRecord> find(
+      Range<Instant> timeRange, Optional<String> process) throws IOException {
+    loadIndex();
+    ImmutableList.Builder<SyslogRecord> records = ImmutableList.builder();
+    if (!index.isEmpty()) {
+      try (FileChannel channel = FileChannel.open(blocksFile, StandardOpenOption.READ)) {
+        for (BlockHeader header : index) {
+          Range<Instant> blockRange =
+              Range.closed(toInstant(header.minMicros()), toInstant(header.maxMicros()));
+          if (timeRange.isConnected(blockRange)
+              && (!process.isPresent() || header.processes().contains(process.get()))) {
+            readBlock(channel, header, timeRange, process, records);
+          }
+        }
+      }
+    }
+    for (SyslogRecord record : buffer) {
+      if (timeRange.contains(record.time())
+          && (!process.isPresent() || record.process().equals(process.get()))) {
+        records.add(record);
+      }
+    }
+    return records.build();
+  }
+
+  /** Writes the buffered records and closes the blocks file. */
+  @Override
+  public synchronized void close() throws IOException {
+    try {
+      flush();
+    } finally {
+      if (writeChannel != null) {
+        writeChannel.close();
+        writeChannel = null;
+      }
+    }
+  }
+
+  /** Reads the headers of the blocks in the file the first time it is needed. */
+  private void loadIndex() throws IOException {
+    if (index != null) {
+      return;
+    }
+    List<BlockHeader> headers = new ArrayList<>();
+    long length = 0;
+    if (Files.exists(blocksFile)) {
+      try (FileChannel channel = FileChannel.open(blocksFile, StandardOpenOption.READ)) {
+        long fileSize = channel.size();
+        while (fileSize - length >= BLOCK_PREFIX_BYTES) {
+          ByteBuffer prefix = ByteBuffer.allocate(BLOCK_PREFIX_BYTES);
+          readFully(channel, prefix, length);
+          int headerLength = prefix.getInt(4);
+          int columnsLength = prefix.getInt(8);
+          long blockEnd = length + BLOCK_PREFIX_BYTES + headerLength + (long) columnsLength;
+          if (prefix.getInt(0) != MAGIC
+              || headerLength < 0
+              || columnsLength < 0
+              || blockEnd > fileSize) {
+            break;
+          }
+          ByteBuffer header = ByteBuffer.allocate(BLOCK_PREFIX_BYTES + headerLength);
+          readFully(channel, header, length);
+          try {
+            headers.add(readHeader(header, length));
+          } catch (RuntimeException e) {
+            break;
+          }
+          length = blockEnd;
+        }
+      }
+    }
+    index = headers;
+    validLength = length;
+  }
+
+  private static byte[] encodeBlock(List<SyslogRecord> records) throws IOException {
+    long minMicros = Long.MAX_VALUE;
+    long maxMicros = Long.MIN_VALUE;
+    for (SyslogRecord record : records) {
+      long micros = toMicros(record.time());
+      minMicros = Math.min(minMicros, micros);
+      maxMicros = Math.max(maxMicros, micros);
+    }
+
+    Map<String, Integer> processes = new HashMap<>();
+    Map<String, Integer> levels = new HashMap<>();
+    Map<String, Integer> subsystems = new HashMap<>();
+    ColumnWriter[] columns = new ColumnWriter[COLUMN_COUNT];
+    for (int i = 0; i < COLUMN_COUNT; i++) {
+      columns[i] = new ColumnWriter();
+    }
+    ColumnWriter levelIndexes = new ColumnWriter();
+    ColumnWriter subsystemIndexes = new ColumnWriter();
+    long previousMicros = minMicros;
+    for (SyslogRecord record : records) {
+      long micros = toMicros(record.time());
+      columns[TIME_COLUMN].writeVarLong(zigzag(micros - previousMicros));
+      previousMicros = micros;
+      columns[PROCESS_COLUMN].writeVarLong(dictionaryIndex(processes, record.process()));
+      columns[PID_COLUMN].writeVarLong(record.pid() & 0xffffffffL);
+      levelIndexes.writeVarLong(dictionaryIndex(levels, record.level()));
+      subsystemIndexes.writeVarLong(dictionaryIndex(subsystems, record.subsystem()));
+      columns[MESSAGE_COLUMN].writeString(record.message());
+    }
+    // The level and subsystem columns start with their dictionaries.
+    columns[LEVEL_COLUMN].writeDictionary(levels);
+    levelIndexes.writeTo(columns[LEVEL_COLUMN]);
+    columns[SUBSYSTEM_COLUMN].writeDictionary(subsystems);
+    subsystemIndexes.writeTo(columns[SUBSYSTEM_COLUMN]);
+
+    ColumnWriter header = new ColumnWriter();
+    header.writeVarLong(records.size());
+    header.writeVarLong(zigzag(minMicros));
+    header.writeVarLong(maxMicros - minMicros);
+    header.writeDictionary(processes);
+    ByteArrayOutputStream compressedColumns = new ByteArrayOutputStream();
+    Deflater deflater = new Deflater(Deflater.BEST_SPEED);
+    try {
+      for (ColumnWriter column : columns) {
+        byte[] compressed = column.deflate(deflater);
+        header.writeVarLong(column.size());
+        header.writeVarLong(compressed.length);
+        compressedColumns.write(compressed);
+      }
+    } finally {
+      deflater.end();
+    }
+
+    ByteBuffer block =
+        ByteBuffer.allocate(BLOCK_PREFIX_BYTES + header.size() + compressedColumns.size());
+    block.putInt(MAGIC);
+    block.putInt(header.size());
+    block.putInt(compressedColumns.size());
+    block.put(header.toByteArray());
+    block.put(compressedColumns.toByteArray());
+    return block.array();
+  }
+
+  /** Reads the header of a block that starts at offset in the blocks file. */
+  private static BlockHeader readHeader(ByteBuffer block, long offset) {
+    int headerLength = block.getInt(4);
+    ColumnReader header = new ColumnReader(block.array(), BLOCK_PREFIX_BYTES, headerLength);
+    int recordCount = (int) header.readVarLong();
+    long minMicros = unzigzag(header.readVarLong());
+    long maxMicros = minMicros + header.readVarLong();
+    ImmutableList<String> processes = header.readDictionary();
+    ImmutableList.Builder<Integer> compressedLengths = ImmutableList.builder();
+    ImmutableList.Builder<Integer> lengths = ImmutableList.builder();
+    for (int i = 0; i < COLUMN_COUNT; i++) {
+      lengths.add((int) header.readVarLong());
+      compressedLengths.add((int) header.readVarLong());
+    }
+    return new AutoValue_SyslogStore_BlockHeader(
+        offset + BLOCK_PREFIX_BYTES + headerLength,
+        recordCount,
+        minMicros,
+        maxMicros,
+        processes,
+        compressedLengths.build(),
+        lengths.build());
+  }
+
+  /** Adds the records of a block that match the query. */
+  private static void readBlock(
+      FileChannel channel,
+      BlockHeader header,
+      Range<Instant> timeRange,
+      Optional<String> process,
+      ImmutableList.Builder<SyslogRecord> records)
+      throws IOException {
+    int count = header.recordCount();
+    long[] micros = new long[count];
+    ColumnReader times = readColumn(channel, header, TIME_COLUMN);
+    long previousMicros = header.minMicros();
+    for (int i = 0; i < count; i++) {
+      micros[i] = previousMicros + unzigzag(times.readVarLong());
+      previousMicros = micros[i];
+    }
+    int processIndex = process.isPresent() ? header.processes().indexOf(process.get()) : -1;
+    int[] processIndexes = new int[count];
+    ColumnReader processColumn = readColumn(channel, header, PROCESS_COLUMN);
+    boolean[] matches = new boolean[count];
+    boolean anyMatch = false;
+    for (int i = 0; i < count; i++) {
+      processIndexes[i] = (int) processColumn.readVarLong();
+      matches[i] =
+          timeRange.contains(toInstant(micros[i]))
+              && (processIndex < 0 || processIndexes[i] == processIndex);
+      anyMatch |= matches[i];
+    }
+    if (!anyMatch) {
+      return;
+    }
+
+    ColumnReader pids = readColumn(channel, header, PID_COLUMN);
+    ColumnReader levelColumn = readColumn(channel, header, LEVEL_COLUMN);
+    ImmutableList<String> levels = levelColumn.readDictionary();
+    ColumnReader subsystemColumn = readColumn(channel, header, SUBSYSTEM_COLUMN);
+    ImmutableList<String> subsystems = subsystemColumn.readDictionary();
+    ColumnReader messages = readColumn(channel, header, MESSAGE_COLUMN);
+    for (int i = 0; i < count; i++) {
+      int pid = (int) pids.readVarLong();
+      String level = levels.get((int) levelColumn.readVarLong());
+      String subsystem = subsystems.get((int) subsystemColumn.readVarLong());
+      // Messages have to be skipped over even if they don't match.
+      String message = messages.readString(matches[i]);
+      if (matches[i]) {
+        records.add(
+            SyslogRecord.create(
+                toInstant(micros[i]),
+                header.processes().get(processIndexes[i]),
+                pid,
+                level,
+                subsystem,
+                message));
+      }
+    }
+  }
+
+  private static ColumnReader readColumn(FileChannel channel, BlockHeader header, int column)
+      throws IOException {
+    long offset = header.columnsOffset();
+    for (int i = 0; i < column; i++) {
+      offset += header.compressedLengths().get(i);
+    }
+    ByteBuffer compressed = ByteBuffer.allocate(header.compressedLengths().get(column));
+    readFully(channel, compressed, offset);
+    byte[] bytes = new byte[header.lengths().get(column)];
+    Inflater inflater = new Inflater();
+    try {
+      inflater.setInput(compressed.array());
+      int length = 0;
+      while (length < bytes.length && !inflater.finished()) {
+        int inflated = inflater.inflate(bytes, length, bytes.length - length);
+        if (inflated == 0 && (inflater.needsInput() || inflater.needsDictionary())) {
+          break;
+        }
+        length += inflated;
+      }
+      if (length != bytes.length) {
+        throw new IOException("Corrupt column " + column + " in block at " + offset);
+      }
+    } catch (DataFormatException e) {
+      throw new IOException("Corrupt column " + column + " in block at " + offset, e);
+    } finally {
+      inflater.end();
+    }
+    return new ColumnReader(bytes, 0, bytes.length);
+  }
+
+  private static void readFully(FileChannel channel, ByteBuffer buffer, long position)
+      throws IOException {
+    while (buffer.hasRemaining()) {
+      int read = channel.read(buffer, position + buffer.position());
+      if (read < 0) {
+        throw new EOFException("Blocks file ends within a block");
+      }
+    }
+    buffer.flip();
+  }
+
+  private static int dictionaryIndex(Map<String, Integer> dictionary, String value) {
+    Integer index = dictionary.get(value);
+    if (index == null) {
+      index = dictionary.size();
+      dictionary.put(value, index);
+    }
+    return index;
+  }
+
+  private static long toMicros(Instant time) {
+    return Math.addExact(
+        Math.multiplyExact(time.getEpochSecond(), 1_000_000L), time.getNano() / 1000);
+  }
+
+  private static Instant toInstant(long micros) {
+    return Instant.ofEpochSecond(
+        Math.floorDiv(micros, 1_000_000L), Math.floorMod(micros, 1_000_000L) * 1000);
+  }
+
+  /** Maps integers of small magnitude to small unsigned integers, which have short encodings. */
+  private static long zigzag(long value) {
+    return value << 1 ^ value >> 63;
+  }
+
+  private static long unzigzag(long value) {
+    return value >>> 1 ^ -(value & 1);
+  }
+
+  /** Writes variable-length integers and strings to a column. */
+  private static final class ColumnWriter extends ByteArrayOutputStream {
+    void writeVarLong(long value) {
+      while ((value & ~0x7fL) != 0) {
+        write((int) (value & 0x7f) | 0x80);
+        value >>>= 7;
+      }
+      write((int) value);
+    }
+
+    void writeString(String value) {
+      byte[] bytes = value.getBytes(UTF_8);
+      writeVarLong(bytes.length);
+      write(bytes, 0, bytes.length);
+    }
+
+    /** Writes the values of a dictionary in the order of their indexes. */
+    void writeDictionary(Map<String, Integer> dictionary) {
+      String[] values = new String[dictionary.size()];
+      for (Map.Entry<String, Integer> entry : dictionary.entrySet()) {
+        values[entry.getValue()] = entry.getKey();
+      }
+      writeVarLong(values.length);
+      for (String value : values) {
+        writeString(value);
+      }
+    }
+
+    byte[] deflate(Deflater deflater) {
+      deflater.reset();
+      deflater.setInput(buf, 0, count);
+      deflater.finish();
+      ByteArrayOutputStream out = new ByteArrayOutputStream(count / 4 + 64);
+      byte[] chunk = new byte[64 * 1024];
+      while (!deflater.finished()) {
+        int length = deflater.deflate(chunk);
+        out.write(chunk, 0, length);
+      }
+      return out.toByteArray();
+    }
+  }
+
+  /** Reads what a {@link ColumnWriter} wrote. */
+  private static final class ColumnReader {
+    private final byte[] bytes;
+    private final int end;
+    private int position;
+
+    ColumnReader(byte[] bytes, int offset, int length) {
+      this.bytes = bytes;
+      this.position = offset;
+      this.end = offset + length;
+    }
+
+    long readVarLong() {
+      long value = 0;
+      for (int shift = 0; shift < 64; shift += 7) {
+        if (position >= end) {
+          throw new IllegalStateException("Column ends within a value");
+        }
+        int b = bytes[position++];
+        value |= (long) (b & 0x7f) << shift;
+        if ((b & 0x80) == 0) {
+          return value;
+        }
+      }
+      throw new IllegalStateException("Malformed variable-length integer");
+    }
+
+    /** Reads a string, or skips it and returns null if decode is false. */
+    String readString(boolean decode) {
+      int length = (int) readVarLong();
+      if (length < 0 || length > end - position) {
+        throw new IllegalStateException("Column ends within a string");
+      }
+      String value = decode ? new String(bytes, position, length, UTF_8) : null;
+      position += length;
+      return value;
+    }
+
+    ImmutableList<String> readDictionary() {
+      int size = (int) readVarLong();
+      ImmutableList.Builder<String> values = ImmutableList.builder();
+      for (int i = 0; i < size; i++) {
+        values.add(readString(true));
+      }
+      return values.build();
+    }
+  }
+
+  /** Parses the lines written to it and appends the records to the store. */
+  private final class IngestStream extends OutputStream {
+    private final SyslogParser parser;
+    private final ByteArrayOutputStream line = new ByteArrayOutputStream();
+    private boolean closed;
+
+    IngestStream(SyslogParser parser) {
+      this.parser = parser;
+    }
+
+    @Override
+    public void write(int b) throws IOException {
+      if (b == '\n') {
+        endLine();
+      } else {
+        line.write(b);
+      }
+    }
+
+    @Override
+    public void write(byte[] b, int off, int len) throws IOException {
+      int end = off + len;
+      for (int i = off; i < end; i++) {
+        if (b[i] == '\n') {
+          line.write(b, off, i - off);
+          endLine();
+          off = i + 1;
+        }
+      }
+      line.write(b, off, end - off);
+    }
+
+    @Override
+    public void close() throws IOException {
+      if (closed) {
+        return;
+      }
+      closed = true;
+      if (line.size() > 0) {
+        endLine();
+      }
+      Optional<SyslogRecord> record = parser.finish();
+      if (record.isPresent()) {
+        append(record.get());
+      }
+      SyslogStore.this.flush();
+    }
+
+    private void endLine() throws IOException {
+      String text = new String(line.toByteArray(), UTF_8);
+      line.reset();
+      if (text.endsWith("\r")) {
+        text = text.substring(0, text.length() - 1);
+      }
+      Optional<SyslogRecord> record = parser.add(text);
+      if (record.isPresent()) {
+        append(record.get());
+      }
+    }
+  }
+}
@@ -33,12 +33,16 @@ import com.google.iosdevicecontrol.IosModel;
 import com.google.iosdevicecontrol.IosModel.Architecture;
 import com.google.iosdevicecontrol.IosVersion;
 import com.google.iosdevicecontrol.real.ConfigurationProfile;
+import com.google.iosdevicecontrol.real.DeviceClockEstimate;
 import com.google.iosdevicecontrol.real.RealDevice;
 import com.google.iosdevicecontrol.simulator.SimulatorDevice;
 import java.io.IOException;
 import java.nio.file.Files;
 import java.nio.file.Path;
+import java.time.Duration;
+import java.time.Instant;
 import java.util.Objects;
+import java.util.Optional;
 import java.util.UUID;
 import java.util.concurrent.atomic.AtomicBoolean;
 
@@ -240,6 +244,11 @@ public abstract class FakeIosDevice implements IosDevice {
       super.checkResponsive();
     }
 
+    @Override
+    public Optional<ImmutableSet<IosAppInfo>> lastKnownApplications() {
+      return Optional.of(ImmutableSet.copyOf(super.applications.values()));
+    }
+
     @Override
     public ImmutableList<ConfigurationProfile> listConfigurationProfiles()
         throws IosDeviceException {
@@ -258,6 +267,12 @@ public abstract class FakeIosDevice implements IosDevice {
 
     @Override
     public void syncToSystemTime() throws IosDeviceException {}
+
+    @Override
+    public DeviceClockEstimate estimateClock() throws IosDeviceException {
+      super.checkResponsive();
+      return DeviceClockEstimate.create(System.nanoTime(), Instant.now(), 0, Duration.ZERO);
+    }
   }
 
   /** Fake implementation of {@link SimulatorDevice} */
@@ -0,0 +1,194 @@
+// Copyright 2017 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+package com.google.iosdevicecontrol.usb;
+
+import static java.nio.charset.StandardCharsets.UTF_8;
+
+import com.google.common.base.Splitter;
+import com.google.common.collect.ImmutableList;
+import com.google.common.collect.ImmutableMap;
+import com.google.iosdevicecontrol.util.FluentLogger;
+import java.io.Closeable;
+import java.io.IOException;
+import java.net.DatagramPacket;
+import java.net.DatagramSocket;
+import java.net.InetAddress;
+import java.net.InetSocketAddress;
+import java.util.Collection;
+import java.util.Comparator;
+import java.util.HashMap;
+import java.util.List;
+import java.util.Map;
+import java.util.TreeMap;
+
+/**
+ * Adds up the bytes that every tool on the host exchanges with each device, as reported by the
+ * native tools and the {@link UsbUsageReporter}. Only one service can listen on a port, so a host
+ * should start a single one, for as long as it controls devices.
+ */
+public final class UsbAccountingService implements Closeable {
+  private static final FluentLogger logger = FluentLogger.forEnclosingClass();
+
+  /** The hub of the devices the {@link UsbTopology} doesn't know. */
+  public static final String UNKNOWN_HUB = "unknown";
+
+  private static final int MAX_DATAGRAM_BYTES = 64 * 1024;
+  private static final Splitter LINE_SPLITTER = Splitter.on('\n').omitEmptyStrings();
+  private static final Splitter FIELD_SPLITTER = Splitter.on('\t');
+
+  private static final Comparator<UsbUsage> MOST_BYTES_FIRST =
+      Comparator.comparingLong(UsbUsage::totalBytes).reversed();
+
+  /** Starts a service on the port that the tools of the host report to. */
+  public static UsbAccountingService start() throws IOException {
+    int port = UsbUsageReporter.hostPort();
+    if (port == 0) {
+      throw new IOException(UsbUsageReporter.PORT_ENVIRONMENT_VARIABLE + " turns reporting off");
+    }
+    return start(port);
+  }
+
+  /** Starts a service on the specified port of the loopback interface, or any free port if 0. */
+  public static UsbAccountingService start(int port) throws IOException {
+    DatagramSocket socket =
+        new DatagramSocket(new InetSocketAddress(InetAddress.getLoopbackAddress(), port));
+    UsbAccountingService service = new UsbAccountingService(socket);
+    service.receiver.start();
+    return service;
+  }
+
+  private final DatagramSocket socket;
+  private final Thread receiver;
+  /** The usage by device and service, guarded by itself. */
+  private final Map<String, Map<String, UsbUsage>> usage = new HashMap<>();
+
+  private UsbAccountingService(DatagramSocket socket) {
+    this.socket = socket;
+    receiver = new Thread(this::receive, "usb-accounting");
+    receiver.setDaemon(true);
+  }
+
+  /** The port the service listens on. */
+  public int port() {
+    return socket.getLocalPort();
+  }
+
+  /** Returns the usage of each device and service, the one with the most bytes first. */
+  public ImmutableList<UsbUsage> usage() {
+    synchronized (usage) {
+      return usage
+          .values()
+          .stream()
+          .flatMap(services -> services.values().stream())
+          .sorted(MOST_BYTES_FIRST)
+          .collect(ImmutableList.toImmutableList());
+    }
+  }
+
+  /** Returns the usage of each device over all its services, the device with most bytes first. */
+  public ImmutableList<UsbUsage> usageByDevice() {
+    synchronized (usage) {
+      return usage
+          .entrySet()
+          .stream()
+          .map(device -> sum(device.getKey(), device.getValue().values()))
+          .sorted(MOST_BYTES_FIRST)
+          .collect(ImmutableList.toImmutableList());
+    }
+  }
+
+  /**
+   * Returns the usage of each device over all its services, grouped by the hub it is attached to,
+   * or {@link #UNKNOWN_HUB} if the topology doesn't have the device. Hubs are sorted by name.
+   */
+  public ImmutableMap<String, ImmutableList<UsbUsage>> usageByHub(UsbTopology topology) {
+    Map<String, ImmutableList.Builder<UsbUsage>> hubs = new TreeMap<>();
+    for (UsbUsage device : usageByDevice()) {
+      hubs.computeIfAbsent(
+              topology.hubOf(device.udid()).orElse(UNKNOWN_HUB), h -> ImmutableList.builder())
+          .add(device);
+    }
+    ImmutableMap.Builder<String, ImmutableList<UsbUsage>> byHub = ImmutableMap.builder();
+    hubs.forEach((hub, devices) -> byHub.put(hub, devices.build()));
+    return byHub.build();
+  }
+
+  @Override
+  public void close() {
+    socket.close();
+  }
+
+  private static UsbUsage sum(String udid, Collection<UsbUsage> services) {
+    UsbUsage total = UsbUsage.create(udid, "", 0, 0);
+    for (UsbUsage service : services) {
+      total = total.plus(service.bytesIn(), service.bytesOut());
+    }
+    return total;
+  }
+
+  /** Returns the bytes in the field, or -1 if it is not a count of bytes. */
+  private static long parseBytes(String field) {
+    try {
+      return Long.parseLong(field);
+    } catch (NumberFormatException e) {
+      return -1;
+    }
+  }
+
+  private void receive() {
+    byte[] buffer = new byte[MAX_DATAGRAM_BYTES];
+    DatagramPacket packet = new DatagramPacket(buffer, buffer.length);
+    while (!socket.isClosed()) {
+      try {
+        packet.setLength(buffer.length);
+        socket.receive(packet);
+      } catch (IOException e) {
+        if (!socket.isClosed()) {
+          logger.atWarning().withCause(e).log("Stopped receiving USB usage reports");
+        }
+        return;
+      }
+      add(new String(packet.getData(), packet.getOffset(), packet.getLength(), UTF_8));
+    }
+  }
+
+  /** Adds the lines of a datagram, skipping any that are malformed. */
+  void add(String datagram) {
+    if (!datagram.startsWith(UsbUsageReporter.HEADER)) {
+      logger.atFine().log("Ignoring datagram that is no USB usage report");
+      return;
+    }
+    for (String line :
+        LINE_SPLITTER.split(datagram.substring(UsbUsageReporter.HEADER.length()))) {
+      List<String> fields = FIELD_SPLITTER.splitToList(line);
+      long bytesIn = fields.size() == 4 ? parseBytes(fields.get(2)) : -1;
+      long bytesOut = fields.size() == 4 ? parseBytes(fields.get(3)) : -1;
+      if (bytesIn < 0 || bytesOut < 0) {
+        logger.atFine().log("Ignoring malformed USB usage: %s", line);
+        continue;
+      }
+      String udid = fields.get(0);
+      String service = fields.get(1);
+      synchronized (usage) {
+        usage
+            .computeIfAbsent(udid, u -> new HashMap<>())
+            .merge(
+                service,
+                UsbUsage.create(udid, service, bytesIn, bytesOut),
+                (old, added) -> old.plus(added.bytesIn(), added.bytesOut()));
+      }
+    }
+  }
+}
@@ -0,0 +1,102 @@
+// Copyright 2017 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+package com.google.iosdevicecontrol.usb;
+
+import static com.google.iosdevicecontrol.command.Command.command;
+
+import com.dd.plist.NSArray;
+import com.dd.plist.NSDictionary;
+import com.dd.plist.NSObject;
+import com.google.common.base.Ascii;
+import com.google.common.collect.ImmutableMap;
+import com.google.iosdevicecontrol.command.CommandException;
+import com.google.iosdevicecontrol.util.PlistParser;
+import java.util.HashMap;
+import java.util.Map;
+import java.util.Optional;
+
+/** The hubs that devices are attached to, as the USB tree of system_profiler shows them. */
+public final class UsbTopology {
+  private static final String ITEMS_KEY = "_items";
+  private static final String NAME_KEY = "_name";
+  private static final String SERIAL_NUMBER_KEY = "serial_num";
+  private static final String LOCATION_KEY = "location_id";
+
+  /** Queries the current USB tree of the host. */
+  public static UsbTopology query() throws CommandException, InterruptedException {
+    String xml =
+        command("system_profiler", "-xml", "SPUSBDataType").execute().stdoutStringUtf8();
+    return fromXml(xml);
+  }
+
+  /** Parses the XML output of "system_profiler -xml SPUSBDataType". */
+  static UsbTopology fromXml(String xml) {
+    Map<String, String> hubs = new HashMap<>();
+    addItems(PlistParser.fromXml(xml), null, hubs);
+    return new UsbTopology(ImmutableMap.copyOf(hubs));
+  }
+
+  /** Adds the devices in the items to hubs, by their serial number. */
+  private static void addItems(NSObject items, String hub, Map<String, String> hubs) {
+    if (!(items instanceof NSArray)) {
+      return;
+    }
+    for (NSObject item : ((NSArray) items).getArray()) {
+      if (!(item instanceof NSDictionary)) {
+        continue;
+      }
+      NSDictionary dict = (NSDictionary) item;
+      NSObject serialNumber = dict.get(SERIAL_NUMBER_KEY);
+      if (serialNumber != null && hub != null) {
+        hubs.put(normalize(serialNumber.toString()), hub);
+      }
+      addItems(dict.get(ITEMS_KEY), hubName(dict), hubs);
+    }
+  }
+
+  /** Names a hub or bus by its name and, if it has one, its location. */
+  private static String hubName(NSDictionary dict) {
+    NSObject name = dict.get(NAME_KEY);
+    NSObject location = dict.get(LOCATION_KEY);
+    String hub = name == null ? "" : name.toString();
+    if (location != null) {
+      // The location is followed by the address on the bus, e.g. "0x14100000 / 2".
+      hub += " @ " + location.toString().split(" ", 2)[0];
+    }
+    return hub;
+  }
+
+  /**
+   * Devices report their UDID as the USB serial number, without the dash of the newer UDIDs and
+   * possibly in another case.
+   */
+  private static String normalize(String udid) {
+    return Ascii.toLowerCase(udid.replace("-", ""));
+  }
+
+  private final ImmutableMap<String, String> hubs;
+
+  private UsbTopology(ImmutableMap<String, String> hubs) {
+    this.hubs = hubs;
+  }
+
+  /**
+   * Returns the hub or bus the device with the UDID is attached to, e.g. "USB3.0 Hub @ 0x14100000",
+   * or empty if the device is not attached.
+   */
+  public Optional<String> hubOf(String udid) {
+    return Optional.ofNullable(hubs.get(normalize(udid)));
+  }
+}
@@ -0,0 +1,44 @@
+// Copyright 2017 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+package com.google.iosdevicecontrol.usb;
+
+import com.google.auto.value.AutoValue;
+
+/** The bytes exchanged with one service of a device over USB. */
+@AutoValue
+public abstract class UsbUsage {
+  public static UsbUsage create(String udid, String service, long bytesIn, long bytesOut) {
+    return new AutoValue_UsbUsage(udid, service, bytesIn, bytesOut);
+  }
+
+  public abstract String udid();
+
+  /** The lockdown service, e.g. "com.apple.debugserver", or empty for all services of a device. */
+  public abstract String service();
+
+  /** The bytes received from the device. */
+  public abstract long bytesIn();
+
+  /** The bytes sent to the device. */
+  public abstract long bytesOut();
+
+  public final long totalBytes() {
+    return bytesIn() + bytesOut();
+  }
+
+  UsbUsage plus(long bytesIn, long bytesOut) {
+    return create(udid(), service(), bytesIn() + bytesIn, bytesOut() + bytesOut);
+  }
+}
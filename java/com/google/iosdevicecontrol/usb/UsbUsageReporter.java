@@ -0,0 +1,116 @@
+// Copyright 2017 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+package com.google.iosdevicecontrol.usb;
+
+import static com.google.common.base.Preconditions.checkArgument;
+import static java.nio.charset.StandardCharsets.UTF_8;
+
+import com.google.common.collect.ImmutableMap;
+import com.google.iosdevicecontrol.util.FluentLogger;
+import java.io.IOException;
+import java.net.DatagramPacket;
+import java.net.DatagramSocket;
+import java.net.InetAddress;
+
+/**
+ * Reports bytes exchanged with devices to the {@link UsbAccountingService} of the host, the same
+ * way the native tools do: as a UDP datagram to a port on the loopback interface, which is dropped
+ * if no service listens. This is for transfers the library makes through tools that don't report
+ * their own bytes.
+ */
+public final class UsbUsageReporter {
+  private static final FluentLogger logger = FluentLogger.forEnclosingClass();
+
+  /** The port the native tools report to, unless the environment variable is set. */
+  public static final int DEFAULT_PORT = 27760;
+
+  /** The environment variable with the port to report to, where 0 turns reporting off. */
+  public static final String PORT_ENVIRONMENT_VARIABLE = "IOS_USB_ACCOUNTING_PORT";
+
+  /** The first line of each datagram, followed by a tab-separated line per device and service. */
+  static final String HEADER = "usb-accounting 1\n";
+
+  private static final UsbUsageReporter HOST = new UsbUsageReporter(hostPort());
+
+  /** Returns the reporter to the port of the host, which the native tools also report to. */
+  public static UsbUsageReporter forHost() {
+    return HOST;
+  }
+
+  /** Returns a reporter to the specified port. */
+  public static UsbUsageReporter toPort(int port) {
+    checkArgument(port > 0 && port <= 0xFFFF, "Invalid port: %s", port);
+    return new UsbUsageReporter(port);
+  }
+
+  /**
+   * Returns the environment that passes the port of the host on to the native tools, which is
+   * empty if the port is the default one.
+   */
+  public static ImmutableMap<String, String> toolEnvironment() {
+    String port = System.getenv(PORT_ENVIRONMENT_VARIABLE);
+    return port == null ? ImmutableMap.of() : ImmutableMap.of(PORT_ENVIRONMENT_VARIABLE, port);
+  }
+
+  /** The port of the host, or 0 if reporting is turned off. */
+  static int hostPort() {
+    String port = System.getenv(PORT_ENVIRONMENT_VARIABLE);
+    if (port == null) {
+      return DEFAULT_PORT;
+    }
+    try {
+      int value = Integer.parseInt(port.trim());
+      return value > 0 && value <= 0xFFFF ? value : 0;
+    } catch (NumberFormatException e) {
+      logger.atWarning().log("Ignoring invalid %s: %s", PORT_ENVIRONMENT_VARIABLE, port);
+      return 0;
+    }
+  }
+
+  private final int port;
+  private DatagramSocket socket;
+
+  private UsbUsageReporter(int port) {
+    this.port = port;
+  }
+
+  /**
+   * Reports bytes received from (in) and sent to (out) the service of the device. Failures are
+   * only logged, since accounting must never fail a transfer.
+   */
+  public void report(String udid, String service, long bytesIn, long bytesOut) {
+    checkArgument(bytesIn >= 0 && bytesOut >= 0, "Negative bytes: %s, %s", bytesIn, bytesOut);
+    if (port == 0 || bytesIn + bytesOut == 0) {
+      return;
+    }
+    byte[] datagram =
+        (HEADER + udid + '\t' + service + '\t' + bytesIn + '\t' + bytesOut + '\n').getBytes(UTF_8);
+    try {
+      socket()
+          .send(
+              new DatagramPacket(
+                  datagram, datagram.length, InetAddress.getLoopbackAddress(), port));
+    } catch (IOException e) {
+      logger.atFine().withCause(e).log("Could not report USB usage of %s", udid);
+    }
+  }
+
+  private synchronized DatagramSocket socket() throws IOException {
+    if (socket == null) {
+      socket = new DatagramSocket();
+    }
+    return socket;
+  }
+}
@@ -0,0 +1,106 @@
+// Copyright 2017 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+package com.google.iosdevicecontrol.util;
+
+import static com.google.common.base.Preconditions.checkArgument;
+import static com.google.common.base.Preconditions.checkNotNull;
+
+import com.google.common.util.concurrent.Uninterruptibles;
+import java.util.concurrent.ArrayBlockingQueue;
+import java.util.concurrent.BlockingQueue;
+import java.util.concurrent.CountDownLatch;
+import java.util.concurrent.TimeUnit;
+import java.util.concurrent.atomic.AtomicLong;
+import java.util.logging.Handler;
+import java.util.logging.Level;
+import java.util.logging.LogRecord;
+
+/**
+ * A log handler that publishes records to another handler on a background thread, so that logging
+ * threads never wait for the other handler's I/O. The records wait in a bounded queue, and when it
+ * is full new records are dropped rather than blocking the logging thread; the number dropped is
+ * logged once there is room again.
+ */
+final class AsyncLogHandler extends Handler {
+  private final Handler delegate;
+  private final BlockingQueue<Object> queue;
+  private final AtomicLong dropped = new AtomicLong();
+
+  /** Creates the handler and starts its thread, which flushes the queue when the JVM exits. */
+  AsyncLogHandler(Handler delegate, int capacity) {
+    checkArgument(capacity > 0, "Invalid capacity: %s", capacity);
+    this.delegate = checkNotNull(delegate);
+    this.queue = new ArrayBlockingQueue<>(capacity);
+    Thread thread = new Thread(this::publishQueued, "async-log-handler");
+    thread.setDaemon(true);
+    thread.start();
+    Runtime.getRuntime().addShutdownHook(new Thread(() -> flush(1, TimeUnit.SECONDS)));
+  }
+
+  @Override
+  public void publish(LogRecord record) {
+    if (!isLoggable(record)) {
+      return;
+    }
+    if (!queue.offer(record)) {
+      dropped.incrementAndGet();
+    }
+  }
+
+  /** Waits until the records logged so far have been published, for at most a few seconds. */
+  @Override
+  public void flush() {
+    flush(5, TimeUnit.SECONDS);
+  }
+
+  private void flush(long timeout, TimeUnit unit) {
+    // The flush marker is queued like a record, so it is reached once the records before it are.
+    CountDownLatch flushed = new CountDownLatch(1);
+    try {
+      if (queue.offer(flushed, timeout, unit)) {
+        flushed.await(timeout, unit);
+      }
+    } catch (InterruptedException e) {
+      Thread.currentThread().interrupt();
+    }
+  }
+
+  @Override
+  public void close() {
+    flush();
+    delegate.close();
+  }
+
+  private void publishQueued() {
+    while (true) {
+      Object next = Uninterruptibles.takeUninterruptibly(queue);
+      long droppedCount = dropped.getAndSet(0);
+      if (droppedCount > 0) {
+        delegate.publish(
+            new LogRecord(Level.WARNING, droppedCount + " log records dropped, logging too fast"));
+      }
+      if (next instanceof CountDownLatch) {
+        delegate.flush();
+        ((CountDownLatch) next).countDown();
+      } else {
+        try {
+          delegate.publish((LogRecord) next);
+        } catch (RuntimeException e) {
+          reportError(null, e, ERROR_WRITE_FAILURE);
+        }
+      }
+    }
+  }
+}
@@ -0,0 +1,42 @@
+// Copyright 2017 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+package com.google.iosdevicecontrol.util;
+
+import java.io.IOException;
+import java.nio.file.Files;
+import java.nio.file.Path;
+import java.nio.file.StandardCopyOption;
+
+/** Static utilities to replace files without readers ever seeing them partially written. */
+public final class AtomicFiles {
+  /**
+   * Writes bytes to a temporary file next to the specified path, then moves it over the path
+   * atomically, so a concurrent reader sees either the previous file or the complete new one. The
+   * parent directory must exist.
+   */
+  public static void write(Path path, byte[] bytes) throws IOException {
+    Path tempPath = Files.createTempFile(path.getParent(), "." + path.getFileName(), ".tmp");
+    try {
+      Files.write(tempPath, bytes);
+      Files.move(
+          tempPath, path, StandardCopyOption.REPLACE_EXISTING, StandardCopyOption.ATOMIC_MOVE);
+    } finally {
+      Files.deleteIfExists(tempPath);
+    }
+  }
+
+  private AtomicFiles() {}
+}
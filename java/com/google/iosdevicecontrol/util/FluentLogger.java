@@ -14,78 +14,242 @@
 
 package com.google.iosdevicecontrol.util;
 
-import java.util.Optional;
+import static com.google.common.base.Preconditions.checkArgument;
+
+import java.util.concurrent.ConcurrentHashMap;
+import java.util.concurrent.ConcurrentMap;
+import java.util.concurrent.TimeUnit;
+import java.util.concurrent.atomic.AtomicLong;
 import java.util.logging.ConsoleHandler;
+import java.util.logging.Handler;
 import java.util.logging.Level;
 import java.util.logging.Logger;
+import javax.annotation.Nullable;
 
 /**
  * Class for a fluent logger. Used as a factory of instances to build log statements via method
  * chaining.
+ *
+ * <p>A statement at a disabled level costs a level check and nothing else: {@link #at} returns a
+ * shared no-op statement, and the message is never formatted. Records are written to the console
+ * by a background thread, so logging threads do not wait for console I/O.
  */
 public final class FluentLogger {
+  private static final int QUEUED_RECORDS = 1024;
+  private static final Object[] NO_PARAMS = new Object[0];
+
+  // Shared by all loggers, so that they are written by a single thread in the order logged.
+  private static final Handler HANDLER = new AsyncLogHandler(new ConsoleHandler(), QUEUED_RECORDS);
+
   /** Returns a generic fluent logger for a class. */
   public static FluentLogger forEnclosingClass() {
     StackTraceElement caller = new Throwable().getStackTrace()[1];
     Logger logger = Logger.getLogger(caller.getClassName());
     logger.setUseParentHandlers(false);
-    logger.addHandler(new ConsoleHandler());
-    return new FluentLogger(logger, Level.OFF, Optional.empty());
+    logger.addHandler(HANDLER);
+    return new FluentLogger(logger);
   }
 
   private final Logger logger;
-  private final Level level;
-  private final Optional<Throwable> cause;
+  private final ConcurrentMap<StackTraceElement, RateLimit> rateLimits = new ConcurrentHashMap<>();
 
-  private FluentLogger(Logger logger, Level level, Optional<Throwable> cause) {
-    this.level = level;
+  private FluentLogger(Logger logger) {
     this.logger = logger;
-    this.cause = cause;
-  }
-
-  /** Returns a fluent logger with the specified cause. */
-  public FluentLogger withCause(Throwable cause) {
-    return new FluentLogger(logger, level, Optional.of(cause));
   }
 
   /** Convenience method for at({@link Level#INFO}). */
-  public FluentLogger atInfo() {
+  public Api atInfo() {
     return at(Level.INFO);
   }
 
   /** Convenience method for at({@link Level#SEVERE}). */
-  public FluentLogger atSevere() {
+  public Api atSevere() {
     return at(Level.SEVERE);
   }
 
   /** Convenience method for at({@link Level#WARNING}). */
-  public FluentLogger atWarning() {
+  public Api atWarning() {
     return at(Level.WARNING);
   }
 
   /** Convenience method for at({@link Level#FINE}). */
-  public FluentLogger atFine() {
+  public Api atFine() {
     return at(Level.FINE);
   }
 
-  /** Returns a fluent logger with the specified logging level. */
-  public FluentLogger at(Level level) {
-    return new FluentLogger(logger, level, cause);
+  /** Returns a log statement at the specified logging level. */
+  public Api at(Level level) {
+    return logger.isLoggable(level) ? new Context(level) : NoOp.INSTANCE;
   }
 
-  /** Print a log of the {@link FluentLogger#cause}. */
-  public void log() {
-    log("");
+  /**
+   * A log statement under construction. The methods that configure it return the same statement,
+   * and it must not be used after it is logged.
+   */
+  public interface Api {
+    /** Logs the statement with the specified cause. */
+    Api withCause(Throwable cause);
+
+    /**
+     * Logs the statement only on the first and every {@code n}th time it is reached from the same
+     * line of code.
+     */
+    Api every(int n);
+
+    /**
+     * Logs the statement only if it was not logged from the same line of code within the
+     * specified period. With {@link #every}, both conditions must be met.
+     */
+    Api atMostEvery(int period, TimeUnit unit);
+
+    /** Print a log of the cause. */
+    void log();
+
+    /** Print a formatted log message without parameters, so only escapes such as %% apply. */
+    void log(String message);
+
+    /** Print a formatted log message. */
+    void log(String message, @Nullable Object param);
+
+    /** Print a formatted log message. */
+    void log(String message, @Nullable Object param1, @Nullable Object param2);
+
+    /** Print a formatted log message. */
+    void log(String message, Object... params);
   }
 
-  /** Print a formatted log message. */
-  public void log(String message, Object... params) {
-    StackTraceElement caller = new Throwable().getStackTrace()[1];
-    String formatMsg = String.format(message, params);
-    if (cause.isPresent()) {
-      logger.logp(level, logger.getName(), caller.getMethodName(), formatMsg, cause.get());
-    } else {
-      logger.logp(level, logger.getName(), caller.getMethodName(), formatMsg);
+  /** The statement at disabled levels, which ignores everything. */
+  private enum NoOp implements Api {
+    INSTANCE;
+
+    @Override
+    public Api withCause(Throwable cause) {
+      return this;
+    }
+
+    @Override
+    public Api every(int n) {
+      return this;
+    }
+
+    @Override
+    public Api atMostEvery(int period, TimeUnit unit) {
+      return this;
+    }
+
+    @Override
+    public void log() {}
+
+    @Override
+    public void log(String message) {}
+
+    @Override
+    public void log(String message, @Nullable Object param) {}
+
+    @Override
+    public void log(String message, @Nullable Object param1, @Nullable Object param2) {}
+
+    @Override
+    public void log(String message, Object... params) {}
+  }
+
+  /** The counts and times of a rate limited statement at one line of code. */
+  private static final class RateLimit {
+    final AtomicLong count = new AtomicLong();
+    final AtomicLong nextAllowedNanos = new AtomicLong(Long.MIN_VALUE);
+    final AtomicLong skipped = new AtomicLong();
+  }
+
+  /** A statement at an enabled level. */
+  private final class Context implements Api {
+    private final Level level;
+    @Nullable private Throwable cause;
+    private int every = 1;
+    private long periodNanos;
+
+    private Context(Level level) {
+      this.level = level;
+    }
+
+    @Override
+    public Api withCause(Throwable cause) {
+      this.cause = cause;
+      return this;
+    }
+
+    @Override
+    public Api every(int n) {
+      checkArgument(n > 0, "Invalid rate: %s", n);
+      every = n;
+      return this;
+    }
+
+    @Override
+    public Api atMostEvery(int period, TimeUnit unit) {
+      checkArgument(period >= 0, "Invalid period: %s", period);
+      periodNanos = unit.toNanos(period);
+      return this;
+    }
+
+    @Override
+    public void log() {
+      logImpl("", (Object[]) null);
+    }
+
+    @Override
+    public void log(String message) {
+      logImpl(message, NO_PARAMS);
+    }
+
+    @Override
+    public void log(String message, @Nullable Object param) {
+      logImpl(message, param);
+    }
+
+    @Override
+    public void log(String message, @Nullable Object param1, @Nullable Object param2) {
+      logImpl(message, param1, param2);
+    }
+
+    @Override
+    public void log(String message, Object... params) {
+      logImpl(message, params);
+    }
+
+    /** Must only be called directly by the log methods, which are called by the logging code. */
+    private void logImpl(String message, @Nullable Object... params) {
+      StackTraceElement caller = new Throwable().getStackTrace()[2];
+      long skipped = 0;
+      if (every > 1 || periodNanos > 0) {
+        RateLimit rateLimit = rateLimits.computeIfAbsent(caller, c -> new RateLimit());
+        if (!tryAcquire(rateLimit)) {
+          rateLimit.skipped.incrementAndGet();
+          return;
+        }
+        skipped = rateLimit.skipped.getAndSet(0);
+      }
+      String formatMsg = params == null ? message : String.format(message, params);
+      if (skipped > 0) {
+        formatMsg += " [" + skipped + " similar messages skipped]";
+      }
+      if (cause != null) {
+        logger.logp(level, logger.getName(), caller.getMethodName(), formatMsg, cause);
+      } else {
+        logger.logp(level, logger.getName(), caller.getMethodName(), formatMsg);
+      }
+    }
+
+    private boolean tryAcquire(RateLimit rateLimit) {
+      if (rateLimit.count.getAndIncrement() % every != 0) {
+        return false;
+      }
+      if (periodNanos > 0) {
+        long now = System.nanoTime();
+        long next = rateLimit.nextAllowedNanos.get();
+        return (next == Long.MIN_VALUE || now - next >= 0)
+            && rateLimit.nextAllowedNanos.compareAndSet(next, now + periodNanos);
+      }
+      return true;
     }
   }
 }
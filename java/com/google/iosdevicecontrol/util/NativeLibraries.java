@@ -0,0 +1,60 @@
+// Copyright 2017 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+package com.google.iosdevicecontrol.util;
+
+import java.nio.file.Files;
+import java.nio.file.Path;
+import java.nio.file.Paths;
+import java.util.Map;
+import java.util.concurrent.ConcurrentHashMap;
+
+/** Loads the optional JNI libraries built from the native tools in third_party. */
+public final class NativeLibraries {
+  private static final FluentLogger logger = FluentLogger.forEnclosingClass();
+
+  /** Where "make install-jni" puts the libraries; not on the default java.library.path on macOS. */
+  private static final Path INSTALL_DIR = Paths.get("/usr/local/lib");
+
+  private static final Map<String, Boolean> loaded = new ConcurrentHashMap<>();
+
+  /**
+   * Loads the native library with the specified name, e.g. "webinspectorproxy" for
+   * libwebinspectorproxy.dylib, and returns whether it is available. The result is memoized, so a
+   * missing library is only looked up once.
+   */
+  public static boolean load(String name) {
+    return loaded.computeIfAbsent(name, NativeLibraries::tryLoad);
+  }
+
+  private static boolean tryLoad(String name) {
+    try {
+      System.loadLibrary(name);
+      return true;
+    } catch (UnsatisfiedLinkError e) {
+      Path installed = INSTALL_DIR.resolve(System.mapLibraryName(name));
+      if (Files.exists(installed)) {
+        try {
+          System.load(installed.toString());
+          return true;
+        } catch (UnsatisfiedLinkError installedError) {
+          logger.atWarning().withCause(installedError).log("Could not load %s", installed);
+        }
+      }
+      return false;
+    }
+  }
+
+  private NativeLibraries() {}
+}
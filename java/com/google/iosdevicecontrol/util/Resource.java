@@ -20,22 +20,51 @@ import com.google.auto.value.AutoValue;
 import com.google.common.annotations.VisibleForTesting;
 import com.google.common.collect.Interner;
 import com.google.common.collect.Interners;
+import com.google.common.hash.HashCode;
+import com.google.common.hash.Hashing;
+import com.google.common.hash.HashingInputStream;
+import com.google.common.io.ByteStreams;
+import com.google.common.io.MoreFiles;
 import java.io.File;
 import java.io.IOException;
 import java.io.InputStream;
+import java.nio.channels.FileChannel;
+import java.nio.channels.FileLock;
 import java.nio.file.Files;
+import java.nio.file.LinkOption;
 import java.nio.file.Path;
+import java.nio.file.Paths;
+import java.nio.file.StandardOpenOption;
+import java.nio.file.attribute.PosixFilePermission;
+import java.nio.file.attribute.PosixFilePermissions;
+import java.nio.file.attribute.UserPrincipal;
+import java.util.EnumSet;
+import java.util.Set;
 
 /**
  * A wrapper to a Java resource, for easy and memoized conversion to a path on disk.
+ *
+ * <p>Resources are extracted into a cache directory shared by all JVMs of the user, under the
+ * SHA-256 hash of their content, so a resource is only written to disk the first time any JVM
+ * extracts that version of it. The cache directory can be set with the {@value
+ * #CACHE_DIR_PROPERTY} system property. It is created accessible only to the user, and is not used
+ * if it belongs to another user or others can write to it.
  */
 @AutoValue
 public abstract class Resource {
+  private static final FluentLogger logger = FluentLogger.forEnclosingClass();
+
+  /** The system property that overrides the directory resources are extracted to. */
+  public static final String CACHE_DIR_PROPERTY = "iosdevicecontrol.resource.cache";
+
   private static final ClassLoader CLASS_LOADER = Resource.class.getClassLoader();
   private static final Interner<Resource> INTERNER = Interners.newStrongInterner();
 
-  /** The default strategy for copying a resource to a file system path. */
-  private static final ResourceToPathCopier DEFAULT_COPIER =
+  private static final Set<PosixFilePermission> SHARED_WRITE_PERMISSIONS =
+      EnumSet.of(PosixFilePermission.GROUP_WRITE, PosixFilePermission.OTHERS_WRITE);
+
+  /** Copies a resource into a temporary directory of this JVM. */
+  private static final ResourceToPathCopier TEMP_DIR_COPIER =
       new ResourceToPathCopier() {
         @Override
         public Path copy(String resourceName) throws IOException {
@@ -48,6 +77,25 @@ public abstract class Resource {
         }
       };
 
+  /**
+   * The default strategy for copying a resource to a file system path: through the shared cache,
+   * or into a temporary directory if the cache cannot be used.
+   */
+  private static final ResourceToPathCopier DEFAULT_COPIER =
+      new ResourceToPathCopier() {
+        private final ResourceToPathCopier cachingCopier = cachingCopier(defaultCacheDir());
+
+        @Override
+        public Path copy(String resourceName) throws IOException {
+          try {
+            return cachingCopier.copy(resourceName);
+          } catch (IOException e) {
+            logger.atWarning().withCause(e).log("Could not extract %s to the cache", resourceName);
+            return TEMP_DIR_COPIER.copy(resourceName);
+          }
+        }
+      };
+
   /**
    * Returns the Java resource with the specified name.
    *
@@ -127,4 +175,116 @@ public abstract class Resource {
   interface ResourceToPathCopier {
     Path copy(String resourceName) throws IOException;
   }
+
+  /**
+   * Returns a copier that extracts resources to {@code <cacheDir>/<sha256>/<resource name>}. A file
+   * only ever appears there complete, by an atomic move, and a lock file serializes the JVMs that
+   * extract the same content at the same time. A file that is already there is reused if its
+   * content hash matches; otherwise it is extracted again. The copier fails if the cache directory
+   * belongs to another user or others can write to it.
+   */
+  @VisibleForTesting
+  static ResourceToPathCopier cachingCopier(Path cacheDir) {
+    return new ResourceToPathCopier() {
+      @Override
+      public synchronized Path copy(String resourceName) throws IOException {
+        checkCacheDir(cacheDir);
+        // Hashing reads the resource, but only extracting it writes to disk.
+        HashCode hash;
+        long size;
+        try (HashingInputStream in =
+            new HashingInputStream(Hashing.sha256(), openResource(resourceName))) {
+          size = ByteStreams.exhaust(in);
+          hash = in.hash();
+        }
+        Path hashDir = cacheDir.resolve(hash.toString());
+        Path path = hashDir.resolve(resourceName.replace('/', File.separatorChar));
+        if (isExtracted(path, size, hash)) {
+          return path;
+        }
+
+        Files.createDirectories(path.getParent());
+        // The lock is only held while extracting, and is released if the JVM dies.
+        try (FileChannel lockChannel =
+                FileChannel.open(
+                    cacheDir.resolve(hash + ".lock"),
+                    StandardOpenOption.CREATE,
+                    StandardOpenOption.WRITE);
+            FileLock lock = lockChannel.lock()) {
+          if (isExtracted(path, size, hash)) {
+            return path;
+          }
+          byte[] bytes;
+          try (InputStream in = openResource(resourceName)) {
+            bytes = ByteStreams.toByteArray(in);
+          }
+          if (!Hashing.sha256().hashBytes(bytes).equals(hash)) {
+            throw new IOException("Resource changed while it was extracted: " + resourceName);
+          }
+          AtomicFiles.write(path, bytes);
+        }
+        return path;
+      }
+    };
+  }
+
+  private static Path defaultCacheDir() {
+    String cacheDir = System.getProperty(CACHE_DIR_PROPERTY);
+    if (cacheDir != null) {
+      return Paths.get(cacheDir);
+    }
+    return Paths.get(
+        System.getProperty("java.io.tmpdir"),
+        "ios-device-control-resources-" + System.getProperty("user.name"));
+  }
+
+  /**
+   * Creates the cache directory accessible only to the user if it does not exist, and checks that
+   * an existing one belongs to the user and that others cannot write to it, so that no other user
+   * can plant files in it.
+   */
+  private static void checkCacheDir(Path cacheDir) throws IOException {
+    boolean posix = cacheDir.getFileSystem().supportedFileAttributeViews().contains("posix");
+    if (!Files.exists(cacheDir, LinkOption.NOFOLLOW_LINKS)) {
+      if (posix) {
+        Files.createDirectories(
+            cacheDir,
+            PosixFilePermissions.asFileAttribute(PosixFilePermissions.fromString("rwx------")));
+      } else {
+        Files.createDirectories(cacheDir);
+      }
+    }
+    if (!Files.isDirectory(cacheDir, LinkOption.NOFOLLOW_LINKS)) {
+      throw new IOException("Resource cache is not a directory: " + cacheDir);
+    }
+    UserPrincipal user =
+        cacheDir
+            .getFileSystem()
+            .getUserPrincipalLookupService()
+            .lookupPrincipalByName(System.getProperty("user.name"));
+    if (!Files.getOwner(cacheDir, LinkOption.NOFOLLOW_LINKS).equals(user)) {
+      throw new IOException("Resource cache belongs to another user: " + cacheDir);
+    }
+    if (posix) {
+      Set<PosixFilePermission> permissions =
+          Files.getPosixFilePermissions(cacheDir, LinkOption.NOFOLLOW_LINKS);
+      if (permissions.stream().anyMatch(SHARED_WRITE_PERMISSIONS::contains)) {
+        throw new IOException("Resource cache is writable by others: " + cacheDir);
+      }
+    }
+  }
+
+  private static InputStream openResource(String resourceName) throws IOException {
+    InputStream stream = CLASS_LOADER.getResourceAsStream(resourceName);
+    if (stream == null) {
+      throw new IOException("Resource does not exist: " + resourceName);
+    }
+    return stream;
+  }
+
+  private static boolean isExtracted(Path path, long size, HashCode hash) throws IOException {
+    return Files.isRegularFile(path, LinkOption.NOFOLLOW_LINKS)
+        && Files.size(path) == size
+        && MoreFiles.asByteSource(path).hash(Hashing.sha256()).equals(hash);
+  }
 }
@@ -37,6 +37,7 @@ import java.io.OutputStream;
 import java.net.ServerSocket;
 
 import java.net.Socket;
+import java.util.Map;
 import java.util.Optional;
 import org.joda.time.Duration;
 
@@ -111,6 +112,8 @@ final class BinaryPlistSocket implements InspectorSocket {
   private final InputStream socketIn;
   private final OutputStream socketOut;
   private final Closeable socketClose;
+  private final Map<MessageSelector, BinaryPlistTemplate> templates =
+      BinaryPlistTemplate.newTemplates();
 
   BinaryPlistSocket(Socket socket) throws IOException {
     try {
@@ -128,13 +131,24 @@ final class BinaryPlistSocket implements InspectorSocket {
   }
 
   @Override
-  public void sendMessage(NSDictionary message) throws IOException {
+  public synchronized void sendMessage(NSDictionary message) throws IOException {
     byte[] messageBytes = BinaryPropertyListWriter.writeToArray(message);
     byte[] lengthBytes = Ints.toByteArray(messageBytes.length);
     socketOut.write(lengthBytes);
     socketOut.write(messageBytes);
   }
 
+  @Override
+  public synchronized void sendMessage(InspectorMessage message) throws IOException {
+    BinaryPlistTemplate template = templates.get(message.selector());
+    if (template == null) {
+      sendMessage(message.toPlist());
+      return;
+    }
+    int length = template.encode(message);
+    socketOut.write(template.buffer(), 0, BinaryPlistTemplate.LENGTH_PREFIX_BYTES + length);
+  }
+
   @Override
   public Optional<NSDictionary> receiveMessage() throws IOException {
     try {
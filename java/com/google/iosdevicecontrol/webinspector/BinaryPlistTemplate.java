@@ -0,0 +1,312 @@
+// Copyright 2017 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+package com.google.iosdevicecontrol.webinspector;
+
+import static java.nio.charset.StandardCharsets.US_ASCII;
+
+import com.google.common.collect.ImmutableList;
+import com.google.common.collect.ImmutableMap;
+import java.util.Arrays;
+import java.util.EnumMap;
+import java.util.Map;
+import javax.json.JsonObject;
+
+/**
+ * Encodes the messages of one selector as binary plists into a reusable buffer, for the messages
+ * that are sent over and over again during a session. Everything but the values of the message is
+ * encoded once when the template is created, so encoding a message only writes its values, the
+ * offset table and the trailer, without building an {@link com.dd.plist.NSDictionary} first.
+ *
+ * <p>The plist is a dictionary of the selector and the argument dictionary, whose keys are in the
+ * order of {@link MessageKey}, like those of {@link InspectorMessage#toPlist}. A template is not
+ * thread-safe; each socket has its own.
+ */
+final class BinaryPlistTemplate {
+  /** Bytes before the plist in the buffer, which hold its length as a big-endian int. */
+  static final int LENGTH_PREFIX_BYTES = 4;
+
+  private static final ImmutableMap<MessageSelector, ImmutableList<MessageKey>> TEMPLATE_KEYS =
+      ImmutableMap.of(
+          MessageSelector.FORWARD_GET_LISTING,
+          ImmutableList.of(MessageKey.APPLICATION_IDENTIFIER, MessageKey.CONNECTION_IDENTIFIER),
+          MessageSelector.FORWARD_SOCKET_DATA,
+          ImmutableList.of(
+              MessageKey.APPLICATION_IDENTIFIER,
+              MessageKey.CONNECTION_IDENTIFIER,
+              MessageKey.PAGE_IDENTIFIER,
+              MessageKey.SENDER,
+              MessageKey.SOCKET_DATA));
+
+  private static final byte[] MAGIC = "bplist00".getBytes(US_ASCII);
+  private static final int INITIAL_BUFFER_SIZE = 4 * 1024;
+
+  // Object markers of the binary plist format.
+  private static final int INTEGER_MARKER = 0x10;
+  private static final int DATA_MARKER = 0x40;
+  private static final int ASCII_STRING_MARKER = 0x50;
+  private static final int UTF16_STRING_MARKER = 0x60;
+  private static final int DICTIONARY_MARKER = 0xD0;
+  /** The low nibble of a marker that says the count follows as an integer object. */
+  private static final int COUNT_FOLLOWS = 0xF;
+
+  // The top dictionary, its two keys, the selector and the argument dictionary, which are followed
+  // by the argument keys and then their values.
+  private static final int TOP_OBJECT = 0;
+  private static final int ARGUMENT_OBJECT = 4;
+  private static final int FIRST_ARGUMENT_KEY_OBJECT = 5;
+
+  /** Returns a new template for each selector that has one. */
+  static Map<MessageSelector, BinaryPlistTemplate> newTemplates() {
+    Map<MessageSelector, BinaryPlistTemplate> templates = new EnumMap<>(MessageSelector.class);
+    TEMPLATE_KEYS.forEach(
+        (selector, keys) -> templates.put(selector, new BinaryPlistTemplate(selector, keys)));
+    return templates;
+  }
+
+  private final MessageSelector selector;
+  private final ImmutableList<MessageKey> keys;
+  /** The offsets of the objects from the start of the plist. */
+  private final int[] objectOffsets;
+  /** The end of the objects that are the same in every message. */
+  private final int valuesStart;
+  private byte[] buffer = new byte[INITIAL_BUFFER_SIZE];
+  private int position = LENGTH_PREFIX_BYTES;
+
+  private BinaryPlistTemplate(MessageSelector selector, ImmutableList<MessageKey> keys) {
+    this.selector = selector;
+    this.keys = keys;
+    // Object references are one byte, which is plenty for any message.
+    objectOffsets = new int[FIRST_ARGUMENT_KEY_OBJECT + 2 * keys.size()];
+
+    write(MAGIC);
+    startObject(TOP_OBJECT);
+    writeMarker(DICTIONARY_MARKER, 2);
+    writeByte(1);
+    writeByte(2);
+    writeByte(3);
+    writeByte(ARGUMENT_OBJECT);
+    startObject(1);
+    writeString(InspectorMessage.SELECTOR_KEY);
+    startObject(2);
+    writeString(InspectorMessage.ARGUMENT_KEY);
+    startObject(3);
+    writeString(selector.toString());
+    startObject(ARGUMENT_OBJECT);
+    writeMarker(DICTIONARY_MARKER, keys.size());
+    for (int i = 0; i < 2 * keys.size(); i++) {
+      writeByte(FIRST_ARGUMENT_KEY_OBJECT + i);
+    }
+    for (int i = 0; i < keys.size(); i++) {
+      startObject(FIRST_ARGUMENT_KEY_OBJECT + i);
+      writeString(keys.get(i).toString());
+    }
+    valuesStart = position;
+  }
+
+  /**
+   * Encodes the message, which must have the selector of the template, and returns the length of
+   * the plist, which starts at {@link #LENGTH_PREFIX_BYTES} in the {@link #buffer}. The buffer is
+   * only valid until the next call.
+   */
+  int encode(InspectorMessage message) {
+    if (message.selector() != selector) {
+      throw new IllegalArgumentException("Not a " + selector + " message: " + message);
+    }
+    position = valuesStart;
+    int firstValueObject = FIRST_ARGUMENT_KEY_OBJECT + keys.size();
+    for (int i = 0; i < keys.size(); i++) {
+      startObject(firstValueObject + i);
+      writeValue(keys.get(i), message);
+    }
+
+    int offsetTableOffset = position - LENGTH_PREFIX_BYTES;
+    int offsetSize = offsetTableOffset < 1 << 8 ? 1 : offsetTableOffset < 1 << 16 ? 2 : 4;
+    for (int offset : objectOffsets) {
+      writeNumber(offset, offsetSize);
+    }
+    // The trailer: six unused bytes, the sizes of offsets and object references, the number of
+    // objects, the top object and the offset of the offset table.
+    writeNumber(0, 6);
+    writeByte(offsetSize);
+    writeByte(1);
+    writeNumber(objectOffsets.length, 8);
+    writeNumber(TOP_OBJECT, 8);
+    writeNumber(offsetTableOffset, 8);
+
+    int length = position - LENGTH_PREFIX_BYTES;
+    position = 0;
+    writeNumber(length, LENGTH_PREFIX_BYTES);
+    return length;
+  }
+
+  /** Returns the buffer that {@link #encode} writes the length prefix and the plist to. */
+  byte[] buffer() {
+    return buffer;
+  }
+
+  private void writeValue(MessageKey key, InspectorMessage message) {
+    switch (key) {
+      case APPLICATION_IDENTIFIER:
+        writeString(message.applicationId());
+        break;
+      case CONNECTION_IDENTIFIER:
+        writeString(message.connectionId());
+        break;
+      case PAGE_IDENTIFIER:
+        writeInteger(message.pageId());
+        break;
+      case SENDER:
+        writeString(message.sender());
+        break;
+      case SOCKET_DATA:
+        writeJsonData(message.socketData());
+        break;
+      default:
+        throw new AssertionError("No template support for " + key);
+    }
+  }
+
+  private void startObject(int object) {
+    objectOffsets[object] = position - LENGTH_PREFIX_BYTES;
+  }
+
+  private void writeMarker(int marker, int count) {
+    if (count < COUNT_FOLLOWS) {
+      writeByte(marker | count);
+    } else {
+      writeByte(marker | COUNT_FOLLOWS);
+      writeInteger(count);
+    }
+  }
+
+  private void writeInteger(long value) {
+    // Only integers of eight bytes are signed.
+    if (value >= 0 && value < 1L << 8) {
+      writeByte(INTEGER_MARKER);
+      writeNumber(value, 1);
+    } else if (value >= 0 && value < 1L << 16) {
+      writeByte(INTEGER_MARKER | 1);
+      writeNumber(value, 2);
+    } else if (value >= 0 && value < 1L << 32) {
+      writeByte(INTEGER_MARKER | 2);
+      writeNumber(value, 4);
+    } else {
+      writeByte(INTEGER_MARKER | 3);
+      writeNumber(value, 8);
+    }
+  }
+
+  private void writeString(String string) {
+    int length = string.length();
+    boolean ascii = true;
+    for (int i = 0; i < length && ascii; i++) {
+      ascii = string.charAt(i) < 0x80;
+    }
+    if (ascii) {
+      writeMarker(ASCII_STRING_MARKER, length);
+      ensureCapacity(length);
+      for (int i = 0; i < length; i++) {
+        buffer[position++] = (byte) string.charAt(i);
+      }
+    } else {
+      writeMarker(UTF16_STRING_MARKER, length);
+      ensureCapacity(2 * length);
+      for (int i = 0; i < length; i++) {
+        char c = string.charAt(i);
+        buffer[position++] = (byte) (c >> 8);
+        buffer[position++] = (byte) c;
+      }
+    }
+  }
+
+  /** Writes the JSON as UTF-8 data, like {@link MessageKey} converts it. */
+  private void writeJsonData(JsonObject json) {
+    String text = json.toString();
+    int length = text.length();
+    int utf8Length = 0;
+    for (int i = 0; i < length; i++) {
+      char c = text.charAt(i);
+      if (c < 0x80) {
+        utf8Length += 1;
+      } else if (c < 0x800) {
+        utf8Length += 2;
+      } else if (isSurrogatePair(text, i)) {
+        utf8Length += 4;
+        i++;
+      } else if (Character.isSurrogate(c)) {
+        // Encoded as '?', like String.getBytes does.
+        utf8Length += 1;
+      } else {
+        utf8Length += 3;
+      }
+    }
+
+    writeMarker(DATA_MARKER, utf8Length);
+    ensureCapacity(utf8Length);
+    for (int i = 0; i < length; i++) {
+      char c = text.charAt(i);
+      if (c < 0x80) {
+        buffer[position++] = (byte) c;
+      } else if (c < 0x800) {
+        buffer[position++] = (byte) (0xC0 | c >> 6);
+        buffer[position++] = (byte) (0x80 | (c & 0x3F));
+      } else if (isSurrogatePair(text, i)) {
+        int codePoint = Character.toCodePoint(c, text.charAt(++i));
+        buffer[position++] = (byte) (0xF0 | codePoint >> 18);
+        buffer[position++] = (byte) (0x80 | (codePoint >> 12 & 0x3F));
+        buffer[position++] = (byte) (0x80 | (codePoint >> 6 & 0x3F));
+        buffer[position++] = (byte) (0x80 | (codePoint & 0x3F));
+      } else if (Character.isSurrogate(c)) {
+        buffer[position++] = '?';
+      } else {
+        buffer[position++] = (byte) (0xE0 | c >> 12);
+        buffer[position++] = (byte) (0x80 | (c >> 6 & 0x3F));
+        buffer[position++] = (byte) (0x80 | (c & 0x3F));
+      }
+    }
+  }
+
+  private static boolean isSurrogatePair(String text, int index) {
+    return Character.isHighSurrogate(text.charAt(index))
+        && index + 1 < text.length()
+        && Character.isLowSurrogate(text.charAt(index + 1));
+  }
+
+  /** Writes the low bytes of the value in big-endian order. */
+  private void writeNumber(long value, int bytes) {
+    ensureCapacity(bytes);
+    for (int shift = 8 * (bytes - 1); shift >= 0; shift -= 8) {
+      buffer[position++] = (byte) (value >> shift);
+    }
+  }
+
+  private void writeByte(int value) {
+    ensureCapacity(1);
+    buffer[position++] = (byte) value;
+  }
+
+  private void write(byte[] bytes) {
+    ensureCapacity(bytes.length);
+    System.arraycopy(bytes, 0, buffer, position, bytes.length);
+    position += bytes.length;
+  }
+
+  /** Grows the buffer if needed, which only happens for messages larger than any before. */
+  private void ensureCapacity(int bytes) {
+    if (position + bytes > buffer.length) {
+      buffer = Arrays.copyOf(buffer, Math.max(2 * buffer.length, position + bytes));
+    }
+  }
+}
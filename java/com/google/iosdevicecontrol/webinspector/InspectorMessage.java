@@ -19,8 +19,8 @@ import com.dd.plist.NSString;
 
 /** A message sent to or from the web inspector in the webkit remote debug protocol. */
 public abstract class InspectorMessage extends MessageDict {
-  private static final String SELECTOR_KEY = "__selector";
-  private static final String ARGUMENT_KEY = "__argument";
+  static final String SELECTOR_KEY = "__selector";
+  static final String ARGUMENT_KEY = "__argument";
 
   /** Converts the given plist to an inspector message. */
   public static InspectorMessage fromPlist(NSDictionary plist) {
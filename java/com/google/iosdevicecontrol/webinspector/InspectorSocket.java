@@ -17,7 +17,11 @@ package com.google.iosdevicecontrol.webinspector;
 import com.dd.plist.NSDictionary;
 import java.io.Closeable;
 import java.io.IOException;
+import java.nio.file.Path;
+import java.time.Duration;
 import java.util.Optional;
+import java.util.Set;
+import java.util.function.Consumer;
 
 /** A nexus for communication with a web inspector. */
 public interface InspectorSocket extends Closeable {
@@ -28,10 +32,69 @@ public interface InspectorSocket extends Closeable {
    */
   void sendMessage(NSDictionary message) throws IOException;
 
+  /**
+   * Sends a message to the web inspector. Sockets may encode the messages that are sent most often
+   * without converting them to a plist first.
+   *
+   * @throws IOException if an I/O error occurs.
+   */
+  default void sendMessage(InspectorMessage message) throws IOException {
+    sendMessage(message.toPlist());
+  }
+
   /**
    * Blocks until a plist is received from the web inspector, or returns empty on EOF.
    *
    * @throws IOException if an I/O error occurs.
    */
   Optional<NSDictionary> receiveMessage() throws IOException;
+
+  /**
+   * Diverts console events (Console.messageAdded, Runtime.consoleAPICalled and the like) away from
+   * {@link #receiveMessage}, appending those of at least minLevel to the specified file, one
+   * tab-separated line per message, and dropping the others. Returns false if the socket can't do
+   * this, in which case the events keep arriving as regular messages.
+   *
+   * @throws IOException if the file can't be opened.
+   */
+  default boolean setConsoleLog(Path file, ConsoleLevel minLevel) throws IOException {
+    return false;
+  }
+
+  /**
+   * Diverts the events of the Network domain away from {@link #receiveMessage}, writing the requests
+   * they describe to the specified HAR file as they complete, with their response bodies if
+   * includeBodies is true. The client still sends Network.enable. The file is complete once the
+   * socket is closed. Returns false if the socket can't do this, in which case the events keep
+   * arriving as regular messages.
+   *
+   * @throws IOException if the file can't be created.
+   */
+  default boolean setHarLog(Path file, boolean includeBodies) throws IOException {
+    return false;
+  }
+
+  /**
+   * Answers commands of the specified methods from a cache when the same connection to a page sent
+   * a command with the same method and params before, instead of sending them to the device. Cached
+   * results are dropped after at most the specified time to live, and sooner when the page reports
+   * a change or the client sends it a command of another method. The methods must not have side
+   * effects. Returns false if the socket can't do this, in which case every command is sent.
+   *
+   * @throws IOException if the socket is closed.
+   */
+  default boolean setResponseCache(Set<String> methods, Duration ttl) throws IOException {
+    return false;
+  }
+
+  /**
+   * Diverts Page.screencastFrame events to the specified listener, which is called on the thread
+   * that receives messages, and acknowledges them, at most maxFramesPerSecond times a second if
+   * positive. Must be called before Page.startScreencast is sent. Returns false if the socket can't
+   * do this, in which case the frames keep arriving as regular messages.
+   */
+  default boolean setScreencastListener(
+      Consumer<ScreencastFrame> listener, int maxFramesPerSecond) {
+    return false;
+  }
 }
@@ -32,6 +32,7 @@ public enum MessageSelector {
   FORWARD_SOCKET_SETUP(ForwardSocketSetupMessage::builder),
   REPORT_CONNECTED_APPLICATION_LIST(ReportConnectedApplicationListMessage::builder),
   REPORT_CONNECTED_DRIVER_LIST(ReportConnectedDriverListMessage::builder),
+  REPORT_DEVICE_LOST(ReportDeviceLostMessage::builder),
   REPORT_IDENTIFIER(ReportIdentifierMessage::builder),
   REPORT_SETUP(ReportSetupMessage::builder);
 
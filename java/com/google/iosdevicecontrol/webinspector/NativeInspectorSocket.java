@@ -0,0 +1,289 @@
+// Copyright 2017 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+package com.google.iosdevicecontrol.webinspector;
+
+import com.dd.plist.BinaryPropertyListWriter;
+import com.dd.plist.NSDictionary;
+import com.google.iosdevicecontrol.util.FluentLogger;
+import com.google.iosdevicecontrol.util.NativeLibraries;
+import com.google.iosdevicecontrol.util.PlistParser;
+import com.google.iosdevicecontrol.util.PlistParser.PlistParseException;
+import java.io.IOException;
+import java.nio.ByteBuffer;
+import java.nio.file.Path;
+import java.time.Duration;
+import java.util.Map;
+import java.util.Optional;
+import java.util.Set;
+import java.util.concurrent.locks.ReadWriteLock;
+import java.util.concurrent.locks.ReentrantReadWriteLock;
+import java.util.function.Consumer;
+
+/**
+ * A web inspector socket to a real device that runs the idevicewebinspectorproxy logic in-process
+ * through JNI, instead of spawning the proxy and connecting to it over a loopback socket. Frames are
+ * exchanged through reusable direct byte buffers that the native side reads and writes in place.
+ */
+final class NativeInspectorSocket implements InspectorSocket {
+  private static final FluentLogger logger = FluentLogger.forEnclosingClass();
+
+  private static final String LIBRARY_NAME = "webinspectorproxy";
+  private static final int INITIAL_BUFFER_SIZE = 64 * 1024;
+
+  /** How long a native receive blocks, which also bounds how long close waits for a receive. */
+  private static final int RECEIVE_TIMEOUT_MILLIS = 500;
+
+  /** Returned by nativeReceive after the device was lost and reportDeviceLost was received. */
+  private static final int RECEIVE_DEVICE_LOST = Integer.MIN_VALUE;
+
+  /** Returns whether the native proxy library is installed. */
+  static boolean isAvailable() {
+    return NativeLibraries.load(LIBRARY_NAME);
+  }
+
+  /** Open a web inspector socket to a real device with the specified udid. */
+  static InspectorSocket open(String udid) throws IOException {
+    return new NativeInspectorSocket(nativeOpen(udid));
+  }
+
+  private final long handle;
+
+  // Send and receive hold the read lock, so they may run concurrently with each other, while close
+  // holds the write lock, so the native handle is never freed during a call that uses it.
+  private final ReadWriteLock handleLock = new ReentrantReadWriteLock();
+  private boolean closed = false;
+
+  // Each buffer is only used by one thread at a time: senders and receivers are serialized.
+  private final Object sendLock = new Object();
+  private final Object receiveLock = new Object();
+  private ByteBuffer sendBuffer = ByteBuffer.allocateDirect(INITIAL_BUFFER_SIZE);
+  private ByteBuffer receiveBuffer = ByteBuffer.allocateDirect(INITIAL_BUFFER_SIZE);
+  // Only used with the send lock held.
+  private final Map<MessageSelector, BinaryPlistTemplate> templates =
+      BinaryPlistTemplate.newTemplates();
+
+  private volatile Consumer<ScreencastFrame> screencastListener;
+
+  private NativeInspectorSocket(long handle) {
+    this.handle = handle;
+  }
+
+  @Override
+  public void sendMessage(NSDictionary message) throws IOException {
+    byte[] messageBytes = BinaryPropertyListWriter.writeToArray(message);
+    synchronized (sendLock) {
+      send(messageBytes, 0, messageBytes.length);
+    }
+  }
+
+  @Override
+  public void sendMessage(InspectorMessage message) throws IOException {
+    BinaryPlistTemplate template = templates.get(message.selector());
+    if (template == null) {
+      sendMessage(message.toPlist());
+      return;
+    }
+    synchronized (sendLock) {
+      int length = template.encode(message);
+      send(template.buffer(), BinaryPlistTemplate.LENGTH_PREFIX_BYTES, length);
+    }
+  }
+
+  /** Copies the plist into the send buffer and sends it; the send lock must be held. */
+  private void send(byte[] plist, int offset, int length) throws IOException {
+    if (sendBuffer.capacity() < length) {
+      sendBuffer = ByteBuffer.allocateDirect(length);
+    }
+    sendBuffer.clear();
+    sendBuffer.put(plist, offset, length);
+
+    handleLock.readLock().lock();
+    try {
+      if (closed) {
+        throw new IOException("Socket is closed");
+      }
+      nativeSend(handle, sendBuffer, length);
+    } finally {
+      handleLock.readLock().unlock();
+    }
+  }
+
+  @Override
+  public Optional<NSDictionary> receiveMessage() throws IOException {
+    synchronized (receiveLock) {
+      while (true) {
+        int length;
+        handleLock.readLock().lock();
+        try {
+          if (closed) {
+            return Optional.empty();
+          }
+          length = nativeReceive(handle, receiveBuffer, RECEIVE_TIMEOUT_MILLIS);
+        } finally {
+          handleLock.readLock().unlock();
+        }
+
+        if (length == RECEIVE_DEVICE_LOST) {
+          // Like the proxy closing its socket once it has sent reportDeviceLost.
+          return Optional.empty();
+        } else if (length < 0) {
+          // The frame is held natively until we retry with a large enough buffer.
+          receiveBuffer = ByteBuffer.allocateDirect(-length);
+        } else if (length > 0) {
+          byte[] messageBytes = new byte[length];
+          receiveBuffer.clear();
+          receiveBuffer.get(messageBytes);
+          try {
+            return Optional.of((NSDictionary) PlistParser.fromBinary(messageBytes));
+          } catch (PlistParseException e) {
+            throw new IOException(e);
+          }
+        }
+      }
+    }
+  }
+
+  @Override
+  public boolean setConsoleLog(Path file, ConsoleLevel minLevel) throws IOException {
+    handleLock.readLock().lock();
+    try {
+      if (closed) {
+        throw new IOException("Socket is closed");
+      }
+      nativeSetConsoleLog(handle, file.toString(), minLevel.ordinal());
+    } finally {
+      handleLock.readLock().unlock();
+    }
+    return true;
+  }
+
+  @Override
+  public boolean setHarLog(Path file, boolean includeBodies) throws IOException {
+    handleLock.readLock().lock();
+    try {
+      if (closed) {
+        throw new IOException("Socket is closed");
+      }
+      nativeSetHarLog(handle, file.toString(), includeBodies);
+    } finally {
+      handleLock.readLock().unlock();
+    }
+    return true;
+  }
+
+  @Override
+  public boolean setResponseCache(Set<String> methods, Duration ttl) throws IOException {
+    handleLock.readLock().lock();
+    try {
+      if (closed) {
+        throw new IOException("Socket is closed");
+      }
+      nativeSetResponseCache(
+          handle, String.join(",", methods), (int) Math.min(ttl.toMillis(), Integer.MAX_VALUE));
+    } finally {
+      handleLock.readLock().unlock();
+    }
+    return true;
+  }
+
+  @Override
+  public boolean setScreencastListener(
+      Consumer<ScreencastFrame> listener, int maxFramesPerSecond) {
+    handleLock.readLock().lock();
+    try {
+      if (!closed) {
+        screencastListener = listener;
+        nativeSetScreencast(handle, true, maxFramesPerSecond);
+      }
+    } finally {
+      handleLock.readLock().unlock();
+    }
+    return true;
+  }
+
+  /** Called by the native proxy from within nativeReceive. */
+  @SuppressWarnings("unused")
+  private void onScreencastFrame(
+      byte[] image,
+      int sessionId,
+      double timestamp,
+      double deviceWidth,
+      double deviceHeight,
+      double pageScaleFactor,
+      double offsetTop,
+      double scrollOffsetX,
+      double scrollOffsetY) {
+    Consumer<ScreencastFrame> listener = screencastListener;
+    if (listener == null) {
+      return;
+    }
+    try {
+      listener.accept(
+          ScreencastFrame.create(
+              image,
+              sessionId,
+              timestamp,
+              deviceWidth,
+              deviceHeight,
+              pageScaleFactor,
+              offsetTop,
+              scrollOffsetX,
+              scrollOffsetY));
+    } catch (RuntimeException e) {
+      // Throwing back into the native receive would only lose the frame it is returning.
+      logger.atWarning().withCause(e).log("Screencast listener failed");
+    }
+  }
+
+  @Override
+  public void close() throws IOException {
+    handleLock.writeLock().lock();
+    try {
+      if (!closed) {
+        closed = true;
+        nativeClose(handle);
+      }
+    } finally {
+      handleLock.writeLock().unlock();
+    }
+  }
+
+  private static native long nativeOpen(String udid) throws IOException;
+
+  private static native void nativeSend(long handle, ByteBuffer frame, int length)
+      throws IOException;
+
+  private static native void nativeSetConsoleLog(long handle, String path, int minLevel)
+      throws IOException;
+
+  private static native void nativeSetHarLog(long handle, String path, boolean includeBodies)
+      throws IOException;
+
+  private static native void nativeSetResponseCache(long handle, String methods, int ttlMillis)
+      throws IOException;
+
+  private static native void nativeSetScreencast(
+      long handle, boolean enabled, int maxFramesPerSecond);
+
+  /**
+   * Returns the length of the received frame, 0 if no frame arrived within the timeout, the
+   * negated required capacity if the frame is larger than the buffer, or RECEIVE_DEVICE_LOST.
+   * Screencast frames are passed to onScreencastFrame while it runs.
+   */
+  private native int nativeReceive(long handle, ByteBuffer frame, int timeoutMillis)
+      throws IOException;
+
+  private static native void nativeClose(long handle);
+}
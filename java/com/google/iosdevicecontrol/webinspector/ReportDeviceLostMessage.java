@@ -0,0 +1,58 @@
+// Copyright 2017 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+package com.google.iosdevicecontrol.webinspector;
+
+import com.google.auto.value.AutoValue;
+
+/**
+ * A reportDeviceLost message. Unlike the other messages, it does not come from the device: the
+ * idevicewebinspectorproxy sends it when the device is unplugged or reboots, right before it closes
+ * the connection, so clients don't have to wait for a receive timeout to notice.
+ *
+ * <p>Example:
+ *
+ * <pre>{@code
+ * <?xml version="1.0" encoding="UTF-8"?>
+ * <!DOCTYPE plist PUBLIC "-//Apple//DTD PLIST 1.0//EN"
+ *     "http://www.apple.com/DTDs/PropertyList-1.0.dtd">
+ * <plist version="1.0">
+ * <dict>
+ *   <key>__selector</key>
+ *   <string>_rpc_reportDeviceLost:</string>
+ *   <key>__argument</key>
+ *   <dict/>
+ * </dict>
+ * </plist>
+ * }</pre>
+ */
+@AutoValue
+public abstract class ReportDeviceLostMessage extends InspectorMessage {
+  /** Returns a new builder. */
+  public static Builder builder() {
+    return new AutoValue_ReportDeviceLostMessage.Builder();
+  }
+
+  /** A builder for creating reportDeviceLost messages. */
+  @AutoValue.Builder
+  public abstract static class Builder extends InspectorMessage.Builder {
+    @Override
+    public abstract ReportDeviceLostMessage build();
+  }
+
+  @Override
+  public MessageSelector selector() {
+    return MessageSelector.REPORT_DEVICE_LOST;
+  }
+}
@@ -0,0 +1,69 @@
+// Copyright 2017 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+package com.google.iosdevicecontrol.webinspector;
+
+import com.google.auto.value.AutoValue;
+
+/**
+ * A Page.screencastFrame event delivered out of band by the native proxy, with its image already
+ * decoded from base64, so that it doesn't have to go through the plist and JSON of a regular
+ * applicationSentData message.
+ */
+@AutoValue
+public abstract class ScreencastFrame {
+  static ScreencastFrame create(
+      byte[] image,
+      int sessionId,
+      double timestamp,
+      double deviceWidth,
+      double deviceHeight,
+      double pageScaleFactor,
+      double offsetTop,
+      double scrollOffsetX,
+      double scrollOffsetY) {
+    return new AutoValue_ScreencastFrame(
+        image,
+        sessionId,
+        timestamp,
+        deviceWidth,
+        deviceHeight,
+        pageScaleFactor,
+        offsetTop,
+        scrollOffsetX,
+        scrollOffsetY);
+  }
+
+  /** The JPEG or PNG image, in the format requested by Page.startScreencast. */
+  @SuppressWarnings("mutable")
+  public abstract byte[] image();
+
+  /** The session id, which the proxy has already acknowledged the frame with. */
+  public abstract int sessionId();
+
+  /** The frame timestamp in seconds, or 0 if the device left it out. */
+  public abstract double timestamp();
+
+  public abstract double deviceWidth();
+
+  public abstract double deviceHeight();
+
+  public abstract double pageScaleFactor();
+
+  public abstract double offsetTop();
+
+  public abstract double scrollOffsetX();
+
+  public abstract double scrollOffsetY();
+}
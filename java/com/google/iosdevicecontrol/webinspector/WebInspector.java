@@ -14,18 +14,29 @@
 
 package com.google.iosdevicecontrol.webinspector;
 
+import static com.google.common.base.Preconditions.checkArgument;
 import static com.google.common.base.Preconditions.checkNotNull;
 
 import com.google.common.annotations.VisibleForTesting;
 import java.io.Closeable;
 import java.io.IOException;
+import java.nio.file.Path;
+import java.time.Duration;
 import java.util.Optional;
+import java.util.Set;
+import java.util.function.Consumer;
 
 /** A web inspector. */
 public final class WebInspector implements Closeable {
-  /** Connects to a web inspector running on a real device. */
+  /**
+   * Connects to a web inspector running on a real device. The proxy runs in-process if its native
+   * library is installed, and as an idevicewebinspectorproxy child process otherwise.
+   */
   public static WebInspector connectToRealDevice(String udid) throws IOException {
-    return connect(BinaryPlistSocket.openToRealDevice(udid));
+    return connect(
+        NativeInspectorSocket.isAvailable()
+            ? NativeInspectorSocket.open(udid)
+            : BinaryPlistSocket.openToRealDevice(udid));
   }
 
   /** Connects to a web inspector running on a simulator. */
@@ -50,7 +61,7 @@ public final class WebInspector implements Closeable {
 
   /** Sends a message to the web inspector. */
   public void sendMessage(InspectorMessage message) throws IOException {
-    socket.sendMessage(message.toPlist());
+    socket.sendMessage(message);
   }
 
   /** Receives a message from the inspector socket or empty if the device socket is closed. */
@@ -58,6 +69,41 @@ public final class WebInspector implements Closeable {
     return socket.receiveMessage().map(InspectorMessage::fromPlist);
   }
 
+  /**
+   * Has the socket write console messages to the specified file instead of delivering them as
+   * messages, if it supports that; see {@link InspectorSocket#setConsoleLog}.
+   */
+  public boolean setConsoleLog(Path file, ConsoleLevel minLevel) throws IOException {
+    return socket.setConsoleLog(checkNotNull(file), checkNotNull(minLevel));
+  }
+
+  /**
+   * Has the socket capture network traffic to the specified HAR file instead of delivering Network
+   * events as messages, if it supports that; see {@link InspectorSocket#setHarLog}.
+   */
+  public boolean setHarLog(Path file, boolean includeBodies) throws IOException {
+    return socket.setHarLog(checkNotNull(file), includeBodies);
+  }
+
+  /**
+   * Has the socket answer repeated commands of the specified idempotent methods, such as
+   * DOM.getDocument, from a cache instead of the device, if it supports that; see {@link
+   * InspectorSocket#setResponseCache}.
+   */
+  public boolean setResponseCache(Set<String> methods, Duration ttl) throws IOException {
+    checkArgument(!methods.isEmpty(), "No methods to cache");
+    checkArgument(!ttl.isNegative() && ttl.toMillis() > 0, "Invalid time to live: %s", ttl);
+    return socket.setResponseCache(methods, ttl);
+  }
+
+  /**
+   * Has the socket deliver Page.screencastFrame events to the specified listener instead of as
+   * messages, if it supports that; see {@link InspectorSocket#setScreencastListener}.
+   */
+  public boolean setScreencastListener(Consumer<ScreencastFrame> listener, int maxFramesPerSecond) {
+    return socket.setScreencastListener(checkNotNull(listener), maxFramesPerSecond);
+  }
+
   @Override
   public void close() throws IOException {
     socket.close();
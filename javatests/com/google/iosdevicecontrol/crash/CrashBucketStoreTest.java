@@ -0,0 +1,108 @@
+// Copyright 2017 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+package com.google.iosdevicecontrol.crash;
+
+import static com.google.common.truth.Truth.assertThat;
+import static java.nio.charset.StandardCharsets.UTF_8;
+
+import com.google.common.collect.ImmutableList;
+import com.google.common.jimfs.Configuration;
+import com.google.common.jimfs.Jimfs;
+import java.io.IOException;
+import java.nio.file.FileSystem;
+import java.nio.file.Files;
+import java.nio.file.Path;
+import org.junit.Before;
+import org.junit.Test;
+import org.junit.runner.RunWith;
+import org.junit.runners.JUnit4;
+
+/** Tests for the {@link com.google.iosdevicecontrol.crash.CrashBucketStore}. */
+@RunWith(JUnit4.class)
+public class CrashBucketStoreTest {
+  private Path storeDir;
+  private Path pullDir;
+  private CrashBucketStore store;
+
+  @Before
+  public void setUp() throws IOException {
+    FileSystem fileSystem = Jimfs.newFileSystem(Configuration.unix());
+    storeDir = fileSystem.getPath("/path/to/crashes");
+    pullDir = Files.createDirectories(fileSystem.getPath("/path/to/pulled"));
+    store = CrashBucketStore.inDirectory(storeDir);
+  }
+
+  @Test
+  public void ingestKeepsOneReportPerSignature() throws IOException {
+    writeReport("MyApp-2017-10-18-120000.crash", CrashReportParserTest.textReport(1, 0x100000000L));
+    writeReport("MyApp-2017-10-18-120100.crash", CrashReportParserTest.textReport(2, 0x200000000L));
+    writeReport("Retired/other.log", "not a crash report");
+
+    ImmutableList<CrashBucket> newBuckets = store.ingest(pullDir);
+    assertThat(newBuckets).hasSize(2);
+    assertThat(Files.exists(pullDir.resolve("MyApp-2017-10-18-120100.crash"))).isFalse();
+    assertThat(Files.exists(pullDir.resolve("Retired/other.log"))).isFalse();
+
+    CrashBucket crash = newBuckets.get(0);
+    assertThat(crash.signature().process()).isEqualTo("MyApp");
+    assertThat(crash.count()).isEqualTo(2);
+    assertThat(crash.report())
+        .isEqualTo(storeDir.resolve(crash.signature().id() + "/MyApp-2017-10-18-120000.crash"));
+    assertThat(Files.exists(crash.report())).isTrue();
+    assertThat(newBuckets.get(1).signature().process()).isEmpty();
+    assertThat(newBuckets.get(1).count()).isEqualTo(1);
+  }
+
+  @Test
+  public void ingestOnlyReturnsNewBuckets() throws IOException {
+    writeReport("MyApp-1.crash", CrashReportParserTest.textReport(1, 0x100000000L));
+    CrashBucket crash = store.ingest(pullDir).get(0);
+    writeReport("MyApp-2.crash", CrashReportParserTest.textReport(2, 0x200000000L));
+    writeReport("MyApp-3.crash", CrashReportParserTest.textReport(3, 0x300000000L));
+
+    assertThat(store.ingest(pullDir)).isEmpty();
+    assertThat(store.buckets()).containsExactly(crash.withCount(3));
+  }
+
+  @Test
+  public void reopenedStoreReadsBuckets() throws IOException {
+    writeReport("MyApp-1.crash", CrashReportParserTest.textReport(1, 0x100000000L));
+    writeReport("other.log", "not a crash report");
+    ImmutableList<CrashBucket> buckets = store.ingest(pullDir);
+
+    CrashBucketStore reopened = CrashBucketStore.inDirectory(storeDir);
+    assertThat(reopened.buckets()).containsExactlyElementsIn(buckets);
+    writeReport("MyApp-2.crash", CrashReportParserTest.textReport(2, 0x200000000L));
+    writeReport("other.log", "not a crash report");
+    assertThat(reopened.ingest(pullDir)).isEmpty();
+    assertThat(reopened.buckets())
+        .containsExactly(buckets.get(0).withCount(2), buckets.get(1).withCount(2));
+  }
+
+  @Test
+  public void malformedBucketIsIgnored() throws IOException {
+    writeReport("MyApp-1.crash", CrashReportParserTest.textReport(1, 0x100000000L));
+    CrashBucket crash = store.ingest(pullDir).get(0);
+    Files.write(crash.report().resolveSibling(CrashBucketStore.BUCKET_FILE_NAME), new byte[] {1});
+
+    assertThat(CrashBucketStore.inDirectory(storeDir).buckets()).isEmpty();
+  }
+
+  private void writeReport(String name, String contents) throws IOException {
+    Path path = pullDir.resolve(name);
+    Files.createDirectories(path.getParent());
+    Files.write(path, contents.getBytes(UTF_8));
+  }
+}
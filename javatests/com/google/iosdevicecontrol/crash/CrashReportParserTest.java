@@ -0,0 +1,107 @@
+// Copyright 2017 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+package com.google.iosdevicecontrol.crash;
+
+import static com.google.common.truth.Truth.assertThat;
+
+import com.google.common.collect.ImmutableList;
+import java.util.Optional;
+import org.junit.Test;
+import org.junit.runner.RunWith;
+import org.junit.runners.JUnit4;
+
+/** Tests for the {@link com.google.iosdevicecontrol.crash.CrashReportParser}. */
+@RunWith(JUnit4.class)
+public class CrashReportParserTest {
+  static String textReport(int pid, long loadAddress) {
+    return "Incident Identifier: 1A2B3C4D-0000-0000-0000-" + pid + "\n"
+        + "Process:             MyApp [" + pid + "]\n"
+        + "Date/Time:           2017-10-18 12:34:56.789 -0700\n"
+        + "\n"
+        + "Exception Type:  EXC_CRASH (SIGABRT)\n"
+        + "Exception Codes: 0x0000000000000000, 0x0000000000000000\n"
+        + "Triggered by Thread:  0\n"
+        + "\n"
+        + "Thread 0 name:  Dispatch queue: com.apple.main-thread\n"
+        + "Thread 0 Crashed:\n"
+        + "0   libsystem_kernel.dylib        \t0x00000001a1b2c3d4 0x1a1b00000 + 181204\n"
+        + "1   libsystem_pthread.dylib       \t0x00000001a1c2c3d4 pthread_kill + 108\n"
+        + "2   libsystem_c.dylib             \t0x00000001a1d2c3d4 abort + 100\n"
+        + "3   MyApp                         \t0x"
+        + Long.toHexString(loadAddress + 700707)
+        + " 0x"
+        + Long.toHexString(loadAddress)
+        + " + 700707\n"
+        + "4   MyApp                         \t0x0000000100abc123 "
+        + "-[Foo bar:] (in MyApp) (Foo.m:42)\n"
+        + "5   UIKitCore                     \t0x00000001b2c3d4e5 "
+        + "-[UIApplication sendAction:] + 96\n"
+        + "6   UIKitCore                     \t0x00000001b2c3d4f5 std::vector<int>::at(int) + 12\n"
+        + "7   CoreFoundation                \t0x00000001b3c3d4e5 __CFRunLoopRun + 1200\n"
+        + "\n"
+        + "Thread 1:\n"
+        + "0   libsystem_kernel.dylib        \t0x00000001a1b2c3e4 mach_msg_trap + 8\n";
+  }
+
+  @Test
+  public void parseTextReport() {
+    assertThat(CrashReportParser.parse(textReport(1234, 0x100a00000L)))
+        .isEqualTo(
+            Optional.of(
+                CrashSignature.create(
+                    "MyApp",
+                    "EXC_CRASH (SIGABRT)",
+                    ImmutableList.of(
+                        "MyApp + 700707",
+                        "MyApp`-[Foo bar:]",
+                        "UIKitCore`-[UIApplication sendAction:]",
+                        "UIKitCore`std::vector<int>::at(int)",
+                        "CoreFoundation`__CFRunLoopRun"))));
+  }
+
+  @Test
+  public void signatureIgnoresPidAndLoadAddress() {
+    assertThat(CrashReportParser.parse(textReport(5678, 0x104f00000L)).get().id())
+        .isEqualTo(CrashReportParser.parse(textReport(1234, 0x100a00000L)).get().id());
+  }
+
+  @Test
+  public void parseJsonReport() {
+    String report =
+        "{\"app_name\":\"MyApp\",\"bug_type\":\"309\"}\n"
+            + "{\"pid\":4321,\"procName\":\"MyApp\",\"faultingThread\":1,"
+            + "\"exception\":{\"type\":\"EXC_BAD_ACCESS\",\"signal\":\"SIGSEGV\"},"
+            + "\"usedImages\":[{\"name\":\"MyApp\"},{\"name\":\"libobjc.A.dylib\"}],"
+            + "\"threads\":[{\"frames\":[]},{\"triggered\":true,\"frames\":["
+            + "{\"imageIndex\":1,\"imageOffset\":7520,\"symbol\":\"objc_msgSend\","
+            + "\"symbolLocation\":32},"
+            + "{\"imageIndex\":0,\"imageOffset\":700707}]}]}\n";
+    assertThat(CrashReportParser.parse(report))
+        .isEqualTo(
+            Optional.of(
+                CrashSignature.create(
+                    "MyApp",
+                    "EXC_BAD_ACCESS (SIGSEGV)",
+                    ImmutableList.of("libobjc.A.dylib`objc_msgSend", "MyApp + 700707"))));
+  }
+
+  @Test
+  public void parseOtherReport() {
+    assertThat(CrashReportParser.parse("Panic: not a crash of a process\n")).isEqualTo(
+        Optional.empty());
+    assertThat(CrashReportParser.parse("{\"bug_type\":\"298\"}\n{\"largestProcess\":\"MyApp\"}"))
+        .isEqualTo(Optional.empty());
+  }
+}
@@ -0,0 +1,85 @@
+// Copyright 2017 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+package com.google.iosdevicecontrol.image;
+
+import static com.google.common.truth.Truth.assertThat;
+
+import java.io.ByteArrayInputStream;
+import java.io.IOException;
+import java.util.Random;
+import javax.imageio.ImageIO;
+import org.junit.Test;
+import org.junit.runner.RunWith;
+import org.junit.runners.JUnit4;
+
+/** Tests for the {@link com.google.iosdevicecontrol.image.PngEncoder}. */
+@RunWith(JUnit4.class)
+public class PngEncoderTest {
+  @Test
+  public void encodeSingleChunk() throws IOException {
+    assertRoundTrips(PngEncoder.create(), testImage(16, 9, 3));
+  }
+
+  @Test
+  public void encodeManyChunks() throws IOException {
+    // Well over the chunk size, with rows that do not divide evenly into chunks.
+    assertRoundTrips(PngEncoder.create(), testImage(640, 1136, 4));
+  }
+
+  @Test
+  public void encodeWithEveryCompressionLevel() throws IOException {
+    RawImage image = testImage(320, 480, 3);
+    for (int level = -1; level <= 9; level++) {
+      assertRoundTrips(PngEncoder.create().withCompressionLevel(level), image);
+    }
+  }
+
+  @Test
+  public void encodeOnCallingThread() throws IOException {
+    assertRoundTrips(PngEncoder.create().withExecutor(Runnable::run), testImage(640, 1136, 3));
+  }
+
+  @Test
+  public void isPng() {
+    byte[] png = PngEncoder.create().encode(testImage(2, 2, 3));
+    assertThat(RawImage.isPng(png)).isTrue();
+    assertThat(RawImage.isPng(new byte[] {'M', 'M', 0, 42})).isFalse();
+  }
+
+  /** Returns an image of gradients and noise, so every row filter gets used. */
+  private static RawImage testImage(int width, int height, int channels) {
+    Random random = new Random(width * height * channels);
+    byte[] pixels = new byte[width * height * channels];
+    int i = 0;
+    for (int y = 0; y < height; y++) {
+      for (int x = 0; x < width; x++) {
+        boolean noisy = (y / 64) % 2 == 1;
+        for (int c = 0; c < channels; c++) {
+          pixels[i++] = (byte) (noisy ? random.nextInt(256) : x * (c + 1) + y);
+        }
+      }
+    }
+    return RawImage.wrap(width, height, channels, pixels);
+  }
+
+  private static void assertRoundTrips(PngEncoder encoder, RawImage image) throws IOException {
+    byte[] png = encoder.encode(image);
+    RawImage decoded = RawImage.fromBufferedImage(ImageIO.read(new ByteArrayInputStream(png)));
+    assertThat(decoded.width()).isEqualTo(image.width());
+    assertThat(decoded.height()).isEqualTo(image.height());
+    assertThat(decoded.channels()).isEqualTo(image.channels());
+    assertThat(decoded.copyPixels()).isEqualTo(image.copyPixels());
+  }
+}
@@ -0,0 +1,114 @@
+// Copyright 2017 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+package com.google.iosdevicecontrol.image;
+
+import static com.google.common.truth.Truth.assertThat;
+
+import java.io.IOException;
+import java.nio.ByteBuffer;
+import java.nio.ByteOrder;
+import org.junit.Test;
+import org.junit.runner.RunWith;
+import org.junit.runners.JUnit4;
+
+/** Tests for the {@link com.google.iosdevicecontrol.image.RawImage}. */
+@RunWith(JUnit4.class)
+public class RawImageTest {
+  private static final byte[] PIXELS = {
+    1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16, 17, 18, 19, 20, 21, 22, 23, 24
+  };
+
+  @Test
+  public void decodeUncompressedTiff() throws IOException {
+    RawImage image = RawImage.decode(tiff(1, PIXELS, PIXELS.length));
+    assertThat(image.width()).isEqualTo(3);
+    assertThat(image.height()).isEqualTo(2);
+    assertThat(image.channels()).isEqualTo(4);
+    assertThat(image.copyPixels()).isEqualTo(PIXELS);
+  }
+
+  @Test
+  public void decodePackBitsTiff() throws IOException {
+    // A literal run of the first 20 bytes, then the last 4 bytes as two runs of two equal bytes.
+    byte[] packed = new byte[27];
+    packed[0] = 19;
+    System.arraycopy(PIXELS, 0, packed, 1, 20);
+    packed[21] = -1;
+    packed[22] = 21;
+    packed[23] = -1;
+    packed[24] = 23;
+    packed[25] = -128;
+    packed[26] = 0;
+    byte[] expected = PIXELS.clone();
+    expected[21] = 21;
+    expected[23] = 23;
+    RawImage image = RawImage.decode(tiff(32773, packed, packed.length));
+    assertThat(image.copyPixels()).isEqualTo(expected);
+  }
+
+  @Test
+  public void scaledToFitAveragesPixels() {
+    RawImage image =
+        RawImage.wrap(4, 2, 3, new byte[] {
+          0, 0, 0, 10, 10, 10, 20, 20, 20, 30, 30, 30,
+          2, 2, 2, 12, 12, 12, 22, 22, 22, 32, 32, 32
+        });
+    RawImage scaled = image.scaledToFit(2, 2);
+    assertThat(scaled.width()).isEqualTo(2);
+    assertThat(scaled.height()).isEqualTo(1);
+    assertThat(scaled.copyPixels()).isEqualTo(new byte[] {6, 6, 6, 26, 26, 26});
+  }
+
+  @Test
+  public void scaledToFitKeepsSmallerImage() {
+    RawImage image = RawImage.wrap(3, 2, 4, PIXELS);
+    assertThat(image.scaledToFit(3, 3)).isSameAs(image);
+  }
+
+  /** Returns a little endian TIFF of a 3x2 RGBA image in a single strip. */
+  private static byte[] tiff(int compression, byte[] strip, int stripLength) {
+    int entries = 9;
+    int bitsOffset = 8 + 2 + entries * 12 + 4;
+    int stripOffset = bitsOffset + 8;
+    ByteBuffer buffer =
+        ByteBuffer.allocate(stripOffset + strip.length).order(ByteOrder.LITTLE_ENDIAN);
+    buffer.put((byte) 'I').put((byte) 'I').putShort((short) 42).putInt(8);
+    buffer.putShort((short) entries);
+    putEntry(buffer, 256, 3, 1, 3);
+    putEntry(buffer, 257, 3, 1, 2);
+    putEntry(buffer, 258, 3, 4, bitsOffset);
+    putEntry(buffer, 259, 3, 1, compression);
+    putEntry(buffer, 262, 3, 1, 2);
+    putEntry(buffer, 273, 4, 1, stripOffset);
+    putEntry(buffer, 277, 3, 1, 4);
+    putEntry(buffer, 279, 4, 1, stripLength);
+    putEntry(buffer, 338, 3, 1, 2);
+    buffer.putInt(0);
+    for (int i = 0; i < 4; i++) {
+      buffer.putShort((short) 8);
+    }
+    buffer.put(strip);
+    return buffer.array();
+  }
+
+  private static void putEntry(ByteBuffer buffer, int tag, int type, int count, int value) {
+    buffer.putShort((short) tag).putShort((short) type).putInt(count);
+    if (type == 3 && count == 1) {
+      buffer.putShort((short) value).putShort((short) 0);
+    } else {
+      buffer.putInt(value);
+    }
+  }
+}
@@ -0,0 +1,231 @@
+// Copyright 2017 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+package com.google.iosdevicecontrol.image;
+
+import static com.google.common.truth.Truth.assertThat;
+import static com.google.common.truth.Truth.assert_;
+import static java.nio.charset.StandardCharsets.US_ASCII;
+
+import com.google.common.jimfs.Configuration;
+import com.google.common.jimfs.Jimfs;
+import com.google.common.util.concurrent.Uninterruptibles;
+import java.awt.image.BufferedImage;
+import java.io.ByteArrayInputStream;
+import java.io.IOException;
+import java.nio.ByteBuffer;
+import java.nio.ByteOrder;
+import java.nio.file.Files;
+import java.nio.file.Path;
+import java.time.Duration;
+import java.util.concurrent.CountDownLatch;
+import java.util.concurrent.TimeUnit;
+import java.util.concurrent.atomic.AtomicBoolean;
+import javax.imageio.ImageIO;
+import org.junit.Before;
+import org.junit.Test;
+import org.junit.runner.RunWith;
+import org.junit.runners.JUnit4;
+
+/** Tests for the {@link com.google.iosdevicecontrol.image.ScreenRecorder}. */
+@RunWith(JUnit4.class)
+public class ScreenRecorderTest {
+  private static final int WIDTH = 32;
+  private static final int HEIGHT = 24;
+
+  private Path videoPath;
+
+  @Before
+  public void setUp() throws IOException {
+    Path directory = Jimfs.newFileSystem(Configuration.unix()).getPath("/videos");
+    Files.createDirectories(directory);
+    videoPath = directory.resolve("screen.avi");
+  }
+
+  @Test
+  public void recordSyntheticFrames() throws IOException {
+    ScreenRecorder recorder =
+        ScreenRecorder.withDefaults().withFrameRate(20).start(frames(10, false), videoPath);
+    Uninterruptibles.sleepUninterruptibly(300, TimeUnit.MILLISECONDS);
+    recorder.close();
+
+    ByteBuffer avi = readVideo();
+    int totalFrames = avi.getInt(48);
+    assertThat(recorder.framesEncoded()).isGreaterThan(0);
+    assertThat(recorder.framesEncoded() + recorder.framesDropped())
+        .isEqualTo(recorder.framesCaptured());
+    assertThat(totalFrames).isAtLeast(recorder.framesEncoded());
+    assertThat(avi.getInt(64)).isEqualTo(WIDTH);
+    assertThat(avi.getInt(68)).isEqualTo(HEIGHT);
+
+    // The first frame follows the headers, and is a JPEG image of the same size.
+    assertThat(fourCc(avi, 224)).isEqualTo("00dc");
+    byte[] jpeg = new byte[avi.getInt(228)];
+    avi.position(232);
+    avi.get(jpeg);
+    BufferedImage frame = ImageIO.read(new ByteArrayInputStream(jpeg));
+    assertThat(frame.getWidth()).isEqualTo(WIDTH);
+    assertThat(frame.getHeight()).isEqualTo(HEIGHT);
+
+    // The index at the end has an entry for every frame, including the repeated ones.
+    int moviEnd = 220 + avi.getInt(216);
+    assertThat(fourCc(avi, moviEnd)).isEqualTo("idx1");
+    assertThat(avi.getInt(moviEnd + 4)).isEqualTo(totalFrames * 16);
+    assertThat(moviEnd + 8 + totalFrames * 16).isEqualTo(avi.limit());
+  }
+
+  @Test
+  public void slowSourceRepeatsFrames() throws IOException {
+    ScreenRecorder recorder =
+        ScreenRecorder.withDefaults().withFrameRate(20).start(frames(120, false), videoPath);
+    Uninterruptibles.sleepUninterruptibly(500, TimeUnit.MILLISECONDS);
+    recorder.close();
+
+    ByteBuffer avi = readVideo();
+    assertThat(recorder.framesEncoded()).isAtLeast(2);
+    assertThat(avi.getInt(48)).isGreaterThan(recorder.framesEncoded());
+  }
+
+  @Test
+  public void recordFramesWithAlpha() throws IOException {
+    ScreenRecorder recorder = ScreenRecorder.withDefaults().start(frames(0, true), videoPath);
+    Uninterruptibles.sleepUninterruptibly(100, TimeUnit.MILLISECONDS);
+    recorder.close();
+    assertThat(recorder.framesEncoded()).isGreaterThan(0);
+    assertThat(fourCc(readVideo(), 0)).isEqualTo("RIFF");
+  }
+
+  @Test
+  public void closeFailsIfCaptureFailed() {
+    ScreenRecorder recorder =
+        ScreenRecorder.withDefaults()
+            .start(
+                () -> {
+                  throw new IOException("Device disconnected");
+                },
+                videoPath);
+    try {
+      recorder.close();
+      assert_().fail();
+    } catch (IOException expected) {
+      assertThat(expected.getCause().getMessage()).isEqualTo("Device disconnected");
+    }
+  }
+
+  @Test
+  public void scaleFramesOfAnotherSize() throws IOException {
+    int[] count = {0};
+    FrameSource rotating =
+        () -> {
+          Uninterruptibles.sleepUninterruptibly(10, TimeUnit.MILLISECONDS);
+          return count[0]++ % 2 == 0
+              ? new BufferedImage(WIDTH, HEIGHT, BufferedImage.TYPE_INT_RGB)
+              : new BufferedImage(HEIGHT, WIDTH, BufferedImage.TYPE_INT_RGB);
+        };
+    ScreenRecorder recorder = ScreenRecorder.withDefaults().start(rotating, videoPath);
+    Uninterruptibles.sleepUninterruptibly(300, TimeUnit.MILLISECONDS);
+    recorder.close();
+    assertThat(recorder.framesEncoded()).isAtLeast(2);
+
+    // Every frame has the size of the video, which is that of the first frame.
+    ByteBuffer avi = readVideo();
+    int moviEnd = 220 + avi.getInt(216);
+    int images = 0;
+    for (int offset = 224; offset < moviEnd; ) {
+      int length = avi.getInt(offset + 4);
+      if (length > 0) {
+        byte[] jpeg = new byte[length];
+        avi.position(offset + 8);
+        avi.get(jpeg);
+        BufferedImage frame = ImageIO.read(new ByteArrayInputStream(jpeg));
+        assertThat(frame.getWidth()).isEqualTo(WIDTH);
+        assertThat(frame.getHeight()).isEqualTo(HEIGHT);
+        images++;
+      }
+      offset += 8 + length + (length & 1);
+    }
+    assertThat(images).isEqualTo(recorder.framesEncoded());
+  }
+
+  @Test
+  public void closeDoesNotWaitForHungCapture() throws IOException {
+    CountDownLatch hung = new CountDownLatch(1);
+    CountDownLatch release = new CountDownLatch(1);
+    AtomicBoolean closed = new AtomicBoolean(false);
+    int[] count = {0};
+    FrameSource source =
+        new FrameSource() {
+          @Override
+          public BufferedImage captureFrame() {
+            if (count[0]++ > 0) {
+              hung.countDown();
+              Uninterruptibles.awaitUninterruptibly(release);
+            }
+            return new BufferedImage(WIDTH, HEIGHT, BufferedImage.TYPE_INT_RGB);
+          }
+
+          @Override
+          public void close() {
+            closed.set(true);
+          }
+        };
+    ScreenRecorder recorder =
+        ScreenRecorder.withDefaults()
+            .withStopTimeout(Duration.ofMillis(100))
+            .start(source, videoPath);
+    Uninterruptibles.awaitUninterruptibly(hung);
+    try {
+      recorder.close();
+      assert_().fail();
+    } catch (IOException expected) {
+      assertThat(expected.getMessage()).contains("did not return");
+      // The source is only closed once the hung capture returns.
+      assertThat(closed.get()).isFalse();
+    } finally {
+      release.countDown();
+    }
+    // The video is finished with the frame captured before.
+    assertThat(recorder.framesEncoded()).isEqualTo(1);
+    assertThat(readVideo().getInt(48)).isEqualTo(1);
+  }
+
+  /** Returns a source of frames that each take the specified time to capture. */
+  private static FrameSource frames(int captureMillis, boolean alpha) {
+    int[] count = {0};
+    return () -> {
+      Uninterruptibles.sleepUninterruptibly(captureMillis, TimeUnit.MILLISECONDS);
+      BufferedImage image =
+          new BufferedImage(
+              WIDTH, HEIGHT, alpha ? BufferedImage.TYPE_INT_ARGB : BufferedImage.TYPE_INT_RGB);
+      image.setRGB(count[0]++ % WIDTH, 0, 0xffffffff);
+      return image;
+    };
+  }
+
+  private ByteBuffer readVideo() throws IOException {
+    ByteBuffer avi = ByteBuffer.wrap(Files.readAllBytes(videoPath)).order(ByteOrder.LITTLE_ENDIAN);
+    assertThat(fourCc(avi, 0)).isEqualTo("RIFF");
+    assertThat(fourCc(avi, 8)).isEqualTo("AVI ");
+    assertThat(avi.getInt(4)).isEqualTo(avi.limit() - 8);
+    return avi;
+  }
+
+  private static String fourCc(ByteBuffer buffer, int offset) {
+    byte[] fourCc = new byte[4];
+    for (int i = 0; i < 4; i++) {
+      fourCc[i] = buffer.get(offset + i);
+    }
+    return new String(fourCc, US_ASCII);
+  }
+}
@@ -0,0 +1,116 @@
+// Copyright 2017 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+package com.google.iosdevicecontrol.image;
+
+import static com.google.common.truth.Truth.assertThat;
+import static java.nio.charset.StandardCharsets.UTF_8;
+
+import com.google.common.jimfs.Configuration;
+import com.google.common.jimfs.Jimfs;
+import com.google.iosdevicecontrol.image.ScreenshotStore.StoredScreenshot;
+import java.io.IOException;
+import java.nio.file.Files;
+import java.nio.file.Path;
+import java.util.List;
+import org.junit.Before;
+import org.junit.Test;
+import org.junit.runner.RunWith;
+import org.junit.runners.JUnit4;
+
+/** Tests for the {@link com.google.iosdevicecontrol.image.ScreenshotStore}. */
+@RunWith(JUnit4.class)
+public class ScreenshotStoreTest {
+  private Path storeDir;
+  private ScreenshotStore store;
+
+  @Before
+  public void setUp() {
+    storeDir = Jimfs.newFileSystem(Configuration.unix()).getPath("/screenshots");
+    store = ScreenshotStore.inDirectory(storeDir);
+  }
+
+  @Test
+  public void addStoresIdenticalScreenshotsOnce() throws IOException {
+    byte[] png = gradientPng(false, 0);
+    StoredScreenshot first = store.add("first", png);
+    StoredScreenshot second = store.add("second", png);
+
+    assertThat(first.duplicate()).isFalse();
+    assertThat(first.unchanged()).isFalse();
+    assertThat(second.duplicate()).isTrue();
+    assertThat(second.unchanged()).isTrue();
+    assertThat(second.path()).isEqualTo(first.path());
+    assertThat(Files.readAllBytes(first.path())).isEqualTo(png);
+  }
+
+  @Test
+  public void addFlagsNearlyIdenticalScreenshotAsUnchanged() throws IOException {
+    StoredScreenshot first = store.add("first", gradientPng(false, 0));
+    StoredScreenshot second = store.add("second", gradientPng(false, 1));
+
+    assertThat(second.contentHash()).isNotEqualTo(first.contentHash());
+    assertThat(second.duplicate()).isFalse();
+    assertThat(second.unchanged()).isTrue();
+  }
+
+  @Test
+  public void addFlagsDifferentScreenshotAsChanged() throws IOException {
+    store.add("first", gradientPng(false, 0));
+    StoredScreenshot second = store.add("second", gradientPng(true, 0));
+    assertThat(second.unchanged()).isFalse();
+  }
+
+  @Test
+  public void addFlagsDifferentScreenshotAsUnchangedWithinDistance() throws IOException {
+    store = ScreenshotStore.inDirectory(storeDir, 63);
+    store.add("first", gradientPng(false, 0));
+    StoredScreenshot second = store.add("second", gradientPng(true, 0));
+    assertThat(second.unchanged()).isTrue();
+  }
+
+  @Test
+  public void addAppendsToIndex() throws IOException {
+    StoredScreenshot first = store.add("first", gradientPng(false, 0));
+    store.add("second\tshot", gradientPng(false, 0));
+
+    List<String> index =
+        Files.readAllLines(storeDir.resolve(ScreenshotStore.INDEX_FILE_NAME), UTF_8);
+    assertThat(index)
+        .containsExactly(
+            String.format("first\t%s\t%016x\t0", first.contentHash(), first.perceptualHash()),
+            String.format("second shot\t%s\t%016x\t1", first.contentHash(), first.perceptualHash()))
+        .inOrder();
+  }
+
+  /**
+   * Returns a PNG of a horizontal gradient that gets brighter or darker, with one pixel of the
+   * specified brightness in the corner.
+   */
+  private static byte[] gradientPng(boolean darker, int cornerValue) {
+    int width = 90;
+    int height = 80;
+    byte[] pixels = new byte[width * height * 3];
+    for (int y = 0; y < height; y++) {
+      for (int x = 0; x < width; x++) {
+        int value = darker ? 255 - x * 2 : x * 2;
+        for (int c = 0; c < 3; c++) {
+          pixels[(y * width + x) * 3 + c] = (byte) value;
+        }
+      }
+    }
+    pixels[0] = (byte) cornerValue;
+    return PngEncoder.create().encode(RawImage.wrap(width, height, 3, pixels));
+  }
+}
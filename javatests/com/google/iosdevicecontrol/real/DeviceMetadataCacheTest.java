@@ -0,0 +1,112 @@
+// Copyright 2017 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+package com.google.iosdevicecontrol.real;
+
+import static com.google.common.truth.Truth.assertThat;
+import static java.nio.charset.StandardCharsets.UTF_8;
+
+import com.google.common.collect.ImmutableMap;
+import com.google.common.collect.ImmutableSet;
+import com.google.common.jimfs.Configuration;
+import com.google.common.jimfs.Jimfs;
+import com.google.iosdevicecontrol.IosAppBundleId;
+import com.google.iosdevicecontrol.real.DeviceMetadataCache.DeviceMetadata;
+import java.io.IOException;
+import java.nio.file.Files;
+import java.nio.file.Path;
+import java.util.Optional;
+import org.junit.Before;
+import org.junit.Test;
+import org.junit.runner.RunWith;
+import org.junit.runners.JUnit4;
+
+/** Tests for the {@link com.google.iosdevicecontrol.real.DeviceMetadataCache}. */
+@RunWith(JUnit4.class)
+public class DeviceMetadataCacheTest {
+  private static final String UDID = "0123456789abcdef0123456789abcdef01234567";
+  private static final ImmutableMap<String, String> INFO =
+      ImmutableMap.of(
+          "BuildVersion", "12H321",
+          "CPUArchitecture", "arm64",
+          "ProductType", "iPhone5,1",
+          "ProductVersion", "8.4.1");
+
+  private Path cacheDir;
+  private DeviceMetadataCache cache;
+
+  @Before
+  public void setUp() {
+    cacheDir = Jimfs.newFileSystem(Configuration.unix()).getPath("/path/to/cache");
+    cache = DeviceMetadataCache.inDirectory(cacheDir);
+  }
+
+  @Test
+  public void readWithoutEntry() {
+    assertThat(cache.read(UDID).isPresent()).isFalse();
+  }
+
+  @Test
+  public void writeThenRead() {
+    DeviceMetadata metadata =
+        DeviceMetadata.create(UDID, "1a2b3c")
+            .withInfo(INFO)
+            .withApplications(ImmutableSet.of(new IosAppBundleId("com.example.app")));
+    cache.write(metadata);
+    assertThat(cache.read(UDID)).isEqualTo(Optional.of(metadata));
+  }
+
+  @Test
+  public void writeReplacesEntry() {
+    DeviceMetadata metadata = DeviceMetadata.create(UDID, "1a2b3c").withInfo(INFO);
+    cache.write(metadata);
+    cache.write(metadata.withoutMutableMetadata());
+    assertThat(cache.read(UDID)).isEqualTo(Optional.of(DeviceMetadata.create(UDID, "1a2b3c")));
+  }
+
+  @Test
+  public void readIgnoresOtherVersion() throws IOException {
+    cache.write(DeviceMetadata.create(UDID, "1a2b3c"));
+    Path entry = cacheDir.resolve(UDID + ".plist");
+    String xml = new String(Files.readAllBytes(entry), UTF_8);
+    String otherVersionXml =
+        xml.replace(
+            "<integer>" + DeviceMetadataCache.VERSION + "</integer>",
+            "<integer>" + (DeviceMetadataCache.VERSION + 1) + "</integer>");
+    assertThat(otherVersionXml).isNotEqualTo(xml);
+    Files.write(entry, otherVersionXml.getBytes(UTF_8));
+    assertThat(cache.read(UDID).isPresent()).isFalse();
+  }
+
+  @Test
+  public void readIgnoresMalformedEntry() throws IOException {
+    Files.createDirectories(cacheDir);
+    Files.write(cacheDir.resolve(UDID + ".plist"), "not a plist".getBytes(UTF_8));
+    assertThat(cache.read(UDID).isPresent()).isFalse();
+  }
+
+  @Test
+  public void readIgnoresIncompleteInfo() {
+    cache.write(
+        DeviceMetadata.create(UDID, "1a2b3c").withInfo(ImmutableMap.of("BuildVersion", "12H321")));
+    assertThat(cache.read(UDID).get().info()).isEmpty();
+  }
+
+  @Test
+  public void disabledCacheHasNoEntries() {
+    DeviceMetadataCache disabled = DeviceMetadataCache.disabled();
+    disabled.write(DeviceMetadata.create(UDID, "1a2b3c"));
+    assertThat(disabled.read(UDID).isPresent()).isFalse();
+  }
+}
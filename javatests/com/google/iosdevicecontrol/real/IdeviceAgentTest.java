@@ -0,0 +1,226 @@
+// Copyright 2017 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+package com.google.iosdevicecontrol.real;
+
+import static com.google.common.truth.Truth.assertThat;
+import static java.nio.charset.StandardCharsets.UTF_8;
+import static org.junit.Assert.fail;
+
+import com.google.iosdevicecontrol.real.IdeviceAgent.CallException;
+import com.google.iosdevicecontrol.real.IdeviceAgent.Channel;
+import java.io.DataInputStream;
+import java.io.DataOutputStream;
+import java.io.IOException;
+import java.net.InetAddress;
+import java.net.ServerSocket;
+import java.net.Socket;
+import java.nio.ByteBuffer;
+import java.util.Optional;
+import java.util.concurrent.atomic.AtomicBoolean;
+import org.junit.After;
+import org.junit.Before;
+import org.junit.Test;
+import org.junit.runner.RunWith;
+import org.junit.runners.JUnit4;
+
+/** Tests for {@link com.google.iosdevicecontrol.real.IdeviceAgent}. */
+@RunWith(JUnit4.class)
+public class IdeviceAgentTest {
+  private static final String TOKEN = "secret";
+
+  private final AtomicBoolean closed = new AtomicBoolean(false);
+  private Socket fakeAgentSocket;
+  private DataInputStream fromClient;
+  private DataOutputStream toClient;
+  private IdeviceAgent agent;
+  private volatile Throwable fakeAgentFailure;
+
+  @Before
+  public void setUp() throws IOException {
+    try (ServerSocket server = new ServerSocket(0, 1, InetAddress.getLoopbackAddress())) {
+      Socket socket = new Socket(InetAddress.getLoopbackAddress(), server.getLocalPort());
+      fakeAgentSocket = server.accept();
+      agent = IdeviceAgent.connect(socket, TOKEN, () -> closed.set(true));
+    }
+    fromClient = new DataInputStream(fakeAgentSocket.getInputStream());
+    toClient = new DataOutputStream(fakeAgentSocket.getOutputStream());
+    assertThat(readFrame()).isEqualTo(new Frame(0, 0, TOKEN));
+  }
+
+  @After
+  public void tearDown() throws IOException {
+    agent.close();
+    fakeAgentSocket.close();
+  }
+
+  @Test
+  public void callReturnsAllDataOfChannel() throws Exception {
+    Thread fakeAgent =
+        startFakeAgent(
+            () -> {
+              Frame open = readFrame();
+              assertThat(open).isEqualTo(new Frame(open.channel, 1, "info\0domain\0key\0"));
+              writeFrame(open.channel, 2, "<plist>".getBytes(UTF_8));
+              writeFrame(open.channel, 2, "</plist>".getBytes(UTF_8));
+              writeClose(open.channel, 0, "");
+            });
+    String info;
+    try {
+      info = new String(agent.call("info", "domain", "key"), UTF_8);
+    } finally {
+      join(fakeAgent);
+    }
+    assertThat(info).isEqualTo("<plist></plist>");
+  }
+
+  @Test
+  public void callThrowsStatusOfFailedMethod() throws Exception {
+    Thread fakeAgent = startFakeAgent(() -> writeClose(readFrame().channel, -3, "No service."));
+    try {
+      agent.call("screenshot");
+      fail();
+    } catch (CallException expected) {
+      assertThat(expected.status()).isEqualTo(-3);
+      assertThat(expected.getMessage()).contains("No service.");
+    } finally {
+      join(fakeAgent);
+    }
+  }
+
+  @Test
+  public void channelsShareConnection() throws Exception {
+    Channel syslog = agent.open("syslog");
+    Channel inspector = agent.open("inspector");
+    Frame openSyslog = readFrame();
+    Frame openInspector = readFrame();
+    assertThat(openSyslog.channel).isNotEqualTo(openInspector.channel);
+
+    inspector.write("message".getBytes(UTF_8));
+    assertThat(readFrame()).isEqualTo(new Frame(openInspector.channel, 2, "message"));
+    writeFrame(openInspector.channel, 2, "reply".getBytes(UTF_8));
+    writeFrame(openSyslog.channel, 2, "line\n".getBytes(UTF_8));
+    assertThat(new String(inspector.read().get(), UTF_8)).isEqualTo("reply");
+    assertThat(new String(syslog.read().get(), UTF_8)).isEqualTo("line\n");
+
+    syslog.close();
+    assertThat(readFrame()).isEqualTo(new Frame(openSyslog.channel, 3, ""));
+    writeClose(openSyslog.channel, 0, "");
+    assertThat(syslog.read()).isEqualTo(Optional.empty());
+    assertThat(syslog.status()).isEqualTo(0);
+    assertThat(agent.isOpen()).isTrue();
+  }
+
+  @Test
+  public void lostConnectionEndsChannels() throws Exception {
+    Channel syslog = agent.open("syslog");
+    readFrame();
+    fakeAgentSocket.close();
+    try {
+      syslog.read();
+      fail();
+    } catch (IOException expected) {
+    }
+    assertThat(agent.isOpen()).isFalse();
+    assertThat(closed.get()).isTrue();
+  }
+
+  private interface FakeAgent {
+    void serve() throws IOException;
+  }
+
+  /**
+   * Serves the client on another thread, which the test waits for with {@link #join}. A failure
+   * closes the connection, so the client does not wait for the fake agent forever.
+   */
+  private Thread startFakeAgent(FakeAgent fakeAgent) {
+    Thread thread =
+        new Thread(
+            () -> {
+              try {
+                fakeAgent.serve();
+              } catch (IOException | RuntimeException | AssertionError e) {
+                fakeAgentFailure = e;
+                try {
+                  fakeAgentSocket.close();
+                } catch (IOException ce) {
+                  e.addSuppressed(ce);
+                }
+              }
+            });
+    thread.start();
+    return thread;
+  }
+
+  private void join(Thread fakeAgent) throws InterruptedException {
+    fakeAgent.join();
+    if (fakeAgentFailure != null) {
+      throw new AssertionError("The fake agent failed", fakeAgentFailure);
+    }
+  }
+
+  private Frame readFrame() throws IOException {
+    int length = fromClient.readInt();
+    int channel = fromClient.readInt();
+    int type = fromClient.readUnsignedByte();
+    byte[] payload = new byte[length];
+    fromClient.readFully(payload);
+    return new Frame(channel, type, new String(payload, UTF_8));
+  }
+
+  private void writeFrame(int channel, int type, byte[] payload) throws IOException {
+    toClient.writeInt(payload.length);
+    toClient.writeInt(channel);
+    toClient.writeByte(type);
+    toClient.write(payload);
+    toClient.flush();
+  }
+
+  private void writeClose(int channel, int status, String message) throws IOException {
+    byte[] text = message.getBytes(UTF_8);
+    writeFrame(channel, 3, ByteBuffer.allocate(4 + text.length).putInt(status).put(text).array());
+  }
+
+  private static final class Frame {
+    final int channel;
+    final int type;
+    final String payload;
+
+    Frame(int channel, int type, String payload) {
+      this.channel = channel;
+      this.type = type;
+      this.payload = payload;
+    }
+
+    @Override
+    public boolean equals(Object o) {
+      if (!(o instanceof Frame)) {
+        return false;
+      }
+      Frame that = (Frame) o;
+      return channel == that.channel && type == that.type && payload.equals(that.payload);
+    }
+
+    @Override
+    public int hashCode() {
+      return 31 * (31 * channel + type) + payload.hashCode();
+    }
+
+    @Override
+    public String toString() {
+      return channel + "/" + type + ": " + payload;
+    }
+  }
+}
@@ -0,0 +1,213 @@
+// Copyright 2017 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+package com.google.iosdevicecontrol.simulator;
+
+import static com.google.common.truth.Truth.assertThat;
+import static java.nio.charset.StandardCharsets.UTF_8;
+
+import com.google.common.collect.ImmutableSet;
+import com.google.common.jimfs.Configuration;
+import com.google.common.jimfs.Jimfs;
+import com.google.common.util.concurrent.Uninterruptibles;
+import com.google.iosdevicecontrol.simulator.CrashLogIndex.CrashReport;
+import java.io.IOException;
+import java.nio.file.FileSystem;
+import java.nio.file.Files;
+import java.nio.file.Path;
+import java.util.concurrent.TimeUnit;
+import org.junit.After;
+import org.junit.Before;
+import org.junit.Rule;
+import org.junit.Test;
+import org.junit.rules.TemporaryFolder;
+import org.junit.runner.RunWith;
+import org.junit.runners.JUnit4;
+
+/** Tests for the {@link com.google.iosdevicecontrol.simulator.CrashLogIndex}. */
+@RunWith(JUnit4.class)
+public class CrashLogIndexTest {
+  private static final String UDID_1 = "5C3E8A1F-2B4D-4E6F-8A0B-1C2D3E4F5A6B";
+  private static final String UDID_2 = "9D8C7B6A-5F4E-4D3C-8B2A-190817263544";
+
+  @Rule public final TemporaryFolder tempFolder = new TemporaryFolder();
+
+  private Path crashLogDir;
+  private CrashLogIndex index;
+
+  @Before
+  public void setUp() throws IOException {
+    crashLogDir = tempFolder.newFolder("DiagnosticReports").toPath();
+    index = new CrashLogIndex(crashLogDir);
+  }
+
+  @After
+  public void tearDown() throws IOException {
+    index.close();
+  }
+
+  @Test
+  public void parseReport() throws IOException {
+    Path path = writeReport("MyApp_2017-05-01-120000_host.crash", "MyApp", 1234, UDID_1);
+    CrashReport report = CrashLogIndex.parse(path).get();
+    assertThat(report.path()).isEqualTo(path);
+    assertThat(report.udid()).isEqualTo(UDID_1);
+    assertThat(report.process()).isEqualTo("MyApp");
+    assertThat(report.pid()).isEqualTo(1234);
+  }
+
+  @Test
+  public void parseJsonReport() throws IOException {
+    Path path = crashLogDir.resolve("MyApp-2021-10-01-120000.ips");
+    Files.write(
+        path,
+        ("{\"app_name\":\"MyApp\",\"bug_type\":\"309\"}\n{\n  \"pid\" : 4321,\n"
+                + "  \"osVersion\" : {\"train\" : \"macOS 12.0\"},\n"
+                + "  \"procName\" : \"MyApp\",\n  \"procPath\" : \""
+                + appPath(UDID_2, "MyApp")
+                + "\"\n}\n")
+            .getBytes(UTF_8));
+    CrashReport report = CrashLogIndex.parse(path).get();
+    assertThat(report.udid()).isEqualTo(UDID_2);
+    assertThat(report.process()).isEqualTo("MyApp");
+    assertThat(report.pid()).isEqualTo(4321);
+  }
+
+  @Test
+  public void parseIgnoresHostReports() throws IOException {
+    Path path = crashLogDir.resolve("Finder_2017-05-01-120000_host.crash");
+    Files.write(
+        path,
+        "Process:               Finder [99]\nPath:                  /System/Finder\n"
+            .getBytes(UTF_8));
+    assertThat(CrashLogIndex.parse(path).isPresent()).isFalse();
+  }
+
+  @Test
+  public void reportsAreAttributedToDevices() throws IOException {
+    Path report1 = writeReport("MyApp_1.crash", "MyApp", 1, UDID_1);
+    Path report2 = writeReport("MyApp_2.crash", "MyApp", 2, UDID_2);
+    Path report3 = writeReport("Other_3.crash", "Other", 3, UDID_1);
+    assertThat(paths(index.reports(UDID_1))).containsExactly(report1, report3);
+    assertThat(paths(index.reports(UDID_2))).containsExactly(report2);
+  }
+
+  @Test
+  public void newReportsAreIndexedIncrementally() throws IOException {
+    Path report1 = writeReport("MyApp_1.crash", "MyApp", 1, UDID_1);
+    assertThat(paths(index.reports(UDID_1))).containsExactly(report1);
+
+    Path report2 = writeReport("MyApp_2.crash", "MyApp", 2, UDID_1);
+    Files.delete(report1);
+    assertThat(awaitReports(UDID_1, 1)).containsExactly(report2);
+  }
+
+  @Test
+  public void pullMovesOnlyTheReportsOfTheDevice() throws IOException {
+    Path report1 = writeReport("MyApp_1.crash", "MyApp", 1, UDID_1);
+    Path report2 = writeReport("MyApp_2.crash", "MyApp", 2, UDID_2);
+    Path pulledDir = tempFolder.newFolder("pulled").toPath();
+
+    index.pull(UDID_1, pulledDir);
+    assertThat(Files.exists(report1)).isFalse();
+    assertThat(Files.exists(pulledDir.resolve(report1.getFileName()))).isTrue();
+    assertThat(Files.exists(report2)).isTrue();
+    assertThat(index.reports(UDID_1)).isEmpty();
+  }
+
+  @Test
+  public void clearDeletesOnlyTheReportsOfTheDevice() throws IOException {
+    Path report1 = writeReport("MyApp_1.crash", "MyApp", 1, UDID_1);
+    Path report2 = writeReport("MyApp_2.crash", "MyApp", 2, UDID_2);
+
+    index.clear(UDID_2);
+    assertThat(Files.exists(report1)).isTrue();
+    assertThat(Files.exists(report2)).isFalse();
+    assertThat(index.reports(UDID_2)).isEmpty();
+  }
+
+  @Test
+  public void pullAndClearFindReportsNotYetWatched() throws IOException {
+    // Like the watch service on macOS, that of jimfs only polls the directory every few seconds.
+    FileSystem fileSystem = Jimfs.newFileSystem(Configuration.unix());
+    Path directory = Files.createDirectories(fileSystem.getPath("/DiagnosticReports"));
+    Path pulledDir = Files.createDirectories(fileSystem.getPath("/pulled"));
+    try (CrashLogIndex polled = new CrashLogIndex(directory)) {
+      assertThat(polled.reports(UDID_1)).isEmpty();
+      Path report1 = writeReport(directory, "MyApp_1.crash", "MyApp", 1, UDID_1);
+      Path report2 = writeReport(directory, "MyApp_2.crash", "MyApp", 2, UDID_2);
+
+      polled.pull(UDID_1, pulledDir);
+      assertThat(Files.exists(report1)).isFalse();
+      assertThat(Files.exists(pulledDir.resolve(report1.getFileName().toString()))).isTrue();
+      polled.clear(UDID_2);
+      assertThat(Files.exists(report2)).isFalse();
+    }
+  }
+
+  @Test
+  public void missingDirectoryHasNoReports() throws IOException {
+    CrashLogIndex missing = new CrashLogIndex(crashLogDir.resolve("missing"));
+    assertThat(missing.reports(UDID_1)).isEmpty();
+    missing.close();
+  }
+
+  /** Waits for the watch service to deliver the events that bring the index to the count. */
+  private ImmutableSet<Path> awaitReports(String udid, int count) throws IOException {
+    ImmutableSet<Path> paths = paths(index.reports(udid));
+    for (int i = 0; i < 500 && paths.size() != count; i++) {
+      Uninterruptibles.sleepUninterruptibly(10, TimeUnit.MILLISECONDS);
+      paths = paths(index.reports(udid));
+    }
+    return paths;
+  }
+
+  private Path writeReport(String fileName, String process, int pid, String udid)
+      throws IOException {
+    return writeReport(crashLogDir, fileName, process, pid, udid);
+  }
+
+  private static Path writeReport(
+      Path directory, String fileName, String process, int pid, String udid) throws IOException {
+    Path path = directory.resolve(fileName);
+    String report =
+        "Process:               "
+            + process
+            + " ["
+            + pid
+            + "]\n"
+            + "Path:                  "
+            + appPath(udid, process)
+            + "\n"
+            + "Identifier:            com.example."
+            + process
+            + "\n"
+            + "Code Type:             X86-64 (Native)\n";
+    Files.write(path, report.getBytes(UTF_8));
+    return path;
+  }
+
+  private static String appPath(String udid, String process) {
+    return "/Users/me/Library/Developer/CoreSimulator/Devices/"
+        + udid
+        + "/data/Containers/Bundle/Application/0A1B2C3D-4E5F-4A6B-8C7D-8E9F0A1B2C3D/"
+        + process
+        + ".app/"
+        + process;
+  }
+
+  private static ImmutableSet<Path> paths(ImmutableSet<CrashReport> reports) {
+    return reports.stream().map(CrashReport::path).collect(ImmutableSet.toImmutableSet());
+  }
+}
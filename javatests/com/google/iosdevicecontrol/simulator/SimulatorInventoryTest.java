@@ -0,0 +1,182 @@
+// Copyright 2017 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+package com.google.iosdevicecontrol.simulator;
+
+import static com.google.common.collect.MoreCollectors.onlyElement;
+import static com.google.common.truth.Truth.assertThat;
+import static com.google.common.truth.Truth.assert_;
+
+import com.google.common.collect.ImmutableSet;
+import com.google.iosdevicecontrol.IosDevice;
+import com.google.iosdevicecontrol.IosVersion;
+import com.google.iosdevicecontrol.command.Command;
+import com.google.iosdevicecontrol.command.CommandStartException;
+import com.google.iosdevicecontrol.command.testing.FakeExecutor;
+import com.google.iosdevicecontrol.command.testing.FakeProcess;
+import java.io.IOException;
+import java.time.Duration;
+import java.util.ArrayDeque;
+import java.util.ArrayList;
+import java.util.List;
+import java.util.Queue;
+import java.util.Set;
+import org.junit.Before;
+import org.junit.Test;
+import org.junit.runner.RunWith;
+import org.junit.runners.JUnit4;
+
+/** Tests for the {@link com.google.iosdevicecontrol.simulator.SimulatorInventory}. */
+@RunWith(JUnit4.class)
+public class SimulatorInventoryTest {
+  private static final String IPHONE_7 = "6F5E4D3C-0000-4000-8000-000000000007";
+  private static final String IPAD_AIR = "6F5E4D3C-0000-4000-8000-00000000000A";
+  private static final String IPHONE_SE = "6F5E4D3C-0000-4000-8000-00000000000E";
+  private static final String WATCH = "6F5E4D3C-0000-4000-8000-000000000042";
+
+  private final Queue<String> listings = new ArrayDeque<>();
+  private final List<String> created = new ArrayList<>();
+  private final List<Set<String>> changes = new ArrayList<>();
+  private FakeExecutor executor;
+  private SimulatorInventory inventory;
+
+  @Before
+  public void setUp() {
+    executor =
+        new FakeExecutor() {
+          @Override
+          public FakeProcess start(Command command) throws CommandStartException {
+            FakeProcess process = super.start(command);
+            process.writeStdoutUtf8(listings.remove());
+            process.setTerminated(0);
+            return process;
+          }
+        };
+    inventory =
+        new SimulatorInventory(
+            executor,
+            (udid, productVersion) -> {
+              created.add(udid);
+              return new SimulatorDeviceImpl(
+                  udid,
+                  IosVersion.builder()
+                      .buildVersion("14E269")
+                      .productVersion(productVersion)
+                      .build());
+            },
+            changes::add);
+  }
+
+  @Test
+  public void refreshListsIosSimulators() throws IOException {
+    listings.add(
+        listing(
+            runtime("iOS 10.3", device(IPHONE_7, "Shutdown"), device(IPAD_AIR, "Booted")),
+            runtime("watchOS 3.2", device(WATCH, "Shutdown"))));
+    assertThat(inventory.refresh()).isTrue();
+
+    assertThat(udids(inventory.devices(Duration.ofHours(1)))).containsExactly(IPHONE_7, IPAD_AIR);
+    assertThat(udids(inventory.devicesInState("Booted"))).containsExactly(IPAD_AIR);
+    assertThat(inventory.productVersions()).containsExactly("10.3");
+    assertThat(executor.dequeueProcess().command().arguments())
+        .containsExactly("simctl", "list", "--json", "devices")
+        .inOrder();
+  }
+
+  @Test
+  public void refreshOnlyCreatesNewSimulators() throws IOException {
+    listings.add(
+        listing(runtime("iOS 10.3", device(IPHONE_7, "Shutdown"), device(IPAD_AIR, "Shutdown"))));
+    listings.add(
+        listing(
+            runtime("iOS 10.3", device(IPHONE_7, "Booted")),
+            runtime("iOS 9.3", device(IPHONE_SE, "Shutdown"))));
+    inventory.refresh();
+    IosDevice iphone7 = device(inventory, IPHONE_7);
+
+    assertThat(inventory.refresh()).isTrue();
+    assertThat(device(inventory, IPHONE_7)).isSameAs(iphone7);
+    assertThat(udids(inventory.devices(Duration.ofHours(1)))).containsExactly(IPHONE_7, IPHONE_SE);
+    assertThat(udids(inventory.devicesInState("Booted"))).containsExactly(IPHONE_7);
+    assertThat(inventory.productVersions()).containsExactly("10.3", "9.3");
+    assertThat(created).containsExactly(IPHONE_7, IPAD_AIR, IPHONE_SE).inOrder();
+  }
+
+  @Test
+  public void refreshWithSameListingChangesNothing() throws IOException {
+    String listing = listing(runtime("iOS 10.3", device(IPHONE_7, "Shutdown")));
+    listings.add(listing);
+    listings.add(listing);
+    assertThat(inventory.refresh()).isTrue();
+    assertThat(inventory.refresh()).isFalse();
+    assertThat(created).containsExactly(IPHONE_7);
+    assertThat(changes).containsExactly(ImmutableSet.of("10.3"));
+  }
+
+  @Test
+  public void devicesRefreshesWhenOlderThanMaxAge() throws IOException {
+    listings.add(listing(runtime("iOS 10.3", device(IPHONE_7, "Shutdown"))));
+    listings.add(listing(runtime("iOS 10.3", device(IPAD_AIR, "Shutdown"))));
+    assertThat(udids(inventory.devices(Duration.ofHours(1)))).containsExactly(IPHONE_7);
+    assertThat(udids(inventory.devices(Duration.ofHours(1)))).containsExactly(IPHONE_7);
+    assertThat(udids(inventory.devices(Duration.ZERO))).containsExactly(IPAD_AIR);
+    assertThat(changes).hasSize(2);
+  }
+
+  @Test
+  public void refreshFailsOnMalformedListing() {
+    listings.add("{\"devices\": {\"iOS 10.3\": [{\"name\": \"iPhone 7\"}]}}");
+    try {
+      inventory.refresh();
+      assert_().fail();
+    } catch (IOException expected) {
+    }
+    assertThat(inventory.devicesInState("Shutdown")).isEmpty();
+  }
+
+  private static IosDevice device(SimulatorInventory inventory, String udid) throws IOException {
+    return inventory
+        .devices(Duration.ofHours(1))
+        .stream()
+        .filter(d -> d.udid().equals(udid))
+        .collect(onlyElement());
+  }
+
+  private static List<String> udids(Iterable<IosDevice> devices) {
+    List<String> udids = new ArrayList<>();
+    devices.forEach(d -> udids.add(d.udid()));
+    return udids;
+  }
+
+  private static String listing(String... runtimes) {
+    return "{\n  \"devices\" : {\n" + String.join(",\n", runtimes) + "\n  }\n}\n";
+  }
+
+  private static String runtime(String name, String... devices) {
+    return "    \"" + name + "\" : [\n" + String.join(",\n", devices) + "\n    ]";
+  }
+
+  private static String device(String udid, String state) {
+    return "      {\n"
+        + "        \"state\" : \""
+        + state
+        + "\",\n"
+        + "        \"availability\" : \"(available)\",\n"
+        + "        \"name\" : \"Simulator\",\n"
+        + "        \"udid\" : \""
+        + udid
+        + "\"\n"
+        + "      }";
+  }
+}
@@ -0,0 +1,98 @@
+// Copyright 2017 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+package com.google.iosdevicecontrol.syslog;
+
+import static com.google.common.truth.Truth.assertThat;
+
+import java.time.Clock;
+import java.time.Instant;
+import java.time.ZoneOffset;
+import java.util.Optional;
+import org.junit.Before;
+import org.junit.Test;
+import org.junit.runner.RunWith;
+import org.junit.runners.JUnit4;
+
+/** Tests for the {@link com.google.iosdevicecontrol.syslog.SyslogParser}. */
+@RunWith(JUnit4.class)
+public class SyslogParserTest {
+  private SyslogParser parser;
+
+  @Before
+  public void setUp() {
+    parser = new SyslogParser(Clock.fixed(Instant.parse("2017-10-18T12:00:00Z"), ZoneOffset.UTC));
+  }
+
+  @Test
+  public void parseIdevicesyslogLine() {
+    assertThat(parser.add("Oct 18 11:34:56 iPhone SpringBoard(UIKitCore)[57] <Notice>: Hello"))
+        .isEqualTo(Optional.empty());
+    assertThat(parser.finish())
+        .isEqualTo(
+            Optional.of(
+                SyslogRecord.create(
+                    Instant.parse("2017-10-18T11:34:56Z"),
+                    "SpringBoard",
+                    57,
+                    "Notice",
+                    "UIKitCore",
+                    "Hello")));
+  }
+
+  @Test
+  public void parseIdevicesyslogLineWithoutLibrary() {
+    parser.add("Oct  8 01:02:03 iPhone kernel[0] <Error>: panic?");
+    assertThat(parser.finish())
+        .isEqualTo(
+            Optional.of(
+                SyslogRecord.create(
+                    Instant.parse("2017-10-08T01:02:03Z"), "kernel", 0, "Error", "", "panic?")));
+  }
+
+  @Test
+  public void parseIdevicesyslogLineFromLastYear() {
+    parser.add("Dec 31 23:59:59 iPhone backboardd[66] <Notice>: bye");
+    assertThat(parser.finish().get().time()).isEqualTo(Instant.parse("2016-12-31T23:59:59Z"));
+  }
+
+  @Test
+  public void parseLogStreamLine() {
+    parser.add(
+        "2017-10-18 05:34:56.123456-0700  0x1f2      Default     0x0                  57     0    "
+            + "SpringBoard: (UIKitCore) [com.apple.UIKit:Touch] Touch began");
+    assertThat(parser.finish())
+        .isEqualTo(
+            Optional.of(
+                SyslogRecord.create(
+                    Instant.parse("2017-10-18T12:34:56.123456Z"),
+                    "SpringBoard",
+                    57,
+                    "Default",
+                    "com.apple.UIKit",
+                    "Touch began")));
+  }
+
+  @Test
+  public void continuationLinesExtendMessage() {
+    parser.add("Filtering the log data using \"type != 4\"");
+    assertThat(parser.add("Oct 18 11:34:56 iPhone MyApp[99] <Error>: Exception:")).isEqualTo(
+        Optional.empty());
+    parser.add("  at frame 0");
+    Optional<SyslogRecord> completed = parser.add("Oct 18 11:34:57 iPhone MyApp[99] <Notice>: ok");
+    assertThat(completed.get().message()).isEqualTo("Exception:\n  at frame 0");
+    assertThat(parser.finish().get().message()).isEqualTo("ok");
+    assertThat(parser.finish()).isEqualTo(Optional.empty());
+  }
+}
@@ -0,0 +1,143 @@
+// Copyright 2017 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+package com.google.iosdevicecontrol.syslog;
+
+import static com.google.common.truth.Truth.assertThat;
+import static java.nio.charset.StandardCharsets.UTF_8;
+
+import com.google.common.collect.Range;
+import com.google.common.jimfs.Configuration;
+import com.google.common.jimfs.Jimfs;
+import java.io.IOException;
+import java.io.OutputStream;
+import java.nio.file.Files;
+import java.nio.file.Path;
+import java.time.Instant;
+import org.junit.Before;
+import org.junit.Test;
+import org.junit.runner.RunWith;
+import org.junit.runners.JUnit4;
+
+/** Tests for the {@link com.google.iosdevicecontrol.syslog.SyslogStore}. */
+@RunWith(JUnit4.class)
+public class SyslogStoreTest {
+  private static final Instant T0 = Instant.parse("2017-10-18T12:00:00.000001Z");
+
+  private static final SyslogRecord SPRINGBOARD_0 =
+      SyslogRecord.create(T0, "SpringBoard", 57, "Notice", "UIKitCore", "Hello");
+  private static final SyslogRecord MYAPP_1 =
+      SyslogRecord.create(T0.plusSeconds(1), "MyApp", 99, "Error", "", "Exception:\n  at frame 0");
+  private static final SyslogRecord SPRINGBOARD_2 =
+      SyslogRecord.create(T0.plusSeconds(2), "SpringBoard", 57, "Notice", "UIKitCore", "Bye");
+
+  private Path storeDir;
+  private SyslogStore store;
+
+  @Before
+  public void setUp() {
+    storeDir = Jimfs.newFileSystem(Configuration.unix()).getPath("/path/to/syslog");
+    store = SyslogStore.inDirectory(storeDir);
+  }
+
+  @Test
+  public void queryBufferedRecords() throws IOException {
+    store.append(SPRINGBOARD_0);
+    store.append(MYAPP_1);
+    assertThat(store.query(Range.all())).containsExactly(SPRINGBOARD_0, MYAPP_1).inOrder();
+    assertThat(Files.exists(storeDir.resolve(SyslogStore.BLOCKS_FILE_NAME))).isFalse();
+  }
+
+  @Test
+  public void queryByTimeRange() throws IOException {
+    appendAllAndClose();
+    assertThat(store.query(Range.closedOpen(T0.plusSeconds(1), T0.plusSeconds(2))))
+        .containsExactly(MYAPP_1);
+    assertThat(store.query(Range.atLeast(T0.plusSeconds(1))))
+        .containsExactly(MYAPP_1, SPRINGBOARD_2)
+        .inOrder();
+    assertThat(store.query(Range.greaterThan(T0.plusSeconds(2)))).isEmpty();
+  }
+
+  @Test
+  public void queryByProcess() throws IOException {
+    appendAllAndClose();
+    assertThat(store.query(Range.all(), "SpringBoard"))
+        .containsExactly(SPRINGBOARD_0, SPRINGBOARD_2)
+        .inOrder();
+    assertThat(store.query(Range.all(), "backboardd")).isEmpty();
+  }
+
+  @Test
+  public void reopenedStoreReadsBlocks() throws IOException {
+    appendAllAndClose();
+    SyslogStore reopened = SyslogStore.inDirectory(storeDir);
+    assertThat(reopened.query(Range.atMost(T0.plusSeconds(1)), "MyApp")).containsExactly(MYAPP_1);
+  }
+
+  @Test
+  public void truncatedBlockIsIgnoredAndOverwritten() throws IOException {
+    store.append(SPRINGBOARD_0);
+    store.close();
+    Path blocksFile = storeDir.resolve(SyslogStore.BLOCKS_FILE_NAME);
+    long length = Files.size(blocksFile);
+    SyslogStore writer = SyslogStore.inDirectory(storeDir);
+    writer.append(MYAPP_1);
+    writer.close();
+    // Cut the second block short, as if the process writing it died.
+    byte[] truncated = new byte[(int) length + 5];
+    System.arraycopy(Files.readAllBytes(blocksFile), 0, truncated, 0, truncated.length);
+    Files.write(blocksFile, truncated);
+
+    SyslogStore reopened = SyslogStore.inDirectory(storeDir);
+    assertThat(reopened.query(Range.all())).containsExactly(SPRINGBOARD_0);
+    reopened.append(SPRINGBOARD_2);
+    reopened.close();
+    assertThat(SyslogStore.inDirectory(storeDir).query(Range.all()))
+        .containsExactly(SPRINGBOARD_0, SPRINGBOARD_2)
+        .inOrder();
+  }
+
+  @Test
+  public void ingestSinkParsesLines() throws IOException {
+    String log =
+        "2017-10-18 12:00:00.000001+0000  0x1f2  Default  0x0  57  0  SpringBoard: (UIKitCore) "
+            + "Hello\r\n"
+            + "2017-10-18 12:00:01.000001+0000  0x2e3  Error  0x0  99  0  MyApp: Exception:\n"
+            + "  at frame 0\n"
+            + "2017-10-18 12:00:02.000001+0000  0x1f2  Default  0x0  57  0  SpringBoard: "
+            + "(UIKitCore) Bye";
+    try (OutputStream ingest = store.ingestSink().openStream()) {
+      byte[] bytes = log.getBytes(UTF_8);
+      // Lines may be split across writes.
+      ingest.write(bytes, 0, 50);
+      ingest.write(bytes, 50, bytes.length - 50);
+    }
+    assertThat(SyslogStore.inDirectory(storeDir).query(Range.all()))
+        .containsExactly(
+            SyslogRecord.create(T0, "SpringBoard", 57, "Default", "UIKitCore", "Hello"),
+            MYAPP_1,
+            SyslogRecord.create(
+                T0.plusSeconds(2), "SpringBoard", 57, "Default", "UIKitCore", "Bye"))
+        .inOrder();
+  }
+
+  private void appendAllAndClose() throws IOException {
+    store.append(SPRINGBOARD_0);
+    store.flush();
+    store.append(MYAPP_1);
+    store.append(SPRINGBOARD_2);
+    store.close();
+  }
+}
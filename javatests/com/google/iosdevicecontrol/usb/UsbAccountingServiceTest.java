@@ -0,0 +1,123 @@
+// Copyright 2017 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+package com.google.iosdevicecontrol.usb;
+
+import static com.google.common.truth.Truth.assertThat;
+
+import com.google.common.collect.ImmutableList;
+import com.google.common.collect.ImmutableMap;
+import java.util.Optional;
+import org.junit.After;
+import org.junit.Before;
+import org.junit.Test;
+import org.junit.runner.RunWith;
+import org.junit.runners.JUnit4;
+
+/** Tests for the {@link com.google.iosdevicecontrol.usb.UsbAccountingService}. */
+@RunWith(JUnit4.class)
+public class UsbAccountingServiceTest {
+  private static final String UDID = "00008030-001A2B3C4D5E6F70";
+  private static final String OTHER_UDID = "0123456789abcdef0123456789abcdef01234567";
+
+  private static final String TOPOLOGY =
+      "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+          + "<plist version=\"1.0\"><array><dict><key>_items</key><array>\n"
+          + "<dict><key>_name</key><string>USB 3.1 Bus</string><key>_items</key><array>\n"
+          + "<dict><key>_name</key><string>USB3.0 Hub</string>"
+          + "<key>location_id</key><string>0x14100000 / 1</string><key>_items</key><array>\n"
+          + "<dict><key>_name</key><string>iPhone</string>"
+          + "<key>serial_num</key><string>00008030001A2B3C4D5E6F70</string>"
+          + "<key>location_id</key><string>0x14110000 / 2</string></dict>\n"
+          + "</array></dict>\n"
+          + "<dict><key>_name</key><string>Keyboard</string></dict>\n"
+          + "</array></dict>\n"
+          + "</array></dict></array></plist>\n";
+
+  private UsbAccountingService service;
+
+  @Before
+  public void setUp() throws Exception {
+    service = UsbAccountingService.start(0);
+  }
+
+  @After
+  public void tearDown() {
+    service.close();
+  }
+
+  @Test
+  public void addsUpReports() {
+    service.add(UsbUsageReporter.HEADER + UDID + "\tcom.apple.debugserver\t100\t20\n");
+    service.add(
+        UsbUsageReporter.HEADER
+            + UDID + "\tcom.apple.debugserver\t5\t1\n"
+            + UDID + "\tcom.apple.mobile.screenshotr\t1000\t0\n"
+            + OTHER_UDID + "\tcom.apple.webinspector\t10\t10\n");
+
+    assertThat(service.usage())
+        .containsExactly(
+            UsbUsage.create(UDID, "com.apple.mobile.screenshotr", 1000, 0),
+            UsbUsage.create(UDID, "com.apple.debugserver", 105, 21),
+            UsbUsage.create(OTHER_UDID, "com.apple.webinspector", 10, 10))
+        .inOrder();
+    assertThat(service.usageByDevice())
+        .containsExactly(
+            UsbUsage.create(UDID, "", 1105, 21), UsbUsage.create(OTHER_UDID, "", 10, 10))
+        .inOrder();
+  }
+
+  @Test
+  public void ignoresMalformedReports() {
+    service.add(UDID + "\tcom.apple.debugserver\t100\t20\n");
+    service.add(
+        UsbUsageReporter.HEADER
+            + UDID + "\tcom.apple.debugserver\t100\n"
+            + UDID + "\tcom.apple.debugserver\t-1\t20\n"
+            + UDID + "\tcom.apple.debugserver\t1\t2\n");
+
+    assertThat(service.usage())
+        .containsExactly(UsbUsage.create(UDID, "com.apple.debugserver", 1, 2));
+  }
+
+  @Test
+  public void receivesReportsOverLoopback() throws Exception {
+    UsbUsageReporter.toPort(service.port()).report(UDID, "com.apple.afc", 0, 4096);
+
+    long deadline = System.currentTimeMillis() + 10_000;
+    while (service.usage().isEmpty() && System.currentTimeMillis() < deadline) {
+      Thread.sleep(10);
+    }
+    assertThat(service.usage()).containsExactly(UsbUsage.create(UDID, "com.apple.afc", 0, 4096));
+  }
+
+  @Test
+  public void groupsDevicesByHub() {
+    UsbTopology topology = UsbTopology.fromXml(TOPOLOGY);
+    assertThat(topology.hubOf(UDID)).isEqualTo(Optional.of("USB3.0 Hub @ 0x14100000"));
+    assertThat(topology.hubOf(OTHER_UDID)).isEqualTo(Optional.empty());
+
+    service.add(
+        UsbUsageReporter.HEADER
+            + UDID + "\tcom.apple.debugserver\t5\t1\n"
+            + OTHER_UDID + "\tcom.apple.webinspector\t10\t10\n");
+    assertThat(service.usageByHub(topology))
+        .isEqualTo(
+            ImmutableMap.of(
+                "USB3.0 Hub @ 0x14100000",
+                ImmutableList.of(UsbUsage.create(UDID, "", 5, 1)),
+                UsbAccountingService.UNKNOWN_HUB,
+                ImmutableList.of(UsbUsage.create(OTHER_UDID, "", 10, 10))));
+  }
+}
@@ -0,0 +1,55 @@
+// Copyright 2017 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+package com.google.iosdevicecontrol.util;
+
+import static com.google.common.truth.Truth.assertThat;
+import static java.nio.charset.StandardCharsets.UTF_8;
+import static java.util.stream.Collectors.toList;
+
+import com.google.common.jimfs.Configuration;
+import com.google.common.jimfs.Jimfs;
+import java.io.IOException;
+import java.nio.file.Files;
+import java.nio.file.Path;
+import java.util.stream.Stream;
+import org.junit.Before;
+import org.junit.Test;
+import org.junit.runner.RunWith;
+import org.junit.runners.JUnit4;
+
+/** Unit tests for {@link com.google.iosdevicecontrol.util.AtomicFiles}. */
+@RunWith(JUnit4.class)
+public class AtomicFilesTest {
+  private Path directory;
+
+  @Before
+  public void setUp() throws IOException {
+    directory =
+        Files.createDirectories(Jimfs.newFileSystem(Configuration.unix()).getPath("/path/to"));
+  }
+
+  @Test
+  public void writeReplacesFileAndLeavesNoTemporaryFile() throws IOException {
+    Path path = directory.resolve("file.txt");
+    AtomicFiles.write(path, "first".getBytes(UTF_8));
+    AtomicFiles.write(path, "second".getBytes(UTF_8));
+
+    assertThat(new String(Files.readAllBytes(path), UTF_8)).isEqualTo("second");
+    try (Stream<Path> files = Files.list(directory)) {
+      assertThat(files.collect(toList())).containsExactly(path);
+    }
+  }
+}
@@ -0,0 +1,108 @@
+// Copyright 2017 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+package com.google.iosdevicecontrol.util;
+
+import static com.google.common.truth.Truth.assertThat;
+import static java.util.concurrent.TimeUnit.HOURS;
+
+import java.util.ArrayList;
+import java.util.List;
+import java.util.logging.Handler;
+import java.util.logging.Level;
+import java.util.logging.LogRecord;
+import java.util.logging.Logger;
+import org.junit.After;
+import org.junit.Before;
+import org.junit.Test;
+import org.junit.runner.RunWith;
+import org.junit.runners.JUnit4;
+
+/** Unit tests for {@link com.google.iosdevicecontrol.util.FluentLogger}. */
+@RunWith(JUnit4.class)
+public class FluentLoggerTest {
+  private static final FluentLogger logger = FluentLogger.forEnclosingClass();
+
+  private final List<LogRecord> records = new ArrayList<>();
+  private final Handler handler =
+      new Handler() {
+        @Override
+        public void publish(LogRecord record) {
+          records.add(record);
+        }
+
+        @Override
+        public void flush() {}
+
+        @Override
+        public void close() {}
+      };
+
+  @Before
+  public void setUp() {
+    Logger.getLogger(FluentLoggerTest.class.getName()).addHandler(handler);
+  }
+
+  @After
+  public void tearDown() {
+    Logger.getLogger(FluentLoggerTest.class.getName()).removeHandler(handler);
+  }
+
+  @Test
+  public void testDisabledLevelIsShared() {
+    assertThat(logger.atFine()).isSameAs(logger.at(Level.FINEST));
+    logger.atFine().log("%s", new Object());
+    assertThat(records).isEmpty();
+  }
+
+  @Test
+  public void testLog() {
+    Exception cause = new Exception();
+    logger.atWarning().withCause(cause).log("%s and %s", "this", "that");
+    assertThat(records).hasSize(1);
+    assertThat(records.get(0).getLevel()).isEqualTo(Level.WARNING);
+    assertThat(records.get(0).getMessage()).isEqualTo("this and that");
+    assertThat(records.get(0).getThrown()).isSameAs(cause);
+    assertThat(records.get(0).getSourceMethodName()).isEqualTo("testLog");
+  }
+
+  @Test
+  public void testLogWithoutParamsIsFormatted() {
+    logger.atInfo().log("100%% done");
+    assertThat(records).hasSize(1);
+    assertThat(records.get(0).getMessage()).isEqualTo("100% done");
+  }
+
+  @Test
+  public void testEvery() {
+    for (int i = 0; i < 7; i++) {
+      logger.atInfo().every(3).log("message %s", i);
+    }
+    assertThat(records).hasSize(3);
+    assertThat(records.get(0).getMessage()).isEqualTo("message 0");
+    assertThat(records.get(1).getMessage()).isEqualTo("message 3 [2 similar messages skipped]");
+    assertThat(records.get(2).getMessage()).isEqualTo("message 6 [2 similar messages skipped]");
+  }
+
+  @Test
+  public void testAtMostEvery() {
+    for (int i = 0; i < 5; i++) {
+      logger.atInfo().atMostEvery(1, HOURS).log("message %s", i);
+    }
+    logger.atInfo().atMostEvery(1, HOURS).log("another line");
+    assertThat(records).hasSize(2);
+    assertThat(records.get(0).getMessage()).isEqualTo("message 0");
+    assertThat(records.get(1).getMessage()).isEqualTo("another line");
+  }
+}
@@ -17,21 +17,33 @@ package com.google.iosdevicecontrol.util;
 import static com.google.common.truth.Truth.assertThat;
 import static com.google.common.truth.Truth.assert_;
 
+import com.google.common.io.ByteStreams;
 import com.google.iosdevicecontrol.util.Resource.ResourceToPathCopier;
 import java.io.IOException;
+import java.io.InputStream;
 import java.nio.file.Files;
 import java.nio.file.Path;
+import java.nio.file.attribute.FileTime;
+import java.nio.file.attribute.PosixFilePermissions;
+import org.junit.Rule;
 import org.junit.Test;
+import org.junit.rules.TemporaryFolder;
 import org.junit.runner.RunWith;
 import org.junit.runners.JUnit4;
 
 /** Unit tests for {@link com.google.iosdevicecontrol.util.Resource}. */
 @RunWith(JUnit4.class)
 public class ResourceTest {
+  private static final String RESOURCE1 = "com/google/iosdevicecontrol/util/resource1";
+
+  @Rule public final TemporaryFolder tempFolder = new TemporaryFolder();
 
   @Test
   public void testCanExtractResourceToPath() throws IOException {
-    Resource resource = Resource.named("com/google/iosdevicecontrol/util/resource1");
+    Path cacheDir = tempFolder.getRoot().toPath().resolve("cache");
+    Resource resource =
+        Resource.named(
+            "com/google/iosdevicecontrol/util/resource1", Resource.cachingCopier(cacheDir));
     Path path = resource.toPath();
     assertThat(Files.exists(path)).isTrue();
   }
@@ -54,6 +66,68 @@ public class ResourceTest {
     }
   }
 
+  @Test
+  public void testCachingCopierExtractsByContentHash() throws IOException {
+    Path cacheDir = tempFolder.getRoot().toPath().resolve("cache");
+    Path path = Resource.cachingCopier(cacheDir).copy(RESOURCE1);
+    assertThat(path.startsWith(cacheDir)).isTrue();
+    assertThat(path.endsWith(RESOURCE1)).isTrue();
+    assertThat(Files.readAllBytes(path)).isEqualTo(resourceBytes(RESOURCE1));
+  }
+
+  @Test
+  public void testCachingCopierReusesExtractedResource() throws IOException {
+    Path cacheDir = tempFolder.getRoot().toPath().resolve("cache");
+    Path path = Resource.cachingCopier(cacheDir).copy(RESOURCE1);
+    FileTime extractedTime = FileTime.fromMillis(0);
+    Files.setLastModifiedTime(path, extractedTime);
+
+    // Another copier over the same directory stands in for another JVM.
+    assertThat(Resource.cachingCopier(cacheDir).copy(RESOURCE1)).isEqualTo(path);
+    assertThat(Files.getLastModifiedTime(path)).isEqualTo(extractedTime);
+  }
+
+  @Test
+  public void testCachingCopierReplacesTruncatedResource() throws IOException {
+    Path cacheDir = tempFolder.getRoot().toPath().resolve("cache");
+    Path path = Resource.cachingCopier(cacheDir).copy(RESOURCE1);
+    Files.write(path, new byte[0]);
+
+    assertThat(Resource.cachingCopier(cacheDir).copy(RESOURCE1)).isEqualTo(path);
+    assertThat(Files.readAllBytes(path)).isEqualTo(resourceBytes(RESOURCE1));
+  }
+
+  @Test
+  public void testCachingCopierReplacesModifiedResource() throws IOException {
+    Path cacheDir = tempFolder.getRoot().toPath().resolve("cache");
+    Path path = Resource.cachingCopier(cacheDir).copy(RESOURCE1);
+    byte[] modified = resourceBytes(RESOURCE1);
+    modified[0] ^= 1;
+    Files.write(path, modified);
+
+    assertThat(Resource.cachingCopier(cacheDir).copy(RESOURCE1)).isEqualTo(path);
+    assertThat(Files.readAllBytes(path)).isEqualTo(resourceBytes(RESOURCE1));
+  }
+
+  @Test
+  public void testCachingCopierCreatesPrivateCacheDir() throws IOException {
+    Path cacheDir = tempFolder.getRoot().toPath().resolve("cache");
+    Resource.cachingCopier(cacheDir).copy(RESOURCE1);
+    assertThat(Files.getPosixFilePermissions(cacheDir))
+        .containsExactlyElementsIn(PosixFilePermissions.fromString("rwx------"));
+  }
+
+  @Test
+  public void testCachingCopierRefusesSharedCacheDir() throws IOException {
+    Path cacheDir = tempFolder.newFolder("cache").toPath();
+    Files.setPosixFilePermissions(cacheDir, PosixFilePermissions.fromString("rwxrwxrwx"));
+    try {
+      Resource.cachingCopier(cacheDir).copy(RESOURCE1);
+      assert_().fail();
+    } catch (IOException expected) {
+    }
+  }
+
   @Test
   public void testCannotConstructNonExistentResource() {
     try {
@@ -76,4 +150,10 @@ public class ResourceTest {
     Resource resource1b = Resource.named("com/google/iosdevicecontrol/util/resource1");
     assertThat(resource1a).isSameAs(resource1b);
   }
+
+  private static byte[] resourceBytes(String name) throws IOException {
+    try (InputStream in = ResourceTest.class.getClassLoader().getResourceAsStream(name)) {
+      return ByteStreams.toByteArray(in);
+    }
+  }
 }
@@ -19,8 +19,10 @@ import static com.google.common.truth.Truth.assertThat;
 import com.dd.plist.BinaryPropertyListWriter;
 import com.dd.plist.NSDictionary;
 import com.dd.plist.NSObject;
+import com.google.common.base.Strings;
 import com.google.common.primitives.Ints;
 import com.google.iosdevicecontrol.util.ForwardingSocket;
+import com.google.iosdevicecontrol.util.JsonParser;
 import com.google.iosdevicecontrol.util.PlistParser;
 import java.io.ByteArrayInputStream;
 import java.io.ByteArrayOutputStream;
@@ -51,6 +53,42 @@ public class BinaryPlistSocketTest {
     assertThat(outputMessage).isEqualTo(inputMessage);
   }
 
+  @Test
+  public void testSendTemplatedMessages() throws IOException {
+    InspectorMessage listing =
+        ForwardGetListingMessage.builder()
+            .applicationId("PID:176")
+            .connectionId("17858421-36EF-4752-89F7-7A13ED5782C5")
+            .build();
+    InspectorMessage small = socketDataMessage(1, "{\"id\": 1, \"method\": \"Inspector.enable\"}");
+    // Large enough for two-byte offsets and to grow the buffer, with multi-byte characters.
+    InspectorMessage large =
+        socketDataMessage(
+            70000,
+            "{\"id\": 2, \"params\": {\"expression\": \""
+                + Strings.repeat("\u00e9\u20ac\uD83D\uDE00", 10000)
+                + "\"}}");
+
+    FakeSocket fakeSocket = new FakeSocket(new byte[] {});
+    try (InspectorSocket socket = new BinaryPlistSocket(fakeSocket)) {
+      socket.sendMessage(listing);
+      socket.sendMessage(small);
+      socket.sendMessage(large);
+      socket.sendMessage(small);
+    }
+
+    ByteArrayInputStream output = new ByteArrayInputStream(fakeSocket.outputBytes());
+    for (InspectorMessage message : new InspectorMessage[] {listing, small, large, small}) {
+      byte[] lengthBytes = new byte[4];
+      output.read(lengthBytes);
+      byte[] messageBytes = new byte[Ints.fromByteArray(lengthBytes)];
+      output.read(messageBytes);
+      NSObject outputMessage = PlistParser.fromBinary(messageBytes);
+      assertThat(outputMessage).isEqualTo(message.toPlist());
+    }
+    assertThat(output.available()).isEqualTo(0);
+  }
+
   @Test
   public void testReceiveMessage() throws IOException {
     NSDictionary inputMessage = new NSDictionary();
@@ -83,6 +121,16 @@ public class BinaryPlistSocketTest {
     }
   }
 
+  private static InspectorMessage socketDataMessage(int pageId, String json) {
+    return ForwardSocketDataMessage.builder()
+        .applicationId("PID:176")
+        .connectionId("17858421-36EF-4752-89F7-7A13ED5782C5")
+        .pageId(pageId)
+        .sender("s\u00fc\u00dfer-sender")
+        .socketData(JsonParser.parseObject(json))
+        .build();
+  }
+
   private static final class FakeSocket extends ForwardingSocket {
     private final InputStream socketIn;
     private final ByteArrayOutputStream socketOut = new ByteArrayOutputStream();
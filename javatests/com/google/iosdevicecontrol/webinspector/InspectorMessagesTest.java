@@ -335,6 +335,13 @@ public class InspectorMessagesTest {
     testPlistConversion(message, argumentsXml);
   }
 
+  @Test
+  public void testReportDeviceLostMessage() {
+    InspectorMessage message = ReportDeviceLostMessage.builder().build();
+    String argumentsXml = "";
+    testPlistConversion(message, argumentsXml);
+  }
+
   @Test
   public void testReportIdentifierMessage() {
     InspectorMessage message =
@@ -0,0 +1,164 @@
+/**
+ * device_session.c - one lockdown session to a device, shared by callers
+ *
+ * Licensed under the GNU General Public License Version 2
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more profile.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301
+ * USA
+ */
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "device_session.h"
+
+struct device_session_private {
+    idevice_t device;
+    char *udid;
+    char *label;
+    pthread_mutex_t mutex;
+    lockdownd_client_t client;  // Guarded by mutex; NULL once dropped.
+};
+
+int device_session_new(const char *udid, const char *label,
+        device_session_t *session) {
+    *session = NULL;
+    device_session_t ret = calloc(1, sizeof(*ret));
+    if (!ret) {
+        return -1;
+    }
+    pthread_mutex_init(&ret->mutex, NULL);
+    ret->label = strdup(label);
+    if (idevice_new(&ret->device, udid) != IDEVICE_E_SUCCESS ||
+            idevice_get_udid(ret->device, &ret->udid) != IDEVICE_E_SUCCESS ||
+            !ret->label) {
+        device_session_free(ret);
+        return -1;
+    }
+    // Fails early if the device is not paired, rather than on first use.
+    if (!device_session_lock(ret)) {
+        device_session_free(ret);
+        return -1;
+    }
+    device_session_unlock(ret, 0);
+    *session = ret;
+    return 0;
+}
+
+const char *device_session_udid(device_session_t session) {
+    return session->udid;
+}
+
+idevice_t device_session_device(device_session_t session) {
+    return session->device;
+}
+
+lockdownd_client_t device_session_lock(device_session_t session) {
+    pthread_mutex_lock(&session->mutex);
+    if (!session->client && lockdownd_client_new_with_handshake(
+            session->device, &session->client, session->label) !=
+            LOCKDOWN_E_SUCCESS) {
+        session->client = NULL;
+        pthread_mutex_unlock(&session->mutex);
+        return NULL;
+    }
+    return session->client;
+}
+
+// Whether a lockdown error means that the session is broken, rather than
+// that lockdown refused the request.
+static int is_session_error(lockdownd_error_t err) {
+    switch (err) {
+    case LOCKDOWN_E_MUX_ERROR:
+    case LOCKDOWN_E_SSL_ERROR:
+    case LOCKDOWN_E_RECEIVE_TIMEOUT:
+    case LOCKDOWN_E_SESSION_INACTIVE:
+    case LOCKDOWN_E_NO_RUNNING_SESSION:
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+void device_session_unlock(device_session_t session, int failed) {
+    if (failed && session->client) {
+        lockdownd_client_free(session->client);
+        session->client = NULL;
+    }
+    pthread_mutex_unlock(&session->mutex);
+}
+
+int device_session_get_value(device_session_t session, const char *domain,
+        const char *key, plist_t *value) {
+    for (int attempt = 0; attempt < 2; attempt++) {
+        lockdownd_client_t client = device_session_lock(session);
+        if (!client) {
+            return -1;
+        }
+        *value = NULL;
+        lockdownd_error_t err = lockdownd_get_value(client, domain, key,
+                value);
+        int failed = is_session_error(err);
+        device_session_unlock(session, failed);
+        if (err == LOCKDOWN_E_SUCCESS) {
+            return 0;
+        }
+        if (!failed) {
+            return -1;
+        }
+    }
+    return -1;
+}
+
+int device_session_start_service(device_session_t session,
+        const char *identifier, lockdownd_service_descriptor_t *service) {
+    for (int attempt = 0; attempt < 2; attempt++) {
+        lockdownd_client_t client = device_session_lock(session);
+        if (!client) {
+            return -1;
+        }
+        *service = NULL;
+        lockdownd_error_t err = lockdownd_start_service(client, identifier,
+                service);
+        int failed = is_session_error(err);
+        device_session_unlock(session, failed);
+        if (err == LOCKDOWN_E_SUCCESS && *service && (*service)->port) {
+            return 0;
+        }
+        lockdownd_service_descriptor_free(*service);
+        *service = NULL;
+        if (!failed) {
+            return -1;
+        }
+    }
+    return -1;
+}
+
+void device_session_free(device_session_t session) {
+    if (!session) {
+        return;
+    }
+    if (session->client) {
+        lockdownd_client_free(session->client);
+    }
+    if (session->device) {
+        idevice_free(session->device);
+    }
+    pthread_mutex_destroy(&session->mutex);
+    free(session->udid);
+    free(session->label);
+    free(session);
+}
@@ -0,0 +1,83 @@
+/**
+ * device_session.h - one lockdown session to a device, shared by callers
+ *
+ * Licensed under the GNU General Public License Version 2
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more profile.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301
+ * USA
+ */
+
+#ifndef DEVICE_SESSION_H
+#define DEVICE_SESSION_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <libimobiledevice/libimobiledevice.h>
+#include <libimobiledevice/lockdown.h>
+#include <plist/plist.h>
+
+typedef struct device_session_private device_session_private;
+typedef device_session_private *device_session_t;
+
+/**
+ * Connects to the device with the given UDID, or the first one if NULL, and
+ * makes a lockdown session with the label. Returns 0 on success.
+ */
+int device_session_new(const char *udid, const char *label,
+        device_session_t *session);
+
+/** The UDID of the device, even if the session was made without one. */
+const char *device_session_udid(device_session_t session);
+
+idevice_t device_session_device(device_session_t session);
+
+/**
+ * Locks the session for the caller and returns its lockdown client, which
+ * is made again if an earlier caller dropped it. Returns NULL, unlocked, if
+ * that fails. Lockdown clients are not thread-safe, so every use of the
+ * client must be between this and device_session_unlock.
+ */
+lockdownd_client_t device_session_lock(device_session_t session);
+
+/**
+ * Unlocks the session. If failed is set, the client is dropped, because
+ * lockdown ends idle or broken sessions; the next lock makes a new one.
+ */
+void device_session_unlock(device_session_t session, int failed);
+
+/**
+ * Like lockdownd_get_value, once more with a new client if the session
+ * broke (a mux, SSL or timeout error, or a session lockdown ended). Other
+ * errors fail at once. Returns 0 on success.
+ */
+int device_session_get_value(device_session_t session, const char *domain,
+        const char *key, plist_t *value);
+
+/**
+ * Like lockdownd_start_service, once more with a new client if the session
+ * broke, as for device_session_get_value. Returns 0 on success.
+ */
+int device_session_start_service(device_session_t session,
+        const char *identifier, lockdownd_service_descriptor_t *service);
+
+void device_session_free(device_session_t session);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,884 @@
+/**
+ * idevice-agent.c - serve one device to one client over a single connection
+ *
+ * Licensed under the GNU General Public License Version 2
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more profile.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301
+ * USA
+ */
+
+/*
+ * The agent serves a single client over a TCP connection on the loopback
+ * interface, whose port it prints to stdout as "port <n>\n", and exits when
+ * that connection closes, or if no client connects in ACCEPT_TIMEOUT_MS.
+ * Everything it does for the client happens on a channel, and any number of
+ * channels share the connection as frames of
+ *
+ *   uint32 payload length, uint32 channel, uint8 type, payload
+ *
+ * with big-endian integers. The client numbers the channels. Frame types:
+ *
+ *   FRAME_HELLO  client, the first frame: the token the agent was started
+ *                with in TOKEN_ENV, which it refuses to start without.
+ *   FRAME_OPEN   client: opens the channel; the payload is the method and
+ *                its arguments, each NUL-terminated.
+ *   FRAME_DATA   either: bytes of the channel.
+ *   FRAME_CLOSE  agent: the channel is done; the payload is an int32
+ *                status, 0 on success, followed by a message. Client: stops
+ *                the channel, which the agent answers with its FRAME_CLOSE.
+ *
+ * Methods:
+ *
+ *   info [DOMAIN [KEY]]  The value as an XML plist, like ideviceinfo -x.
+ *   screenshot           The image, like idevicescreenshot, over one
+ *                        screenshotr connection kept open between calls.
+ *                        The status is a screen_capture_error_t.
+ *   syslog               The system log, like idevicesyslog, until the
+ *                        client stops it.
+ *   inspector            Web inspector messages both ways, each a uint32
+ *                        length and a plist, like the socket of
+ *                        idevicewebinspectorproxy.
+ *   run APPID [ARG...]   Runs the app like idevice-app-runner, until it
+ *                        exits or the client stops it. Each event is a
+ *                        uint8 app_runner_event_type_t, an int32 exit code
+ *                        and the event data; an event of type
+ *                        EVENT_CONNECTED, after any events of connecting,
+ *                        says the app is about to be launched. The status
+ *                        is the exit code of idevice-app-runner, or an
+ *                        app_runner_error_t if the runner could not connect.
+ *
+ * Lockdown requests and service starts all go through the one lockdown
+ * session of the agent, so only the first of each kind of connection pays
+ * for a handshake; the web inspector proxy still makes its own per channel.
+ */
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <getopt.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <libimobiledevice/libimobiledevice.h>
+#include <libimobiledevice/lockdown.h>
+#include <libimobiledevice/syslog_relay.h>
+#include <plist/plist.h>
+
+#include "app_runner.h"
+#include "device_session.h"
+#include "screen_capture.h"
+#include "webinspector_proxy.h"
+
+#define TOKEN_ENV "IDEVICE_AGENT_TOKEN"
+#define ACCEPT_TIMEOUT_MS 30000
+#define FRAME_HEADER_BYTES 9
+#define MAX_FRAME_BYTES (64 * 1024 * 1024)
+#define MAX_ARGS 64
+// How often handlers waiting on the device check whether they were stopped.
+#define POLL_MS 100
+#define SYSLOG_BUFFER_BYTES 4096
+// How long running apps get to be killed once the client is gone.
+#define SHUTDOWN_MS 5000
+// Not an app_runner_event_type_t; sent once the runner is connected.
+#define EVENT_CONNECTED 0xFF
+
+typedef enum {
+    FRAME_HELLO = 0,
+    FRAME_OPEN = 1,
+    FRAME_DATA = 2,
+    FRAME_CLOSE = 3
+} frame_type_t;
+
+// DATA from the client that its channel has not taken yet.
+typedef struct chunk {
+    struct chunk *next;
+    uint32_t length;
+    char data[];
+} chunk_t;
+
+typedef struct agent agent_t;
+
+typedef struct channel {
+    agent_t *agent;
+    uint32_t id;
+    char *request;  // The OPEN payload, which args point into.
+    char *args[MAX_ARGS + 1];
+    int argc;
+
+    // Guarded by the mutex of the agent.
+    struct channel *next;
+    chunk_t *head;
+    chunk_t *tail;
+    int stopped;          // By the client, or because it is gone.
+    app_runner_t runner;  // While an app runs on the channel.
+} channel_t;
+
+struct agent {
+    int fd;
+    device_session_t session;
+
+    pthread_mutex_t write_mutex;
+
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;  // Data arrived, or a channel stopped or ended.
+    channel_t *channels;
+
+    pthread_mutex_t screen_mutex;
+    screen_capture_t screen;  // Kept open between screenshots.
+};
+
+static void put_u32(char *p, uint32_t value) {
+    p[0] = (char)(value >> 24);
+    p[1] = (char)(value >> 16);
+    p[2] = (char)(value >> 8);
+    p[3] = (char)value;
+}
+
+static uint32_t get_u32(const char *p) {
+    const unsigned char *u = (const unsigned char *)p;
+    return ((uint32_t)u[0] << 24) | ((uint32_t)u[1] << 16) |
+            ((uint32_t)u[2] << 8) | u[3];
+}
+
+static int read_all(int fd, char *data, size_t length) {
+    while (length > 0) {
+        ssize_t n = read(fd, data, length);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return -1;
+        }
+        data += n;
+        length -= n;
+    }
+    return 0;
+}
+
+static int write_all(int fd, const char *data, size_t length) {
+    while (length > 0) {
+        ssize_t n = write(fd, data, length);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return -1;
+        }
+        data += n;
+        length -= n;
+    }
+    return 0;
+}
+
+/**
+ * Sends a frame whose payload is prefix followed by data. A failed write
+ * means the client is gone, which the reader notices too, so it is ignored.
+ */
+static void send_frame(channel_t *channel, frame_type_t type,
+        const char *prefix, size_t prefix_length, const char *data,
+        size_t length) {
+    char header[FRAME_HEADER_BYTES];
+    put_u32(header, (uint32_t)(prefix_length + length));
+    put_u32(header + 4, channel->id);
+    header[8] = (char)type;
+    pthread_mutex_lock(&channel->agent->write_mutex);
+    if (!write_all(channel->agent->fd, header, sizeof(header)) &&
+            !write_all(channel->agent->fd, prefix, prefix_length)) {
+        write_all(channel->agent->fd, data, length);
+    }
+    pthread_mutex_unlock(&channel->agent->write_mutex);
+}
+
+static void send_data(channel_t *channel, const char *data, size_t length) {
+    send_frame(channel, FRAME_DATA, NULL, 0, data, length);
+}
+
+static void send_close(channel_t *channel, int32_t status,
+        const char *message) {
+    char prefix[4];
+    put_u32(prefix, (uint32_t)status);
+    send_frame(channel, FRAME_CLOSE, prefix, sizeof(prefix), message,
+            strlen(message));
+}
+
+/** Returns the argument at index, or NULL if it is missing or empty. */
+static const char *optional_arg(channel_t *channel, int index) {
+    return (index < channel->argc && *channel->args[index] ?
+            channel->args[index] : NULL);
+}
+
+static int is_stopped(channel_t *channel) {
+    pthread_mutex_lock(&channel->agent->mutex);
+    int stopped = channel->stopped;
+    pthread_mutex_unlock(&channel->agent->mutex);
+    return stopped;
+}
+
+/** Stops the channel from the agent's side, e.g. when the device is gone. */
+static void stop(channel_t *channel) {
+    pthread_mutex_lock(&channel->agent->mutex);
+    channel->stopped = 1;
+    pthread_cond_broadcast(&channel->agent->cond);
+    pthread_mutex_unlock(&channel->agent->mutex);
+}
+
+/**
+ * Waits up to timeout_ms for DATA from the client and returns it, or NULL.
+ * Sets *stopped once the channel is stopped and has no DATA left.
+ */
+static chunk_t *take_chunk(channel_t *channel, unsigned int timeout_ms,
+        int *stopped) {
+    agent_t *agent = channel->agent;
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    uint64_t deadline_us = (uint64_t)now.tv_sec * 1000000 + now.tv_usec +
+            (uint64_t)timeout_ms * 1000;
+    struct timespec deadline = {
+        (time_t)(deadline_us / 1000000), (long)(deadline_us % 1000000) * 1000
+    };
+
+    pthread_mutex_lock(&agent->mutex);
+    while (!channel->head && !channel->stopped &&
+            pthread_cond_timedwait(&agent->cond, &agent->mutex, &deadline) !=
+            ETIMEDOUT) {
+    }
+    chunk_t *chunk = channel->head;
+    if (chunk) {
+        channel->head = chunk->next;
+        if (!channel->head) {
+            channel->tail = NULL;
+        }
+    }
+    *stopped = (!chunk && channel->stopped);
+    pthread_mutex_unlock(&agent->mutex);
+    return chunk;
+}
+
+/** Waits up to timeout_ms for the channel to stop, ignoring any DATA. */
+static int wait_stopped(channel_t *channel, unsigned int timeout_ms) {
+    int stopped = 0;
+    free(take_chunk(channel, timeout_ms, &stopped));
+    return stopped;
+}
+
+static void handle_info(channel_t *channel) {
+    plist_t value = NULL;
+    if (device_session_get_value(channel->agent->session,
+            optional_arg(channel, 1), optional_arg(channel, 2), &value)) {
+        send_close(channel, -1, "Could not get the value from lockdown.");
+        return;
+    }
+    char *xml = NULL;
+    uint32_t length = 0;
+    plist_to_xml(value, &xml, &length);
+    plist_free(value);
+    if (!xml) {
+        send_close(channel, -1, "Could not convert the value to XML.");
+        return;
+    }
+    send_data(channel, xml, length);
+    free(xml);
+    send_close(channel, 0, "");
+}
+
+static void handle_screenshot(channel_t *channel) {
+    agent_t *agent = channel->agent;
+    char *data = NULL;
+    uint64_t size = 0;
+    screen_capture_error_t res = SCREEN_CAPTURE_E_CAPTURE_FAILED;
+
+    pthread_mutex_lock(&agent->screen_mutex);
+    // The connection kept from an earlier screenshot may have broken since,
+    // so a failed capture is retried once over a new one.
+    for (int attempt = 0; attempt < 2 && res != SCREEN_CAPTURE_E_SUCCESS;
+            attempt++) {
+        if (!agent->screen) {
+            res = screen_capture_new(device_session_udid(agent->session),
+                    &agent->screen);
+            if (res != SCREEN_CAPTURE_E_SUCCESS) {
+                break;
+            }
+        }
+        res = screen_capture_take(agent->screen, &data, &size);
+        if (res != SCREEN_CAPTURE_E_SUCCESS) {
+            screen_capture_free(agent->screen);
+            agent->screen = NULL;
+        }
+    }
+    pthread_mutex_unlock(&agent->screen_mutex);
+
+    if (res != SCREEN_CAPTURE_E_SUCCESS) {
+        // The service is part of the developer image, so that is what is
+        // usually missing when it can't be started.
+        send_close(channel, res, res == SCREEN_CAPTURE_E_SERVICE_FAILED ?
+                "Could not start screenshotr." : "Could not take a screenshot.");
+        return;
+    }
+    send_data(channel, data, size);
+    free(data);
+    send_close(channel, 0, "");
+}
+
+typedef struct {
+    channel_t *channel;
+    pthread_mutex_t mutex;
+    char buffer[SYSLOG_BUFFER_BYTES];
+    size_t length;
+} syslog_capture_t;
+
+static void flush_syslog(syslog_capture_t *capture) {
+    if (capture->length) {
+        send_data(capture->channel, capture->buffer, capture->length);
+        capture->length = 0;
+    }
+}
+
+/** Called by syslog_relay on its own thread, with each received char. */
+static void on_syslog_char(char c, void *user_data) {
+    syslog_capture_t *capture = user_data;
+    pthread_mutex_lock(&capture->mutex);
+    capture->buffer[capture->length++] = c;
+    if (c == '\n' || capture->length == sizeof(capture->buffer)) {
+        flush_syslog(capture);
+    }
+    pthread_mutex_unlock(&capture->mutex);
+}
+
+static void handle_syslog(channel_t *channel) {
+    agent_t *agent = channel->agent;
+    lockdownd_service_descriptor_t service = NULL;
+    syslog_relay_client_t client = NULL;
+    if (device_session_start_service(agent->session,
+            SYSLOG_RELAY_SERVICE_NAME, &service)) {
+        send_close(channel, -1, "Could not start syslog_relay.");
+        return;
+    }
+    syslog_relay_error_t err = syslog_relay_client_new(
+            device_session_device(agent->session), service, &client);
+    lockdownd_service_descriptor_free(service);
+    if (err != SYSLOG_RELAY_E_SUCCESS) {
+        send_close(channel, -1, "Could not connect to syslog_relay.");
+        return;
+    }
+
+    syslog_capture_t capture;
+    memset(&capture, 0, sizeof(capture));
+    capture.channel = channel;
+    pthread_mutex_init(&capture.mutex, NULL);
+    if (syslog_relay_start_capture(client, on_syslog_char, &capture) !=
+            SYSLOG_RELAY_E_SUCCESS) {
+        syslog_relay_client_free(client);
+        pthread_mutex_destroy(&capture.mutex);
+        send_close(channel, -1, "Could not capture the system log.");
+        return;
+    }
+    while (!wait_stopped(channel, POLL_MS)) {
+        // Sends a line that is still being written after a while, too.
+        pthread_mutex_lock(&capture.mutex);
+        flush_syslog(&capture);
+        pthread_mutex_unlock(&capture.mutex);
+    }
+    syslog_relay_stop_capture(client);
+    syslog_relay_client_free(client);
+    flush_syslog(&capture);
+    pthread_mutex_destroy(&capture.mutex);
+    send_close(channel, 0, "");
+}
+
+typedef struct {
+    channel_t *channel;
+    webinspector_proxy_t proxy;
+    webinspector_proxy_error_t error;  // The first failed send.
+} inspector_sender_t;
+
+/**
+ * Sends the messages of the client to the device, reassembled from its
+ * DATA, which need not follow message boundaries.
+ */
+static void *send_inspector_messages(void *user_data) {
+    inspector_sender_t *sender = user_data;
+    char *pending = NULL;
+    size_t pending_length = 0;
+    int stopped = 0;
+
+    while (!stopped && sender->error == WEBINSPECTOR_PROXY_E_SUCCESS) {
+        chunk_t *chunk = take_chunk(sender->channel, POLL_MS, &stopped);
+        if (!chunk) {
+            continue;
+        }
+        char *grown = realloc(pending, pending_length + chunk->length);
+        if (!grown) {
+            free(chunk);
+            sender->error = WEBINSPECTOR_PROXY_E_UNKNOWN_ERROR;
+            break;
+        }
+        pending = grown;
+        memcpy(pending + pending_length, chunk->data, chunk->length);
+        pending_length += chunk->length;
+        free(chunk);
+
+        size_t offset = 0;
+        while (pending_length - offset >= 4) {
+            uint32_t length = get_u32(pending + offset);
+            if (length > MAX_FRAME_BYTES) {
+                sender->error = WEBINSPECTOR_PROXY_E_PLIST_ERROR;
+                break;
+            }
+            if (pending_length - offset - 4 < length) {
+                break;
+            }
+            webinspector_proxy_error_t res = webinspector_proxy_send(
+                    sender->proxy, pending + offset + 4, length);
+            if (res != WEBINSPECTOR_PROXY_E_SUCCESS) {
+                sender->error = res;
+                break;
+            }
+            offset += 4 + length;
+        }
+        memmove(pending, pending + offset, pending_length - offset);
+        pending_length -= offset;
+    }
+    free(pending);
+    if (sender->error != WEBINSPECTOR_PROXY_E_SUCCESS) {
+        stop(sender->channel);
+    }
+    return NULL;
+}
+
+static void handle_inspector(channel_t *channel) {
+    agent_t *agent = channel->agent;
+    inspector_sender_t sender;
+    memset(&sender, 0, sizeof(sender));
+    sender.channel = channel;
+    webinspector_proxy_error_t res = webinspector_proxy_new(
+            device_session_udid(agent->session), &sender.proxy);
+    if (res == WEBINSPECTOR_PROXY_E_SUCCESS) {
+        res = webinspector_proxy_connect(sender.proxy);
+    }
+    pthread_t thread;
+    if (res != WEBINSPECTOR_PROXY_E_SUCCESS || pthread_create(&thread, NULL,
+            send_inspector_messages, &sender)) {
+        webinspector_proxy_free(sender.proxy);
+        send_close(channel, res ? res : WEBINSPECTOR_PROXY_E_UNKNOWN_ERROR,
+                "Could not connect to the web inspector.");
+        return;
+    }
+
+    while (!is_stopped(channel)) {
+        char *frame = NULL;
+        uint32_t length = 0;
+        res = webinspector_proxy_receive(sender.proxy, &frame, &length,
+                POLL_MS);
+        if (res == WEBINSPECTOR_PROXY_E_SUCCESS) {
+            char prefix[4];
+            put_u32(prefix, length);
+            send_frame(channel, FRAME_DATA, prefix, sizeof(prefix), frame,
+                    length);
+            free(frame);
+        } else if (res != WEBINSPECTOR_PROXY_E_RECEIVE_TIMEOUT) {
+            stop(channel);
+        } else {
+            res = WEBINSPECTOR_PROXY_E_SUCCESS;
+        }
+    }
+    pthread_join(thread, NULL);
+    webinspector_proxy_free(sender.proxy);
+    if (res == WEBINSPECTOR_PROXY_E_SUCCESS) {
+        res = sender.error;
+    }
+    send_close(channel, res, res == WEBINSPECTOR_PROXY_E_SUCCESS ? "" :
+            "The web inspector failed.");
+}
+
+static void send_event(channel_t *channel, int type, int exit_code,
+        const char *data, size_t length) {
+    char prefix[5];
+    prefix[0] = (char)type;
+    put_u32(prefix + 1, (uint32_t)exit_code);
+    send_frame(channel, FRAME_DATA, prefix, sizeof(prefix), data,
+            data ? length : 0);
+}
+
+/** Called by the runner on the thread of handle_run. */
+static void on_runner_event(const app_runner_event_t *event,
+        void *user_data) {
+    send_event(user_data, event->type, event->exit_code, event->data,
+            event->length);
+}
+
+/** Lockdown requests of the runner, each of which locks the session briefly. */
+static int runner_get_value(void *session, const char *domain,
+        const char *key, plist_t *value) {
+    return device_session_get_value(session, domain, key, value);
+}
+
+static int runner_start_service(void *session, const char *identifier,
+        lockdownd_service_descriptor_t *service) {
+    return device_session_start_service(session, identifier, service);
+}
+
+static void handle_run(channel_t *channel) {
+    agent_t *agent = channel->agent;
+    if (!optional_arg(channel, 1)) {
+        send_close(channel, APP_RUNNER_E_INVALID_ARG, "No app to run.");
+        return;
+    }
+    app_runner_options_t options;
+    memset(&options, 0, sizeof(options));
+    options.udid = device_session_udid(agent->session);
+    options.app_id = channel->args[1];
+    options.args = &channel->args[2];
+    options.device = device_session_device(agent->session);
+    // The session is only locked for each lockdown request, so other
+    // channels are not held up while the app is looked up and launched.
+    options.lockdown_get_value = runner_get_value;
+    options.lockdown_start_service = runner_start_service;
+    options.lockdown_data = agent->session;
+    app_runner_t runner = NULL;
+    app_runner_error_t err = app_runner_new(&options, on_runner_event,
+            channel, &runner);
+    if (err == APP_RUNNER_E_SUCCESS) {
+        err = app_runner_connect(runner);
+    }
+    if (err != APP_RUNNER_E_SUCCESS) {
+        app_runner_free(runner);
+        send_close(channel, err, "Could not connect the runner.");
+        return;
+    }
+    send_event(channel, EVENT_CONNECTED, 0, NULL, 0);
+
+    pthread_mutex_lock(&agent->mutex);
+    channel->runner = runner;
+    if (channel->stopped) {
+        app_runner_stop(runner);
+    }
+    pthread_mutex_unlock(&agent->mutex);
+    int exit_code = app_runner_run(runner);
+    pthread_mutex_lock(&agent->mutex);
+    channel->runner = NULL;
+    pthread_mutex_unlock(&agent->mutex);
+    app_runner_free(runner);
+    send_close(channel, exit_code, "");
+}
+
+static void *run_channel(void *user_data) {
+    channel_t *channel = user_data;
+    agent_t *agent = channel->agent;
+    const char *method = optional_arg(channel, 0);
+    if (!method) {
+        send_close(channel, -1, "No method.");
+    } else if (!strcmp(method, "info")) {
+        handle_info(channel);
+    } else if (!strcmp(method, "screenshot")) {
+        handle_screenshot(channel);
+    } else if (!strcmp(method, "syslog")) {
+        handle_syslog(channel);
+    } else if (!strcmp(method, "inspector")) {
+        handle_inspector(channel);
+    } else if (!strcmp(method, "run")) {
+        handle_run(channel);
+    } else {
+        send_close(channel, -1, "Unknown method.");
+    }
+
+    pthread_mutex_lock(&agent->mutex);
+    channel_t **link = &agent->channels;
+    while (*link != channel) {
+        link = &(*link)->next;
+    }
+    *link = channel->next;
+    while (channel->head) {
+        chunk_t *chunk = channel->head;
+        channel->head = chunk->next;
+        free(chunk);
+    }
+    pthread_cond_broadcast(&agent->cond);
+    pthread_mutex_unlock(&agent->mutex);
+    free(channel->request);
+    free(channel);
+    return NULL;
+}
+
+/** Returns the channel, or NULL; the mutex of the agent must be held. */
+static channel_t *find_channel(agent_t *agent, uint32_t id) {
+    channel_t *channel = agent->channels;
+    while (channel && channel->id != id) {
+        channel = channel->next;
+    }
+    return channel;
+}
+
+/** Starts a channel for an OPEN frame, taking ownership of its payload. */
+static void open_channel(agent_t *agent, uint32_t id, char *request,
+        uint32_t length) {
+    channel_t *channel = calloc(1, sizeof(channel_t));
+    if (!channel) {
+        free(request);
+        return;
+    }
+    channel->agent = agent;
+    channel->id = id;
+    channel->request = request;
+    // The payload is NUL-terminated strings, and one more NUL follows it.
+    for (uint32_t offset = 0; offset < length && channel->argc < MAX_ARGS;
+            offset += strlen(request + offset) + 1) {
+        channel->args[channel->argc++] = request + offset;
+    }
+
+    // The thread is started with the mutex held, so it cannot end and
+    // unlink the channel before it is linked.
+    pthread_mutex_lock(&agent->mutex);
+    pthread_t thread;
+    int started = 0;
+    if (find_channel(agent, id)) {
+        fprintf(stderr, "Channel %u is already open.\n", id);
+    } else if (pthread_create(&thread, NULL, run_channel, channel)) {
+        send_close(channel, -1, "Could not start a thread.");
+    } else {
+        pthread_detach(thread);
+        channel->next = agent->channels;
+        agent->channels = channel;
+        started = 1;
+    }
+    pthread_mutex_unlock(&agent->mutex);
+    if (!started) {
+        free(channel->request);
+        free(channel);
+    }
+}
+
+/** Reads one frame into a chunk the caller frees, or returns NULL. */
+static chunk_t *read_frame(agent_t *agent, uint32_t *id, int *type) {
+    char header[FRAME_HEADER_BYTES];
+    if (read_all(agent->fd, header, sizeof(header))) {
+        return NULL;
+    }
+    uint32_t length = get_u32(header);
+    *id = get_u32(header + 4);
+    *type = (unsigned char)header[8];
+    if (length > MAX_FRAME_BYTES) {
+        fprintf(stderr, "Frame of %u bytes is too long.\n", length);
+        return NULL;
+    }
+    // One more byte NUL-terminates the payload of an OPEN frame.
+    chunk_t *chunk = malloc(sizeof(chunk_t) + length + 1);
+    if (!chunk || read_all(agent->fd, chunk->data, length)) {
+        free(chunk);
+        return NULL;
+    }
+    chunk->next = NULL;
+    chunk->length = length;
+    chunk->data[length] = '\0';
+    return chunk;
+}
+
+/** Serves frames from the client until it is gone. */
+static void serve(agent_t *agent) {
+    uint32_t id = 0;
+    int type = 0;
+    chunk_t *chunk;
+    while ((chunk = read_frame(agent, &id, &type))) {
+        if (type == FRAME_OPEN) {
+            char *request = malloc(chunk->length + 1);
+            if (request) {
+                memcpy(request, chunk->data, chunk->length + 1);
+                open_channel(agent, id, request, chunk->length);
+            }
+            free(chunk);
+            continue;
+        }
+        pthread_mutex_lock(&agent->mutex);
+        channel_t *channel = find_channel(agent, id);
+        if (channel && type == FRAME_DATA && !channel->stopped) {
+            if (channel->tail) {
+                channel->tail->next = chunk;
+            } else {
+                channel->head = chunk;
+            }
+            channel->tail = chunk;
+            chunk = NULL;
+        } else if (channel && type == FRAME_CLOSE) {
+            channel->stopped = 1;
+            if (channel->runner) {
+                app_runner_stop(channel->runner);
+            }
+        }
+        pthread_cond_broadcast(&agent->cond);
+        pthread_mutex_unlock(&agent->mutex);
+        free(chunk);
+    }
+}
+
+/** Stops all channels and waits a while for them to end. */
+static void shut_down(agent_t *agent) {
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    struct timespec deadline = {
+        now.tv_sec + SHUTDOWN_MS / 1000, (long)now.tv_usec * 1000
+    };
+    pthread_mutex_lock(&agent->mutex);
+    for (channel_t *channel = agent->channels; channel;
+            channel = channel->next) {
+        channel->stopped = 1;
+        if (channel->runner) {
+            app_runner_stop(channel->runner);
+        }
+    }
+    pthread_cond_broadcast(&agent->cond);
+    while (agent->channels && pthread_cond_timedwait(&agent->cond,
+            &agent->mutex, &deadline) != ETIMEDOUT) {
+    }
+    pthread_mutex_unlock(&agent->mutex);
+}
+
+/**
+ * Waits for the client on a new port of the loopback interface, which is
+ * printed to stdout, and returns its connection, or -1.
+ */
+static int accept_client(void) {
+    struct sockaddr_in address;
+    socklen_t address_length = sizeof(address);
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    int listener = socket(AF_INET, SOCK_STREAM, 0);
+    if (listener < 0 ||
+            bind(listener, (struct sockaddr *)&address, sizeof(address)) ||
+            listen(listener, 1) ||
+            getsockname(listener, (struct sockaddr *)&address,
+                    &address_length)) {
+        perror("Could not listen");
+        if (listener >= 0) {
+            close(listener);
+        }
+        return -1;
+    }
+    printf("port %u\n", ntohs(address.sin_port));
+    fflush(stdout);
+
+    struct pollfd pfd = {listener, POLLIN, 0};
+    int fd = -1;
+    if (poll(&pfd, 1, ACCEPT_TIMEOUT_MS) == 1) {
+        fd = accept(listener, NULL, NULL);
+    } else {
+        fprintf(stderr, "No client connected.\n");
+    }
+    close(listener);
+    return fd;
+}
+
+/** Checks that the first frame is a HELLO with the token. */
+static int authenticate(agent_t *agent, const char *token) {
+    uint32_t id = 0;
+    int type = 0;
+    chunk_t *hello = read_frame(agent, &id, &type);
+    int ok = (hello && type == FRAME_HELLO && !strcmp(hello->data, token));
+    free(hello);
+    if (!ok) {
+        fprintf(stderr, "The client did not authenticate.\n");
+    }
+    return ok;
+}
+
+static void print_usage(int argc, char **argv) {
+    char *name = strrchr(argv[0], '/');
+    name = (name ? name + 1 : argv[0]);
+    fprintf(stderr,
+        "Usage: %s [OPTIONS]\n"
+        "Serve runner, web inspector, info, screenshots and the system log\n"
+        "of an iDevice to one client over one connection, which is made to\n"
+        "the loopback port printed to stdout. The client must first send the\n"
+        "token in the " TOKEN_ENV " environment variable, which is required.\n"
+        "\n"
+        "  -u, --udid UDID\ttarget specific device by its device UDID.\n"
+        "  -h, --help\t\tprints usage information\n"
+        "\n", name);
+}
+
+int main(int argc, char **argv) {
+    static struct option longopts[] = {
+        {"udid", 1, NULL, 'u'},
+        {"help", 0, NULL, 'h'},
+        {NULL, 0, NULL, 0}
+    };
+    const char *udid = NULL;
+    while (1) {
+        int c = getopt_long(argc, argv, "u:h", longopts, (int *) 0);
+        if (c == -1) {
+            break;
+        }
+        switch (c) {
+        case 'h':
+            print_usage(argc, argv);
+            exit(0);
+        case 'u':
+            udid = optarg;
+            break;
+        default:
+            print_usage(argc, argv);
+            exit(2);
+        }
+    }
+    if (optind < argc) {
+        print_usage(argc, argv);
+        exit(2);
+    }
+    // Any local process can connect to the port, so a client must prove
+    // that it started the agent.
+    const char *token = getenv(TOKEN_ENV);
+    if (!token || !*token) {
+        fprintf(stderr, "%s must be set to the token of the client.\n",
+                TOKEN_ENV);
+        exit(2);
+    }
+    signal(SIGPIPE, SIG_IGN);
+
+    agent_t agent;
+    memset(&agent, 0, sizeof(agent));
+    pthread_mutex_init(&agent.write_mutex, NULL);
+    pthread_mutex_init(&agent.mutex, NULL);
+    pthread_cond_init(&agent.cond, NULL);
+    pthread_mutex_init(&agent.screen_mutex, NULL);
+    if (device_session_new(udid, "idevice-agent", &agent.session)) {
+        fprintf(stderr, "Could not connect to %s.\n",
+                udid ? udid : "a device");
+        return 1;
+    }
+    agent.fd = accept_client();
+    if (agent.fd < 0 || !authenticate(&agent, token)) {
+        device_session_free(agent.session);
+        return 1;
+    }
+    serve(&agent);
+    shut_down(&agent);
+
+    // Channels that did not end in time may still use the session, so it
+    // is left to the exit.
+    if (!agent.channels) {
+        screen_capture_free(agent.screen);
+        device_session_free(agent.session);
+    }
+    close(agent.fd);
+    return 0;
+}
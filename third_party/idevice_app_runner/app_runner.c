@@ -0,0 +1,1872 @@
+/**
+ * app_runner.c - run an app on an iDevice using com.apple.debugserver
+ *
+ * based on:
+ *   idevice-app-runner - by <predrg@gmail.com>
+ *   ideviceinstaller - Copyright (C) 2010 Nikias Bassen <nikias@gmx.li>
+ *   remote.c - from gdb
+ *
+ * Licensed under the GNU General Public License Version 2
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more profile.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301
+ * USA
+ */
+
+#include <inttypes.h>
+#include <ctype.h>
+#include <math.h>
+#include <regex.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <libimobiledevice/installation_proxy.h>
+#include <libimobiledevice/libimobiledevice.h>
+#include <libimobiledevice/lockdown.h>
+#include <plist/plist.h>
+
+#include "app_runner.h"
+#include "clock_sync.h"
+#include "rsp_transport.h"
+#include "trace_writer.h"
+
+#ifndef BOOL
+#define BOOL int
+#endif
+
+#define MAX_FRAMES 64
+// The longest hang report header, with a 20-digit duration, and frame line,
+// "\n  #64 0x" and 16 hex digits.
+#define HANG_HEADER_MAX 72
+#define HANG_FRAME_MAX 25
+#define MAX_TRACE_THREADS 256
+#define MAX_TRACE_DEPTH 64
+
+// Longer output lines are delivered without being matched against markers.
+#define MAX_MARKER_LINE 4096
+
+// How long to wait for the app to stop after an interrupt.
+#define INTERRUPT_TIMEOUT_MS 2000
+
+// Register numbers, looked up with qRegisterInfo when first needed; -1 if
+// unknown. The return address register only exists on ARM.
+typedef struct {
+    int pc;
+    int fp;
+    int sp;
+    int ra;
+    int bytes;
+} registers_t;
+
+// Main thread samples taken by the hang watchdog.
+typedef struct {
+    uint64_t next_sample_ms;
+    char *main_tid;
+
+    // The current run of samples with the same frames.
+    uint64_t frames[MAX_FRAMES];
+    size_t frames_len;
+    uint64_t pc;
+    BOOL pc_moved;
+    uint64_t first_sample_ms;
+    uint64_t last_sample_ms;
+} watchdog_t;
+
+typedef struct {
+    char *name;
+    uint64_t addr;  // Before the slide is applied.
+
+    // Rate cap: calls in the current one second window, after which the
+    // function's tracing is paused until the window ends.
+    uint64_t window_start_us;
+    unsigned int window_calls;
+    BOOL paused;
+} trace_function_t;
+
+typedef struct {
+    uint64_t addr;
+    BOOL inserted;
+    int function;          // Index of the function entered here, or -1.
+    unsigned int returns;  // Traced calls that will return here.
+} breakpoint_t;
+
+// The traced calls a thread is in, innermost last.
+typedef struct {
+    uint64_t tid;
+    size_t depth;
+    struct {
+        int function;
+        uint64_t return_addr;
+    } frames[MAX_TRACE_DEPTH];
+} trace_thread_t;
+
+// Function tracing with entry and return breakpoints.
+typedef struct {
+    trace_function_t *functions;
+    size_t functions_len;
+    breakpoint_t *breakpoints;
+    size_t breakpoints_len;
+    size_t breakpoints_cap;
+    trace_thread_t threads[MAX_TRACE_THREADS];
+    size_t threads_len;
+    uint64_t next_resume_us;  // When a paused function resumes, or 0.
+} tracer_t;
+
+// Output markers. Output is split into lines, the last of which is held
+// until its newline arrives.
+typedef struct {
+    BOOL enabled;
+    regex_t regex;
+    char line[MAX_MARKER_LINE];
+    size_t line_len;
+} markers_t;
+
+struct app_runner_private {
+    char *udid;
+    idevice_t device;  // Borrowed, or NULL.
+    // Whether device was opened by app_runner_connect for the final clock
+    // estimate rather than borrowed.
+    BOOL owns_device;
+    // The lockdown client app_runner_connect made, kept for the final clock
+    // estimate; NULL if the caller lends its session.
+    lockdownd_client_t clock_client;
+    // Borrowed lockdown requests, or NULL.
+    int (*lockdown_get_value)(void *lockdown_data, const char *domain,
+            const char *key, plist_t *value);
+    int (*lockdown_start_service)(void *lockdown_data,
+            const char *identifier, lockdownd_service_descriptor_t *service);
+    void *lockdown_data;
+    char *app_id;
+    char **env;
+    char **args;
+    BOOL debug_flag;
+    unsigned int watchdog_interval_ms;
+    unsigned int hang_threshold_ms;
+    BOOL hang_include_blocked;
+    uint64_t trace_slide;
+    unsigned int trace_max_rate;
+    char *trace_path;
+    char *record_path;
+    char *replay_path;
+    BOOL replay_paced;
+    unsigned int clock_sync_probes;
+
+    app_runner_event_cb_t callback;
+    void *user_data;
+
+    char *app_path;
+    idevice_connection_t connection;
+    rsp_transport *transport;
+    rsp_transport_stats_t stats;
+
+    volatile sig_atomic_t user_quit;
+    BOOL app_quit;
+    BOOL error_flag;
+
+    // Whether we sent an interrupt and wait for the app to stop.
+    BOOL interrupt_pending;
+    // When the last interrupt was sent, or 0 if none was.
+    uint64_t interrupt_sent_ms;
+    registers_t regs;
+    watchdog_t watchdog;
+    tracer_t tracer;
+    markers_t markers;
+    trace_writer *trace;
+    clock_sync_estimate_t clock;
+    BOOL clock_valid;
+};
+
+static int start_service(app_runner_t runner, lockdownd_client_t client,
+        const char *identifier, lockdownd_service_descriptor_t *service);
+static plist_t get_apps(app_runner_t runner, idevice_t phone,
+        lockdownd_client_t client);
+static char **get_app_ids(plist_t apps);
+static char *get_app_path(const char *app_id, plist_t apps);
+
+static int hex2int(char c);
+static char *tohex(char *to_s, const char *from_s, size_t n);
+static char *fromhex(char *to_s, const char *from_s, size_t n);
+
+
+struct in_struct;
+typedef struct in_struct *in_t;
+static in_t in_new(app_runner_t runner, size_t buf_len);
+static void in_free(in_t in);
+
+static int read_pkt(in_t in, char **to_s, size_t *to_n, BOOL allow_empty);
+static int read_pkt_assert(in_t in, const char *expected);
+
+
+struct out_struct;
+typedef struct out_struct *out_t;
+static out_t out_new(app_runner_t runner);
+static void out_free(out_t out);
+
+static void write_pkt(out_t out, const char *s);
+
+
+static void emit(app_runner_t runner, app_runner_event_type_t type,
+        const char *data, size_t length, int exit_code) {
+    if (!runner->callback) {
+        return;
+    }
+    app_runner_event_t event;
+    event.type = type;
+    event.data = data;
+    event.length = length;
+    event.exit_code = exit_code;
+    runner->callback(&event, runner->user_data);
+}
+
+static void emit_message(app_runner_t runner, app_runner_event_type_t type,
+        const char *format, ...) {
+    char buf[1024];
+    va_list ap;
+    va_start(ap, format);
+    int n = vsnprintf(buf, sizeof(buf), format, ap);
+    va_end(ap);
+    if (n < 0) {
+        return;
+    }
+    emit(runner, type, buf, ((size_t)n < sizeof(buf) ? (size_t)n :
+            sizeof(buf) - 1), 0);
+}
+
+#define emit_error(runner, ...) \
+    emit_message(runner, APP_RUNNER_EVENT_ERROR, __VA_ARGS__)
+#define emit_debug(runner, ...) \
+    do { \
+        if ((runner)->debug_flag) { \
+            emit_message(runner, APP_RUNNER_EVENT_DEBUG, __VA_ARGS__); \
+        } \
+    } while (0)
+
+static char **copy_strings(char **strings) {
+    if (!strings) {
+        return NULL;
+    }
+    size_t n = 0;
+    while (strings[n]) {
+        n++;
+    }
+    char **ret = calloc(n + 1, sizeof(char *));
+    size_t i;
+    for (i = 0; ret && i < n; i++) {
+        ret[i] = strdup(strings[i]);
+    }
+    return ret;
+}
+
+static void free_strings(char **strings) {
+    if (strings) {
+        char **s;
+        for (s = strings; *s; s++) {
+            free(*s);
+        }
+        free(strings);
+    }
+}
+
+
+static char *create_env_packet(const char *env) {
+    char *ret = calloc(2*strlen(env)+28, sizeof(char));
+    char *t = ret;
+    t = stpcpy(t, "$QEnvironmentHexEncoded:");
+    t = tohex(t, env, strlen(env));
+    t = stpcpy(t, "#00");
+    return ret;
+}
+
+// "$A," + len(app_path) + ",0," + hex(app_path)
+//    + [ "," len(args[i]) ","+i+"," + hex(args[i]) ]*
+//    + "#00"
+static char *create_args_packet(const char *app_path, char **args) {
+    size_t len = 5; // $A #00
+    size_t i;
+    for (i = 0; ; i++) {
+        const char *s = (i ? (args ? args[i-1] : NULL) : app_path);
+        if (!s) break;
+        size_t n = strlen(s);
+        #define numlen(v) ((v) ? (int)(log10((v)+1)+1) : 1)
+        len += (i?3:2) + numlen(2*n) + numlen(i) + 2*n;
+    }
+    char *ret = calloc(len + 1, sizeof(char));
+    char *t = stpcpy(ret, "$A");
+    for (i = 0; ; i++) {
+        const char *s = (i ? (args ? args[i-1] : NULL) : app_path);
+        if (!s) break;
+        size_t n = strlen(s);
+        t += sprintf(t, "%s%d,%d,", (i ? "," : ""), 2*(int)n, (int)i);
+        t = tohex(t, s, n);
+    }
+    t = stpcpy(t, "#00");
+    return ret;
+}
+
+
+static uint64_t now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// Delivers a held output line unless it matches the marker pattern, in
+// which case it becomes a trace event.
+static void flush_marker_line(app_runner_t runner, uint64_t ts_us) {
+    markers_t *markers = &runner->markers;
+    size_t n = markers->line_len;
+    if (n == 0) {
+        return;
+    }
+    markers->line_len = 0;
+    if (n < sizeof(markers->line) && markers->line[n-1] == '\n') {
+        size_t len = n - 1;
+        if (len > 0 && markers->line[len-1] == '\r') {
+            len--;
+        }
+        // The regex needs a NUL-terminated line; the newline is restored
+        // before the line is delivered.
+        markers->line[len] = '\0';
+        regmatch_t match[3];
+        if (!regexec(&markers->regex, markers->line, 3, match, 0) &&
+                match[1].rm_so >= 0 && match[1].rm_eo > match[1].rm_so &&
+                match[2].rm_so >= 0) {
+            char phase;
+            switch (tolower((unsigned char)markers->line[match[1].rm_so])) {
+            case 'b': phase = TRACE_PHASE_BEGIN; break;
+            case 'e': phase = TRACE_PHASE_END; break;
+            case 'i': phase = TRACE_PHASE_INSTANT; break;
+            default: phase = 0; break;
+            }
+            if (phase) {
+                trace_writer_event(runner->trace, phase,
+                        markers->line + match[2].rm_so,
+                        match[2].rm_eo - match[2].rm_so, "marker", ts_us, 0);
+                return;
+            }
+        }
+        if (len < n - 1) {
+            markers->line[len] = '\r';
+        }
+        markers->line[n-1] = '\n';
+    }
+    emit(runner, APP_RUNNER_EVENT_OUTPUT, markers->line, n, 0);
+}
+
+// Splits output into lines for flush_marker_line. All lines of a packet get
+// its receive time.
+static void handle_marker_output(app_runner_t runner, const char *s,
+        size_t n) {
+    markers_t *markers = &runner->markers;
+    uint64_t ts_us = trace_now_us();
+    while (n > 0) {
+        const char *nl = memchr(s, '\n', n);
+        size_t len = (nl ? (size_t)(nl - s) + 1 : n);
+        size_t room = sizeof(markers->line) - markers->line_len;
+        if (len > room) {
+            // Too long to be a marker.
+            len = room;
+            nl = NULL;
+        }
+        memcpy(markers->line + markers->line_len, s, len);
+        markers->line_len += len;
+        s += len;
+        n -= len;
+        if (nl || markers->line_len == sizeof(markers->line)) {
+            flush_marker_line(runner, ts_us);
+        }
+    }
+}
+
+// Returns whether s is an "$O<hex>#00" stdout packet, which it then delivers
+// as an APP_RUNNER_EVENT_OUTPUT event and acknowledges. An "$OK#00" reply is
+// not, as 'K' is not a hex digit.
+static BOOL handle_output_pkt(app_runner_t runner, out_t out, char *s,
+        size_t n) {
+    if (n > 5 && !strncmp(s, "$O", 2) && hex2int(s[2]) >= 0 &&
+            !strncmp(s+n-3, "#00", 3)) {
+        char *end = fromhex(s, s+2, n-5);
+        if (runner->markers.enabled) {
+            handle_marker_output(runner, s, end - s);
+        } else {
+            emit(runner, APP_RUNNER_EVENT_OUTPUT, s, end - s, 0);
+        }
+        write_pkt(out, "$OK#00");
+        return 1;
+    }
+    return 0;
+}
+
+// Sends a request while the app is stopped and returns the payload of the
+// reply (between '$' and '#'), which is only valid until the next read.
+static int request(app_runner_t runner, in_t in, out_t out, const char *pkt,
+        char **to_payload, size_t *to_len) {
+    write_pkt(out, pkt);
+    while (1) {
+        char *s = NULL;
+        size_t n = 0;
+        if (read_pkt(in, &s, &n, 0)) {
+            return -1;
+        }
+        if (handle_output_pkt(runner, out, s, n)) {
+            // Output sent before the app stopped.
+            continue;
+        }
+        if (n < 4 || s[0] != '$') {
+            return -1;
+        }
+        *to_payload = s + 1;
+        *to_len = n - 4;
+        return 0;
+    }
+}
+
+// Parses a register or memory value, which debugserver sends as hex bytes in
+// target (little endian) order.
+static BOOL parse_le_hex(const char *s, size_t n, uint64_t *to_value) {
+    if (n == 0 || n > 16 || (n & 1)) {
+        return 0;
+    }
+    uint64_t value = 0;
+    size_t i;
+    for (i = n; i > 0; i -= 2) {
+        int hi = hex2int(s[i-2]);
+        int lo = hex2int(s[i-1]);
+        if (hi < 0 || lo < 0) {
+            return 0;
+        }
+        value = (value << 8) | (uint64_t)(hi << 4 | lo);
+    }
+    *to_value = value;
+    return 1;
+}
+
+// Finds the registers the watchdog and tracer read, which debugserver tags as
+// "generic:pc" etc. in its qRegisterInfo replies.
+static int lookup_registers(app_runner_t runner, in_t in, out_t out) {
+    registers_t *regs = &runner->regs;
+    if (regs->pc >= 0) {
+        return 0;
+    }
+    int regnum;
+    for (regnum = 0; regnum < 256; regnum++) {
+        char pkt[32];
+        char *s;
+        size_t n;
+        snprintf(pkt, sizeof(pkt), "$qRegisterInfo%x#00", regnum);
+        if (request(runner, in, out, pkt, &s, &n) || n == 0 || s[0] == 'E') {
+            break;
+        }
+        char *info = strndup(s, n);
+        if (strstr(info, "generic:pc;")) {
+            regs->pc = regnum;
+        } else if (strstr(info, "generic:fp;")) {
+            regs->fp = regnum;
+            char *bitsize = strstr(info, "bitsize:");
+            regs->bytes = (bitsize ? atoi(bitsize + 8) / 8 : 8);
+        } else if (strstr(info, "generic:sp;")) {
+            regs->sp = regnum;
+        } else if (strstr(info, "generic:ra;")) {
+            regs->ra = regnum;
+        }
+        free(info);
+    }
+    if (regs->pc < 0 || regs->fp < 0 || regs->sp < 0) {
+        emit_error(runner, "Could not find the pc, fp and sp registers.");
+        regs->pc = -1;
+        return -1;
+    }
+    return 0;
+}
+
+static int select_thread(app_runner_t runner, in_t in, out_t out,
+        const char *tid) {
+    char pkt[64];
+    char *s;
+    size_t n;
+    snprintf(pkt, sizeof(pkt), "$Hg%s#00", tid);
+    if (request(runner, in, out, pkt, &s, &n) || n < 2 || strncmp(s, "OK", 2)) {
+        return -1;
+    }
+    return 0;
+}
+
+// Reads a register of the thread selected with select_thread.
+static int read_register(app_runner_t runner, in_t in, out_t out, int regnum,
+        uint64_t *to_value) {
+    char pkt[32];
+    char *s;
+    size_t n;
+    snprintf(pkt, sizeof(pkt), "$p%x#00", regnum);
+    if (request(runner, in, out, pkt, &s, &n)) {
+        return -1;
+    }
+    // Registers wider than 64 bits are never pc, fp, sp or ra.
+    return (parse_le_hex(s, n, to_value) ? 0 : -1);
+}
+
+// Reads count pointer-sized words at addr.
+static int read_words(app_runner_t runner, in_t in, out_t out, uint64_t addr,
+        uint64_t *words, int count) {
+    int bytes = runner->regs.bytes;
+    char pkt[64];
+    char *s;
+    size_t n;
+    snprintf(pkt, sizeof(pkt), "$m%" PRIx64 ",%x#00", addr, count * bytes);
+    if (request(runner, in, out, pkt, &s, &n) ||
+            n != (size_t)(2 * count * bytes)) {
+        return -1;
+    }
+    int i;
+    for (i = 0; i < count; i++) {
+        if (!parse_le_hex(s + 2 * i * bytes, 2 * bytes, &words[i])) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Reads the main thread's pc and the return addresses of its frame pointer
+// chain. Each frame record is the caller's fp followed by the return address.
+static int sample_main_thread(app_runner_t runner, in_t in, out_t out,
+        uint64_t *to_pc, uint64_t *frames, size_t *to_len) {
+    watchdog_t *wd = &runner->watchdog;
+    char *s;
+    size_t n;
+    if (!wd->main_tid) {
+        // The first thread reported is the main thread.
+        if (request(runner, in, out, "$qfThreadInfo#00", &s, &n) ||
+                n < 2 || s[0] != 'm') {
+            return -1;
+        }
+        size_t len = strcspn(s + 1, ",#");
+        wd->main_tid = strndup(s + 1, (len < n - 1 ? len : n - 1));
+    }
+    uint64_t fp = 0;
+    if (lookup_registers(runner, in, out) ||
+            select_thread(runner, in, out, wd->main_tid) ||
+            read_register(runner, in, out, runner->regs.pc, to_pc) ||
+            read_register(runner, in, out, runner->regs.fp, &fp)) {
+        return -1;
+    }
+
+    size_t len = 0;
+    while (fp && len < MAX_FRAMES) {
+        uint64_t record[2];
+        if (read_words(runner, in, out, fp, record, 2) || !record[1]) {
+            break;
+        }
+        frames[len++] = record[1];
+        // The stack grows down, so callers' frames are at higher addresses.
+        if (record[0] <= fp) {
+            break;
+        }
+        fp = record[0];
+    }
+    *to_len = len;
+    return 0;
+}
+
+// Reports the current run of samples if the main thread stayed in the same
+// frames for at least the hang threshold.
+// Appends to the report at *n, or returns -1 and leaves *n alone if the
+// text does not fit.
+static int append_report(char *report, size_t size, size_t *n,
+        const char *format, ...) {
+    va_list ap;
+    va_start(ap, format);
+    int len = vsnprintf(report + *n, size - *n, format, ap);
+    va_end(ap);
+    if (len < 0 || (size_t)len >= size - *n) {
+        report[*n] = '\0';
+        return -1;
+    }
+    *n += len;
+    return 0;
+}
+
+static void report_hang(app_runner_t runner) {
+    watchdog_t *wd = &runner->watchdog;
+    uint64_t duration = wd->last_sample_ms - wd->first_sample_ms;
+    if (!wd->first_sample_ms || duration < runner->hang_threshold_ms ||
+            (!wd->pc_moved && !runner->hang_include_blocked)) {
+        return;
+    }
+    char report[HANG_HEADER_MAX + HANG_FRAME_MAX * (MAX_FRAMES + 1)];
+    size_t n = 0;
+    append_report(report, sizeof(report), &n,
+            "Main thread hang: %" PRIu64 " ms in the same frames%s",
+            duration, (wd->pc_moved ? "" : " (blocked)"));
+    append_report(report, sizeof(report), &n, "\n  #0 0x%016" PRIx64,
+            wd->pc);
+    size_t i;
+    for (i = 0; i < wd->frames_len; i++) {
+        if (append_report(report, sizeof(report), &n,
+                "\n  #%zu 0x%016" PRIx64, i + 1, wd->frames[i])) {
+            break;
+        }
+    }
+    emit(runner, APP_RUNNER_EVENT_HANG, report, n, 0);
+}
+
+// Samples the main thread after the watchdog interrupted the app, and
+// reports a hang once it leaves the frames it hung in.
+static void watchdog_sample(app_runner_t runner, in_t in, out_t out) {
+    watchdog_t *wd = &runner->watchdog;
+    uint64_t pc = 0;
+    uint64_t frames[MAX_FRAMES];
+    size_t len = 0;
+    if (sample_main_thread(runner, in, out, &pc, frames, &len)) {
+        emit_debug(runner, "Watchdog could not sample the main thread.");
+        return;
+    }
+    uint64_t now = now_ms();
+    if (wd->first_sample_ms && len == wd->frames_len &&
+            !memcmp(frames, wd->frames, len * sizeof(uint64_t))) {
+        wd->pc_moved |= (pc != wd->pc);
+        wd->pc = pc;
+        wd->last_sample_ms = now;
+        return;
+    }
+    report_hang(runner);
+    memcpy(wd->frames, frames, len * sizeof(uint64_t));
+    wd->frames_len = len;
+    wd->pc = pc;
+    wd->pc_moved = 0;
+    wd->first_sample_ms = now;
+    wd->last_sample_ms = now;
+}
+
+// Stop packet fields: "$T<signal>key:value;key:value;...#00".
+static int stop_signal(const char *s, size_t n) {
+    if (n < 4) {
+        return -1;
+    }
+    return hex2int(s[2]) << 4 | hex2int(s[3]);
+}
+
+// Returns the value of "thread:<tid>;" in a NUL-terminated stop packet, or
+// NULL; the caller frees it.
+static char *stop_thread(const char *stop) {
+    const char *tid = strstr(stop, "thread:");
+    if (!tid) {
+        return NULL;
+    }
+    tid += strlen("thread:");
+    return strndup(tid, strcspn(tid, ";#"));
+}
+
+static int set_breakpoint(app_runner_t runner, in_t in, out_t out,
+        uint64_t addr, BOOL insert) {
+    char pkt[64];
+    char *s;
+    size_t n;
+    // The kind is the size of the breakpoint instruction, 4 on arm64.
+    snprintf(pkt, sizeof(pkt), "$%c0,%" PRIx64 ",4#00", (insert ? 'Z' : 'z'),
+            addr);
+    if (request(runner, in, out, pkt, &s, &n) || n < 2 || strncmp(s, "OK", 2)) {
+        emit_error(runner, "Could not %s breakpoint at 0x%" PRIx64 ".",
+                (insert ? "set" : "clear"), addr);
+        return -1;
+    }
+    return 0;
+}
+
+static int find_breakpoint(tracer_t *tracer, uint64_t addr) {
+    size_t i;
+    for (i = 0; i < tracer->breakpoints_len; i++) {
+        if (tracer->breakpoints[i].addr == addr) {
+            return (int)i;
+        }
+    }
+    return -1;
+}
+
+static int add_breakpoint(tracer_t *tracer, uint64_t addr) {
+    int i = find_breakpoint(tracer, addr);
+    if (i >= 0) {
+        return i;
+    }
+    if (tracer->breakpoints_len == tracer->breakpoints_cap) {
+        size_t cap = (tracer->breakpoints_cap ? 2 * tracer->breakpoints_cap : 16);
+        breakpoint_t *breakpoints = realloc(tracer->breakpoints,
+                cap * sizeof(breakpoint_t));
+        if (!breakpoints) {
+            return -1;
+        }
+        tracer->breakpoints = breakpoints;
+        tracer->breakpoints_cap = cap;
+    }
+    breakpoint_t *bp = &tracer->breakpoints[tracer->breakpoints_len];
+    memset(bp, 0, sizeof(breakpoint_t));
+    bp->addr = addr;
+    bp->function = -1;
+    return (int)tracer->breakpoints_len++;
+}
+
+// Inserts or removes a breakpoint depending on whether it's still needed: it
+// is while its function is traced or a traced call will return to it.
+static int sync_breakpoint(app_runner_t runner, in_t in, out_t out, int i) {
+    tracer_t *tracer = &runner->tracer;
+    breakpoint_t *bp = &tracer->breakpoints[i];
+    BOOL needed = (bp->returns > 0 || (bp->function >= 0 &&
+            !tracer->functions[bp->function].paused));
+    if (needed == bp->inserted) {
+        return 0;
+    }
+    if (set_breakpoint(runner, in, out, bp->addr, needed)) {
+        return -1;
+    }
+    bp->inserted = needed;
+    return 0;
+}
+
+static trace_thread_t *find_thread(tracer_t *tracer, uint64_t tid) {
+    size_t i;
+    for (i = 0; i < tracer->threads_len; i++) {
+        if (tracer->threads[i].tid == tid) {
+            return &tracer->threads[i];
+        }
+    }
+    if (tracer->threads_len == MAX_TRACE_THREADS) {
+        return NULL;
+    }
+    trace_thread_t *thread = &tracer->threads[tracer->threads_len++];
+    memset(thread, 0, sizeof(trace_thread_t));
+    thread->tid = tid;
+    return thread;
+}
+
+// Parses the "NAME=ADDR" function specs.
+static app_runner_error_t parse_trace_functions(app_runner_t runner,
+        char **specs) {
+    tracer_t *tracer = &runner->tracer;
+    size_t n = 0;
+    while (specs && specs[n]) {
+        n++;
+    }
+    if (!n) {
+        return APP_RUNNER_E_SUCCESS;
+    }
+    tracer->functions = calloc(n, sizeof(trace_function_t));
+    if (!tracer->functions) {
+        return APP_RUNNER_E_UNKNOWN_ERROR;
+    }
+    size_t i;
+    for (i = 0; i < n; i++) {
+        const char *eq = strrchr(specs[i], '=');
+        char *end = NULL;
+        uint64_t addr = (eq ? strtoull(eq + 1, &end, 16) : 0);
+        if (!eq || eq == specs[i] || !addr || *end) {
+            return APP_RUNNER_E_INVALID_ARG;
+        }
+        tracer->functions[i].name = strndup(specs[i], eq - specs[i]);
+        tracer->functions[i].addr = addr;
+        tracer->functions_len++;
+    }
+    return APP_RUNNER_E_SUCCESS;
+}
+
+// Sets the entry breakpoints of the traced functions, while the app is
+// stopped before it starts running.
+static int trace_start(app_runner_t runner, in_t in, out_t out) {
+    tracer_t *tracer = &runner->tracer;
+    if (lookup_registers(runner, in, out)) {
+        return -1;
+    }
+    size_t i;
+    for (i = 0; i < tracer->functions_len; i++) {
+        int bp = add_breakpoint(tracer,
+                tracer->functions[i].addr + runner->trace_slide);
+        if (bp < 0) {
+            return -1;
+        }
+        tracer->breakpoints[bp].function = (int)i;
+        if (sync_breakpoint(runner, in, out, bp)) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Resumes the functions paused by the rate cap whose one second window is
+// over, and schedules the next such resume.
+static void trace_resume_paused(app_runner_t runner, in_t in, out_t out,
+        uint64_t now) {
+    tracer_t *tracer = &runner->tracer;
+    tracer->next_resume_us = 0;
+    size_t i;
+    for (i = 0; i < tracer->functions_len; i++) {
+        trace_function_t *f = &tracer->functions[i];
+        if (!f->paused) {
+            continue;
+        }
+        uint64_t resume_us = f->window_start_us + 1000000;
+        if (now >= resume_us) {
+            f->paused = 0;
+            sync_breakpoint(runner, in, out, find_breakpoint(tracer,
+                    f->addr + runner->trace_slide));
+        } else if (!tracer->next_resume_us ||
+                resume_us < tracer->next_resume_us) {
+            tracer->next_resume_us = resume_us;
+        }
+    }
+}
+
+// Counts a call against its function's rate cap, pausing the function's
+// tracing for the rest of the one second window once the cap is reached.
+static void trace_count_call(app_runner_t runner, trace_function_t *f,
+        uint64_t now) {
+    tracer_t *tracer = &runner->tracer;
+    if (!runner->trace_max_rate) {
+        return;
+    }
+    if (now - f->window_start_us >= 1000000) {
+        f->window_start_us = now;
+        f->window_calls = 0;
+    }
+    if (++f->window_calls >= runner->trace_max_rate) {
+        f->paused = 1;
+        uint64_t resume_us = f->window_start_us + 1000000;
+        if (!tracer->next_resume_us || resume_us < tracer->next_resume_us) {
+            tracer->next_resume_us = resume_us;
+        }
+        emit_debug(runner, "Pausing tracing of %s for the rest of the second.",
+                f->name);
+    }
+}
+
+// Reads the return address of a function the selected thread just entered:
+// the link register on ARM, the top of the stack on x86.
+static int read_return_address(app_runner_t runner, in_t in, out_t out,
+        uint64_t *to_addr) {
+    if (runner->regs.ra >= 0) {
+        return read_register(runner, in, out, runner->regs.ra, to_addr);
+    }
+    uint64_t sp = 0;
+    if (read_register(runner, in, out, runner->regs.sp, &sp)) {
+        return -1;
+    }
+    return read_words(runner, in, out, sp, to_addr, 1);
+}
+
+// Steps the thread over the breakpoint it stopped at, so the app can be
+// continued with the breakpoint still inserted.
+static int step_over_breakpoint(app_runner_t runner, in_t in, out_t out,
+        uint64_t addr, const char *tid) {
+    char pkt[64];
+    char *s;
+    size_t n;
+    if (set_breakpoint(runner, in, out, addr, 0)) {
+        return -1;
+    }
+    snprintf(pkt, sizeof(pkt), "$vCont;s:%s#00", tid);
+    if (request(runner, in, out, pkt, &s, &n) || n < 1 || s[0] != 'T') {
+        return -1;
+    }
+    return set_breakpoint(runner, in, out, addr, 1);
+}
+
+// Handles a stop at one of the tracer's breakpoints: records the entry to or
+// return from a traced function and continues the app. Returns whether the
+// stop was handled, i.e. it was at a tracer breakpoint.
+static BOOL trace_handle_stop(app_runner_t runner, in_t in, out_t out,
+        const char *s, size_t n) {
+    tracer_t *tracer = &runner->tracer;
+    uint64_t now = trace_now_us();
+    if (!tracer->breakpoints_len || stop_signal(s, n) != 0x05) {
+        return 0;
+    }
+    char *stop = strndup(s, n);
+    char *tid_str = stop_thread(stop);
+    free(stop);
+    uint64_t pc = 0;
+    int bp;
+    if (!tid_str || select_thread(runner, in, out, tid_str) ||
+            read_register(runner, in, out, runner->regs.pc, &pc) ||
+            (bp = find_breakpoint(tracer, pc)) < 0) {
+        free(tid_str);
+        return 0;
+    }
+    uint64_t tid = strtoull(tid_str, NULL, 16);
+    trace_thread_t *thread = find_thread(tracer, tid);
+
+    // A return from a traced call; recursive calls return to the same
+    // address, so only the innermost call returns.
+    breakpoint_t *b = &tracer->breakpoints[bp];
+    if (thread && b->returns && thread->depth &&
+            thread->frames[thread->depth - 1].return_addr == pc) {
+        trace_function_t *f = &tracer->functions[
+                thread->frames[--thread->depth].function];
+        trace_writer_event(runner->trace, TRACE_PHASE_END, f->name,
+                strlen(f->name), "function", now, tid);
+        b->returns--;
+    }
+
+    // A call to a traced function.
+    if (b->function >= 0 && !tracer->functions[b->function].paused) {
+        int function = b->function;
+        trace_function_t *f = &tracer->functions[function];
+        uint64_t return_addr = 0;
+        int ret_bp;
+        if (thread && thread->depth < MAX_TRACE_DEPTH &&
+                !read_return_address(runner, in, out, &return_addr) &&
+                (ret_bp = add_breakpoint(tracer, return_addr)) >= 0) {
+            tracer->breakpoints[ret_bp].returns++;
+            thread->frames[thread->depth].function = function;
+            thread->frames[thread->depth].return_addr = return_addr;
+            thread->depth++;
+            trace_writer_event(runner->trace, TRACE_PHASE_BEGIN, f->name,
+                    strlen(f->name), "function", now, tid);
+            sync_breakpoint(runner, in, out, ret_bp);
+        }
+        trace_count_call(runner, f, now);
+    }
+
+    // Continue past the breakpoint if it's still needed, else remove it.
+    // add_breakpoint may have moved the breakpoints.
+    b = &tracer->breakpoints[bp];
+    BOOL was_inserted = b->inserted;
+    sync_breakpoint(runner, in, out, bp);
+    if (was_inserted && b->inserted) {
+        step_over_breakpoint(runner, in, out, pc, tid_str);
+    }
+    free(tid_str);
+    trace_resume_paused(runner, in, out, trace_now_us());
+    write_pkt(out, "$c#00");
+    return 1;
+}
+
+static void trace_free(tracer_t *tracer) {
+    size_t i;
+    for (i = 0; i < tracer->functions_len; i++) {
+        free(tracer->functions[i].name);
+    }
+    free(tracer->functions);
+    free(tracer->breakpoints);
+    memset(tracer, 0, sizeof(tracer_t));
+}
+
+// Turns tracing off after a failure so that the app runs untraced instead of
+// the session failing. Inserted breakpoints are cleared first.
+static void trace_disable(app_runner_t runner, in_t in, out_t out) {
+    tracer_t *tracer = &runner->tracer;
+    size_t i;
+    for (i = 0; i < tracer->breakpoints_len; i++) {
+        if (tracer->breakpoints[i].inserted) {
+            set_breakpoint(runner, in, out, tracer->breakpoints[i].addr, 0);
+        }
+    }
+    trace_free(tracer);
+    if (runner->markers.enabled) {
+        regfree(&runner->markers.regex);
+        runner->markers.enabled = 0;
+    }
+    trace_writer_close(runner->trace);
+    runner->trace = NULL;
+}
+
+
+app_runner_error_t app_runner_new(const app_runner_options_t *options,
+        app_runner_event_cb_t callback, void *user_data,
+        app_runner_t *runner) {
+    if (!options || !runner ||
+            !(options->app_id || options->replay_path)) {
+        return APP_RUNNER_E_INVALID_ARG;
+    }
+    app_runner_t ret = calloc(1, sizeof(struct app_runner_private));
+    if (!ret) {
+        return APP_RUNNER_E_UNKNOWN_ERROR;
+    }
+    ret->udid = (options->udid ? strdup(options->udid) : NULL);
+    ret->device = options->device;
+    ret->lockdown_get_value = options->lockdown_get_value;
+    ret->lockdown_start_service = options->lockdown_start_service;
+    ret->lockdown_data = options->lockdown_data;
+    // Replays may not know the app; the session file names the trace.
+    ret->app_id = strdup(options->app_id ? options->app_id :
+            options->replay_path);
+    ret->env = copy_strings(options->env);
+    ret->args = copy_strings(options->args);
+    ret->debug_flag = options->debug;
+    ret->watchdog_interval_ms = options->watchdog_interval_ms;
+    ret->hang_threshold_ms = options->hang_threshold_ms;
+    ret->hang_include_blocked = options->hang_include_blocked;
+    ret->trace_slide = options->trace_slide;
+    ret->trace_max_rate = options->trace_max_rate;
+    ret->trace_path = (options->trace_path ? strdup(options->trace_path) :
+            NULL);
+    ret->record_path = (options->record_path ?
+            strdup(options->record_path) : NULL);
+    ret->replay_path = (options->replay_path ?
+            strdup(options->replay_path) : NULL);
+    ret->replay_paced = options->replay_paced;
+    ret->clock_sync_probes = options->clock_sync_probes;
+    ret->regs.pc = -1;
+    ret->regs.fp = -1;
+    ret->regs.sp = -1;
+    ret->regs.ra = -1;
+    ret->callback = callback;
+    ret->user_data = user_data;
+    app_runner_error_t err = parse_trace_functions(ret,
+            options->trace_functions);
+    if (err == APP_RUNNER_E_SUCCESS && options->marker_pattern) {
+        if (regcomp(&ret->markers.regex, options->marker_pattern,
+                REG_EXTENDED)) {
+            err = APP_RUNNER_E_INVALID_ARG;
+        } else {
+            ret->markers.enabled = 1;
+            if (ret->markers.regex.re_nsub < 2) {
+                err = APP_RUNNER_E_INVALID_ARG;
+            }
+        }
+    }
+    if (err == APP_RUNNER_E_SUCCESS &&
+            (ret->tracer.functions_len || ret->markers.enabled) &&
+            !ret->trace_path) {
+        err = APP_RUNNER_E_INVALID_ARG;
+    }
+    if (err != APP_RUNNER_E_SUCCESS) {
+        app_runner_free(ret);
+        return err;
+    }
+    *runner = ret;
+    return APP_RUNNER_E_SUCCESS;
+}
+
+void app_runner_free(app_runner_t runner) {
+    if (!runner) {
+        return;
+    }
+    rsp_transport_free(runner->transport);
+    if (runner->connection) {
+        idevice_disconnect(runner->connection);
+    }
+    if (runner->clock_client) {
+        lockdownd_client_free(runner->clock_client);
+    }
+    if (runner->owns_device) {
+        idevice_free(runner->device);
+    }
+    free_strings(runner->env);
+    free_strings(runner->args);
+    free(runner->watchdog.main_tid);
+    trace_free(&runner->tracer);
+    if (runner->markers.enabled) {
+        regfree(&runner->markers.regex);
+    }
+    free(runner->trace_path);
+    free(runner->record_path);
+    free(runner->replay_path);
+    free(runner->app_path);
+    free(runner->app_id);
+    free(runner->udid);
+    free(runner);
+}
+
+void app_runner_stop(app_runner_t runner) {
+    if (runner) {
+        runner->user_quit = 1;
+    }
+}
+
+int app_runner_get_clock_sync(app_runner_t runner,
+        clock_sync_estimate_t *estimate) {
+    if (!runner->clock_valid) {
+        return -1;
+    }
+    *estimate = runner->clock;
+    return 0;
+}
+
+/**
+ * Estimates the device clock again now that time has passed since connecting,
+ * which gives its drift, and records the estimate in the trace.
+ */
+// A clock_sync_probe_cb_t that reads the device time through the caller's
+// lockdown session.
+static int borrowed_clock_probe(void *user_data, double *device_s) {
+    app_runner_t runner = user_data;
+    plist_t value = NULL;
+    if (runner->lockdown_get_value(runner->lockdown_data, NULL,
+            "TimeIntervalSince1970", &value)) {
+        return -1;
+    }
+    int ret = clock_sync_time_value(value, device_s);
+    plist_free(value);
+    return ret;
+}
+
+static void finish_clock_sync(app_runner_t runner) {
+    // Probe over the connection of the first estimate, so that no handshake
+    // comes before the probes. A lent session is locked for each probe.
+    clock_sync_estimate_t later;
+    int failed;
+    if (runner->lockdown_get_value) {
+        failed = clock_sync_estimate(borrowed_clock_probe, runner,
+                runner->clock_sync_probes, CLOCK_SYNC_INTERVAL_MS, &later);
+    } else {
+        failed = !runner->clock_client || clock_sync_estimate(
+                clock_sync_lockdown_probe, runner->clock_client,
+                runner->clock_sync_probes, CLOCK_SYNC_INTERVAL_MS, &later);
+        if (failed && runner->device) {
+            // Lockdown ends sessions that were idle for long, as while the
+            // app ran; only then connect again, to the device the app ran on.
+            if (runner->clock_client) {
+                lockdownd_client_free(runner->clock_client);
+                runner->clock_client = NULL;
+            }
+            if (lockdownd_client_new_with_handshake(runner->device,
+                    &runner->clock_client, "idevice-app-runner") ==
+                    LOCKDOWN_E_SUCCESS) {
+                failed = clock_sync_estimate(clock_sync_lockdown_probe,
+                        runner->clock_client, runner->clock_sync_probes,
+                        CLOCK_SYNC_INTERVAL_MS, &later);
+            } else {
+                runner->clock_client = NULL;
+            }
+        }
+    }
+    if (failed) {
+        emit_error(runner, "Could not read the device clock.");
+    } else {
+        if (runner->clock_valid) {
+            clock_sync_add_drift(&runner->clock, &later);
+        }
+        runner->clock = later;
+        runner->clock_valid = 1;
+    }
+    if (runner->clock_valid && runner->trace) {
+        char args[256];
+        snprintf(args, sizeof(args), "{\"host_us\":%" PRIu64
+                ",\"offset_us\":%.1f,\"drift_ppm\":%.3f,"
+                "\"uncertainty_us\":%.1f}", runner->clock.host_us,
+                runner->clock.offset_us, runner->clock.drift_ppm,
+                runner->clock.uncertainty_us);
+        trace_writer_metadata(runner->trace, "clock_sync", args);
+    }
+}
+
+void app_runner_get_stats(app_runner_t runner, app_runner_stats_t *stats) {
+    const rsp_transport_stats_t *s = &runner->stats;
+    memset(stats, 0, sizeof(app_runner_stats_t));
+    stats->bytes_sent = s->bytes_sent;
+    stats->bytes_received = s->bytes_received;
+    stats->receives = s->receives;
+    if (s->last_us > s->first_us) {
+        stats->elapsed_us = s->last_us - s->first_us;
+    }
+    stats->lateness_total_us = s->lateness_total_us;
+    stats->lateness_max_us = s->lateness_max_us;
+}
+
+// Starts a service through the caller if it lends its lockdown session, or
+// with the runner's own client. Returns 0 on success.
+static int start_service(app_runner_t runner, lockdownd_client_t client,
+        const char *identifier, lockdownd_service_descriptor_t *service) {
+    if (runner->lockdown_start_service) {
+        return runner->lockdown_start_service(runner->lockdown_data,
+                identifier, service);
+    }
+    return (lockdownd_start_service(client, identifier, service) !=
+            LOCKDOWN_E_SUCCESS || !(*service)->port) ? -1 : 0;
+}
+
+app_runner_error_t app_runner_connect(app_runner_t runner) {
+    if (!runner || runner->transport) {
+        return APP_RUNNER_E_INVALID_ARG;
+    }
+    if (runner->replay_path) {
+        runner->transport = rsp_transport_new_replay(runner->replay_path,
+                runner->replay_paced);
+        if (!runner->transport) {
+            emit_error(runner, "Could not read session %s.",
+                    runner->replay_path);
+            return APP_RUNNER_E_CONNECT_FAILED;
+        }
+        free(runner->app_path);
+        runner->app_path = strdup(runner->app_id);
+        return APP_RUNNER_E_SUCCESS;
+    }
+    idevice_t phone = runner->device;
+    lockdownd_client_t client = NULL;
+    plist_t apps = NULL;
+    lockdownd_service_descriptor_t service = NULL;
+    app_runner_error_t ret = APP_RUNNER_E_UNKNOWN_ERROR;
+
+    // Get phone
+    if (!phone && IDEVICE_E_SUCCESS != idevice_new(&phone, runner->udid)) {
+        emit_error(runner, "No iPhone found, is it plugged in?");
+        ret = APP_RUNNER_E_NO_DEVICE;
+        goto leave_cleanup;
+    }
+
+    // Connect to lockdownd, unless the caller lends its session
+    if (!runner->lockdown_start_service &&
+            LOCKDOWN_E_SUCCESS != lockdownd_client_new_with_handshake(
+            phone, &client, "idevice-app-runner")) {
+        emit_error(runner, "Could not connect to lockdownd. Exiting.");
+        ret = APP_RUNNER_E_LOCKDOWN_FAILED;
+        goto leave_cleanup;
+    }
+
+    if (runner->clock_sync_probes) {
+        runner->clock_valid = !(client ?
+                clock_sync_estimate(clock_sync_lockdown_probe, client,
+                        runner->clock_sync_probes, CLOCK_SYNC_INTERVAL_MS,
+                        &runner->clock) :
+                clock_sync_estimate(borrowed_clock_probe, runner,
+                        runner->clock_sync_probes, CLOCK_SYNC_INTERVAL_MS,
+                        &runner->clock));
+        if (!runner->clock_valid) {
+            emit_error(runner, "Could not read the device clock.");
+        }
+    }
+
+    // Start debugserver
+    if (start_service(runner, client, "com.apple.debugserver", &service)) {
+        // This happens if you reboot the phone and don't have Xcode running.
+        // The workaround is to keep Xcode running in the background.
+        // TBD fix this!
+        emit_error(runner, "Could not start com.apple.debugserver!");
+        ret = APP_RUNNER_E_DEBUGSERVER_FAILED;
+        goto leave_cleanup;
+    }
+
+    // Connect to debugserver
+    if (idevice_connect(phone, service->port, &runner->connection)
+            != IDEVICE_E_SUCCESS) {
+        emit_error(runner, "idevice_connect failed!");
+        ret = APP_RUNNER_E_CONNECT_FAILED;
+        goto leave_cleanup;
+    }
+    runner->transport = rsp_transport_new_device(phone,
+            runner->connection);
+    if (runner->transport && runner->record_path) {
+        rsp_transport *recorder = rsp_transport_new_recorder(
+                runner->transport, runner->record_path);
+        if (!recorder) {
+            emit_error(runner, "Could not create %s.", runner->record_path);
+            ret = APP_RUNNER_E_CONNECT_FAILED;
+            goto leave_cleanup;
+        }
+        runner->transport = recorder;
+    }
+
+    // Get app path
+    apps = get_apps(runner, phone, client);
+    runner->app_path = get_app_path(runner->app_id, apps);
+    if (!runner->app_path) {
+        if (!strncmp(runner->app_id, "/", 1)) {
+            // Backwards-compatible path from `ideviceinstaller -l -o xml`
+            runner->app_path = strdup(runner->app_id);
+        } else {
+            emit_error(runner, "Unknown APPID (%s) is not in:",
+                    runner->app_id);
+            char **app_ids = get_app_ids(apps);
+            char **tail;
+            for (tail = app_ids; *tail; tail++) {
+                emit_error(runner, "\t%s", *tail);
+                free(*tail);
+            }
+            free(app_ids);
+            ret = APP_RUNNER_E_UNKNOWN_APP;
+            goto leave_cleanup;
+        }
+    }
+
+    ret = APP_RUNNER_E_SUCCESS;
+
+leave_cleanup:
+    plist_free(apps);
+    if (ret != APP_RUNNER_E_SUCCESS) {
+        rsp_transport_free(runner->transport);
+        runner->transport = NULL;
+        if (runner->connection) {
+            idevice_disconnect(runner->connection);
+            runner->connection = NULL;
+        }
+    }
+    lockdownd_service_descriptor_free(service);
+    if (client && ret == APP_RUNNER_E_SUCCESS && runner->clock_sync_probes) {
+        // Kept to estimate the clock again when the app is done.
+        runner->clock_client = client;
+    } else if (client) {
+        lockdownd_client_free(client);
+    }
+    if (phone != runner->device) {
+        if (ret == APP_RUNNER_E_SUCCESS && runner->clock_sync_probes) {
+            // Kept to estimate the clock again when the app is done.
+            runner->device = phone;
+            runner->owns_device = 1;
+        } else {
+            idevice_free(phone);
+        }
+    }
+
+    return ret;
+}
+
+int app_runner_run(app_runner_t runner) {
+    if (!runner || !runner->transport) {
+        return -1;
+    }
+    size_t buf_len = 16*1024;
+    runner->app_quit = 0;
+    runner->error_flag = 0;
+    in_t in = in_new(runner, buf_len);
+    out_t out = out_new(runner);
+    if (!in || !out) {
+        in_free(in);
+        out_free(out);
+        return -1;
+    }
+
+    // Begin lldb remote serial protocol
+    //
+    // Some useful links:
+    // http://opensource.apple.com/source/lldb/lldb-159/docs/lldb-gdb-remote.txt
+    // http://davis.lbl.gov/Manuals/GDB/gdb_31.html
+    // http://sourceware.org/gdb/onlinedocs/gdb/Packets.html
+    // http://www.embecosm.com/appnotes/ean4/\
+    //     embecosm-howto-rsp-server-ean4-issue-2.html
+
+    // Disable acks
+    write_pkt(out, "$QStartNoAckMode#b0");
+    read_pkt_assert(in, "+");
+    read_pkt_assert(in, "$OK#9a");
+    write_pkt(out, "+");
+
+    // Set environment variables
+    if (runner->env) {
+        char **s;
+        for (s = runner->env; *s; s++) {
+            char *encoded_env = create_env_packet(*s);
+            write_pkt(out, encoded_env);
+            free(encoded_env);
+            read_pkt_assert(in, "$OK#00");
+        }
+    }
+
+    // Set app_path and args
+    char *encoded_app_path = create_args_packet(runner->app_path,
+            runner->args);
+    write_pkt(out, encoded_app_path);
+    free(encoded_app_path);
+
+    read_pkt_assert(in, "$OK#00");
+
+    // Check status
+    write_pkt(out, "$qLaunchSuccess#00");
+    read_pkt_assert(in, "$OK#00");
+
+    // Select all threads
+    write_pkt(out, "$Hc-1#00");
+    read_pkt_assert(in, "$OK#00");
+
+    if (runner->tracer.functions_len || runner->markers.enabled) {
+        runner->trace = trace_writer_open(runner->trace_path, runner->app_id);
+        if (!runner->trace) {
+            emit_error(runner, "Could not create %s. Tracing is disabled.",
+                    runner->trace_path);
+            trace_disable(runner, in, out);
+        } else if (runner->tracer.functions_len &&
+                trace_start(runner, in, out)) {
+            emit_error(runner, "Could not start tracing. Tracing is disabled.");
+            trace_disable(runner, in, out);
+        }
+    }
+    runner->markers.line_len = 0;
+
+    // Continue
+    write_pkt(out, "$c#00");
+
+    // Read stdout from phone
+    int ret = 1;
+    int spin_counter = 0;
+    watchdog_t *wd = &runner->watchdog;
+    wd->next_sample_ms = now_ms() + runner->watchdog_interval_ms;
+    while (!runner->user_quit) {
+        uint64_t now = now_ms();
+        if (runner->interrupt_pending &&
+                now - runner->interrupt_sent_ms > INTERRUPT_TIMEOUT_MS) {
+            // The interrupt crossed a stop and was dropped; send another.
+            runner->interrupt_pending = 0;
+            runner->interrupt_sent_ms = 0;
+        }
+        if (!runner->interrupt_pending &&
+                ((runner->watchdog_interval_ms && now >= wd->next_sample_ms) ||
+                 (runner->tracer.next_resume_us &&
+                  trace_now_us() >= runner->tracer.next_resume_us))) {
+            // Interrupt the app to sample its main thread or to resume
+            // tracing of rate capped functions.
+            write_pkt(out, "\003");
+            runner->interrupt_pending = 1;
+            runner->interrupt_sent_ms = now;
+        }
+        char *s = NULL;
+        size_t n = 0;
+        if (read_pkt(in, &s, &n, 1)) {
+            break;
+        }
+        if (n == 0) {
+            if (++spin_counter > 5) {
+                // Our read_pkt should wait 1s for input, but just to make
+                // sure that we don't spin, let's add a sleep here:
+                sleep(1);
+                spin_counter = 0;
+            }
+
+            // GDB won't tell us if the app has died or the user did an
+            // exit.
+            //
+            // If it's been a long time, we could send a break:
+            //   write_pkt(out, "\3");
+            // then look for:
+            //   !strncmp(s, "$T" ...
+            // and continue via:
+            //   write_pkt(out, "$c#00");
+            // If we never get a "$T" then maybe it's dead.
+            continue;
+        }
+        spin_counter = 0;
+        if (n == 4 && !strncmp(s, "$#00", 4)) {
+            continue;
+        }
+        if (handle_output_pkt(runner, out, s, n)) {
+            continue;
+        }
+        int sig = (n > 2 && !strncmp(s, "$T", 2) ? stop_signal(s, n) : -1);
+        if (runner->interrupt_pending && (sig == 0x02 || sig == 0x11)) {
+            // Our interrupt, reported as SIGINT or SIGSTOP.
+            runner->interrupt_pending = 0;
+            runner->interrupt_sent_ms = 0;
+            if (runner->watchdog_interval_ms &&
+                    now_ms() >= wd->next_sample_ms) {
+                watchdog_sample(runner, in, out);
+                wd->next_sample_ms = now_ms() + runner->watchdog_interval_ms;
+            }
+            trace_resume_paused(runner, in, out, trace_now_us());
+            write_pkt(out, "$c#00");
+            continue;
+        }
+        if (sig == 0x05 && trace_handle_stop(runner, in, out, s, n)) {
+            continue;
+        }
+        if (n > 2 && !strncmp(s, "$T", 2)) {
+            // Crashed?
+            emit(runner, APP_RUNNER_EVENT_STOPPED, s, n, 0);
+            break;
+        }
+        if (n > 5 && (!strncmp(s, "$W", 2) || !strncmp(s, "$X", 2)) &&
+                !strncmp(s+n-3, "#00", 3)) {
+            // Exit
+            runner->app_quit = 1;
+            int exit_code = (int)strtol(s+2, NULL, 16);
+            fromhex(s, s+2, n-3);
+            ret = atoi(s);
+            emit(runner, APP_RUNNER_EVENT_EXIT, NULL, 0, exit_code);
+            write_pkt(out, "$OK#00");
+            break;
+        }
+        emit_error(runner, "recv (%.*s) instead of expected ($O<stdout>#00)",
+                (int)n, s);
+        break;
+    }
+
+    // A hang that lasted until the app exited or was stopped.
+    if (runner->watchdog_interval_ms) {
+        report_hang(runner);
+    }
+
+    // Output after the last newline.
+    if (runner->markers.enabled) {
+        flush_marker_line(runner, trace_now_us());
+    }
+
+    if (runner->clock_sync_probes && !runner->replay_path) {
+        finish_clock_sync(runner);
+    }
+
+    // Calls still in progress are left open, which viewers show as lasting
+    // until the end of the trace.
+    trace_writer_close(runner->trace);
+    runner->trace = NULL;
+
+    // Send kill
+    write_pkt(out, "$k#00");
+
+    rsp_transport_get_stats(runner->transport, &runner->stats);
+    rsp_transport_free(runner->transport);
+    runner->transport = NULL;
+    if (runner->connection) {
+        idevice_disconnect(runner->connection);
+        runner->connection = NULL;
+    }
+
+    in_free(in);
+    out_free(out);
+
+    return ret;
+}
+
+
+static plist_t get_apps(app_runner_t runner, idevice_t phone,
+        lockdownd_client_t client) {
+    lockdownd_service_descriptor_t service = NULL;
+    const char * service_name = "com.apple.mobile.installation_proxy";
+    if (start_service(runner, client, service_name, &service)) {
+        emit_error(runner, "Could not start %s!", service_name);
+        lockdownd_service_descriptor_free(service);
+        return NULL;
+    }
+
+    instproxy_client_t ipc = NULL;
+    if (instproxy_client_new(phone, service, &ipc) != INSTPROXY_E_SUCCESS) {
+        emit_error(runner, "Could not connect to installation_proxy!");
+        return NULL;
+    }
+
+    plist_t client_opts = instproxy_client_options_new();
+    instproxy_client_options_add(client_opts, "ApplicationType", "User", NULL);
+    instproxy_error_t err;
+    plist_t apps = NULL;
+    err = instproxy_browse(ipc, client_opts, &apps);
+    instproxy_client_options_free(client_opts);
+    instproxy_client_free(ipc);
+    lockdownd_service_descriptor_free(service);
+    if (err != INSTPROXY_E_SUCCESS) {
+        plist_free(apps);
+        return NULL;
+    }
+
+    return apps;
+}
+
+static char **get_app_ids(plist_t apps) {
+    size_t len = 0;
+    uint32_t i;
+    uint32_t n = plist_array_get_size(apps);
+    for (i = 0; i < n; i++) {
+        plist_t dict = plist_array_get_item(apps, i);
+        plist_t item = plist_dict_get_item(dict, "CFBundleIdentifier");
+        if (item) {
+            len++;
+        }
+    }
+    char **ret = (char **)calloc(len + 1, sizeof(char **));
+    char **tail = ret;
+    for (i = 0; i < n; i++) {
+        plist_t dict = plist_array_get_item(apps, i);
+        plist_t item = plist_dict_get_item(dict, "CFBundleIdentifier");
+        if (item) {
+            plist_get_string_val(item, tail++);
+        }
+    }
+    return ret;
+}
+
+static char *get_app_path(const char *app_id, plist_t apps) {
+    if (!app_id || !apps) {
+        return NULL;
+    }
+    uint32_t i;
+    uint32_t n = plist_array_get_size(apps);
+    for (i = 0; i < n; i++) {
+        plist_t dict = plist_array_get_item(apps, i);
+        plist_t item = plist_dict_get_item(dict, "CFBundleIdentifier");
+        if (!item) {
+            continue;
+        }
+        char *name;
+        plist_get_string_val(item, &name);
+        int is_match = (name && !strcmp(name, app_id));
+        free(name);
+        if (is_match) {
+            plist_t path = plist_dict_get_item(dict, "Path");
+            if (plist_get_node_type(path) == PLIST_STRING) {
+                char *ret = NULL;
+                plist_get_string_val(path, &ret);
+                return ret;
+            }
+        }
+    }
+    return NULL;
+}
+
+
+static char int2hex(int x) {
+    static const char *hexchars = "0123456789ABCDEF";
+    return hexchars[x];
+}
+
+static int hex2int(char c) {
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    else if (c >= 'a' && c <= 'f')
+        return 10 + c - 'a';
+    else if (c >= 'A' && c <= 'F')
+        return 10 + c - 'A';
+    else
+        return -1;
+}
+
+static char *tohex(char *to_s, const char *from_s, size_t n) {
+    const char *f = from_s;
+    char *t = to_s;
+    const char *fend = f + n;
+    while (f < fend) {
+        *t++ = int2hex(*f >> 4);
+        *t++ = int2hex(*f & 0xf);
+        f++;
+    }
+    *t = '\0';
+    return t;
+}
+
+static char *fromhex(char *to_s, const char *from_s, size_t n) {
+    const char *f = from_s;
+    char *t = to_s;
+    const char *fend = f + n;
+    while (f < fend) {
+        int i1 = hex2int(*f++);
+        int i2 = hex2int(*f++);
+        *t++ = i1 << 4 | i2;
+    }
+    *t = '\0';
+    return t;
+}
+
+
+struct in_struct {
+    app_runner_t runner;
+    rsp_transport *transport;
+
+    char *buf_begin;
+    char *buf_head;
+    char *buf_next;
+    char *buf_tail;
+    char *buf_end;
+};
+
+static in_t in_new(app_runner_t runner, size_t buf_len) {
+    in_t in = (in_t)malloc(sizeof(struct in_struct));
+    char *buf = (char *)malloc(buf_len);
+    if (!in || !buf) {
+        free(in);
+        free(buf);
+        return NULL;
+    }
+    memset(in, 0, sizeof(struct in_struct));
+    in->runner = runner;
+    in->transport = runner->transport;
+    in->buf_begin = buf;
+    in->buf_head = buf;
+    in->buf_next = buf;
+    in->buf_tail = buf;
+    in->buf_end = buf + buf_len;
+    return in;
+}
+
+static void in_free(in_t in) {
+    if (in) {
+        free(in->buf_begin);
+        memset(in, 0, sizeof(struct in_struct));
+        free(in);
+    }
+}
+
+
+struct out_struct {
+    app_runner_t runner;
+    rsp_transport *transport;
+};
+
+static out_t out_new(app_runner_t runner) {
+    out_t out = (out_t)malloc(sizeof(struct out_struct));
+    if (!out) {
+        return NULL;
+    }
+    memset(out, 0, sizeof(struct out_struct));
+    out->runner = runner;
+    out->transport = runner->transport;
+    return out;
+}
+
+static void out_free(out_t out) {
+    if (out) {
+        memset(out, 0, sizeof(struct out_struct));
+        free(out);
+    }
+}
+
+
+static void write_pkt(out_t out, const char *s) {
+    app_runner_t runner = out->runner;
+    if (runner->error_flag) {
+        return;
+    }
+    int n = strlen(s);
+    int bytes = 0;
+    int err_code = rsp_transport_send(out->transport, s, n,
+             (uint32_t*)&bytes);
+    emit_debug(runner, "sent[%d] (%s)", bytes, s);
+    if (err_code != IDEVICE_E_SUCCESS || bytes != n) {
+        if (runner->app_quit) {
+          emit_debug(runner, "App quit before it could be killed. That's OK.");
+        } else {
+          emit_error(runner, "Send failed, err_code=%d bytes=%d/%d Exiting.",
+                  err_code, bytes, n);
+        }
+        runner->error_flag = 1;
+    }
+    return;
+}
+
+static int read_char(in_t in, char *to_ch, BOOL *to_allow_empty) {
+    app_runner_t runner = in->runner;
+    if (runner->error_flag) {
+        return -1;
+    }
+    if (in->buf_next == in->buf_tail) {
+        // Must read
+        size_t avail = in->buf_end - in->buf_tail;
+        size_t len = in->buf_end - in->buf_begin;
+        if (avail < (len >> 2)) {
+            // Make room
+            size_t offset = in->buf_head - in->buf_begin;
+            if (!avail && !offset) {
+                emit_error(runner, "Recv buffer[%zd] full! %.*s%s", len,
+                        (len > 20 ? 20 : (int)len), in->buf_begin,
+                        (len > 20 ? "..." : ""));
+                runner->error_flag = 1;
+                return -1;
+            }
+            size_t used = in->buf_tail - in->buf_head;
+            if (offset && used) {
+                memmove(in->buf_begin, in->buf_head, used);
+            }
+            in->buf_head = in->buf_begin;
+            in->buf_next = in->buf_begin + used;
+            in->buf_tail = in->buf_next;
+            avail = in->buf_end - in->buf_tail;
+        }
+
+        // If the call requires bytes to be read (to_allow_empty == NULL),
+        // we loop up to timeout deadline until we receive some bytes.
+        uint32_t bytes = 0;
+        time_t start;
+        time(&start);
+        while (1) {
+            int err_code = rsp_transport_receive(
+                  in->transport, in->buf_tail, avail, &bytes, 500);
+            if (err_code != IDEVICE_E_SUCCESS) {
+                emit_error(runner, "Recv failed, err_code=%d bytes=%d. Exiting.",
+                        err_code, bytes);
+                runner->error_flag = 1;
+                return -1;
+            }
+            if (bytes == 0 && to_allow_empty) {
+                *to_allow_empty = 1;
+                return 0;
+            }
+            emit_debug(runner, "recv[%d] (%.*s)", bytes, bytes, in->buf_tail);
+            if (bytes > 0) {
+                in->buf_tail += bytes;
+                break;
+            }
+            time_t now;
+            time(&now);
+            if (difftime(now, start) > 10) {
+                emit_error(runner, "Recv timeout. Exiting.");
+                runner->error_flag = 1;
+                return -1;
+            }
+            sleep(1);
+        }
+    }
+    if (to_allow_empty) {
+        *to_allow_empty = 0;
+    }
+    *to_ch = *in->buf_next++;
+    return 0;
+}
+
+static int read_pkt(in_t in, char **to_s, size_t *to_n, BOOL allow_empty) {
+    app_runner_t runner = in->runner;
+    if (runner->error_flag) {
+        return -1;
+    }
+    char ch;
+    BOOL is_empty = 0;
+    if (read_char(in, &ch, (allow_empty ? &is_empty : NULL))) {
+        return -1;
+    }
+    BOOL is_success = 0;
+    if (is_empty) {
+        is_success = 1;
+    } else if (ch == '+') {
+        is_success = 1;
+    } else if (ch == '$') {
+        while (1) {
+            if (read_char(in, &ch, NULL)) {
+                return -1;
+            }
+            if (ch == '#') {
+                break;
+            }
+        }
+        if (read_char(in, &ch, NULL)) {
+            return -1;
+        }
+        if (hex2int(ch) >= 0) {
+            if (read_char(in, &ch, NULL)) {
+                return -1;
+            }
+            if (hex2int(ch) >= 0) {
+                is_success = 1;
+            }
+        }
+    }
+    size_t n = in->buf_next - in->buf_head;
+    if (!is_success) {
+        emit_error(runner, "Received invalid gdb command (%.*s). Exiting.",
+                (int)n, in->buf_head);
+        runner->error_flag = 1;
+    }
+    *to_s = in->buf_head;
+    *to_n = n;
+    in->buf_head = in->buf_next;
+    return (is_success ? 0 : -1);
+}
+
+static int read_pkt_assert(in_t in, const char *expected) {
+    char  *s = NULL;
+    size_t n = 0;
+    if (!read_pkt(in, &s, &n, 0)) {
+        if (expected && !strncmp(s, expected, n)) {
+            return 0;
+        }
+        emit_error(in->runner, "Error: recv (%.*s) instead of expected (%s)",
+            (int)n, s, expected);
+        in->runner->error_flag = 1;
+    }
+    return -1;
+}
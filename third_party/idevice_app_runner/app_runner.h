@@ -0,0 +1,204 @@
+/**
+ * app_runner.h - run an app on an iDevice using com.apple.debugserver
+ *
+ * Library form of idevice-app-runner, for embedding the runner in another
+ * process. The caller receives the app's output and status as events
+ * instead of parsing the runner's stdout and stderr.
+ *
+ * Licensed under the GNU General Public License Version 2
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more profile.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301
+ * USA
+ */
+
+#ifndef APP_RUNNER_H
+#define APP_RUNNER_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+
+#include <libimobiledevice/libimobiledevice.h>
+#include <libimobiledevice/lockdown.h>
+
+#include "clock_sync.h"
+
+// A marker_pattern for lines such as "TRACE BEGIN parse feed".
+#define APP_RUNNER_DEFAULT_MARKER_PATTERN \
+    "^TRACE (BEGIN|END|INSTANT) (.+)$"
+
+typedef enum {
+    APP_RUNNER_E_SUCCESS = 0,
+    APP_RUNNER_E_INVALID_ARG = -1,
+    APP_RUNNER_E_NO_DEVICE = -2,
+    APP_RUNNER_E_LOCKDOWN_FAILED = -3,
+    // Usually means the developer disk image is not mounted.
+    APP_RUNNER_E_DEBUGSERVER_FAILED = -4,
+    APP_RUNNER_E_CONNECT_FAILED = -5,
+    APP_RUNNER_E_UNKNOWN_APP = -6,
+    APP_RUNNER_E_UNKNOWN_ERROR = -256
+} app_runner_error_t;
+
+typedef enum {
+    // data/length: bytes the app wrote to stdout.
+    APP_RUNNER_EVENT_OUTPUT,
+    // exit_code: the app exited normally or by a signal.
+    APP_RUNNER_EVENT_EXIT,
+    // data/length: the stop packet; the app stopped unexpectedly (crashed?).
+    APP_RUNNER_EVENT_STOPPED,
+    // data/length: a diagnostic message, e.g. an unexpected packet.
+    APP_RUNNER_EVENT_ERROR,
+    // data/length: a protocol trace line, only sent in debug mode.
+    APP_RUNNER_EVENT_DEBUG,
+    // data/length: a hang report with the main thread's stack and how long
+    // it stayed in the same frames; only sent if the watchdog is enabled.
+    APP_RUNNER_EVENT_HANG
+} app_runner_event_type_t;
+
+typedef struct {
+    app_runner_event_type_t type;
+    const char *data;  // Not NUL-terminated; only valid during the callback.
+    size_t length;
+    int exit_code;
+} app_runner_event_t;
+
+typedef void (*app_runner_event_cb_t)(const app_runner_event_t *event,
+        void *user_data);
+
+typedef struct {
+    const char *udid;    // 40-digit UDID, or NULL for the first device.
+    const char *app_id;  // Bundle id, or an app path on the device.
+    char **env;          // NULL-terminated "NAME=VALUE" strings, or NULL.
+    char **args;         // NULL-terminated app arguments, or NULL.
+    int debug;           // Send APP_RUNNER_EVENT_DEBUG events.
+
+    // Hang watchdog: every watchdog_interval_ms (0 disables it) the app is
+    // interrupted and the main thread's stack sampled. Staying in the same
+    // frames for hang_threshold_ms or longer is reported as a hang. A main
+    // thread parked at the same pc looks like an idle run loop and is only
+    // reported if hang_include_blocked is set.
+    unsigned int watchdog_interval_ms;
+    unsigned int hang_threshold_ms;
+    int hang_include_blocked;
+
+    // Function tracing: NULL-terminated "NAME=ADDR" strings, ADDR being the
+    // hex address of a function in the app binary (e.g. from nm), which is
+    // moved by trace_slide, the ASLR slide of the app. Each traced call is
+    // written to trace_path as a Chrome trace span, timed on the host. At
+    // most trace_max_rate calls per function and second are traced (0 for
+    // no cap), as every call stops the app twice.
+    char **trace_functions;
+    unsigned long long trace_slide;
+    unsigned int trace_max_rate;
+    const char *trace_path;
+
+    // Output markers: a POSIX extended regex matched against each line of
+    // the app's output, without its line terminator. Subexpression 1 is the
+    // phase, a word starting with B(egin), E(nd) or I(nstant) in any case,
+    // and subexpression 2 the event name. Matching lines are written to
+    // trace_path as Chrome trace events, timed when the line was received,
+    // instead of being delivered as output. NULL disables markers.
+    const char *marker_pattern;
+
+    // Session capture: if record_path is set, every byte exchanged with
+    // debugserver is also written to it with a timestamp. If replay_path is
+    // set, no device is used; the app's side of such a session is played
+    // back instead, paced as recorded if replay_paced is set, otherwise as
+    // fast as the runner reads it.
+    const char *record_path;
+    const char *replay_path;
+    int replay_paced;
+
+    // Borrowed connection: a device to use instead of connecting to udid,
+    // and lockdown requests to make through the caller instead of a client
+    // of the runner's own, e.g. those of a long-lived agent, which saves the
+    // handshake. The requests return 0 on success and are made from within
+    // app_runner_connect, so the caller only needs to hold its session for
+    // each one. Set both or neither. The caller frees the device. NULL
+    // connects as usual.
+    idevice_t device;
+    int (*lockdown_get_value)(void *lockdown_data, const char *domain,
+            const char *key, plist_t *value);
+    int (*lockdown_start_service)(void *lockdown_data,
+            const char *identifier, lockdownd_service_descriptor_t *service);
+    void *lockdown_data;
+
+    // Clock sync: if not 0, the device clock is probed this many times when
+    // connecting and again when the app has exited, to estimate its offset
+    // and drift from the host monotonic clock. The estimate is written to
+    // trace_path as a "clock_sync" metadata event, for aligning the trace
+    // with device timestamps.
+    unsigned int clock_sync_probes;
+} app_runner_options_t;
+
+typedef struct {
+    unsigned long long bytes_sent;
+    unsigned long long bytes_received;
+    unsigned long long receives;    // Reads from debugserver that had data.
+    unsigned long long elapsed_us;  // From the first send to the last read.
+    // Paced replays only: how much later than recorded chunks were read.
+    unsigned long long lateness_total_us;
+    unsigned long long lateness_max_us;
+} app_runner_stats_t;
+
+typedef struct app_runner_private app_runner_private;
+typedef app_runner_private *app_runner_t;
+
+/**
+ * Creates a runner. The options are copied. Events are delivered to callback
+ * on the thread that calls app_runner_connect or app_runner_run.
+ */
+app_runner_error_t app_runner_new(const app_runner_options_t *options,
+        app_runner_event_cb_t callback, void *user_data, app_runner_t *runner);
+
+/**
+ * Starts debugserver on the device, connects to it and resolves the app path.
+ * An APP_RUNNER_EVENT_ERROR event describes any failure.
+ */
+app_runner_error_t app_runner_connect(app_runner_t runner);
+
+/**
+ * Launches the app over the connection made by app_runner_connect and
+ * delivers its output until it exits, crashes, fails or app_runner_stop is
+ * called, then kills it. Returns the exit code idevice-app-runner exits with.
+ */
+int app_runner_run(app_runner_t runner);
+
+/**
+ * Makes app_runner_run kill the app and return. Safe to call from any
+ * thread and from a signal handler.
+ */
+void app_runner_stop(app_runner_t runner);
+
+/** Gets the traffic of the last app_runner_run. */
+void app_runner_get_stats(app_runner_t runner, app_runner_stats_t *stats);
+
+/**
+ * Gets the latest estimate of the device clock. Returns 0 on success, -1 if
+ * clock_sync_probes was 0 or the device clock could not be read.
+ */
+int app_runner_get_clock_sync(app_runner_t runner,
+        clock_sync_estimate_t *estimate);
+
+/** Disconnects and frees the runner, which must not be running. */
+void app_runner_free(app_runner_t runner);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,270 @@
+/**
+ * app_runner_jni.c - JNI binding of the app runner for NativeAppProcess and
+ * NativeScreenCapture
+ *
+ * Licensed under the GNU General Public License Version 2
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more profile.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301
+ * USA
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <jni.h>
+
+#include "app_runner.h"
+#include "clock_sync.h"
+#include "screen_capture.h"
+#include "trace_writer.h"
+
+// The runner plus the Java object that receives its events. The listener is
+// only set while a connect or run call is in progress, on the calling thread.
+typedef struct {
+    app_runner_t runner;
+    JNIEnv *env;
+    jobject listener;
+    jmethodID on_event;
+} jni_runner;
+
+static jni_runner *to_jni_runner(jlong handle) {
+    return (jni_runner *)(intptr_t)handle;
+}
+
+static void throw_io_exception(JNIEnv *env, const char *what, int error) {
+    char message[128];
+    jclass clazz = (*env)->FindClass(env, "java/io/IOException");
+    if (clazz) {
+        snprintf(message, sizeof(message), "%s failed: %d", what, error);
+        (*env)->ThrowNew(env, clazz, message);
+    }
+}
+
+/** Forwards an event to listener.onEvent(int type, byte[] data, int exitCode). */
+static void on_event(const app_runner_event_t *event, void *user_data) {
+    jni_runner *jr = (jni_runner *)user_data;
+    JNIEnv *env = jr->env;
+    if (!env || !jr->listener || (*env)->ExceptionCheck(env)) {
+        return;
+    }
+    jbyteArray data = NULL;
+    if (event->data) {
+        data = (*env)->NewByteArray(env, (jsize)event->length);
+        if (!data) {
+            app_runner_stop(jr->runner);
+            return;
+        }
+        (*env)->SetByteArrayRegion(env, data, 0, (jsize)event->length,
+                (const jbyte *)event->data);
+    }
+    (*env)->CallVoidMethod(env, jr->listener, jr->on_event,
+            (jint)event->type, data, (jint)event->exit_code);
+    if (data) {
+        (*env)->DeleteLocalRef(env, data);
+    }
+    if ((*env)->ExceptionCheck(env)) {
+        // Let the exception propagate once the native call returns.
+        app_runner_stop(jr->runner);
+    }
+}
+
+static int bind_listener(JNIEnv *env, jni_runner *jr, jobject listener) {
+    jclass clazz = (*env)->GetObjectClass(env, listener);
+    jr->on_event = (*env)->GetMethodID(env, clazz, "onEvent", "(I[BI)V");
+    if (!jr->on_event) {
+        return -1;
+    }
+    jr->env = env;
+    jr->listener = listener;
+    return 0;
+}
+
+static void unbind_listener(jni_runner *jr) {
+    jr->env = NULL;
+    jr->listener = NULL;
+}
+
+static char **to_strings(JNIEnv *env, jobjectArray array) {
+    if (!array) {
+        return NULL;
+    }
+    jsize n = (*env)->GetArrayLength(env, array);
+    char **ret = calloc(n + 1, sizeof(char *));
+    jsize i;
+    for (i = 0; ret && i < n; i++) {
+        jstring s = (jstring)(*env)->GetObjectArrayElement(env, array, i);
+        const char *chars = (*env)->GetStringUTFChars(env, s, NULL);
+        ret[i] = (chars ? strdup(chars) : strdup(""));
+        if (chars) {
+            (*env)->ReleaseStringUTFChars(env, s, chars);
+        }
+        (*env)->DeleteLocalRef(env, s);
+    }
+    return ret;
+}
+
+static void free_strings(char **strings) {
+    if (strings) {
+        char **s;
+        for (s = strings; *s; s++) {
+            free(*s);
+        }
+        free(strings);
+    }
+}
+
+/* private static native long nativeNew(String udid, String appId, String[] args) throws IOException; */
+JNIEXPORT jlong JNICALL Java_com_google_iosdevicecontrol_real_NativeAppProcess_nativeNew(
+        JNIEnv *env, jclass clazz, jstring udid, jstring app_id, jobjectArray args) {
+    jni_runner *jr = calloc(1, sizeof(jni_runner));
+    if (!jr) {
+        throw_io_exception(env, "app_runner_new", APP_RUNNER_E_UNKNOWN_ERROR);
+        return 0;
+    }
+
+    app_runner_options_t options;
+    memset(&options, 0, sizeof(options));
+    options.udid = (udid ? (*env)->GetStringUTFChars(env, udid, NULL) : NULL);
+    options.app_id = (app_id ? (*env)->GetStringUTFChars(env, app_id, NULL) : NULL);
+    options.args = to_strings(env, args);
+
+    app_runner_error_t res = app_runner_new(&options, on_event, jr, &jr->runner);
+
+    free_strings(options.args);
+    if (options.app_id) {
+        (*env)->ReleaseStringUTFChars(env, app_id, options.app_id);
+    }
+    if (options.udid) {
+        (*env)->ReleaseStringUTFChars(env, udid, options.udid);
+    }
+    if (res != APP_RUNNER_E_SUCCESS) {
+        free(jr);
+        throw_io_exception(env, "app_runner_new", res);
+        return 0;
+    }
+    return (jlong)(intptr_t)jr;
+}
+
+/* private native int nativeConnect(long handle); */
+JNIEXPORT jint JNICALL Java_com_google_iosdevicecontrol_real_NativeAppProcess_nativeConnect(
+        JNIEnv *env, jobject self, jlong handle) {
+    jni_runner *jr = to_jni_runner(handle);
+    if (bind_listener(env, jr, self)) {
+        return APP_RUNNER_E_UNKNOWN_ERROR;
+    }
+    app_runner_error_t res = app_runner_connect(jr->runner);
+    unbind_listener(jr);
+    return res;
+}
+
+/* private native int nativeRun(long handle); */
+JNIEXPORT jint JNICALL Java_com_google_iosdevicecontrol_real_NativeAppProcess_nativeRun(
+        JNIEnv *env, jobject self, jlong handle) {
+    jni_runner *jr = to_jni_runner(handle);
+    if (bind_listener(env, jr, self)) {
+        return -1;
+    }
+    int ret = app_runner_run(jr->runner);
+    unbind_listener(jr);
+    return ret;
+}
+
+/* private static native void nativeStop(long handle); */
+JNIEXPORT void JNICALL Java_com_google_iosdevicecontrol_real_NativeAppProcess_nativeStop(
+        JNIEnv *env, jclass clazz, jlong handle) {
+    app_runner_stop(to_jni_runner(handle)->runner);
+}
+
+/* private static native double[] nativeEstimateClock(String udid, int probes); */
+JNIEXPORT jdoubleArray JNICALL Java_com_google_iosdevicecontrol_real_NativeAppProcess_nativeEstimateClock(
+        JNIEnv *env, jclass clazz, jstring udid, jint probes) {
+    clock_sync_estimate_t estimate;
+    const char *udid_chars = (udid ? (*env)->GetStringUTFChars(env, udid, NULL) : NULL);
+    int res = clock_sync_device(udid_chars, probes > 0 ? probes : 1, &estimate);
+    if (udid_chars) {
+        (*env)->ReleaseStringUTFChars(env, udid, udid_chars);
+    }
+    if (res) {
+        return NULL;
+    }
+    // Java can only relate our monotonic clock to its own through "now".
+    jdouble values[4];
+    values[0] = (jdouble)(trace_now_us() - estimate.host_us);
+    values[1] = estimate.host_us + estimate.offset_us;
+    values[2] = estimate.drift_ppm;
+    values[3] = estimate.uncertainty_us;
+    jdoubleArray ret = (*env)->NewDoubleArray(env, 4);
+    if (ret) {
+        (*env)->SetDoubleArrayRegion(env, ret, 0, 4, values);
+    }
+    return ret;
+}
+
+/* private static native void nativeFree(long handle); */
+JNIEXPORT void JNICALL Java_com_google_iosdevicecontrol_real_NativeAppProcess_nativeFree(
+        JNIEnv *env, jclass clazz, jlong handle) {
+    jni_runner *jr = to_jni_runner(handle);
+    app_runner_free(jr->runner);
+    free(jr);
+}
+
+/*
+ * private static native long nativeOpen(String udid) throws IOException;
+ * Returns 0 if the screenshot service could not be started.
+ */
+JNIEXPORT jlong JNICALL Java_com_google_iosdevicecontrol_real_NativeScreenCapture_nativeOpen(
+        JNIEnv *env, jclass clazz, jstring udid) {
+    screen_capture_t capture = NULL;
+    const char *udid_chars = (udid ? (*env)->GetStringUTFChars(env, udid, NULL) : NULL);
+    screen_capture_error_t res = screen_capture_new(udid_chars, &capture);
+    if (udid_chars) {
+        (*env)->ReleaseStringUTFChars(env, udid, udid_chars);
+    }
+    if (res == SCREEN_CAPTURE_E_SERVICE_FAILED) {
+        return 0;
+    }
+    if (res != SCREEN_CAPTURE_E_SUCCESS) {
+        throw_io_exception(env, "screen_capture_new", res);
+        return 0;
+    }
+    return (jlong)(intptr_t)capture;
+}
+
+/* private static native byte[] nativeTake(long handle) throws IOException; */
+JNIEXPORT jbyteArray JNICALL Java_com_google_iosdevicecontrol_real_NativeScreenCapture_nativeTake(
+        JNIEnv *env, jclass clazz, jlong handle) {
+    char *data = NULL;
+    uint64_t size = 0;
+    screen_capture_error_t res = screen_capture_take((screen_capture_t)(intptr_t)handle, &data,
+            &size);
+    if (res != SCREEN_CAPTURE_E_SUCCESS) {
+        throw_io_exception(env, "screen_capture_take", res);
+        return NULL;
+    }
+    jbyteArray ret = (*env)->NewByteArray(env, (jsize)size);
+    if (ret) {
+        (*env)->SetByteArrayRegion(env, ret, 0, (jsize)size, (const jbyte *)data);
+    }
+    free(data);
+    return ret;
+}
+
+/* private static native void nativeFree(long handle); */
+JNIEXPORT void JNICALL Java_com_google_iosdevicecontrol_real_NativeScreenCapture_nativeFree(
+        JNIEnv *env, jclass clazz, jlong handle) {
+    screen_capture_free((screen_capture_t)(intptr_t)handle);
+}
@@ -0,0 +1,164 @@
+/**
+ * clock_sync.c - estimate the offset between host and device clocks
+ *
+ * Licensed under the GNU General Public License Version 2
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more profile.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301
+ * USA
+ */
+
+#include <math.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <libimobiledevice/libimobiledevice.h>
+#include <libimobiledevice/lockdown.h>
+#include <plist/plist.h>
+
+#include "clock_sync.h"
+#include "trace_writer.h"
+
+// Round trips up to this much slower than the fastest still count, so that
+// the average is not left to a single lucky probe.
+#define RTT_SLACK_US 1000
+
+typedef struct {
+    double host_us;
+    double offset_us;
+    double rtt_us;
+} sample_t;
+
+int clock_sync_estimate(clock_sync_probe_cb_t probe, void *user_data,
+        unsigned int probes, unsigned int interval_ms,
+        clock_sync_estimate_t *estimate) {
+    sample_t *samples = calloc(probes ? probes : 1, sizeof(sample_t));
+    if (!samples) {
+        return -1;
+    }
+    unsigned int n = 0;
+    int whole_seconds = 1;
+    unsigned int i;
+    for (i = 0; i < probes; i++) {
+        if (i > 0 && interval_ms) {
+            usleep(interval_ms * 1000);
+        }
+        double device_s;
+        uint64_t sent_us = trace_now_us();
+        if (probe(user_data, &device_s)) {
+            continue;
+        }
+        uint64_t received_us = trace_now_us();
+        samples[n].host_us = (sent_us + received_us) / 2.0;
+        samples[n].offset_us = device_s * 1e6 - samples[n].host_us;
+        samples[n].rtt_us = (double)(received_us - sent_us);
+        if (device_s != floor(device_s)) {
+            whole_seconds = 0;
+        }
+        n++;
+    }
+    if (n == 0) {
+        free(samples);
+        return -1;
+    }
+
+    double min_rtt_us = samples[0].rtt_us;
+    for (i = 1; i < n; i++) {
+        if (samples[i].rtt_us < min_rtt_us) {
+            min_rtt_us = samples[i].rtt_us;
+        }
+    }
+    double host_sum = 0;
+    double offset_sum = 0;
+    unsigned int kept = 0;
+    for (i = 0; i < n; i++) {
+        if (samples[i].rtt_us <= 2 * min_rtt_us + RTT_SLACK_US) {
+            host_sum += samples[i].host_us;
+            offset_sum += samples[i].offset_us;
+            kept++;
+        }
+    }
+    estimate->host_us = (uint64_t)(host_sum / kept);
+    estimate->offset_us = offset_sum / kept;
+    estimate->drift_ppm = 0;
+    // The device is read somewhere within the round trip; a device that
+    // only reports whole seconds adds up to a second more.
+    estimate->uncertainty_us = min_rtt_us / 2 + (whole_seconds ? 1e6 : 0);
+    estimate->samples = kept;
+    free(samples);
+    return 0;
+}
+
+void clock_sync_add_drift(const clock_sync_estimate_t *earlier,
+        clock_sync_estimate_t *later) {
+    if (later->host_us <= earlier->host_us) {
+        return;
+    }
+    double elapsed_us = (double)(later->host_us - earlier->host_us);
+    // Drift estimates from short spans are mostly noise.
+    if (elapsed_us < 10 * (earlier->uncertainty_us + later->uncertainty_us)) {
+        return;
+    }
+    later->drift_ppm =
+            (later->offset_us - earlier->offset_us) / elapsed_us * 1e6;
+}
+
+double clock_sync_device_us(const clock_sync_estimate_t *estimate,
+        uint64_t host_us) {
+    double since_us = (double)host_us - (double)estimate->host_us;
+    return host_us + estimate->offset_us +
+            since_us * estimate->drift_ppm / 1e6;
+}
+
+int clock_sync_time_value(plist_t value, double *device_s) {
+    if (plist_get_node_type(value) == PLIST_REAL) {
+        plist_get_real_val(value, device_s);
+    } else if (plist_get_node_type(value) == PLIST_UINT) {
+        uint64_t seconds = 0;
+        plist_get_uint_val(value, &seconds);
+        *device_s = (double)seconds;
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+int clock_sync_lockdown_probe(void *lockdownd_client, double *device_s) {
+    plist_t value = NULL;
+    if (lockdownd_get_value((lockdownd_client_t)lockdownd_client, NULL,
+            "TimeIntervalSince1970", &value) != LOCKDOWN_E_SUCCESS || !value) {
+        return -1;
+    }
+    int ret = clock_sync_time_value(value, device_s);
+    plist_free(value);
+    return ret;
+}
+
+int clock_sync_device(const char *udid, unsigned int probes,
+        clock_sync_estimate_t *estimate) {
+    idevice_t phone = NULL;
+    lockdownd_client_t client = NULL;
+    int ret = -1;
+    if (idevice_new(&phone, udid) != IDEVICE_E_SUCCESS) {
+        return -1;
+    }
+    if (lockdownd_client_new_with_handshake(phone, &client,
+            "idevice-app-runner") == LOCKDOWN_E_SUCCESS) {
+        ret = clock_sync_estimate(clock_sync_lockdown_probe, client, probes,
+                CLOCK_SYNC_INTERVAL_MS, estimate);
+        lockdownd_client_free(client);
+    }
+    idevice_free(phone);
+    return ret;
+}
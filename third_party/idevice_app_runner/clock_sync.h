@@ -0,0 +1,99 @@
+/**
+ * clock_sync.h - estimate the offset between host and device clocks
+ *
+ * Licensed under the GNU General Public License Version 2
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more profile.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301
+ * USA
+ */
+
+#ifndef CLOCK_SYNC_H
+#define CLOCK_SYNC_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+#include <plist/plist.h>
+
+// A probe interval that spreads probes over USB hiccups without taking long.
+#define CLOCK_SYNC_INTERVAL_MS 20
+
+/**
+ * How device time relates to host time: at host_us on the host monotonic
+ * clock (trace_now_us), the device clock read host_us + offset_us, and it
+ * gains drift_ppm microseconds per second on the host clock. The offset is
+ * off by at most uncertainty_us, if the device answered probes evenly.
+ */
+typedef struct {
+    uint64_t host_us;
+    double offset_us;
+    double drift_ppm;
+    double uncertainty_us;
+    unsigned int samples;  // Probes the estimate is based on.
+} clock_sync_estimate_t;
+
+/**
+ * Reads the device clock, as seconds since the epoch. Returns 0 on success.
+ */
+typedef int (*clock_sync_probe_cb_t)(void *user_data, double *device_s);
+
+/**
+ * Estimates the offset from probes round trips, interval_ms apart. Each
+ * probe gives an offset between the device time and the host time halfway
+ * through the round trip; the estimate averages those of the fastest round
+ * trips, whose halfway point is least skewed by queueing. Returns 0 on
+ * success, -1 if no probe succeeded.
+ */
+int clock_sync_estimate(clock_sync_probe_cb_t probe, void *user_data,
+        unsigned int probes, unsigned int interval_ms,
+        clock_sync_estimate_t *estimate);
+
+/**
+ * Derives the drift from an earlier estimate, which should be at least a
+ * few seconds older, into later.
+ */
+void clock_sync_add_drift(const clock_sync_estimate_t *earlier,
+        clock_sync_estimate_t *later);
+
+/** Converts a time on the host monotonic clock into device microseconds. */
+double clock_sync_device_us(const clock_sync_estimate_t *estimate,
+        uint64_t host_us);
+
+/**
+ * Connects to the device with the given UDID (or the first one if NULL)
+ * and estimates its offset with lockdown queries of the device time, which
+ * is what idevicedate reads.
+ * Returns 0 on success.
+ */
+int clock_sync_device(const char *udid, unsigned int probes,
+        clock_sync_estimate_t *estimate);
+
+/** A clock_sync_probe_cb_t for a lockdownd_client_t user_data. */
+int clock_sync_lockdown_probe(void *lockdownd_client, double *device_s);
+
+/**
+ * Reads a lockdown TimeIntervalSince1970 value, for probes that get it some
+ * other way. Returns 0 on success.
+ */
+int clock_sync_time_value(plist_t value, double *device_s);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
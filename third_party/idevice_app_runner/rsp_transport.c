@@ -0,0 +1,315 @@
+/**
+ * rsp_transport.c - byte streams to debugserver, live, recorded or replayed
+ *
+ * Licensed under the GNU General Public License Version 2
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more profile.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301
+ * USA
+ */
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "rsp_transport.h"
+#include "usb_accounting.h"
+
+#define DEBUGSERVER_SERVICE "com.apple.debugserver"
+
+typedef enum {
+    TRANSPORT_DEVICE,
+    TRANSPORT_RECORDER,
+    TRANSPORT_REPLAY
+} transport_kind_t;
+
+struct rsp_transport {
+    transport_kind_t kind;
+    rsp_transport_stats_t stats;
+    uint64_t start_us;  // When the session began, or 0.
+
+    // TRANSPORT_DEVICE
+    idevice_connection_t connection;
+    char *udid;  // For usb_accounting, or NULL if it couldn't be read.
+
+    // TRANSPORT_RECORDER
+    rsp_transport *inner;
+    FILE *file;
+
+    // TRANSPORT_REPLAY: the whole session file, read up front so that
+    // replays measure the runner rather than the disk.
+    char *session;
+    size_t session_len;
+    size_t session_next;      // Offset of the next record.
+    const char *chunk;        // Rest of the received chunk being returned.
+    size_t chunk_len;
+    uint64_t chunk_us;
+    int paced;
+};
+
+static uint64_t now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+// Microseconds since the session began, which is now if it just did.
+static uint64_t session_us(rsp_transport *transport, uint64_t now) {
+    if (!transport->start_us) {
+        transport->start_us = now;
+    }
+    return now - transport->start_us;
+}
+
+static void write_record(rsp_transport *transport, char direction,
+        const char *data, uint32_t len, uint64_t now) {
+    fprintf(transport->file, "%c %" PRIu64 " %u\n", direction,
+            session_us(transport, now), len);
+    fwrite(data, 1, len, transport->file);
+    fputc('\n', transport->file);
+}
+
+// Finds the next received chunk of the replayed session. Returns -1 at the
+// end of the session or if the file is malformed.
+static int next_chunk(rsp_transport *transport) {
+    while (transport->session_next < transport->session_len) {
+        char *header = transport->session + transport->session_next;
+        char *end;
+        char direction = header[0];
+        if ((direction != '<' && direction != '>') || header[1] != ' ') {
+            return -1;
+        }
+        uint64_t ts = strtoull(header + 2, &end, 10);
+        if (*end != ' ') {
+            return -1;
+        }
+        size_t len = strtoul(end + 1, &end, 10);
+        if (*end != '\n') {
+            return -1;
+        }
+        size_t offset = end + 1 - transport->session;
+        if (len + 1 > transport->session_len - offset) {
+            return -1;
+        }
+        transport->session_next = offset + len + 1;
+        if (direction == '<' && len > 0) {
+            transport->chunk = transport->session + offset;
+            transport->chunk_len = len;
+            transport->chunk_us = ts;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+static idevice_error_t replay_receive(rsp_transport *transport, char *data,
+        uint32_t len, uint32_t *recv_bytes, unsigned int timeout) {
+    *recv_bytes = 0;
+    if (!transport->chunk_len) {
+        if (next_chunk(transport)) {
+            return IDEVICE_E_UNKNOWN_ERROR;
+        }
+        if (transport->paced) {
+            uint64_t now = session_us(transport, now_us());
+            if (now < transport->chunk_us) {
+                uint64_t wait_us = transport->chunk_us - now;
+                if (wait_us > (uint64_t)timeout * 1000) {
+                    // Still due after this receive times out.
+                    usleep(timeout * 1000);
+                    return IDEVICE_E_SUCCESS;
+                }
+                usleep(wait_us);
+                now = session_us(transport, now_us());
+            }
+            uint64_t lateness = now - transport->chunk_us;
+            transport->stats.lateness_total_us += lateness;
+            if (lateness > transport->stats.lateness_max_us) {
+                transport->stats.lateness_max_us = lateness;
+            }
+        }
+    }
+    uint32_t n = (transport->chunk_len < len ? transport->chunk_len : len);
+    memcpy(data, transport->chunk, n);
+    transport->chunk += n;
+    transport->chunk_len -= n;
+    *recv_bytes = n;
+    return IDEVICE_E_SUCCESS;
+}
+
+static char *read_file(const char *path, size_t *to_len) {
+    FILE *file = fopen(path, "rb");
+    if (!file) {
+        return NULL;
+    }
+    size_t cap = 64 * 1024;
+    size_t len = 0;
+    char *buf = malloc(cap);
+    while (buf) {
+        len += fread(buf + len, 1, cap - len, file);
+        if (len < cap) {
+            break;
+        }
+        char *bigger = realloc(buf, cap * 2);
+        if (!bigger) {
+            free(buf);
+            buf = NULL;
+            break;
+        }
+        buf = bigger;
+        cap *= 2;
+    }
+    if (buf && ferror(file)) {
+        free(buf);
+        buf = NULL;
+    }
+    fclose(file);
+    *to_len = len;
+    return buf;
+}
+
+rsp_transport *rsp_transport_new_device(idevice_t device,
+        idevice_connection_t connection) {
+    rsp_transport *transport = calloc(1, sizeof(rsp_transport));
+    if (transport) {
+        transport->kind = TRANSPORT_DEVICE;
+        transport->connection = connection;
+        idevice_get_udid(device, &transport->udid);
+    }
+    return transport;
+}
+
+rsp_transport *rsp_transport_new_recorder(rsp_transport *inner,
+        const char *path) {
+    rsp_transport *transport = calloc(1, sizeof(rsp_transport));
+    FILE *file = fopen(path, "wb");
+    if (!transport || !file) {
+        free(transport);
+        if (file) {
+            fclose(file);
+        }
+        return NULL;
+    }
+    fputs(RSP_SESSION_MAGIC, file);
+    transport->kind = TRANSPORT_RECORDER;
+    transport->inner = inner;
+    transport->file = file;
+    return transport;
+}
+
+rsp_transport *rsp_transport_new_replay(const char *path, int paced) {
+    size_t len = 0;
+    char *session = read_file(path, &len);
+    size_t magic_len = strlen(RSP_SESSION_MAGIC);
+    if (!session || len < magic_len ||
+            memcmp(session, RSP_SESSION_MAGIC, magic_len)) {
+        free(session);
+        return NULL;
+    }
+    rsp_transport *transport = calloc(1, sizeof(rsp_transport));
+    if (!transport) {
+        free(session);
+        return NULL;
+    }
+    transport->kind = TRANSPORT_REPLAY;
+    transport->session = session;
+    transport->session_len = len;
+    transport->session_next = magic_len;
+    transport->paced = paced;
+    return transport;
+}
+
+idevice_error_t rsp_transport_send(rsp_transport *transport, const char *data,
+        uint32_t len, uint32_t *sent_bytes) {
+    uint64_t now = now_us();
+    idevice_error_t err = IDEVICE_E_SUCCESS;
+    *sent_bytes = 0;
+    switch (transport->kind) {
+    case TRANSPORT_DEVICE:
+        err = idevice_connection_send(transport->connection, data, len,
+                sent_bytes);
+        usb_accounting_add(transport->udid, DEBUGSERVER_SERVICE, 0,
+                *sent_bytes);
+        break;
+    case TRANSPORT_RECORDER:
+        err = rsp_transport_send(transport->inner, data, len, sent_bytes);
+        if (*sent_bytes > 0) {
+            write_record(transport, '>', data, *sent_bytes, now);
+        }
+        break;
+    case TRANSPORT_REPLAY:
+        session_us(transport, now);
+        *sent_bytes = len;
+        break;
+    }
+    if (!transport->stats.first_us) {
+        transport->stats.first_us = now;
+    }
+    transport->stats.bytes_sent += *sent_bytes;
+    return err;
+}
+
+idevice_error_t rsp_transport_receive(rsp_transport *transport, char *data,
+        uint32_t len, uint32_t *recv_bytes, unsigned int timeout) {
+    idevice_error_t err = IDEVICE_E_SUCCESS;
+    *recv_bytes = 0;
+    switch (transport->kind) {
+    case TRANSPORT_DEVICE:
+        err = idevice_connection_receive_timeout(transport->connection, data,
+                len, recv_bytes, timeout);
+        usb_accounting_add(transport->udid, DEBUGSERVER_SERVICE, *recv_bytes,
+                0);
+        break;
+    case TRANSPORT_RECORDER:
+        err = rsp_transport_receive(transport->inner, data, len, recv_bytes,
+                timeout);
+        if (*recv_bytes > 0) {
+            write_record(transport, '<', data, *recv_bytes, now_us());
+        }
+        break;
+    case TRANSPORT_REPLAY:
+        err = replay_receive(transport, data, len, recv_bytes, timeout);
+        break;
+    }
+    if (*recv_bytes > 0) {
+        transport->stats.bytes_received += *recv_bytes;
+        transport->stats.receives++;
+        transport->stats.last_us = now_us();
+    }
+    return err;
+}
+
+void rsp_transport_get_stats(rsp_transport *transport,
+        rsp_transport_stats_t *stats) {
+    *stats = transport->stats;
+}
+
+void rsp_transport_free(rsp_transport *transport) {
+    if (!transport) {
+        return;
+    }
+    rsp_transport_free(transport->inner);
+    if (transport->file) {
+        fclose(transport->file);
+    }
+    if (transport->udid) {
+        // Report the session's last bytes now rather than with the next.
+        usb_accounting_flush();
+    }
+    free(transport->session);
+    free(transport->udid);
+    free(transport);
+}
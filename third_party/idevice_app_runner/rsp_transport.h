@@ -0,0 +1,97 @@
+/**
+ * rsp_transport.h - byte streams to debugserver, live, recorded or replayed
+ *
+ * Licensed under the GNU General Public License Version 2
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more profile.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301
+ * USA
+ */
+
+#ifndef RSP_TRANSPORT_H
+#define RSP_TRANSPORT_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+#include <libimobiledevice/libimobiledevice.h>
+
+/**
+ * Session files hold every chunk of bytes exchanged with debugserver as a
+ * "<direction> <microseconds since the session began> <length>\n" line, '>'
+ * for sent and '<' for received, followed by the bytes and a newline. They
+ * start with RSP_SESSION_MAGIC.
+ */
+#define RSP_SESSION_MAGIC "rsp-session 1\n"
+
+typedef struct {
+    uint64_t bytes_sent;
+    uint64_t bytes_received;
+    uint64_t receives;  // Receives that returned bytes.
+    uint64_t first_us;  // When the first byte was sent.
+    uint64_t last_us;   // When the last byte was received.
+
+    // Paced replays only: how much later than recorded the runner received
+    // each chunk, which is the latency of its input path.
+    uint64_t lateness_total_us;
+    uint64_t lateness_max_us;
+} rsp_transport_stats_t;
+
+typedef struct rsp_transport rsp_transport;
+
+/**
+ * Exchanges bytes with debugserver over connection to device, which both
+ * stay open. The bytes are reported to usb_accounting.
+ */
+rsp_transport *rsp_transport_new_device(idevice_t device,
+        idevice_connection_t connection);
+
+/**
+ * Passes bytes through to inner, which the recorder takes ownership of, and
+ * writes them to a session file at path. Returns NULL if the file can't be
+ * created.
+ */
+rsp_transport *rsp_transport_new_recorder(rsp_transport *inner,
+        const char *path);
+
+/**
+ * Replays the received side of the session file at path and discards sent
+ * bytes. If paced, each chunk is held back until the time it was received
+ * in the recorded session, otherwise chunks are returned as fast as they
+ * are read. Receives fail at the end of the session. Returns NULL if the
+ * file can't be read.
+ */
+rsp_transport *rsp_transport_new_replay(const char *path, int paced);
+
+/** Like idevice_connection_send. */
+idevice_error_t rsp_transport_send(rsp_transport *transport, const char *data,
+        uint32_t len, uint32_t *sent_bytes);
+
+/** Like idevice_connection_receive_timeout. */
+idevice_error_t rsp_transport_receive(rsp_transport *transport, char *data,
+        uint32_t len, uint32_t *recv_bytes, unsigned int timeout);
+
+void rsp_transport_get_stats(rsp_transport *transport,
+        rsp_transport_stats_t *stats);
+
+void rsp_transport_free(rsp_transport *transport);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
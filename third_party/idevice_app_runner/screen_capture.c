@@ -0,0 +1,106 @@
+/**
+ * screen_capture.c - take screenshots over one screenshotr connection
+ *
+ * Licensed under the GNU General Public License Version 2
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more profile.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301
+ * USA
+ */
+
+#include <stdlib.h>
+
+#include <libimobiledevice/libimobiledevice.h>
+#include <libimobiledevice/lockdown.h>
+#include <libimobiledevice/screenshotr.h>
+
+#include "screen_capture.h"
+#include "usb_accounting.h"
+
+struct screen_capture_private {
+    idevice_t phone;
+    screenshotr_client_t client;
+    char *udid;  // For usb_accounting, or NULL if it couldn't be read.
+};
+
+screen_capture_error_t screen_capture_new(const char *udid,
+        screen_capture_t *capture) {
+    idevice_t phone = NULL;
+    lockdownd_client_t lockdown = NULL;
+    lockdownd_service_descriptor_t service = NULL;
+    screenshotr_client_t client = NULL;
+    *capture = NULL;
+    if (idevice_new(&phone, udid) != IDEVICE_E_SUCCESS) {
+        return SCREEN_CAPTURE_E_NO_DEVICE;
+    }
+    if (lockdownd_client_new_with_handshake(phone, &lockdown,
+            "idevice-app-runner") != LOCKDOWN_E_SUCCESS) {
+        idevice_free(phone);
+        return SCREEN_CAPTURE_E_LOCKDOWN_FAILED;
+    }
+    // The service is part of the developer image, so starting it is what
+    // fails when the image is not mounted.
+    lockdownd_error_t started = lockdownd_start_service(lockdown,
+            SCREENSHOTR_SERVICE_NAME, &service);
+    lockdownd_client_free(lockdown);
+    if (started != LOCKDOWN_E_SUCCESS || !service || !service->port) {
+        lockdownd_service_descriptor_free(service);
+        idevice_free(phone);
+        return SCREEN_CAPTURE_E_SERVICE_FAILED;
+    }
+    screenshotr_error_t connected = screenshotr_client_new(phone, service,
+            &client);
+    lockdownd_service_descriptor_free(service);
+    if (connected != SCREENSHOTR_E_SUCCESS) {
+        idevice_free(phone);
+        return SCREEN_CAPTURE_E_SERVICE_FAILED;
+    }
+    struct screen_capture_private *ret = calloc(1, sizeof(*ret));
+    if (!ret) {
+        screenshotr_client_free(client);
+        idevice_free(phone);
+        return SCREEN_CAPTURE_E_CAPTURE_FAILED;
+    }
+    ret->phone = phone;
+    ret->client = client;
+    idevice_get_udid(phone, &ret->udid);
+    *capture = ret;
+    return SCREEN_CAPTURE_E_SUCCESS;
+}
+
+screen_capture_error_t screen_capture_take(screen_capture_t capture,
+        char **data, uint64_t *size) {
+    *data = NULL;
+    *size = 0;
+    if (screenshotr_take_screenshot(capture->client, data, size) !=
+            SCREENSHOTR_E_SUCCESS || !*data) {
+        free(*data);
+        *data = NULL;
+        return SCREEN_CAPTURE_E_CAPTURE_FAILED;
+    }
+    usb_accounting_add(capture->udid, SCREENSHOTR_SERVICE_NAME, *size, 0);
+    return SCREEN_CAPTURE_E_SUCCESS;
+}
+
+void screen_capture_free(screen_capture_t capture) {
+    if (!capture) {
+        return;
+    }
+    screenshotr_client_free(capture->client);
+    idevice_free(capture->phone);
+    free(capture->udid);
+    free(capture);
+    // Report the session's last bytes now rather than with the next.
+    usb_accounting_flush();
+}
@@ -0,0 +1,64 @@
+/**
+ * screen_capture.h - take screenshots over one screenshotr connection
+ *
+ * Licensed under the GNU General Public License Version 2
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more profile.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301
+ * USA
+ */
+
+#ifndef SCREEN_CAPTURE_H
+#define SCREEN_CAPTURE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+typedef enum {
+    SCREEN_CAPTURE_E_SUCCESS = 0,
+    SCREEN_CAPTURE_E_NO_DEVICE = -1,
+    SCREEN_CAPTURE_E_LOCKDOWN_FAILED = -2,
+    // Usually means the developer image is not mounted.
+    SCREEN_CAPTURE_E_SERVICE_FAILED = -3,
+    SCREEN_CAPTURE_E_CAPTURE_FAILED = -4
+} screen_capture_error_t;
+
+typedef struct screen_capture_private *screen_capture_t;
+
+/**
+ * Connects to the screenshot service of the device with the given UDID (or
+ * the first one if NULL). Keeping the connection open saves the device
+ * lookup, lockdown handshake and service start that idevicescreenshot pays
+ * for every screenshot.
+ */
+screen_capture_error_t screen_capture_new(const char *udid,
+        screen_capture_t *capture);
+
+/**
+ * Takes a screenshot, as TIFF before iOS 9 and PNG since. The caller frees
+ * *data.
+ */
+screen_capture_error_t screen_capture_take(screen_capture_t capture,
+        char **data, uint64_t *size);
+
+void screen_capture_free(screen_capture_t capture);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,114 @@
+/**
+ * trace_writer.c - write Chrome trace event format JSON files
+ *
+ * Licensed under the GNU General Public License Version 2
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more profile.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301
+ * USA
+ */
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "trace_writer.h"
+
+// All events belong to the one app being run.
+#define TRACE_PID 1
+
+struct trace_writer {
+    FILE *file;
+};
+
+static void write_json_string(FILE *file, const char *s, size_t n) {
+    fputc('"', file);
+    size_t i;
+    for (i = 0; i < n; i++) {
+        unsigned char c = (unsigned char)s[i];
+        if (c == '"' || c == '\\') {
+            fputc('\\', file);
+            fputc(c, file);
+        } else if (c < 0x20) {
+            fprintf(file, "\\u%04x", c);
+        } else {
+            fputc(c, file);
+        }
+    }
+    fputc('"', file);
+}
+
+trace_writer *trace_writer_open(const char *path, const char *process_name) {
+    trace_writer *writer = calloc(1, sizeof(trace_writer));
+    if (!writer) {
+        return NULL;
+    }
+    writer->file = fopen(path, "w");
+    if (!writer->file) {
+        free(writer);
+        return NULL;
+    }
+    // Metadata event naming the process, so a viewer shows the app's name.
+    fprintf(writer->file, "[{\"ph\":\"M\",\"name\":\"process_name\","
+            "\"pid\":%d,\"tid\":0,\"args\":{\"name\":", TRACE_PID);
+    write_json_string(writer->file, process_name, strlen(process_name));
+    fputs("}}", writer->file);
+    return writer;
+}
+
+void trace_writer_event(trace_writer *writer, char phase, const char *name,
+        size_t name_len, const char *category, uint64_t ts_us, uint64_t tid) {
+    if (!writer) {
+        return;
+    }
+    FILE *file = writer->file;
+    fprintf(file, ",\n{\"ph\":\"%c\",\"cat\":\"%s\",\"name\":", phase,
+            category);
+    write_json_string(file, name, name_len);
+    fprintf(file, ",\"ts\":%" PRIu64 ",\"pid\":%d,\"tid\":%" PRIu64,
+            ts_us, TRACE_PID, tid);
+    if (phase == TRACE_PHASE_INSTANT) {
+        // Thread-scoped instant events are drawn on their thread's track.
+        fputs(",\"s\":\"t\"", file);
+    }
+    fputc('}', file);
+}
+
+void trace_writer_metadata(trace_writer *writer, const char *name,
+        const char *args_json) {
+    if (!writer) {
+        return;
+    }
+    fputs(",\n{\"ph\":\"M\",\"name\":", writer->file);
+    write_json_string(writer->file, name, strlen(name));
+    fprintf(writer->file, ",\"pid\":%d,\"tid\":0,\"args\":%s}", TRACE_PID,
+            args_json);
+}
+
+void trace_writer_close(trace_writer *writer) {
+    if (!writer) {
+        return;
+    }
+    fputs("\n]\n", writer->file);
+    fclose(writer->file);
+    free(writer);
+}
+
+uint64_t trace_now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
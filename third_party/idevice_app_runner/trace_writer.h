@@ -0,0 +1,69 @@
+/**
+ * trace_writer.h - write Chrome trace event format JSON files
+ *
+ * Licensed under the GNU General Public License Version 2
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more profile.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301
+ * USA
+ */
+
+#ifndef TRACE_WRITER_H
+#define TRACE_WRITER_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Event phases of the Trace Event Format, as read by chrome://tracing.
+#define TRACE_PHASE_BEGIN 'B'
+#define TRACE_PHASE_END 'E'
+#define TRACE_PHASE_INSTANT 'i'
+
+typedef struct trace_writer trace_writer;
+
+/**
+ * Creates the file at path and starts a JSON array of events for a process
+ * with the specified name. Returns NULL if the file can't be created.
+ */
+trace_writer *trace_writer_open(const char *path, const char *process_name);
+
+/**
+ * Appends an event. The name need not be NUL-terminated. Timestamps are in
+ * microseconds; viewers only care that they share a clock.
+ */
+void trace_writer_event(trace_writer *writer, char phase, const char *name,
+        size_t name_len, const char *category, uint64_t ts_us, uint64_t tid);
+
+/**
+ * Appends a metadata event with the given name, whose args are the JSON
+ * object args_json.
+ */
+void trace_writer_metadata(trace_writer *writer, const char *name,
+        const char *args_json);
+
+/** Closes the JSON array and the file, and frees the writer. */
+void trace_writer_close(trace_writer *writer);
+
+/** Returns the current time on the monotonic clock used for events. */
+uint64_t trace_now_us(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
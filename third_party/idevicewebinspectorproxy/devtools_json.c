@@ -0,0 +1,401 @@
+/*
+ * devtools_json.c
+ * Minimal scanning of the JSON messages of the DevTools protocol
+ *
+ * Copyright (c) 2013 Yury Melnichek All Rights Reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "devtools_json.h"
+
+static const char *skip_space(const char *p, const char *end)
+{
+	while (p < end && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r')) {
+		p++;
+	}
+	return p;
+}
+
+/* Returns the end of the string starting at p, after its closing quote. */
+static const char *skip_string(const char *p, const char *end)
+{
+	if (p >= end || *p != '"') {
+		return NULL;
+	}
+	for (p++; p < end; p++) {
+		if (*p == '\\') {
+			p++;
+		} else if (*p == '"') {
+			return p + 1;
+		}
+	}
+	return NULL;
+}
+
+/* Returns the end of the value starting at p, or NULL if it is malformed. */
+static const char *skip_value(const char *p, const char *end)
+{
+	const char *start = p;
+	int depth = 0;
+
+	if (p >= end) {
+		return NULL;
+	}
+	if (*p == '"') {
+		return skip_string(p, end);
+	}
+	if (*p != '{' && *p != '[') {
+		/* a number or literal, which the caller checks if it cares */
+		while (p < end && *p != ',' && *p != ':' && *p != '}' && *p != ']' &&
+				*p != ' ' && *p != '\t' && *p != '\n' && *p != '\r') {
+			p++;
+		}
+		return (p > start ? p : NULL);
+	}
+	while (p < end) {
+		if (*p == '"') {
+			p = skip_string(p, end);
+			if (!p) {
+				return NULL;
+			}
+			continue;
+		}
+		if (*p == '{' || *p == '[') {
+			depth++;
+		} else if ((*p == '}' || *p == ']') && --depth == 0) {
+			return p + 1;
+		}
+		p++;
+	}
+	return NULL;
+}
+
+int devtools_json_parse(const char *text, size_t length, devtools_json_t *value)
+{
+	const char *end = text + length;
+	const char *start = skip_space(text, end);
+	const char *value_end = skip_value(start, end);
+
+	if (!value_end || skip_space(value_end, end) != end) {
+		return -1;
+	}
+	value->start = start;
+	value->length = value_end - start;
+	return 0;
+}
+
+/*
+ * Calls found for each member of an object until it returns non-zero.
+ * Returns 0 if found did, -1 otherwise.
+ */
+static int find_member(devtools_json_t object, int (*found)(devtools_json_t key, devtools_json_t value, void *data), void *data)
+{
+	const char *end = object.start + object.length;
+	const char *p = object.start;
+	devtools_json_t key;
+	devtools_json_t value;
+
+	if (object.length < 2 || *p != '{') {
+		return -1;
+	}
+	p = skip_space(p + 1, end);
+	while (p < end && *p == '"') {
+		const char *key_end = skip_string(p, end);
+		if (!key_end) {
+			return -1;
+		}
+		key.start = p;
+		key.length = key_end - p;
+		p = skip_space(key_end, end);
+		if (p >= end || *p != ':') {
+			return -1;
+		}
+		p = skip_space(p + 1, end);
+		const char *value_end = skip_value(p, end);
+		if (!value_end) {
+			return -1;
+		}
+		value.start = p;
+		value.length = value_end - p;
+		if (found(key, value, data)) {
+			return 0;
+		}
+		p = skip_space(value_end, end);
+		if (p < end && *p == ',') {
+			p = skip_space(p + 1, end);
+		}
+	}
+	return -1;
+}
+
+typedef struct {
+	const char *key;
+	size_t key_length;
+	size_t index;
+	devtools_json_t *found_key;
+	devtools_json_t *found_value;
+} member_search_t;
+
+static int match_key(devtools_json_t key, devtools_json_t value, void *data)
+{
+	member_search_t *search = (member_search_t *)data;
+
+	if (key.length != search->key_length + 2 || memcmp(key.start + 1, search->key, search->key_length)) {
+		return 0;
+	}
+	*search->found_value = value;
+	return 1;
+}
+
+static int match_index(devtools_json_t key, devtools_json_t value, void *data)
+{
+	member_search_t *search = (member_search_t *)data;
+
+	if (search->index-- > 0) {
+		return 0;
+	}
+	*search->found_key = key;
+	*search->found_value = value;
+	return 1;
+}
+
+int devtools_json_get(devtools_json_t object, const char *key, devtools_json_t *value)
+{
+	member_search_t search = { key, strlen(key), 0, NULL, value };
+	return find_member(object, match_key, &search);
+}
+
+int devtools_json_member(devtools_json_t object, size_t index, devtools_json_t *key, devtools_json_t *value)
+{
+	member_search_t search = { NULL, 0, index, key, value };
+	return find_member(object, match_index, &search);
+}
+
+int devtools_json_index(devtools_json_t array, size_t index, devtools_json_t *value)
+{
+	const char *end = array.start + array.length;
+	const char *p = array.start;
+
+	if (array.length < 2 || *p != '[') {
+		return -1;
+	}
+	p = skip_space(p + 1, end);
+	while (p < end && *p != ']') {
+		const char *value_end = skip_value(p, end);
+		if (!value_end) {
+			return -1;
+		}
+		if (index-- == 0) {
+			value->start = p;
+			value->length = value_end - p;
+			return 0;
+		}
+		p = skip_space(value_end, end);
+		if (p < end && *p == ',') {
+			p = skip_space(p + 1, end);
+		}
+	}
+	return -1;
+}
+
+int devtools_json_is_string(devtools_json_t value, const char *s)
+{
+	size_t length = strlen(s);
+	return (value.length == length + 2 && value.start[0] == '"' && !memcmp(value.start + 1, s, length));
+}
+
+int devtools_json_number(devtools_json_t value, double *number)
+{
+	char buffer[64];
+	char *end;
+
+	if (value.length == 0 || value.length >= sizeof(buffer)) {
+		return -1;
+	}
+	memcpy(buffer, value.start, value.length);
+	buffer[value.length] = '\0';
+	*number = strtod(buffer, &end);
+	return (end == buffer + value.length ? 0 : -1);
+}
+
+static int hex_digit(char c)
+{
+	if (c >= '0' && c <= '9') {
+		return c - '0';
+	}
+	if (c >= 'a' && c <= 'f') {
+		return c - 'a' + 10;
+	}
+	if (c >= 'A' && c <= 'F') {
+		return c - 'A' + 10;
+	}
+	return -1;
+}
+
+static int parse_hex4(const char *p, const char *end, uint32_t *to_code)
+{
+	uint32_t code = 0;
+	int i;
+
+	if (end - p < 4) {
+		return -1;
+	}
+	for (i = 0; i < 4; i++) {
+		int digit = hex_digit(p[i]);
+		if (digit < 0) {
+			return -1;
+		}
+		code = (code << 4) | digit;
+	}
+	*to_code = code;
+	return 0;
+}
+
+static char *put_utf8(char *t, uint32_t code)
+{
+	if (code < 0x80) {
+		*t++ = (char)code;
+	} else if (code < 0x800) {
+		*t++ = (char)(0xc0 | (code >> 6));
+		*t++ = (char)(0x80 | (code & 0x3f));
+	} else if (code < 0x10000) {
+		*t++ = (char)(0xe0 | (code >> 12));
+		*t++ = (char)(0x80 | ((code >> 6) & 0x3f));
+		*t++ = (char)(0x80 | (code & 0x3f));
+	} else {
+		*t++ = (char)(0xf0 | (code >> 18));
+		*t++ = (char)(0x80 | ((code >> 12) & 0x3f));
+		*t++ = (char)(0x80 | ((code >> 6) & 0x3f));
+		*t++ = (char)(0x80 | (code & 0x3f));
+	}
+	return t;
+}
+
+char *devtools_json_string(devtools_json_t value, size_t *length)
+{
+	const char *p = value.start + 1;
+	const char *end = value.start + value.length - 1;
+	char *ret;
+	char *t;
+
+	if (value.length < 2 || value.start[0] != '"' || *end != '"') {
+		return NULL;
+	}
+	/* the contents never get longer when unescaped */
+	ret = malloc(value.length - 1);
+	if (!ret) {
+		return NULL;
+	}
+	for (t = ret; p < end; p++) {
+		if (*p != '\\') {
+			*t++ = *p;
+			continue;
+		}
+		if (++p >= end) {
+			break;
+		}
+		switch (*p) {
+		case 'b': *t++ = '\b'; break;
+		case 'f': *t++ = '\f'; break;
+		case 'n': *t++ = '\n'; break;
+		case 'r': *t++ = '\r'; break;
+		case 't': *t++ = '\t'; break;
+		case 'u': {
+			uint32_t code;
+			uint32_t low;
+			if (parse_hex4(p + 1, end, &code)) {
+				free(ret);
+				return NULL;
+			}
+			p += 4;
+			if (code >= 0xd800 && code < 0xdc00 && end - p > 6 && p[1] == '\\' && p[2] == 'u' &&
+					!parse_hex4(p + 3, end, &low) && low >= 0xdc00 && low < 0xe000) {
+				/* a surrogate pair, which is 12 characters for 4 bytes */
+				code = 0x10000 + ((code - 0xd800) << 10) + (low - 0xdc00);
+				p += 6;
+			}
+			t = put_utf8(t, code);
+			break;
+		}
+		default: *t++ = *p; break;
+		}
+	}
+	*t = '\0';
+	if (length) {
+		*length = t - ret;
+	}
+	return ret;
+}
+
+static int base64_digit(char c)
+{
+	if (c >= 'A' && c <= 'Z') {
+		return c - 'A';
+	}
+	if (c >= 'a' && c <= 'z') {
+		return c - 'a' + 26;
+	}
+	if (c >= '0' && c <= '9') {
+		return c - '0' + 52;
+	}
+	if (c == '+') {
+		return 62;
+	}
+	if (c == '/') {
+		return 63;
+	}
+	return -1;
+}
+
+char *devtools_json_base64(devtools_json_t value, uint32_t *length)
+{
+	const char *p = value.start + 1;
+	const char *end = value.start + value.length - 1;
+	uint32_t bits = 0;
+	int nbits = 0;
+	char *ret;
+	char *t;
+
+	if (value.length < 2 || value.start[0] != '"' || *end != '"') {
+		return NULL;
+	}
+	ret = malloc((value.length / 4 + 1) * 3);
+	if (!ret) {
+		return NULL;
+	}
+	for (t = ret; p < end && *p != '='; p++) {
+		int digit = base64_digit(*p);
+		if (digit < 0) {
+			if (*p == '\\' && p + 1 < end && p[1] == '/') {
+				/* JSON may escape the slash */
+				continue;
+			}
+			free(ret);
+			return NULL;
+		}
+		bits = (bits << 6) | digit;
+		nbits += 6;
+		if (nbits >= 8) {
+			nbits -= 8;
+			*t++ = (char)(bits >> nbits);
+		}
+	}
+	*length = t - ret;
+	return ret;
+}
@@ -0,0 +1,87 @@
+/*
+ * devtools_json.h
+ * Minimal scanning of the JSON messages of the DevTools protocol
+ *
+ * Copyright (c) 2013 Yury Melnichek All Rights Reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef DEVTOOLS_JSON_H
+#define DEVTOOLS_JSON_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * A JSON value within a message, which is scanned in place rather than
+ * parsed into a tree: the proxy only ever looks at a few members of the
+ * messages that pass through it.
+ */
+typedef struct {
+	const char *start;
+	size_t length;
+} devtools_json_t;
+
+/** Wraps a complete message. Returns 0 on success, -1 if it is not JSON. */
+int devtools_json_parse(const char *text, size_t length, devtools_json_t *value);
+
+/**
+ * Finds the member with the given key of an object. Returns 0 on success,
+ * -1 if the value is not an object or has no such member.
+ */
+int devtools_json_get(devtools_json_t object, const char *key, devtools_json_t *value);
+
+/**
+ * Gets the key and value of the member at index of an object, for iterating
+ * over it. Returns 0 on success, -1 if the value is not an object or has no
+ * more members.
+ */
+int devtools_json_member(devtools_json_t object, size_t index, devtools_json_t *key, devtools_json_t *value);
+
+/**
+ * Gets the element at index of an array. Returns 0 on success, -1 if the
+ * value is not an array or is too short.
+ */
+int devtools_json_index(devtools_json_t array, size_t index, devtools_json_t *value);
+
+/** Returns whether the value is a string equal to s, which has no escapes. */
+int devtools_json_is_string(devtools_json_t value, const char *s);
+
+/** Gets a number value. Returns 0 on success, -1 if it is not a number. */
+int devtools_json_number(devtools_json_t value, double *number);
+
+/**
+ * Returns the contents of a string value without quotes or escapes,
+ * NUL-terminated, in a buffer the caller frees; or NULL if it is not a
+ * string. If length is not NULL, it is set to the length of the contents.
+ */
+char *devtools_json_string(devtools_json_t value, size_t *length);
+
+/**
+ * Decodes a base64 string value into a buffer the caller frees. Returns NULL
+ * if it is not a base64 string.
+ */
+char *devtools_json_base64(devtools_json_t value, uint32_t *length);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
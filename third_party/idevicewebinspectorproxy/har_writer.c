@@ -0,0 +1,480 @@
+/*
+ * har_writer.c
+ * Streaming HAR capture from the Network events of the DevTools protocol
+ *
+ * Copyright (c) 2013 Yury Melnichek All Rights Reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "har_writer.h"
+
+/* requests in flight and pages that are remembered */
+#define MAX_ENTRIES 256
+#define MAX_PAGES 64
+/* bodies whose JSON is longer are left out */
+#define MAX_BODY_LENGTH (4 * 1024 * 1024)
+
+/* A request in flight; the strings are JSON fragments from its events. */
+typedef struct {
+	int used;
+	unsigned long long sequence;
+	char *page;
+	char *request_id;
+	char *started;
+	double start_time;
+	double response_time;
+	double end_time;
+	char *method;
+	char *url;
+	char *request_headers;
+	char *post_data;
+	char *resource_type;
+	int has_response;
+	double status;
+	char *status_text;
+	char *protocol;
+	char *response_headers;
+	char *mime_type;
+	double data_length;
+	double encoded_data_length;
+	char *error_text;
+	int body_id;
+} har_entry_t;
+
+struct har_writer_private {
+	FILE *file;
+	int include_bodies;
+	int entry_count;
+	/* walltime minus timestamp, from the last event that had both */
+	double wall_offset;
+	int has_wall_offset;
+	unsigned long long sequence;
+	har_entry_t entries[MAX_ENTRIES];
+	char *pages[MAX_PAGES];
+	char *page_started[MAX_PAGES];
+	int page_count;
+};
+
+static char *copy_json(devtools_json_t value)
+{
+	char *s = malloc(value.length + 1);
+
+	if (s) {
+		memcpy(s, value.start, value.length);
+		s[value.length] = '\0';
+	}
+	return s;
+}
+
+/* Copies the member key of object as JSON, or returns NULL if it has none. */
+static char *copy_member(devtools_json_t object, const char *key)
+{
+	devtools_json_t value;
+
+	return (devtools_json_get(object, key, &value) ? NULL : copy_json(value));
+}
+
+static double get_number(devtools_json_t object, const char *key, double default_value)
+{
+	devtools_json_t value;
+	double number;
+
+	if (devtools_json_get(object, key, &value) || devtools_json_number(value, &number)) {
+		return default_value;
+	}
+	return number;
+}
+
+/* Converts a headers object into the name/value array of HAR. */
+static char *copy_headers(devtools_json_t object, const char *key)
+{
+	devtools_json_t headers;
+	devtools_json_t name;
+	devtools_json_t value;
+	size_t capacity;
+	size_t length = 1;
+	size_t i;
+	char *s;
+
+	if (devtools_json_get(object, key, &headers)) {
+		return strdup("[]");
+	}
+	/* "a":"" becomes {"name":"a","value":""}, which is the worst case */
+	capacity = headers.length * 4 + 3;
+	s = malloc(capacity);
+	if (!s) {
+		return NULL;
+	}
+	s[0] = '[';
+	for (i = 0; !devtools_json_member(headers, i, &name, &value); i++) {
+		int n = snprintf(s + length, capacity - length, "%s{\"name\":%.*s,\"value\":%.*s}", i ? "," : "",
+				(int)name.length, name.start, (int)value.length, value.start);
+		if (n < 0 || (size_t)n >= capacity - length) {
+			break;
+		}
+		length += n;
+	}
+	snprintf(s + length, capacity - length, "]");
+	return s;
+}
+
+static void write_string(FILE *file, const char *s)
+{
+	fputc('"', file);
+	for (; *s; s++) {
+		if (*s == '"' || *s == '\\') {
+			fputc('\\', file);
+			fputc(*s, file);
+		} else if ((unsigned char)*s < 0x20) {
+			fprintf(file, "\\u%04x", *s);
+		} else {
+			fputc(*s, file);
+		}
+	}
+	fputc('"', file);
+}
+
+/* Formats a time in seconds since the epoch in ISO 8601. */
+static char *format_time(double seconds)
+{
+	char buffer[40];
+	struct tm tm;
+	long long ms = (long long)(seconds * 1000 + 0.5);
+	time_t whole = (time_t)(ms / 1000);
+
+	gmtime_r(&whole, &tm);
+	size_t n = strftime(buffer, sizeof(buffer), "%Y-%m-%dT%H:%M:%S", &tm);
+	snprintf(buffer + n, sizeof(buffer) - n, ".%03dZ", (int)(ms % 1000));
+	return strdup(buffer);
+}
+
+static double now_seconds(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_REALTIME, &now);
+	return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+static double duration_ms(double from, double to)
+{
+	return (from > 0 && to >= from ? (to - from) * 1000 : -1);
+}
+
+static void free_entry(har_entry_t *entry)
+{
+	free(entry->page);
+	free(entry->request_id);
+	free(entry->started);
+	free(entry->method);
+	free(entry->url);
+	free(entry->request_headers);
+	free(entry->post_data);
+	free(entry->resource_type);
+	free(entry->status_text);
+	free(entry->protocol);
+	free(entry->response_headers);
+	free(entry->mime_type);
+	free(entry->error_text);
+	memset(entry, 0, sizeof(*entry));
+}
+
+/* Writes an entry, with the reply of Network.getResponseBody if body is not NULL, and frees it. */
+static void write_entry(har_writer_t writer, har_entry_t *entry, devtools_json_t *body)
+{
+	FILE *file = writer->file;
+	devtools_json_t text;
+	devtools_json_t encoded;
+	double wait = duration_ms(entry->start_time, entry->response_time);
+	double receive = duration_ms(entry->response_time, entry->end_time);
+	double total = duration_ms(entry->start_time, entry->end_time);
+
+	fprintf(file, "%s\n{\"pageref\":", writer->entry_count++ ? "," : "");
+	write_string(file, entry->page);
+	fprintf(file, ",\"startedDateTime\":\"%s\",\"time\":%.3f,", entry->started, total < 0 ? 0 : total);
+	fprintf(file, "\"request\":{\"method\":%s,\"url\":%s,\"httpVersion\":%s,\"cookies\":[],\"headers\":%s,\"queryString\":[],",
+			entry->method ? entry->method : "\"GET\"", entry->url ? entry->url : "\"\"",
+			entry->protocol ? entry->protocol : "\"\"", entry->request_headers ? entry->request_headers : "[]");
+	if (entry->post_data) {
+		fprintf(file, "\"postData\":{\"mimeType\":\"\",\"text\":%s},", entry->post_data);
+	}
+	fprintf(file, "\"headersSize\":-1,\"bodySize\":-1},");
+	fprintf(file, "\"response\":{\"status\":%.0f,\"statusText\":%s,\"httpVersion\":%s,\"cookies\":[],\"headers\":%s,",
+			entry->has_response ? entry->status : 0, entry->status_text ? entry->status_text : "\"\"",
+			entry->protocol ? entry->protocol : "\"\"", entry->response_headers ? entry->response_headers : "[]");
+	fprintf(file, "\"content\":{\"size\":%.0f,\"mimeType\":%s", entry->data_length, entry->mime_type ? entry->mime_type : "\"\"");
+	if (body && !devtools_json_get(*body, "body", &text)) {
+		if (text.length <= MAX_BODY_LENGTH) {
+			fprintf(file, ",\"text\":%.*s", (int)text.length, text.start);
+			if (!devtools_json_get(*body, "base64Encoded", &encoded) && encoded.length == 4 && !memcmp(encoded.start, "true", 4)) {
+				fprintf(file, ",\"encoding\":\"base64\"");
+			}
+		} else {
+			fprintf(file, ",\"comment\":\"body too large\"");
+		}
+	}
+	fprintf(file, "},\"redirectURL\":\"\",\"headersSize\":-1,\"bodySize\":%.0f},",
+			entry->encoded_data_length > 0 ? entry->encoded_data_length : -1);
+	fprintf(file, "\"cache\":{},\"timings\":{\"send\":0,\"wait\":%.3f,\"receive\":%.3f}", wait < 0 ? 0 : wait, receive < 0 ? 0 : receive);
+	if (entry->resource_type) {
+		fprintf(file, ",\"_resourceType\":%s", entry->resource_type);
+	}
+	if (entry->error_text) {
+		fprintf(file, ",\"_error\":%s", entry->error_text);
+	} else if (!entry->end_time) {
+		fprintf(file, ",\"comment\":\"incomplete\"");
+	}
+	fprintf(file, "}");
+	fflush(file);
+	free_entry(entry);
+}
+
+static har_entry_t *find_entry(har_writer_t writer, const char *page, devtools_json_t request_id)
+{
+	int i;
+
+	for (i = 0; i < MAX_ENTRIES; i++) {
+		har_entry_t *entry = &writer->entries[i];
+		if (entry->used && strlen(entry->request_id) == request_id.length &&
+				!memcmp(entry->request_id, request_id.start, request_id.length) && !strcmp(entry->page, page)) {
+			return entry;
+		}
+	}
+	return NULL;
+}
+
+/* Returns a free entry, writing out the oldest one if there is none. */
+static har_entry_t *new_entry(har_writer_t writer)
+{
+	har_entry_t *oldest = NULL;
+	int i;
+
+	for (i = 0; i < MAX_ENTRIES; i++) {
+		har_entry_t *entry = &writer->entries[i];
+		if (!entry->used) {
+			return entry;
+		}
+		if (!oldest || entry->sequence < oldest->sequence) {
+			oldest = entry;
+		}
+	}
+	write_entry(writer, oldest, NULL);
+	return oldest;
+}
+
+static void add_page(har_writer_t writer, const char *page, const char *started)
+{
+	int i;
+
+	for (i = 0; i < writer->page_count; i++) {
+		if (!strcmp(writer->pages[i], page)) {
+			return;
+		}
+	}
+	if (writer->page_count < MAX_PAGES) {
+		writer->pages[writer->page_count] = strdup(page);
+		writer->page_started[writer->page_count] = strdup(started);
+		writer->page_count++;
+	}
+}
+
+/* Fills in the response of an entry from a Network.Response object. */
+static void set_response(har_entry_t *entry, devtools_json_t response, double time)
+{
+	free(entry->status_text);
+	free(entry->response_headers);
+	free(entry->mime_type);
+	entry->has_response = 1;
+	entry->response_time = time;
+	entry->status = get_number(response, "status", 0);
+	entry->status_text = copy_member(response, "statusText");
+	entry->response_headers = copy_headers(response, "headers");
+	entry->mime_type = copy_member(response, "mimeType");
+	if (!entry->protocol) {
+		entry->protocol = copy_member(response, "protocol");
+	}
+}
+
+har_writer_t har_writer_new(const char *path, int include_bodies)
+{
+	har_writer_t writer = calloc(1, sizeof(har_writer_private));
+
+	if (!writer) {
+		return NULL;
+	}
+	writer->file = fopen(path, "w");
+	if (!writer->file) {
+		free(writer);
+		return NULL;
+	}
+	writer->include_bodies = include_bodies;
+	fprintf(writer->file, "{\"log\":{\"version\":\"1.2\",\"creator\":{\"name\":\"idevicewebinspectorproxy\",\"version\":\"1.0\"},\"entries\":[");
+	fflush(writer->file);
+	return writer;
+}
+
+int har_writer_is_network_event(devtools_json_t method)
+{
+	return (method.length > 10 && !memcmp(method.start, "\"Network.", 9));
+}
+
+const char *har_writer_add_event(har_writer_t writer, const char *page, devtools_json_t method, devtools_json_t params)
+{
+	devtools_json_t request_id;
+	devtools_json_t value;
+	har_entry_t *entry;
+	double time = get_number(params, "timestamp", 0);
+
+	if (devtools_json_get(params, "requestId", &request_id)) {
+		return NULL;
+	}
+	entry = find_entry(writer, page, request_id);
+
+	if (devtools_json_is_string(method, "Network.requestWillBeSent")) {
+		if (entry && !devtools_json_get(params, "redirectResponse", &value)) {
+			/* the same requestId continues with the redirected request */
+			set_response(entry, value, time);
+			entry->end_time = time;
+			write_entry(writer, entry, NULL);
+		} else if (entry) {
+			write_entry(writer, entry, NULL);
+		}
+		entry = new_entry(writer);
+		entry->used = 1;
+		entry->sequence = writer->sequence++;
+		entry->page = strdup(page);
+		entry->request_id = copy_json(request_id);
+		entry->start_time = time;
+		if (!devtools_json_get(params, "walltime", &value) && !devtools_json_number(value, &writer->wall_offset)) {
+			writer->wall_offset -= time;
+			writer->has_wall_offset = 1;
+		}
+		/* only the first request of a redirect chain has a walltime */
+		entry->started = format_time(writer->has_wall_offset ? time + writer->wall_offset : now_seconds());
+		entry->resource_type = copy_member(params, "type");
+		entry->body_id = -1;
+		if (!devtools_json_get(params, "request", &value)) {
+			entry->method = copy_member(value, "method");
+			entry->url = copy_member(value, "url");
+			entry->request_headers = copy_headers(value, "headers");
+			entry->post_data = copy_member(value, "postData");
+		}
+		add_page(writer, page, entry->started);
+		return NULL;
+	}
+	if (!entry) {
+		return NULL;
+	}
+	if (devtools_json_is_string(method, "Network.responseReceived")) {
+		if (!devtools_json_get(params, "response", &value)) {
+			set_response(entry, value, time);
+		}
+		if (!entry->resource_type) {
+			entry->resource_type = copy_member(params, "type");
+		}
+	} else if (devtools_json_is_string(method, "Network.dataReceived")) {
+		entry->data_length += get_number(params, "dataLength", 0);
+		entry->encoded_data_length += get_number(params, "encodedDataLength", 0);
+	} else if (devtools_json_is_string(method, "Network.loadingFinished")) {
+		entry->end_time = time;
+		if (!devtools_json_get(params, "metrics", &value)) {
+			/* WebKit reports the transferred size here rather than per chunk */
+			double body_bytes = get_number(value, "responseBodyBytesReceived", -1);
+			if (body_bytes >= 0) {
+				entry->encoded_data_length = body_bytes;
+			}
+			if (!entry->protocol) {
+				entry->protocol = copy_member(value, "protocol");
+			}
+		}
+		if (writer->include_bodies) {
+			return entry->request_id;
+		}
+		write_entry(writer, entry, NULL);
+	} else if (devtools_json_is_string(method, "Network.loadingFailed")) {
+		entry->end_time = time;
+		entry->error_text = copy_member(params, "errorText");
+		write_entry(writer, entry, NULL);
+	}
+	return NULL;
+}
+
+void har_writer_expect_body(har_writer_t writer, const char *page, const char *request_id, int id)
+{
+	devtools_json_t request_id_json = { request_id, strlen(request_id) };
+	har_entry_t *entry = find_entry(writer, page, request_id_json);
+
+	if (!entry) {
+		return;
+	}
+	if (id < 0) {
+		write_entry(writer, entry, NULL);
+	} else {
+		entry->body_id = id;
+	}
+}
+
+int har_writer_add_body(har_writer_t writer, int id, devtools_json_t reply)
+{
+	devtools_json_t result;
+	int i;
+
+	for (i = 0; i < MAX_ENTRIES; i++) {
+		har_entry_t *entry = &writer->entries[i];
+		if (entry->used && entry->body_id == id) {
+			if (devtools_json_get(reply, "result", &result)) {
+				/* e.g. no body for a redirect or a cached resource */
+				write_entry(writer, entry, NULL);
+			} else {
+				write_entry(writer, entry, &result);
+			}
+			return 0;
+		}
+	}
+	return -1;
+}
+
+void har_writer_free(har_writer_t writer)
+{
+	int i;
+
+	if (!writer) {
+		return;
+	}
+	for (i = 0; i < MAX_ENTRIES; i++) {
+		if (writer->entries[i].used) {
+			write_entry(writer, &writer->entries[i], NULL);
+		}
+	}
+	fprintf(writer->file, "\n],\"pages\":[");
+	for (i = 0; i < writer->page_count; i++) {
+		fprintf(writer->file, "%s\n{\"id\":", i ? "," : "");
+		write_string(writer->file, writer->pages[i]);
+		fprintf(writer->file, ",\"title\":");
+		write_string(writer->file, writer->pages[i]);
+		fprintf(writer->file, ",\"startedDateTime\":\"%s\",\"pageTimings\":{}}", writer->page_started[i]);
+		free(writer->pages[i]);
+		free(writer->page_started[i]);
+	}
+	fprintf(writer->file, "\n]}}\n");
+	fclose(writer->file);
+	free(writer);
+}
@@ -0,0 +1,75 @@
+/*
+ * har_writer.h
+ * Streaming HAR capture from the Network events of the DevTools protocol
+ *
+ * Copyright (c) 2013 Yury Melnichek All Rights Reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef HAR_WRITER_H
+#define HAR_WRITER_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "devtools_json.h"
+
+typedef struct har_writer_private har_writer_private;
+typedef har_writer_private *har_writer_t;
+
+/**
+ * Opens a HAR file for writing. Entries are written as soon as their request
+ * completes, so memory only grows with the requests in flight, of which at
+ * most a few hundred are kept; the oldest are written incomplete beyond that.
+ * The file is only valid JSON once the writer is freed.
+ *
+ * @return the writer, or NULL if the file can't be opened.
+ */
+har_writer_t har_writer_new(const char *path, int include_bodies);
+
+/** Returns whether method is an event of the Network domain. */
+int har_writer_is_network_event(devtools_json_t method);
+
+/**
+ * Adds a Network event that page, an identifier of the inspected page, sent.
+ * Returns the requestId of a request whose response body should be fetched,
+ * as JSON owned by the writer, or NULL. The caller then sends
+ * Network.getResponseBody and calls har_writer_expect_body.
+ */
+const char *har_writer_add_event(har_writer_t writer, const char *page, devtools_json_t method, devtools_json_t params);
+
+/**
+ * Notes that the body of a request whose requestId har_writer_add_event
+ * returned is fetched by the command with the given id, or, if id is
+ * negative, that it won't be.
+ */
+void har_writer_expect_body(har_writer_t writer, const char *page, const char *request_id, int id);
+
+/**
+ * Adds the reply to a Network.getResponseBody command. Returns 0 if the
+ * command was one of the writer's, -1 otherwise.
+ */
+int har_writer_add_body(har_writer_t writer, int id, devtools_json_t reply);
+
+/** Writes the requests in flight and the pages, and closes the file. */
+void har_writer_free(har_writer_t writer);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -25,13 +25,14 @@
 #include <errno.h>
 #include <signal.h>
 #include <time.h>
+#include <pthread.h>
 
 #include <libimobiledevice/libimobiledevice.h>
-#include <libimobiledevice/webinspector.h>
 
 #include "endianness.h"
 #include "common/socket.h"
 #include "common/thread.h"
+#include "webinspector_proxy.h"
 
 #define info(...) fprintf(stdout, __VA_ARGS__); fflush(stdout)
 #define debug(...) if(debug_mode) { fprintf(stdout, __VA_ARGS__); fflush(stdout); }
@@ -39,14 +40,16 @@
 static int debug_mode = 0;
 static int quit_flag = 0;
 
+/* the subscriber to screencast frames, or -1 */
+static int screencast_fd = -1;
+static pthread_mutex_t screencast_mutex = PTHREAD_MUTEX_INITIALIZER;
+
 typedef struct {
 	int server_fd;
 	int client_fd;
 	uint16_t local_port;
-	idevice_t device;
-	webinspector_client_t inspector;
+	webinspector_proxy_t proxy;
 	uint32_t timeout;
-	int format_xml;
 	volatile int stop_ctod;
 	volatile int stop_dtoc;
 } socket_info_t;
@@ -68,6 +71,16 @@ static void print_usage(int argc, char **argv)
 	printf("  -u, --udid UDID\ttarget specific device by its 40-digit device UDID\n");
 	printf("  -h, --help\t\tprints usage information\n");
 	printf("  -t, --timeout MSEC\t\tchange timeout when receiving data\n");
+	printf("  -c, --console-log PATH\tappend console messages to PATH instead of forwarding them\n");
+	printf("  --console-level LEVEL\tonly log console messages of LEVEL (debug, log, info,\n");
+	printf("  \t\t\twarning or error) or higher, default log\n");
+	printf("  --har PATH\t\twrite Network events to a HAR file instead of forwarding them\n");
+	printf("  --har-no-bodies\tleave response bodies out of the HAR file\n");
+	printf("  --cache-methods LIST\tanswer repeated commands of the comma-separated methods in\n");
+	printf("  \t\t\tLIST from a cache, e.g. DOM.getDocument,Page.getResourceTree\n");
+	printf("  --cache-ttl MSEC\tkeep cached results for at most MSEC, default 1000\n");
+	printf("  -s, --screencast PORT\tserve Page.screencastFrame images as binary frames at PORT\n");
+	printf("  --screencast-fps N\tacknowledge at most N screencast frames per second\n");
 	printf("\n");
 }
 
@@ -99,16 +112,95 @@ static int receive_message_timeout(int fd, char *data, size_t message_length, in
 	return message_length;
 }
 
+static int send_length_prefixed(int fd, const char *data, uint32_t length)
+{
+	uint32_t be_length = htobe32(length);
+
+	if (send_message(fd, (char*)&be_length, sizeof(be_length)) <= 0) {
+		return -1;
+	}
+	return (send_message(fd, (char*)data, length) == length ? 0 : -1);
+}
+
+/*
+ * Sends a screencast frame to the subscriber as the big-endian length of its
+ * metadata JSON, the metadata, the big-endian length of the image and the
+ * image.
+ */
+static void send_screencast_frame(const webinspector_proxy_screencast_frame_t *frame, void *user_data)
+{
+	char metadata[512];
+	int metadata_length;
+
+	metadata_length = snprintf(metadata, sizeof(metadata),
+			"{\"sessionId\":%d,\"timestamp\":%.6f,\"deviceWidth\":%g,\"deviceHeight\":%g,"
+			"\"pageScaleFactor\":%g,\"offsetTop\":%g,\"scrollOffsetX\":%g,\"scrollOffsetY\":%g}",
+			frame->session_id, frame->timestamp, frame->device_width, frame->device_height,
+			frame->page_scale_factor, frame->offset_top, frame->scroll_offset_x, frame->scroll_offset_y);
+
+	pthread_mutex_lock(&screencast_mutex);
+	if (screencast_fd >= 0) {
+		if (send_length_prefixed(screencast_fd, metadata, metadata_length) < 0 ||
+				send_length_prefixed(screencast_fd, frame->data, frame->length) < 0) {
+			debug("%s: screencast subscriber went away\n", __func__);
+			socket_close(screencast_fd);
+			screencast_fd = -1;
+		}
+	}
+	pthread_mutex_unlock(&screencast_mutex);
+}
+
+/* Accepts screencast subscribers; a new one replaces the previous one. */
+static void *thread_screencast_server(void *data)
+{
+	uint16_t port = *(uint16_t*)data;
+	int server_fd;
+
+	server_fd = socket_create(port);
+	if (server_fd < 0) {
+		fprintf(stderr, "Could not create screencast socket\n");
+		return NULL;
+	}
+	while (!quit_flag) {
+		int fd = socket_accept(server_fd, port);
+		if (fd < 0) {
+			continue;
+		}
+		debug("%s: new screencast subscriber\n", __func__);
+		pthread_mutex_lock(&screencast_mutex);
+		if (screencast_fd >= 0) {
+			socket_close(screencast_fd);
+		}
+		screencast_fd = fd;
+		pthread_mutex_unlock(&screencast_mutex);
+	}
+	socket_close(server_fd);
+	return NULL;
+}
+
+static int parse_console_level(const char *name, webinspector_proxy_console_level_t *level)
+{
+	static const char *const names[] = { "debug", "log", "info", "warning", "error" };
+	int i;
+
+	for (i = 0; i < 5; i++) {
+		if (!strcmp(name, names[i])) {
+			*level = (webinspector_proxy_console_level_t)i;
+			return 0;
+		}
+	}
+	return -1;
+}
+
 static void *thread_device_to_client(void *data)
 {
 	socket_info_t* socket_info = (socket_info_t*)data;
-	webinspector_error_t res = WEBINSPECTOR_E_UNKNOWN_ERROR;
+	webinspector_proxy_error_t res = WEBINSPECTOR_PROXY_E_UNKNOWN_ERROR;
 
 	uint32_t network_mlen = 0;
 	uint32_t message_length = 0;
 	int sent;
 	char * buf = NULL;
-	plist_t message = NULL;
 
 	debug("%s: started thread...\n", __func__);
 
@@ -118,24 +210,18 @@ static void *thread_device_to_client(void *data)
 	while (!quit_flag && !socket_info->stop_dtoc && socket_info->client_fd > 0 && socket_info->server_fd > 0) {
 		debug("%s: receiving data from device...\n", __func__);
 
-		res = webinspector_receive_with_timeout(socket_info->inspector, &message, socket_info->timeout);
-		if (res != WEBINSPECTOR_E_SUCCESS) {
-			fprintf(stderr, "webinspector_receive_with_timeout failed: %d\n", res);
+		res = webinspector_proxy_receive(socket_info->proxy, &buf, &message_length, socket_info->timeout);
+		if (res == WEBINSPECTOR_PROXY_E_RECEIVE_TIMEOUT) {
+			debug("%s: nothing received from device\n", __func__);
 			continue;
-		}
-		if (socket_info->format_xml) {
-			plist_to_xml(message, &buf, &message_length);
-		} else {
-			plist_to_bin(message, &buf, &message_length);
-		}
-		if (!buf || message_length == 0) {
-			fprintf(stderr, "Error converting plist to binary.\n");
+		} else if (res == WEBINSPECTOR_PROXY_E_DEVICE_LOST) {
+			/* the client got the device lost frame, so close it and quit */
+			fprintf(stderr, "Device lost, exiting.\n");
+			quit_flag++;
+			break;
+		} else if (res != WEBINSPECTOR_PROXY_E_SUCCESS) {
+			fprintf(stderr, "webinspector_proxy_receive failed: %d\n", res);
 			break;
-		}
-
-		if (message) {
-			plist_free(message);
-			message = NULL;
 		}
 
 		/* send message length to client */
@@ -160,12 +246,12 @@ static void *thread_device_to_client(void *data)
 			}
 		}
 
-		if (buf) {
-			free(buf);
-			buf = NULL;
-		}
+		free(buf);
+		buf = NULL;
 	}
 
+	free(buf);
+
 	debug("%s: shutting down...\n", __func__);
 
 	socket_shutdown(socket_info->client_fd, SHUT_RDWR);
@@ -180,11 +266,10 @@ static void *thread_device_to_client(void *data)
 static void *thread_client_to_device(void *data)
 {
 	socket_info_t* socket_info = (socket_info_t*)data;
-	webinspector_error_t res = WEBINSPECTOR_E_UNKNOWN_ERROR;
+	webinspector_proxy_error_t res = WEBINSPECTOR_PROXY_E_UNKNOWN_ERROR;
 
 	int recv_len;
 	char buffer[131072];
-	plist_t message = NULL;
 	uint32_t network_mlen = 0;
 	uint32_t message_length = 0;
 	thread_t dtoc = 0;
@@ -216,24 +301,24 @@ static void *thread_client_to_device(void *data)
 			break;
 		}
 
-		/* convert buffer to a message */
-		if ((message_length > 8) && !memcmp(buffer, "bplist00", 8)) {
-			plist_from_bin(buffer, message_length, &message);
-		} else if ((message_length > 5) && !memcmp(buffer, "<?xml", 5)) {
-			plist_from_xml(buffer, message_length, &message);
-		} else {
+		/* forward data to device, connecting to the inspector on first use */
+		debug("%s: sending data to device...\n", __func__);
+
+		res = webinspector_proxy_send(socket_info->proxy, buffer, message_length);
+		if (res == WEBINSPECTOR_PROXY_E_PLIST_ERROR) {
 			fprintf(stderr, "Invalid input %u: %*s\n", message_length, message_length, buffer);
 			break;
+		} else if (res == WEBINSPECTOR_PROXY_E_CONNECT_FAILED) {
+			fprintf(stderr, "Could not connect to the webinspector!\n");
+			break;
+		} else if (res != WEBINSPECTOR_PROXY_E_SUCCESS) {
+			fprintf(stderr, "send failed: %d\n", res);
+			break;
 		}
 
-		if (!socket_info->inspector) {
-			debug("%s: connecting to inspector...\n", __func__);
-			webinspector_error_t error = webinspector_client_start_service(socket_info->device, &socket_info->inspector, "idevicewebinspectorproxy");
-			if (error != WEBINSPECTOR_E_SUCCESS) {
-				fprintf(stderr, "Could not connect to the webinspector! Error: %i\n", error);
-				break;
-			}
-		}
+		// sending succeeded, receive from device
+		debug("%s: sent %d bytes to device\n", __func__, message_length);
+
 		if (!dtoc) {
 			debug("%s: Starting device-to-client thread...\n", __func__);
 			if (thread_new(&dtoc, thread_device_to_client, data) != 0) {
@@ -241,18 +326,6 @@ static void *thread_client_to_device(void *data)
 				break;
 			}
 		}
-
-		/* forward data to device */
-		debug("%s: sending data to device...\n", __func__);
-
-		res = webinspector_send(socket_info->inspector, message);
-		if (res != WEBINSPECTOR_E_SUCCESS) {
-			fprintf(stderr, "send failed: %s\n", strerror(errno));
-			break;
-		}
-
-		// sending succeeded, receive from device
-		debug("%s: sent %d bytes to device\n", __func__, message_length);
 	}
 
 	debug("%s: shutting down...\n", __func__);
@@ -303,18 +376,25 @@ static void* connection_handler(void* data)
 
 int main(int argc, char **argv)
 {
-	idevice_error_t ret = IDEVICE_E_UNKNOWN_ERROR;
+	webinspector_proxy_error_t ret = WEBINSPECTOR_PROXY_E_UNKNOWN_ERROR;
 	thread_t th;
 	const char* udid = NULL;
 	int result = EXIT_SUCCESS;
+	int format_xml = 0;
+	const char *console_log = NULL;
+	webinspector_proxy_console_level_t console_level = WEBINSPECTOR_PROXY_CONSOLE_LOG;
+	const char *har_log = NULL;
+	int har_bodies = 1;
+	const char *cache_methods = NULL;
+	uint32_t cache_ttl_ms = 1000;
+	uint16_t screencast_port = 0;
+	uint32_t screencast_fps = 0;
 	int i;
 	socket_info_t socket_info;
 
-	socket_info.device = NULL;
-	socket_info.inspector = NULL;
+	socket_info.proxy = NULL;
 	socket_info.local_port = 0;
 	socket_info.timeout = 1000;
-	socket_info.format_xml = 0;
 	socket_info.stop_ctod = 0;
 	socket_info.stop_dtoc = 0;
 
@@ -367,8 +447,74 @@ int main(int argc, char **argv)
 			socket_info.timeout = atoi(argv[i]);
 			continue;
 		}
+		else if (!strcmp(argv[i], "-c") || !strcmp(argv[i], "--console-log")) {
+			i++;
+			if (!argv[i]) {
+				print_usage(argc, argv);
+				return 0;
+			}
+			console_log = argv[i];
+			continue;
+		}
+		else if (!strcmp(argv[i], "--console-level")) {
+			i++;
+			if (!argv[i] || parse_console_level(argv[i], &console_level)) {
+				print_usage(argc, argv);
+				return 0;
+			}
+			continue;
+		}
+		else if (!strcmp(argv[i], "--har")) {
+			i++;
+			if (!argv[i]) {
+				print_usage(argc, argv);
+				return 0;
+			}
+			har_log = argv[i];
+			continue;
+		}
+		else if (!strcmp(argv[i], "--har-no-bodies")) {
+			har_bodies = 0;
+			continue;
+		}
+		else if (!strcmp(argv[i], "--cache-methods")) {
+			i++;
+			if (!argv[i]) {
+				print_usage(argc, argv);
+				return 0;
+			}
+			cache_methods = argv[i];
+			continue;
+		}
+		else if (!strcmp(argv[i], "--cache-ttl")) {
+			i++;
+			if (!argv[i] || (atoi(argv[i]) <= 0)) {
+				print_usage(argc, argv);
+				return 0;
+			}
+			cache_ttl_ms = atoi(argv[i]);
+			continue;
+		}
+		else if (!strcmp(argv[i], "-s") || !strcmp(argv[i], "--screencast")) {
+			i++;
+			if (!argv[i] || (atoi(argv[i]) <= 0)) {
+				print_usage(argc, argv);
+				return 0;
+			}
+			screencast_port = atoi(argv[i]);
+			continue;
+		}
+		else if (!strcmp(argv[i], "--screencast-fps")) {
+			i++;
+			if (!argv[i] || (atoi(argv[i]) <= 0)) {
+				print_usage(argc, argv);
+				return 0;
+			}
+			screencast_fps = atoi(argv[i]);
+			continue;
+		}
 		else if (!strcmp(argv[i], "-x") || !strcmp(argv[i], "--xml")) {
-			socket_info.format_xml = 1;
+			format_xml = 1;
 		}
 		else if (!strcmp(argv[i], "-h") || !strcmp(argv[i], "--help")) {
 			print_usage(argc, argv);
@@ -391,9 +537,9 @@ int main(int argc, char **argv)
 		goto leave_cleanup;
 	}
 
-	/* start services and connect to device */
-	ret = idevice_new(&socket_info.device, udid);
-	if (ret != IDEVICE_E_SUCCESS) {
+	/* connect to device; the inspector service is started on first use */
+	ret = webinspector_proxy_new(udid, &socket_info.proxy);
+	if (ret != WEBINSPECTOR_PROXY_E_SUCCESS) {
 		if (udid) {
 			fprintf(stderr, "No device found with udid %s, is it plugged in?\n", udid);
 		} else {
@@ -402,6 +548,32 @@ int main(int argc, char **argv)
 		result = EXIT_FAILURE;
 		goto leave_cleanup;
 	}
+	webinspector_proxy_set_xml_output(socket_info.proxy, format_xml);
+	webinspector_proxy_set_debug(socket_info.proxy, debug_mode);
+	if (console_log && webinspector_proxy_set_console_log(socket_info.proxy, console_log, console_level) != WEBINSPECTOR_PROXY_E_SUCCESS) {
+		fprintf(stderr, "Could not open console log %s\n", console_log);
+		result = EXIT_FAILURE;
+		goto leave_cleanup;
+	}
+	if (har_log && webinspector_proxy_set_har_log(socket_info.proxy, har_log, har_bodies) != WEBINSPECTOR_PROXY_E_SUCCESS) {
+		fprintf(stderr, "Could not create HAR file %s\n", har_log);
+		result = EXIT_FAILURE;
+		goto leave_cleanup;
+	}
+	if (cache_methods && webinspector_proxy_set_response_cache(socket_info.proxy, cache_methods, cache_ttl_ms) != WEBINSPECTOR_PROXY_E_SUCCESS) {
+		fprintf(stderr, "Invalid methods to cache: %s\n", cache_methods);
+		result = EXIT_FAILURE;
+		goto leave_cleanup;
+	}
+	if (screencast_port) {
+		thread_t screencast_thread;
+		webinspector_proxy_set_screencast_callback(socket_info.proxy, send_screencast_frame, NULL, screencast_fps);
+		if (thread_new(&screencast_thread, thread_screencast_server, &screencast_port) != 0) {
+			fprintf(stderr, "Could not start screencast server.\n");
+			result = EXIT_FAILURE;
+			goto leave_cleanup;
+		}
+	}
 
 	/* create local socket */
 	socket_info.server_fd = socket_create(socket_info.local_port);
@@ -433,11 +605,8 @@ int main(int argc, char **argv)
 	debug("%s: Shutting down webinspector proxy...\n", __func__);
 
 leave_cleanup:
-	if (socket_info.inspector) {
-		webinspector_client_free(socket_info.inspector);
-	}
-	if (socket_info.device) {
-		idevice_free(socket_info.device);
+	if (socket_info.proxy) {
+		webinspector_proxy_free(socket_info.proxy);
 	}
 
 	return result;
@@ -0,0 +1,356 @@
+/*
+ * response_cache.c
+ * Cache of the replies to idempotent DevTools commands, per page
+ *
+ * Copyright (c) 2013 Yury Melnichek All Rights Reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "response_cache.h"
+
+/* results that are cached and commands whose reply is awaited */
+#define MAX_ENTRIES 64
+#define MAX_PENDING 64
+/* results whose JSON is longer are not cached */
+#define MAX_RESULT_LENGTH (4 * 1024 * 1024)
+
+/* A cached result; the strings are JSON from the command and its reply. */
+typedef struct {
+	int used;
+	char *page;
+	char *method;
+	char *params;
+	char *result;
+	uint64_t expires_ms;
+} cache_entry_t;
+
+/* A command of a cached method that was sent to the device. */
+typedef struct {
+	int used;
+	unsigned long long sequence;
+	char *page;
+	double id;
+	char *method;
+	char *params;
+	/* the page changed after the command was sent, so the result may be old */
+	int stale;
+} pending_command_t;
+
+struct response_cache_private {
+	char **methods;
+	int method_count;
+	uint32_t ttl_ms;
+	unsigned long long sequence;
+	cache_entry_t entries[MAX_ENTRIES];
+	pending_command_t pending[MAX_PENDING];
+};
+
+/* Events after which the results of earlier commands may be different. */
+static const char *const change_events[] = {
+	"DOM.documentUpdated",
+	"DOM.childNodeInserted",
+	"DOM.childNodeRemoved",
+	"DOM.childNodeCountUpdated",
+	"DOM.attributeModified",
+	"DOM.attributeRemoved",
+	"DOM.characterDataModified",
+	"DOM.pseudoElementAdded",
+	"DOM.pseudoElementRemoved",
+	"Page.domContentEventFired",
+	"Page.loadEventFired",
+	"Page.frameNavigated",
+	"Page.frameDetached",
+	"Runtime.executionContextCreated",
+	"Runtime.executionContextsCleared",
+};
+
+static char *copy_json(devtools_json_t value)
+{
+	char *s = malloc(value.length + 1);
+
+	if (s) {
+		memcpy(s, value.start, value.length);
+		s[value.length] = '\0';
+	}
+	return s;
+}
+
+static int json_equals(devtools_json_t value, const char *json)
+{
+	return (strlen(json) == value.length && !memcmp(json, value.start, value.length));
+}
+
+static int is_cached_method(response_cache_t cache, devtools_json_t method)
+{
+	int i;
+
+	for (i = 0; i < cache->method_count; i++) {
+		if (devtools_json_is_string(method, cache->methods[i])) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+static void free_entry(cache_entry_t *entry)
+{
+	free(entry->page);
+	free(entry->method);
+	free(entry->params);
+	free(entry->result);
+	memset(entry, 0, sizeof(*entry));
+}
+
+static void free_pending(pending_command_t *pending)
+{
+	free(pending->page);
+	free(pending->method);
+	free(pending->params);
+	memset(pending, 0, sizeof(*pending));
+}
+
+/* Drops the results cached for page and marks the results it awaits as stale. */
+static void invalidate_page(response_cache_t cache, const char *page)
+{
+	int i;
+
+	for (i = 0; i < MAX_ENTRIES; i++) {
+		if (cache->entries[i].used && !strcmp(cache->entries[i].page, page)) {
+			free_entry(&cache->entries[i]);
+		}
+	}
+	for (i = 0; i < MAX_PENDING; i++) {
+		if (cache->pending[i].used && !strcmp(cache->pending[i].page, page)) {
+			cache->pending[i].stale = 1;
+		}
+	}
+}
+
+static cache_entry_t *find_entry(response_cache_t cache, const char *page, devtools_json_t method, devtools_json_t params)
+{
+	int i;
+
+	for (i = 0; i < MAX_ENTRIES; i++) {
+		cache_entry_t *entry = &cache->entries[i];
+		if (entry->used && json_equals(method, entry->method) && json_equals(params, entry->params) &&
+				!strcmp(entry->page, page)) {
+			return entry;
+		}
+	}
+	return NULL;
+}
+
+/* Returns a free entry, dropping the one that expires first if there is none. */
+static cache_entry_t *new_entry(response_cache_t cache)
+{
+	cache_entry_t *oldest = NULL;
+	int i;
+
+	for (i = 0; i < MAX_ENTRIES; i++) {
+		cache_entry_t *entry = &cache->entries[i];
+		if (!entry->used) {
+			return entry;
+		}
+		if (!oldest || entry->expires_ms < oldest->expires_ms) {
+			oldest = entry;
+		}
+	}
+	free_entry(oldest);
+	return oldest;
+}
+
+/* Returns a free pending command, dropping the oldest if there is none. */
+static pending_command_t *new_pending(response_cache_t cache)
+{
+	pending_command_t *oldest = NULL;
+	int i;
+
+	for (i = 0; i < MAX_PENDING; i++) {
+		pending_command_t *pending = &cache->pending[i];
+		if (!pending->used) {
+			return pending;
+		}
+		if (!oldest || pending->sequence < oldest->sequence) {
+			oldest = pending;
+		}
+	}
+	free_pending(oldest);
+	return oldest;
+}
+
+response_cache_t response_cache_new(const char *methods, uint32_t ttl_ms)
+{
+	response_cache_t cache;
+	const char *p;
+	const char *end;
+
+	if (!methods || !*methods || ttl_ms == 0) {
+		return NULL;
+	}
+	cache = calloc(1, sizeof(response_cache_private));
+	if (!cache) {
+		return NULL;
+	}
+	cache->ttl_ms = ttl_ms;
+	cache->methods = calloc(strlen(methods) / 2 + 1, sizeof(char *));
+	for (p = methods; cache->methods && *p; p = (*end ? end + 1 : end)) {
+		end = strchr(p, ',');
+		if (!end) {
+			end = p + strlen(p);
+		}
+		while (p < end && *p == ' ') {
+			p++;
+		}
+		if (end > p) {
+			cache->methods[cache->method_count++] = strndup(p, end - p);
+		}
+	}
+	if (cache->method_count == 0) {
+		response_cache_free(cache);
+		return NULL;
+	}
+	return cache;
+}
+
+char *response_cache_lookup(response_cache_t cache, const char *page, devtools_json_t command, uint64_t now_ms, size_t *length)
+{
+	devtools_json_t id;
+	devtools_json_t method;
+	devtools_json_t params = { "", 0 };
+	cache_entry_t *entry;
+	pending_command_t *pending;
+	double id_number;
+	char *reply;
+	int n;
+
+	if (devtools_json_get(command, "id", &id) || devtools_json_number(id, &id_number) ||
+			devtools_json_get(command, "method", &method)) {
+		return NULL;
+	}
+	if (!is_cached_method(cache, method)) {
+		invalidate_page(cache, page);
+		return NULL;
+	}
+	devtools_json_get(command, "params", &params);
+
+	entry = find_entry(cache, page, method, params);
+	if (entry && now_ms < entry->expires_ms) {
+		size_t capacity = sizeof("{\"id\":,\"result\":}") + id.length + strlen(entry->result);
+		reply = malloc(capacity);
+		n = (reply ? snprintf(reply, capacity, "{\"id\":%.*s,\"result\":%s}", (int)id.length, id.start, entry->result) : -1);
+		if (n < 0) {
+			free(reply);
+			return NULL;
+		}
+		*length = n;
+		return reply;
+	}
+	if (entry) {
+		free_entry(entry);
+	}
+
+	pending = new_pending(cache);
+	pending->used = 1;
+	pending->sequence = cache->sequence++;
+	pending->page = strdup(page);
+	pending->id = id_number;
+	pending->method = copy_json(method);
+	pending->params = copy_json(params);
+	if (!pending->page || !pending->method || !pending->params) {
+		free_pending(pending);
+	}
+	return NULL;
+}
+
+void response_cache_add_reply(response_cache_t cache, const char *page, devtools_json_t reply, uint64_t now_ms)
+{
+	devtools_json_t value;
+	devtools_json_t result;
+	double id;
+	int i;
+
+	if (devtools_json_get(reply, "id", &value) || devtools_json_number(value, &id)) {
+		return;
+	}
+	for (i = 0; i < MAX_PENDING; i++) {
+		pending_command_t *pending = &cache->pending[i];
+		if (!pending->used || pending->id != id || strcmp(pending->page, page)) {
+			continue;
+		}
+		/* errors and exceptions thrown by Runtime.evaluate may not happen again */
+		if (!pending->stale && !devtools_json_get(reply, "result", &result) && result.length <= MAX_RESULT_LENGTH &&
+				(devtools_json_get(result, "wasThrown", &value) || !json_equals(value, "true"))) {
+			devtools_json_t method = { pending->method, strlen(pending->method) };
+			devtools_json_t params = { pending->params, strlen(pending->params) };
+			cache_entry_t *entry = find_entry(cache, page, method, params);
+			if (entry) {
+				free_entry(entry);
+			} else {
+				entry = new_entry(cache);
+			}
+			entry->used = 1;
+			entry->page = pending->page;
+			entry->method = pending->method;
+			entry->params = pending->params;
+			entry->result = copy_json(result);
+			entry->expires_ms = now_ms + cache->ttl_ms;
+			pending->page = NULL;
+			pending->method = NULL;
+			pending->params = NULL;
+			if (!entry->result) {
+				free_entry(entry);
+			}
+		}
+		free_pending(pending);
+		return;
+	}
+}
+
+void response_cache_add_event(response_cache_t cache, const char *page, devtools_json_t method)
+{
+	size_t i;
+
+	for (i = 0; i < sizeof(change_events) / sizeof(change_events[0]); i++) {
+		if (devtools_json_is_string(method, change_events[i])) {
+			invalidate_page(cache, page);
+			return;
+		}
+	}
+}
+
+void response_cache_free(response_cache_t cache)
+{
+	int i;
+
+	if (!cache) {
+		return;
+	}
+	for (i = 0; i < MAX_ENTRIES; i++) {
+		free_entry(&cache->entries[i]);
+	}
+	for (i = 0; i < MAX_PENDING; i++) {
+		free_pending(&cache->pending[i]);
+	}
+	for (i = 0; i < cache->method_count; i++) {
+		free(cache->methods[i]);
+	}
+	free(cache->methods);
+	free(cache);
+}
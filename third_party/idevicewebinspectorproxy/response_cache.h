@@ -0,0 +1,71 @@
+/*
+ * response_cache.h
+ * Cache of the replies to idempotent DevTools commands, per page
+ *
+ * Copyright (c) 2013 Yury Melnichek All Rights Reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef RESPONSE_CACHE_H
+#define RESPONSE_CACHE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+#include "devtools_json.h"
+
+typedef struct response_cache_private response_cache_private;
+typedef response_cache_private *response_cache_t;
+
+/**
+ * Creates a cache for the results of the commands whose method is in methods,
+ * a comma-separated list such as "DOM.getDocument,Page.getResourceTree".
+ * Results are kept for at most ttl_ms, and dropped sooner when the page
+ * reports a change of its document, frames or execution contexts. At most a
+ * few dozen results are kept; the oldest are dropped beyond that.
+ *
+ * @return the cache, or NULL if methods is empty or ttl_ms is 0.
+ */
+response_cache_t response_cache_new(const char *methods, uint32_t ttl_ms);
+
+/**
+ * Looks up a command that the client sent to page, an identifier of the
+ * client's connection to the inspected page. If the result of an equal
+ * command (same method and params) is cached, returns the reply to this
+ * command, with its id, as JSON in a buffer the caller frees, and sets
+ * *length to its length. Otherwise returns NULL; the command is then sent to
+ * the device, and if its method is cached, its reply is expected through
+ * response_cache_add_reply. Any other command may change the page, so it
+ * drops the results cached for it.
+ */
+char *response_cache_lookup(response_cache_t cache, const char *page, devtools_json_t command, uint64_t now_ms, size_t *length);
+
+/** Caches the result of a reply to page if it answers a command that is expected. */
+void response_cache_add_reply(response_cache_t cache, const char *page, devtools_json_t reply, uint64_t now_ms);
+
+/** Drops the results cached for page if the event method reports a change. */
+void response_cache_add_event(response_cache_t cache, const char *page, devtools_json_t method);
+
+void response_cache_free(response_cache_t cache);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
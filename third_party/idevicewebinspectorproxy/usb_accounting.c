@@ -0,0 +1,220 @@
+/*
+ * usb_accounting.c
+ * Report bytes exchanged with devices to the host
+ *
+ * Copyright (c) 2013 Yury Melnichek All Rights Reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+
+#include "usb_accounting.h"
+
+/* devices times services that are counted between sends */
+#define MAX_COUNTERS 32
+#define FLUSH_INTERVAL_MS 1000
+/* fits in one datagram on the loopback interface of any host */
+#define MAX_DATAGRAM 8192
+
+typedef struct {
+	char udid[64];
+	const char *service; /* a constant, like the names of lockdown services */
+	uint64_t bytes_in;
+	uint64_t bytes_out;
+} counter_t;
+
+static pthread_once_t once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+/* signalled when counts are added while there were none */
+static pthread_cond_t pending = PTHREAD_COND_INITIALIZER;
+static int fd = -1;
+static struct sockaddr_in address;
+static counter_t counters[MAX_COUNTERS];
+static size_t counter_count;
+static uint64_t last_flush_ms;
+
+static uint64_t now_ms(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void *flush_thread(void *arg);
+
+static void init(void)
+{
+	const char *env = getenv(USB_ACCOUNTING_PORT_ENV);
+	long port = env ? strtol(env, NULL, 10) : USB_ACCOUNTING_DEFAULT_PORT;
+	if (port <= 0 || port > 65535) {
+		return;
+	}
+	fd = socket(AF_INET, SOCK_DGRAM, 0);
+	if (fd < 0) {
+		return;
+	}
+	/*
+	 * reports must never hold up the tool, so they are dropped when the
+	 * socket buffer is full or nothing listens
+	 */
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+	fcntl(fd, F_SETFD, FD_CLOEXEC);
+	memset(&address, 0, sizeof(address));
+	address.sin_family = AF_INET;
+	address.sin_port = htons((uint16_t)port);
+	address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	last_flush_ms = now_ms();
+	atexit(usb_accounting_flush);
+
+	pthread_t thread;
+	pthread_attr_t attr;
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	pthread_create(&thread, &attr, flush_thread, NULL);
+	pthread_attr_destroy(&attr);
+}
+
+/* sends the counters and zeroes them; the mutex must be held */
+static void flush_locked(void)
+{
+	char datagram[MAX_DATAGRAM];
+	size_t header_len = strlen(USB_ACCOUNTING_HEADER);
+	size_t len = header_len;
+	memcpy(datagram, USB_ACCOUNTING_HEADER, header_len);
+	for (size_t i = 0; i < counter_count; i++) {
+		counter_t *counter = &counters[i];
+		char line[256];
+		int n = snprintf(line, sizeof(line), "%s\t%s\t%" PRIu64 "\t%" PRIu64
+				"\n", counter->udid, counter->service, counter->bytes_in,
+				counter->bytes_out);
+		if (n <= 0 || (size_t)n >= sizeof(line)) {
+			continue;
+		}
+		if (len + n > sizeof(datagram)) {
+			sendto(fd, datagram, len, 0, (struct sockaddr *)&address,
+					sizeof(address));
+			len = header_len;
+		}
+		memcpy(datagram + len, line, n);
+		len += n;
+	}
+	if (len > header_len) {
+		sendto(fd, datagram, len, 0, (struct sockaddr *)&address,
+				sizeof(address));
+	}
+	counter_count = 0;
+	last_flush_ms = now_ms();
+}
+
+/* waits until the counts are due and sends them; the mutex must be held */
+static void flush_later_locked(void)
+{
+	struct timespec deadline;
+	uint64_t due_ms = last_flush_ms + FLUSH_INTERVAL_MS;
+	uint64_t now = now_ms();
+	if (due_ms > now) {
+		/* the condition variable waits on the realtime clock */
+		clock_gettime(CLOCK_REALTIME, &deadline);
+		uint64_t wait_ms = due_ms - now;
+		deadline.tv_sec += wait_ms / 1000;
+		deadline.tv_nsec += (long)(wait_ms % 1000) * 1000000;
+		if (deadline.tv_nsec >= 1000000000) {
+			deadline.tv_sec++;
+			deadline.tv_nsec -= 1000000000;
+		}
+		pthread_cond_timedwait(&pending, &mutex, &deadline);
+		if (now_ms() < last_flush_ms + FLUSH_INTERVAL_MS) {
+			/* woken early, or another thread just flushed */
+			return;
+		}
+	}
+	if (counter_count > 0) {
+		flush_locked();
+	}
+}
+
+/*
+ * Sends counts that were added but not followed by more within a second,
+ * so that a process that goes idle, like the JVM holding the library,
+ * still reports its last counts.
+ */
+static void *flush_thread(void *arg)
+{
+	pthread_mutex_lock(&mutex);
+	while (1) {
+		while (counter_count == 0) {
+			pthread_cond_wait(&pending, &mutex);
+		}
+		flush_later_locked();
+	}
+	return NULL;
+}
+
+void usb_accounting_add(const char *udid, const char *service,
+		uint64_t bytes_in, uint64_t bytes_out)
+{
+	pthread_once(&once, init);
+	if (fd < 0 || !udid || !service || (!bytes_in && !bytes_out)) {
+		return;
+	}
+	pthread_mutex_lock(&mutex);
+	counter_t *counter = NULL;
+	for (size_t i = 0; i < counter_count && !counter; i++) {
+		if (!strcmp(counters[i].service, service) &&
+				!strcmp(counters[i].udid, udid)) {
+			counter = &counters[i];
+		}
+	}
+	if (!counter) {
+		if (counter_count == MAX_COUNTERS) {
+			flush_locked();
+		}
+		if (counter_count == 0) {
+			pthread_cond_signal(&pending);
+		}
+		counter = &counters[counter_count++];
+		snprintf(counter->udid, sizeof(counter->udid), "%s", udid);
+		counter->service = service;
+		counter->bytes_in = 0;
+		counter->bytes_out = 0;
+	}
+	counter->bytes_in += bytes_in;
+	counter->bytes_out += bytes_out;
+	if (now_ms() - last_flush_ms >= FLUSH_INTERVAL_MS) {
+		flush_locked();
+	}
+	pthread_mutex_unlock(&mutex);
+}
+
+void usb_accounting_flush(void)
+{
+	pthread_once(&once, init);
+	if (fd < 0) {
+		return;
+	}
+	pthread_mutex_lock(&mutex);
+	flush_locked();
+	pthread_mutex_unlock(&mutex);
+}
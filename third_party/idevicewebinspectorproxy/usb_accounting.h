@@ -0,0 +1,58 @@
+/*
+ * usb_accounting.h
+ * Report bytes exchanged with devices to the host
+ *
+ * Copyright (c) 2013 Yury Melnichek All Rights Reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef USB_ACCOUNTING_H
+#define USB_ACCOUNTING_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+/**
+ * Bytes are reported in UDP datagrams to this port on the loopback
+ * interface, where com.google.iosdevicecontrol.usb.UsbAccountingService
+ * adds them up for the whole host. Each datagram is USB_ACCOUNTING_HEADER
+ * followed by "<udid>\t<service>\t<bytes in>\t<bytes out>\n" lines, the
+ * bytes since the previous datagram. The port is read from the environment
+ * variable USB_ACCOUNTING_PORT_ENV if it is set; 0 turns reporting off.
+ */
+#define USB_ACCOUNTING_DEFAULT_PORT 27760
+#define USB_ACCOUNTING_PORT_ENV "IOS_USB_ACCOUNTING_PORT"
+#define USB_ACCOUNTING_HEADER "usb-accounting 1\n"
+
+/**
+ * Adds bytes received from (in) and sent to (out) the service of the device
+ * with the given UDID. Counts are batched and sent about once a second,
+ * also when nothing more is added, and at exit; sends never block, and are
+ * dropped if nothing listens. Thread-safe.
+ */
+void usb_accounting_add(const char *udid, const char *service, uint64_t bytes_in, uint64_t bytes_out);
+
+/** Sends the counts added since the last send, for example before idling. */
+void usb_accounting_flush(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
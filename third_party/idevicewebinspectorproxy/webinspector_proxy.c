@@ -0,0 +1,1282 @@
+/*
+ * webinspector_proxy.c
+ * Embeddable device side of idevicewebinspectorproxy
+ *
+ * Copyright (c) 2013 Yury Melnichek All Rights Reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#include <libimobiledevice/libimobiledevice.h>
+#include <libimobiledevice/webinspector.h>
+
+#include "devtools_json.h"
+#include "har_writer.h"
+#include "response_cache.h"
+#include "usb_accounting.h"
+#include "webinspector_proxy.h"
+
+/* receives wait in slices of at most this long to notice a lost device */
+#define LOST_POLL_MS 250
+/* how often a device that isn't watched by events is checked for */
+#define PROBE_INTERVAL_MS 1000
+/* ids of the commands the proxy sends itself, whose replies it drops */
+#define INTERNAL_ID_BASE 1000000000
+/* pages the proxy remembers how to send its own commands to */
+#define MAX_PAGE_TARGETS 16
+/* replies from the response cache that wait for a receive */
+#define MAX_CACHED_REPLIES 16
+/* how long a receive waits on the device before it checks for cached replies */
+#define CACHE_POLL_MS 10
+/* the length prefix of each message of the service */
+#define FRAME_PREFIX_BYTES 4
+/* roughly what the plist around the DevTools JSON of a message adds */
+#define ENVELOPE_BYTES 256
+
+#define debug(proxy, ...) if ((proxy)->debug) { fprintf(stdout, __VA_ARGS__); fflush(stdout); }
+
+struct webinspector_proxy_private {
+	idevice_t device;
+	char *udid;
+	webinspector_client_t inspector;
+	int format_xml;
+	int debug;
+
+	/* removal watch, guarded by watch_mutex */
+	webinspector_proxy_t next_watched;
+	int watched_by_event;
+	int lost;
+	int lost_reported;
+	uint64_t next_probe_ms;
+
+	/* a frame that did not fit the buffer given to receive_into */
+	char *pending;
+	uint32_t pending_length;
+
+	/* the client's sends and our own may come from different threads */
+	pthread_mutex_t send_mutex;
+
+	/* screencast frames; the callback, its settings and the target are
+	 * guarded by mutex, the acknowledgement only used by the receiving thread */
+	webinspector_proxy_screencast_cb_t screencast_cb;
+	void *screencast_user_data;
+	uint32_t screencast_interval_ms;
+	plist_t screencast_target;
+	int ack_pending;
+	int ack_session_id;
+	uint64_t ack_due_ms;
+
+	/* console events, guarded by mutex */
+	FILE *console_log;
+	webinspector_proxy_console_level_t console_min_level;
+
+	/* HAR capture, guarded by mutex */
+	har_writer_t har;
+
+	/* _rpc_forwardSocketData: arguments by WIRSenderKey, guarded by mutex */
+	char *page_target_senders[MAX_PAGE_TARGETS];
+	plist_t page_targets[MAX_PAGE_TARGETS];
+	int next_page_target;
+
+	/* cached replies to the client's commands, guarded by mutex */
+	response_cache_t cache;
+	plist_t cached_replies[MAX_CACHED_REPLIES];
+	int cached_reply_start;
+	int cached_reply_count;
+
+	/* commands sent by the proxy itself, only used by the receiving thread */
+	int next_internal_id;
+	int internal_pending;
+
+	/* close waits until no thread is inside send or receive */
+	pthread_mutex_t mutex;
+	pthread_cond_t idle;
+	int closed;
+	int users;
+};
+
+/*
+ * libimobiledevice allows one device event subscriber per process, so all
+ * proxies share one subscription. subscribe_mutex serializes subscribing and
+ * unsubscribing, which waits for the event thread and so must not be done
+ * under watch_mutex, which the event callback takes.
+ */
+static pthread_mutex_t subscribe_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t watch_mutex = PTHREAD_MUTEX_INITIALIZER;
+static webinspector_proxy_t watched_proxies = NULL;
+static int subscribed = 0;
+
+static uint64_t now_ms(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void on_device_event(const idevice_event_t *event, void *user_data)
+{
+	webinspector_proxy_t proxy;
+
+	if (event->event != IDEVICE_DEVICE_REMOVE || !event->udid) {
+		return;
+	}
+	pthread_mutex_lock(&watch_mutex);
+	for (proxy = watched_proxies; proxy; proxy = proxy->next_watched) {
+		if (!strcmp(proxy->udid, event->udid)) {
+			debug(proxy, "%s: device %s removed\n", __func__, event->udid);
+			proxy->lost = 1;
+		}
+	}
+	pthread_mutex_unlock(&watch_mutex);
+}
+
+static void watch_device(webinspector_proxy_t proxy)
+{
+	pthread_mutex_lock(&subscribe_mutex);
+	if (!subscribed) {
+		subscribed = (idevice_event_subscribe(on_device_event, NULL) == IDEVICE_E_SUCCESS);
+	}
+	pthread_mutex_lock(&watch_mutex);
+	proxy->watched_by_event = subscribed;
+	proxy->next_watched = watched_proxies;
+	watched_proxies = proxy;
+	pthread_mutex_unlock(&watch_mutex);
+	pthread_mutex_unlock(&subscribe_mutex);
+}
+
+static void unwatch_device(webinspector_proxy_t proxy)
+{
+	webinspector_proxy_t *p;
+	int unsubscribe;
+
+	pthread_mutex_lock(&subscribe_mutex);
+	pthread_mutex_lock(&watch_mutex);
+	for (p = &watched_proxies; *p; p = &(*p)->next_watched) {
+		if (*p == proxy) {
+			*p = proxy->next_watched;
+			break;
+		}
+	}
+	unsubscribe = (subscribed && !watched_proxies);
+	pthread_mutex_unlock(&watch_mutex);
+	if (unsubscribe) {
+		idevice_event_unsubscribe();
+		subscribed = 0;
+	}
+	pthread_mutex_unlock(&subscribe_mutex);
+}
+
+/*
+ * Returns whether the device is gone. Without events, this checks at most
+ * every PROBE_INTERVAL_MS that usbmuxd still lists the device.
+ */
+static int device_lost(webinspector_proxy_t proxy)
+{
+	int lost;
+	int probe = 0;
+	uint64_t now = now_ms();
+
+	pthread_mutex_lock(&watch_mutex);
+	if (!proxy->lost && !proxy->watched_by_event && now >= proxy->next_probe_ms) {
+		proxy->next_probe_ms = now + PROBE_INTERVAL_MS;
+		probe = 1;
+	}
+	pthread_mutex_unlock(&watch_mutex);
+
+	if (probe) {
+		idevice_t device = NULL;
+		if (idevice_new(&device, proxy->udid) == IDEVICE_E_NO_DEVICE) {
+			debug(proxy, "%s: device %s is gone\n", __func__, proxy->udid);
+			pthread_mutex_lock(&watch_mutex);
+			proxy->lost = 1;
+			pthread_mutex_unlock(&watch_mutex);
+		}
+		if (device) {
+			idevice_free(device);
+		}
+	}
+
+	pthread_mutex_lock(&watch_mutex);
+	lost = proxy->lost;
+	pthread_mutex_unlock(&watch_mutex);
+	return lost;
+}
+
+/* Returns the device lost frame the first time, and NULL afterwards. */
+static char *take_device_lost_frame(webinspector_proxy_t proxy, uint32_t *length)
+{
+	char *frame = NULL;
+	int report;
+
+	pthread_mutex_lock(&watch_mutex);
+	report = !proxy->lost_reported;
+	proxy->lost_reported = 1;
+	pthread_mutex_unlock(&watch_mutex);
+
+	if (report) {
+		plist_t message = plist_new_dict();
+		plist_dict_set_item(message, "__selector", plist_new_string(WEBINSPECTOR_PROXY_DEVICE_LOST_SELECTOR));
+		plist_dict_set_item(message, "__argument", plist_new_dict());
+		if (proxy->format_xml) {
+			plist_to_xml(message, &frame, length);
+		} else {
+			plist_to_bin(message, &frame, length);
+		}
+		plist_free(message);
+	}
+	return frame;
+}
+
+/*
+ * Gets a copy of the DevTools message carried in the data_key of a message
+ * with the given selector. Returns 0 on success.
+ */
+static int get_message_data(plist_t message, const char *selector, const char *data_key, char **data, uint64_t *length)
+{
+	plist_t item = plist_dict_get_item(message, "__selector");
+	char *message_selector = NULL;
+	int match;
+
+	if (!item || plist_get_node_type(item) != PLIST_STRING) {
+		return -1;
+	}
+	plist_get_string_val(item, &message_selector);
+	match = (message_selector && !strcmp(message_selector, selector));
+	free(message_selector);
+	if (!match) {
+		return -1;
+	}
+	item = plist_dict_get_item(plist_dict_get_item(message, "__argument"), data_key);
+	if (!item || plist_get_node_type(item) != PLIST_DATA) {
+		return -1;
+	}
+	*data = NULL;
+	plist_get_data_val(item, data, length);
+	return (*data ? 0 : -1);
+}
+
+static webinspector_error_t send_plist(webinspector_proxy_t proxy, plist_t message)
+{
+	webinspector_error_t error;
+
+	pthread_mutex_lock(&proxy->send_mutex);
+	error = webinspector_send(proxy->inspector, message);
+	pthread_mutex_unlock(&proxy->send_mutex);
+	return error;
+}
+
+/*
+ * Sends a command of the proxy's own to the page that target, a
+ * _rpc_forwardSocketData: argument of the client, was sent to. The command
+ * is the JSON after the id, which starts with a comma. Returns the id, or -1
+ * if the command could not be sent.
+ */
+static int send_internal_command(webinspector_proxy_t proxy, plist_t target, const char *command)
+{
+	char json[512];
+	int id = INTERNAL_ID_BASE + proxy->next_internal_id;
+	int length;
+
+	length = snprintf(json, sizeof(json), "{\"id\":%d%s}", id, command);
+	if (length < 0 || (size_t)length >= sizeof(json)) {
+		return -1;
+	}
+	proxy->next_internal_id = (proxy->next_internal_id + 1) % INTERNAL_ID_BASE;
+
+	plist_t argument = plist_copy(target);
+	plist_dict_set_item(argument, "WIRSocketDataKey", plist_new_data(json, length));
+	plist_t message = plist_new_dict();
+	plist_dict_set_item(message, "__selector", plist_new_string("_rpc_forwardSocketData:"));
+	plist_dict_set_item(message, "__argument", argument);
+	debug(proxy, "%s: sending %s\n", __func__, json);
+	if (send_plist(proxy, message) == WEBINSPECTOR_E_SUCCESS) {
+		usb_accounting_add(proxy->udid, WEBINSPECTOR_SERVICE_NAME, 0, length + ENVELOPE_BYTES);
+		proxy->internal_pending++;
+	} else {
+		id = -1;
+	}
+	plist_free(message);
+	return id;
+}
+
+static char *get_argument_string(plist_t message, const char *key)
+{
+	plist_t item = plist_dict_get_item(plist_dict_get_item(message, "__argument"), key);
+	char *s = NULL;
+
+	if (item && plist_get_node_type(item) == PLIST_STRING) {
+		plist_get_string_val(item, &s);
+	}
+	return s;
+}
+
+/* Remembers the page a _rpc_forwardSocketData: message of the client goes to, by its sender key. */
+static void remember_page_target(webinspector_proxy_t proxy, plist_t message)
+{
+	char *sender = get_argument_string(message, "WIRSenderKey");
+	int i;
+
+	if (!sender) {
+		return;
+	}
+	pthread_mutex_lock(&proxy->mutex);
+	for (i = 0; i < MAX_PAGE_TARGETS; i++) {
+		if (proxy->page_target_senders[i] && !strcmp(proxy->page_target_senders[i], sender)) {
+			break;
+		}
+	}
+	if (i == MAX_PAGE_TARGETS) {
+		i = proxy->next_page_target;
+		proxy->next_page_target = (i + 1) % MAX_PAGE_TARGETS;
+		free(proxy->page_target_senders[i]);
+		plist_free(proxy->page_targets[i]);
+		proxy->page_target_senders[i] = sender;
+		proxy->page_targets[i] = plist_copy(plist_dict_get_item(message, "__argument"));
+		plist_dict_remove_item(proxy->page_targets[i], "WIRSocketDataKey");
+		sender = NULL;
+	}
+	pthread_mutex_unlock(&proxy->mutex);
+	free(sender);
+}
+
+/* Returns a copy of the target of the client's connection with the given sender key, or NULL. */
+static plist_t copy_page_target(webinspector_proxy_t proxy, const char *sender)
+{
+	plist_t target = NULL;
+	int i;
+
+	pthread_mutex_lock(&proxy->mutex);
+	for (i = 0; i < MAX_PAGE_TARGETS; i++) {
+		if (proxy->page_target_senders[i] && !strcmp(proxy->page_target_senders[i], sender)) {
+			target = plist_copy(proxy->page_targets[i]);
+			break;
+		}
+	}
+	pthread_mutex_unlock(&proxy->mutex);
+	return target;
+}
+
+static void send_screencast_ack(webinspector_proxy_t proxy)
+{
+	char command[96];
+	plist_t target;
+
+	proxy->ack_pending = 0;
+	pthread_mutex_lock(&proxy->mutex);
+	target = (proxy->screencast_target ? plist_copy(proxy->screencast_target) : NULL);
+	pthread_mutex_unlock(&proxy->mutex);
+	if (target) {
+		snprintf(command, sizeof(command), ",\"method\":\"Page.screencastFrameAck\",\"params\":{\"sessionId\":%d}", proxy->ack_session_id);
+		send_internal_command(proxy, target, command);
+		plist_free(target);
+	}
+}
+
+static double get_number(devtools_json_t object, const char *key)
+{
+	devtools_json_t value;
+	double number = 0;
+
+	if (devtools_json_get(object, key, &value) || devtools_json_number(value, &number)) {
+		return 0;
+	}
+	return number;
+}
+
+/* Passes a Page.screencastFrame event to the callback and acknowledges it. */
+static void handle_screencast_frame(webinspector_proxy_t proxy, devtools_json_t event)
+{
+	webinspector_proxy_screencast_frame_t frame;
+	webinspector_proxy_screencast_cb_t callback;
+	void *user_data;
+	uint32_t interval_ms;
+	devtools_json_t params;
+	devtools_json_t metadata;
+	devtools_json_t data;
+	char *image;
+
+	/* the callback is called without the lock, with the settings it was set with */
+	pthread_mutex_lock(&proxy->mutex);
+	callback = proxy->screencast_cb;
+	user_data = proxy->screencast_user_data;
+	interval_ms = proxy->screencast_interval_ms;
+	pthread_mutex_unlock(&proxy->mutex);
+	if (!callback) {
+		return;
+	}
+
+	memset(&frame, 0, sizeof(frame));
+	if (devtools_json_get(event, "params", &params) || devtools_json_get(params, "data", &data)) {
+		return;
+	}
+	image = devtools_json_base64(data, &frame.length);
+	if (!image) {
+		return;
+	}
+	frame.data = image;
+	frame.session_id = (int)get_number(params, "sessionId");
+	if (!devtools_json_get(params, "metadata", &metadata)) {
+		frame.timestamp = get_number(metadata, "timestamp");
+		frame.device_width = get_number(metadata, "deviceWidth");
+		frame.device_height = get_number(metadata, "deviceHeight");
+		frame.page_scale_factor = get_number(metadata, "pageScaleFactor");
+		frame.offset_top = get_number(metadata, "offsetTop");
+		frame.scroll_offset_x = get_number(metadata, "scrollOffsetX");
+		frame.scroll_offset_y = get_number(metadata, "scrollOffsetY");
+	}
+	uint64_t received_ms = now_ms();
+	callback(&frame, user_data);
+	free(image);
+
+	/* the device sends the next frame once this one is acknowledged */
+	proxy->ack_pending = 1;
+	proxy->ack_session_id = frame.session_id;
+	proxy->ack_due_ms = received_ms + interval_ms;
+	if (now_ms() >= proxy->ack_due_ms) {
+		send_screencast_ack(proxy);
+	}
+}
+
+static int is_console_event(devtools_json_t method)
+{
+	return devtools_json_is_string(method, "Console.messageAdded") ||
+			devtools_json_is_string(method, "Console.messageRepeatCountUpdated") ||
+			devtools_json_is_string(method, "Console.messagesCleared") ||
+			devtools_json_is_string(method, "Runtime.consoleAPICalled");
+}
+
+static webinspector_proxy_console_level_t to_console_level(devtools_json_t level)
+{
+	if (devtools_json_is_string(level, "debug")) {
+		return WEBINSPECTOR_PROXY_CONSOLE_DEBUG;
+	} else if (devtools_json_is_string(level, "info")) {
+		return WEBINSPECTOR_PROXY_CONSOLE_INFO;
+	} else if (devtools_json_is_string(level, "warning")) {
+		return WEBINSPECTOR_PROXY_CONSOLE_WARNING;
+	} else if (devtools_json_is_string(level, "error") || devtools_json_is_string(level, "assert")) {
+		return WEBINSPECTOR_PROXY_CONSOLE_ERROR;
+	}
+	return WEBINSPECTOR_PROXY_CONSOLE_LOG;
+}
+
+/* Writes a string without the characters that separate fields and lines. */
+static void write_console_field(FILE *file, const char *s, size_t length)
+{
+	size_t i;
+
+	for (i = 0; i < length; i++) {
+		switch (s[i]) {
+		case '\t': fputs("\\t", file); break;
+		case '\n': fputs("\\n", file); break;
+		case '\r': fputs("\\r", file); break;
+		case '\\': fputs("\\\\", file); break;
+		default: fputc(s[i], file); break;
+		}
+	}
+}
+
+/* Writes a string value unescaped, or any other value as its JSON. */
+static void write_console_value(FILE *file, devtools_json_t value)
+{
+	size_t length;
+	char *s = devtools_json_string(value, &length);
+
+	if (s) {
+		write_console_field(file, s, length);
+		free(s);
+	} else {
+		write_console_field(file, value.start, value.length);
+	}
+}
+
+static void write_console_key(FILE *file, plist_t argument, const char *key)
+{
+	plist_t item = plist_dict_get_item(argument, key);
+	char *s = NULL;
+
+	if (item && plist_get_node_type(item) == PLIST_STRING) {
+		plist_get_string_val(item, &s);
+	}
+	if (s) {
+		write_console_field(file, s, strlen(s));
+		free(s);
+	}
+	fputc('\t', file);
+}
+
+static const char *const console_level_names[] = { "debug", "log", "info", "warning", "error" };
+
+/* Appends a console event to the console log if its level is high enough. */
+static void log_console_event(webinspector_proxy_t proxy, plist_t message, devtools_json_t event, devtools_json_t method)
+{
+	webinspector_proxy_console_level_t level = WEBINSPECTOR_PROXY_CONSOLE_LOG;
+	devtools_json_t params = { NULL, 0 };
+	devtools_json_t entry;
+	devtools_json_t value;
+	struct timespec now;
+	int api_call = devtools_json_is_string(method, "Runtime.consoleAPICalled");
+	size_t i;
+
+	devtools_json_get(event, "params", &params);
+	if (api_call) {
+		entry = params;
+		if (!devtools_json_get(entry, "type", &value)) {
+			level = to_console_level(value);
+		}
+	} else if (!devtools_json_get(params, "message", &entry)) {
+		if (!devtools_json_get(entry, "level", &value)) {
+			level = to_console_level(value);
+		}
+	} else {
+		/* repeat counts and clears have no level or text of their own */
+		entry = params;
+	}
+	pthread_mutex_lock(&proxy->mutex);
+	FILE *file = proxy->console_log;
+	if (!file || level < proxy->console_min_level) {
+		pthread_mutex_unlock(&proxy->mutex);
+		return;
+	}
+	plist_t argument = plist_dict_get_item(message, "__argument");
+	clock_gettime(CLOCK_REALTIME, &now);
+	fprintf(file, "%llu\t", (unsigned long long)now.tv_sec * 1000 + now.tv_nsec / 1000000);
+	write_console_key(file, argument, "WIRApplicationIdentifierKey");
+	write_console_key(file, argument, "WIRDestinationKey");
+	fprintf(file, "%s\t", console_level_names[level]);
+	if (api_call) {
+		/* the arguments of console.log(), as their values or descriptions */
+		devtools_json_t args;
+		devtools_json_t arg;
+		if (!devtools_json_get(entry, "args", &args)) {
+			for (i = 0; !devtools_json_index(args, i, &arg); i++) {
+				if (i > 0) {
+					fputc(' ', file);
+				}
+				if (!devtools_json_get(arg, "value", &value) || !devtools_json_get(arg, "description", &value)) {
+					write_console_value(file, value);
+				}
+			}
+		}
+	} else if (!devtools_json_get(entry, "text", &value)) {
+		write_console_value(file, value);
+		if (!devtools_json_get(entry, "url", &value) && value.length > 2) {
+			fputs(" (", file);
+			write_console_value(file, value);
+			if (!devtools_json_get(entry, "line", &value)) {
+				fputc(':', file);
+				write_console_value(file, value);
+			}
+			fputc(')', file);
+		}
+	} else {
+		/* the method name, e.g. for Console.messagesCleared */
+		write_console_value(file, method);
+		if (!devtools_json_get(entry, "count", &value)) {
+			fputc(' ', file);
+			write_console_value(file, value);
+		}
+	}
+	fputc('\n', file);
+	fflush(file);
+	pthread_mutex_unlock(&proxy->mutex);
+}
+
+/*
+ * Adds a Network event to the HAR capture, and fetches the response body of
+ * finished requests if the capture includes them.
+ */
+static void capture_network_event(webinspector_proxy_t proxy, plist_t message, devtools_json_t event, devtools_json_t method)
+{
+	char command[384];
+	devtools_json_t params;
+	char *request_id = NULL;
+	char *page = get_argument_string(message, "WIRDestinationKey");
+	int id = -1;
+
+	if (!page || devtools_json_get(event, "params", &params)) {
+		free(page);
+		return;
+	}
+	/* the requestId is owned by the writer, which may be replaced once unlocked */
+	pthread_mutex_lock(&proxy->mutex);
+	if (proxy->har) {
+		const char *writer_request_id = har_writer_add_event(proxy->har, page, method, params);
+		if (writer_request_id) {
+			request_id = strdup(writer_request_id);
+		}
+	}
+	pthread_mutex_unlock(&proxy->mutex);
+	if (request_id) {
+		plist_t target = copy_page_target(proxy, page);
+		if (target && snprintf(command, sizeof(command), ",\"method\":\"Network.getResponseBody\",\"params\":{\"requestId\":%s}", request_id) < (int)sizeof(command)) {
+			id = send_internal_command(proxy, target, command);
+		}
+		plist_free(target);
+		/* a new writer does not know the request and ignores it */
+		pthread_mutex_lock(&proxy->mutex);
+		if (proxy->har) {
+			har_writer_expect_body(proxy->har, page, request_id, id);
+		}
+		pthread_mutex_unlock(&proxy->mutex);
+		free(request_id);
+	}
+	free(page);
+}
+
+/*
+ * Lets the response cache see a reply or, if is_event, an event method that
+ * the device sent to one of the client's connections.
+ */
+static void cache_device_message(webinspector_proxy_t proxy, plist_t message, devtools_json_t json, int is_event)
+{
+	char *page = get_argument_string(message, "WIRDestinationKey");
+
+	if (!page) {
+		return;
+	}
+	pthread_mutex_lock(&proxy->mutex);
+	if (proxy->cache && is_event) {
+		response_cache_add_event(proxy->cache, page, json);
+	} else if (proxy->cache) {
+		response_cache_add_reply(proxy->cache, page, json, now_ms());
+	}
+	pthread_mutex_unlock(&proxy->mutex);
+	free(page);
+}
+
+/*
+ * Handles messages from the device that the client should not see. Returns
+ * whether the message was consumed.
+ */
+static int filter_message(webinspector_proxy_t proxy, plist_t message)
+{
+	devtools_json_t json;
+	devtools_json_t value;
+	double id;
+	char *data = NULL;
+	uint64_t length = 0;
+	int consumed = 0;
+	int screencast;
+	int console;
+	int har;
+	int cache;
+
+	/* the handlers check again under the lock, in case a setter just ran */
+	pthread_mutex_lock(&proxy->mutex);
+	screencast = (proxy->screencast_cb != NULL);
+	console = (proxy->console_log != NULL);
+	har = (proxy->har != NULL);
+	cache = (proxy->cache != NULL);
+	pthread_mutex_unlock(&proxy->mutex);
+	if (!screencast && !console && !har && !proxy->internal_pending && !cache) {
+		return 0;
+	}
+	if (get_message_data(message, "_rpc_applicationSentData:", "WIRMessageDataKey", &data, &length)) {
+		return 0;
+	}
+	if (!devtools_json_parse(data, length, &json)) {
+		if (!devtools_json_get(json, "method", &value)) {
+			if (cache) {
+				cache_device_message(proxy, message, value, 1);
+			}
+			if (screencast && devtools_json_is_string(value, "Page.screencastFrame")) {
+				handle_screencast_frame(proxy, json);
+				consumed = 1;
+			} else if (console && is_console_event(value)) {
+				log_console_event(proxy, message, json, value);
+				consumed = 1;
+			} else if (har && har_writer_is_network_event(value)) {
+				capture_network_event(proxy, message, json, value);
+				consumed = 1;
+			}
+		} else if (!devtools_json_get(json, "id", &value) && !devtools_json_number(value, &id)) {
+			if (proxy->internal_pending && id >= INTERNAL_ID_BASE) {
+				/* the reply to a command of ours */
+				pthread_mutex_lock(&proxy->mutex);
+				if (proxy->har) {
+					har_writer_add_body(proxy->har, (int)id, json);
+				}
+				pthread_mutex_unlock(&proxy->mutex);
+				proxy->internal_pending--;
+				consumed = 1;
+			} else if (cache) {
+				cache_device_message(proxy, message, json, 0);
+			}
+		}
+	}
+	if (consumed) {
+		/* messages for the client are counted when they are handed out */
+		usb_accounting_add(proxy->udid, WEBINSPECTOR_SERVICE_NAME, length + ENVELOPE_BYTES, 0);
+	}
+	free(data);
+	return consumed;
+}
+
+/*
+ * Notes the page the client starts a screencast on, for acknowledgements,
+ * and the pages it talks to, for fetching response bodies.
+ */
+static void watch_client_message(webinspector_proxy_t proxy, plist_t message)
+{
+	devtools_json_t json;
+	devtools_json_t method;
+	char *data = NULL;
+	uint64_t length = 0;
+	int har;
+	int screencast;
+
+	pthread_mutex_lock(&proxy->mutex);
+	har = (proxy->har != NULL);
+	screencast = (proxy->screencast_cb != NULL);
+	pthread_mutex_unlock(&proxy->mutex);
+	if (har) {
+		remember_page_target(proxy, message);
+	}
+	if (!screencast) {
+		return;
+	}
+	if (get_message_data(message, "_rpc_forwardSocketData:", "WIRSocketDataKey", &data, &length)) {
+		return;
+	}
+	if (!devtools_json_parse(data, length, &json) && !devtools_json_get(json, "method", &method) &&
+			devtools_json_is_string(method, "Page.startScreencast")) {
+		plist_t target = plist_copy(plist_dict_get_item(message, "__argument"));
+		plist_dict_remove_item(target, "WIRSocketDataKey");
+		pthread_mutex_lock(&proxy->mutex);
+		plist_free(proxy->screencast_target);
+		proxy->screencast_target = target;
+		pthread_mutex_unlock(&proxy->mutex);
+	}
+	free(data);
+}
+
+/*
+ * Answers a command of the client from the response cache, queueing the
+ * reply for the receive functions. Returns whether the command was answered,
+ * in which case it is not sent to the device.
+ */
+static int answer_from_cache(webinspector_proxy_t proxy, plist_t message)
+{
+	devtools_json_t json;
+	char *data = NULL;
+	uint64_t length = 0;
+	char *sender;
+	char *reply = NULL;
+	size_t reply_length = 0;
+	int answered = 0;
+
+	if (get_message_data(message, "_rpc_forwardSocketData:", "WIRSocketDataKey", &data, &length)) {
+		return 0;
+	}
+	sender = get_argument_string(message, "WIRSenderKey");
+	if (sender && !devtools_json_parse(data, length, &json)) {
+		pthread_mutex_lock(&proxy->mutex);
+		if (proxy->cache && proxy->cached_reply_count < MAX_CACHED_REPLIES) {
+			reply = response_cache_lookup(proxy->cache, sender, json, now_ms(), &reply_length);
+		}
+		if (reply) {
+			/* the reply as the device would send it to the client's connection */
+			char *application = get_argument_string(message, "WIRApplicationIdentifierKey");
+			plist_t argument = plist_new_dict();
+			if (application) {
+				plist_dict_set_item(argument, "WIRApplicationIdentifierKey", plist_new_string(application));
+			}
+			plist_dict_set_item(argument, "WIRDestinationKey", plist_new_string(sender));
+			plist_dict_set_item(argument, "WIRMessageDataKey", plist_new_data(reply, reply_length));
+			plist_t answer = plist_new_dict();
+			plist_dict_set_item(answer, "__selector", plist_new_string("_rpc_applicationSentData:"));
+			plist_dict_set_item(answer, "__argument", argument);
+			proxy->cached_replies[(proxy->cached_reply_start + proxy->cached_reply_count) % MAX_CACHED_REPLIES] = answer;
+			proxy->cached_reply_count++;
+			free(application);
+			free(reply);
+			answered = 1;
+		}
+		pthread_mutex_unlock(&proxy->mutex);
+	}
+	if (answered) {
+		debug(proxy, "%s: answered %.*s from the cache\n", __func__, (int)length, data);
+	}
+	free(sender);
+	free(data);
+	return answered;
+}
+
+/* Returns the next reply that answer_from_cache queued, or NULL. */
+static plist_t take_cached_reply(webinspector_proxy_t proxy)
+{
+	plist_t reply = NULL;
+
+	pthread_mutex_lock(&proxy->mutex);
+	if (proxy->cached_reply_count > 0) {
+		reply = proxy->cached_replies[proxy->cached_reply_start];
+		proxy->cached_reply_start = (proxy->cached_reply_start + 1) % MAX_CACHED_REPLIES;
+		proxy->cached_reply_count--;
+	}
+	pthread_mutex_unlock(&proxy->mutex);
+	return reply;
+}
+
+static webinspector_proxy_error_t proxy_enter(webinspector_proxy_t proxy)
+{
+	webinspector_proxy_error_t res = WEBINSPECTOR_PROXY_E_SUCCESS;
+	pthread_mutex_lock(&proxy->mutex);
+	if (proxy->closed) {
+		res = WEBINSPECTOR_PROXY_E_CLOSED;
+	} else {
+		proxy->users++;
+	}
+	pthread_mutex_unlock(&proxy->mutex);
+	return res;
+}
+
+static void proxy_leave(webinspector_proxy_t proxy)
+{
+	pthread_mutex_lock(&proxy->mutex);
+	if (--proxy->users == 0) {
+		pthread_cond_broadcast(&proxy->idle);
+	}
+	pthread_mutex_unlock(&proxy->mutex);
+}
+
+webinspector_proxy_error_t webinspector_proxy_new(const char *udid, webinspector_proxy_t *proxy)
+{
+	if (!proxy) {
+		return WEBINSPECTOR_PROXY_E_INVALID_ARG;
+	}
+
+	webinspector_proxy_t new_proxy = (webinspector_proxy_t)calloc(1, sizeof(webinspector_proxy_private));
+	if (!new_proxy) {
+		return WEBINSPECTOR_PROXY_E_UNKNOWN_ERROR;
+	}
+	if (idevice_new(&new_proxy->device, udid) != IDEVICE_E_SUCCESS) {
+		free(new_proxy);
+		return WEBINSPECTOR_PROXY_E_NO_DEVICE;
+	}
+	if (udid) {
+		new_proxy->udid = strdup(udid);
+	} else {
+		idevice_get_udid(new_proxy->device, &new_proxy->udid);
+	}
+	if (!new_proxy->udid) {
+		idevice_free(new_proxy->device);
+		free(new_proxy);
+		return WEBINSPECTOR_PROXY_E_UNKNOWN_ERROR;
+	}
+	pthread_mutex_init(&new_proxy->mutex, NULL);
+	pthread_mutex_init(&new_proxy->send_mutex, NULL);
+	pthread_cond_init(&new_proxy->idle, NULL);
+	watch_device(new_proxy);
+
+	*proxy = new_proxy;
+	return WEBINSPECTOR_PROXY_E_SUCCESS;
+}
+
+webinspector_proxy_error_t webinspector_proxy_connect(webinspector_proxy_t proxy)
+{
+	webinspector_proxy_error_t res = WEBINSPECTOR_PROXY_E_SUCCESS;
+
+	if (!proxy) {
+		return WEBINSPECTOR_PROXY_E_INVALID_ARG;
+	}
+
+	/* the sending and receiving threads may both get here first */
+	pthread_mutex_lock(&proxy->mutex);
+	if (!proxy->inspector) {
+		debug(proxy, "%s: connecting to inspector...\n", __func__);
+		webinspector_error_t error = webinspector_client_start_service(proxy->device, &proxy->inspector, "idevicewebinspectorproxy");
+		if (error != WEBINSPECTOR_E_SUCCESS) {
+			debug(proxy, "%s: could not connect to the webinspector: %d\n", __func__, error);
+			proxy->inspector = NULL;
+			res = WEBINSPECTOR_PROXY_E_CONNECT_FAILED;
+		}
+	}
+	pthread_mutex_unlock(&proxy->mutex);
+
+	return res;
+}
+
+void webinspector_proxy_set_xml_output(webinspector_proxy_t proxy, int xml)
+{
+	if (proxy) {
+		proxy->format_xml = xml;
+	}
+}
+
+void webinspector_proxy_set_debug(webinspector_proxy_t proxy, int debug)
+{
+	if (proxy) {
+		proxy->debug = debug;
+	}
+}
+
+webinspector_proxy_error_t webinspector_proxy_set_console_log(webinspector_proxy_t proxy, const char *path, webinspector_proxy_console_level_t min_level)
+{
+	FILE *file = NULL;
+	FILE *old_file;
+
+	if (!proxy) {
+		return WEBINSPECTOR_PROXY_E_INVALID_ARG;
+	}
+	if (path) {
+		file = fopen(path, "a");
+		if (!file) {
+			return WEBINSPECTOR_PROXY_E_INVALID_ARG;
+		}
+	}
+	/* the receiving thread writes to the file under the lock */
+	pthread_mutex_lock(&proxy->mutex);
+	old_file = proxy->console_log;
+	proxy->console_log = file;
+	proxy->console_min_level = min_level;
+	pthread_mutex_unlock(&proxy->mutex);
+	if (old_file) {
+		fclose(old_file);
+	}
+	return WEBINSPECTOR_PROXY_E_SUCCESS;
+}
+
+webinspector_proxy_error_t webinspector_proxy_set_har_log(webinspector_proxy_t proxy, const char *path, int include_bodies)
+{
+	har_writer_t har = NULL;
+	har_writer_t old_har;
+
+	if (!proxy) {
+		return WEBINSPECTOR_PROXY_E_INVALID_ARG;
+	}
+	if (path) {
+		har = har_writer_new(path, include_bodies);
+		if (!har) {
+			return WEBINSPECTOR_PROXY_E_INVALID_ARG;
+		}
+	}
+	/* the receiving thread uses the writer under the lock */
+	pthread_mutex_lock(&proxy->mutex);
+	old_har = proxy->har;
+	proxy->har = har;
+	pthread_mutex_unlock(&proxy->mutex);
+	har_writer_free(old_har);
+	return WEBINSPECTOR_PROXY_E_SUCCESS;
+}
+
+webinspector_proxy_error_t webinspector_proxy_set_response_cache(webinspector_proxy_t proxy, const char *methods, uint32_t ttl_ms)
+{
+	response_cache_t cache = NULL;
+
+	if (!proxy) {
+		return WEBINSPECTOR_PROXY_E_INVALID_ARG;
+	}
+	if (methods) {
+		cache = response_cache_new(methods, ttl_ms);
+		if (!cache) {
+			return WEBINSPECTOR_PROXY_E_INVALID_ARG;
+		}
+	}
+	pthread_mutex_lock(&proxy->mutex);
+	response_cache_free(proxy->cache);
+	proxy->cache = cache;
+	pthread_mutex_unlock(&proxy->mutex);
+	return WEBINSPECTOR_PROXY_E_SUCCESS;
+}
+
+void webinspector_proxy_set_screencast_callback(webinspector_proxy_t proxy, webinspector_proxy_screencast_cb_t callback, void *user_data, uint32_t max_fps)
+{
+	if (proxy) {
+		pthread_mutex_lock(&proxy->mutex);
+		proxy->screencast_cb = callback;
+		proxy->screencast_user_data = user_data;
+		proxy->screencast_interval_ms = (max_fps ? 1000 / max_fps : 0);
+		pthread_mutex_unlock(&proxy->mutex);
+	}
+}
+
+webinspector_proxy_error_t webinspector_proxy_send(webinspector_proxy_t proxy, const char *frame, uint32_t length)
+{
+	webinspector_proxy_error_t res;
+	plist_t message = NULL;
+
+	if (!proxy || !frame) {
+		return WEBINSPECTOR_PROXY_E_INVALID_ARG;
+	}
+
+	/* convert buffer to a message */
+	if ((length > 8) && !memcmp(frame, "bplist00", 8)) {
+		plist_from_bin(frame, length, &message);
+	} else if ((length > 5) && !memcmp(frame, "<?xml", 5)) {
+		plist_from_xml(frame, length, &message);
+	}
+	if (!message) {
+		return WEBINSPECTOR_PROXY_E_PLIST_ERROR;
+	}
+
+	res = proxy_enter(proxy);
+	if (res == WEBINSPECTOR_PROXY_E_SUCCESS) {
+		if (device_lost(proxy)) {
+			res = WEBINSPECTOR_PROXY_E_DEVICE_LOST;
+		} else {
+			res = webinspector_proxy_connect(proxy);
+		}
+		if (res == WEBINSPECTOR_PROXY_E_SUCCESS) {
+			debug(proxy, "%s: sending %u bytes to device...\n", __func__, length);
+			watch_client_message(proxy, message);
+			if (proxy->cache && answer_from_cache(proxy, message)) {
+				/* the reply is already queued */
+			} else if (send_plist(proxy, message) != WEBINSPECTOR_E_SUCCESS) {
+				res = WEBINSPECTOR_PROXY_E_SEND_FAILED;
+			} else {
+				usb_accounting_add(proxy->udid, WEBINSPECTOR_SERVICE_NAME, 0, length + FRAME_PREFIX_BYTES);
+			}
+		}
+		proxy_leave(proxy);
+	}
+
+	plist_free(message);
+	return res;
+}
+
+/*
+ * Receives a message for the client in slices of at most LOST_POLL_MS, so
+ * that a lost device is noticed well before a long timeout ends, and sends
+ * screencast acknowledgements when they are due. With a response cache, the
+ * slices are at most CACHE_POLL_MS, so that replies from the cache don't
+ * wait for the device. Sets *from_device unless the message is such a reply.
+ */
+static webinspector_proxy_error_t receive_message(webinspector_proxy_t proxy, plist_t *message, int *from_device, uint32_t timeout_ms)
+{
+	uint64_t deadline = now_ms() + timeout_ms;
+
+	while (1) {
+		*message = take_cached_reply(proxy);
+		if (*message) {
+			*from_device = 0;
+			return WEBINSPECTOR_PROXY_E_SUCCESS;
+		}
+		uint64_t start = now_ms();
+		if (proxy->ack_pending && start >= proxy->ack_due_ms) {
+			send_screencast_ack(proxy);
+		}
+		uint32_t slice = (deadline > start ? (uint32_t)(deadline - start) : 0);
+		if (slice > LOST_POLL_MS) {
+			slice = LOST_POLL_MS;
+		}
+		if (proxy->cache && slice > CACHE_POLL_MS) {
+			slice = CACHE_POLL_MS;
+		}
+		if (proxy->ack_pending && proxy->ack_due_ms - start < slice) {
+			slice = (uint32_t)(proxy->ack_due_ms - start);
+		}
+		if (slice == 0) {
+			/* a zero timeout would make libimobiledevice block forever */
+			return WEBINSPECTOR_PROXY_E_RECEIVE_TIMEOUT;
+		}
+		*message = NULL;
+		webinspector_error_t err = webinspector_receive_with_timeout(proxy->inspector, message, slice);
+		if (err == WEBINSPECTOR_E_SUCCESS && *message) {
+			if (!filter_message(proxy, *message)) {
+				*from_device = 1;
+				return WEBINSPECTOR_PROXY_E_SUCCESS;
+			}
+			plist_free(*message);
+			*message = NULL;
+			continue;
+		}
+		plist_free(*message);
+		*message = NULL;
+		if (device_lost(proxy)) {
+			return WEBINSPECTOR_PROXY_E_DEVICE_LOST;
+		}
+		switch (err) {
+		case WEBINSPECTOR_E_SUCCESS:
+		case WEBINSPECTOR_E_RECEIVE_TIMEOUT:
+			/* nothing arrived in this slice; try again until the deadline */
+			continue;
+		case WEBINSPECTOR_E_PLIST_ERROR:
+			return WEBINSPECTOR_PROXY_E_PLIST_ERROR;
+		case WEBINSPECTOR_E_MUX_ERROR:
+		case WEBINSPECTOR_E_SSL_ERROR:
+		case WEBINSPECTOR_E_NOT_ENOUGH_DATA:
+			debug(proxy, "%s: receive failed: %d\n", __func__, err);
+			return WEBINSPECTOR_PROXY_E_RECEIVE_FAILED;
+		default:
+			debug(proxy, "%s: receive failed: %d\n", __func__, err);
+			return WEBINSPECTOR_PROXY_E_UNKNOWN_ERROR;
+		}
+	}
+}
+
+/**
+ * Receives one frame like webinspector_proxy_receive; the caller must be
+ * between proxy_enter and proxy_leave.
+ */
+static webinspector_proxy_error_t receive_frame(webinspector_proxy_t proxy, char **frame, uint32_t *length, uint32_t timeout_ms)
+{
+	webinspector_proxy_error_t res;
+	plist_t message = NULL;
+	int from_device = 0;
+
+	*frame = NULL;
+	*length = 0;
+
+	/* hand out a frame left behind by receive_into first */
+	pthread_mutex_lock(&proxy->mutex);
+	if (proxy->pending) {
+		*frame = proxy->pending;
+		*length = proxy->pending_length;
+		proxy->pending = NULL;
+		proxy->pending_length = 0;
+	}
+	pthread_mutex_unlock(&proxy->mutex);
+	if (*frame) {
+		return WEBINSPECTOR_PROXY_E_SUCCESS;
+	}
+
+	if (device_lost(proxy)) {
+		res = WEBINSPECTOR_PROXY_E_DEVICE_LOST;
+	} else {
+		res = webinspector_proxy_connect(proxy);
+		if (res == WEBINSPECTOR_PROXY_E_SUCCESS) {
+			debug(proxy, "%s: receiving data from device...\n", __func__);
+			res = receive_message(proxy, &message, &from_device, timeout_ms);
+		}
+	}
+
+	if (res == WEBINSPECTOR_PROXY_E_SUCCESS) {
+		if (proxy->format_xml) {
+			plist_to_xml(message, frame, length);
+		} else {
+			plist_to_bin(message, frame, length);
+		}
+		if (!*frame || *length == 0) {
+			free(*frame);
+			*frame = NULL;
+			*length = 0;
+			res = WEBINSPECTOR_PROXY_E_PLIST_ERROR;
+		} else if (from_device) {
+			usb_accounting_add(proxy->udid, WEBINSPECTOR_SERVICE_NAME, *length + FRAME_PREFIX_BYTES, 0);
+		}
+		plist_free(message);
+	} else if (res == WEBINSPECTOR_PROXY_E_DEVICE_LOST) {
+		/* report the loss as a frame once, then as an error */
+		*frame = take_device_lost_frame(proxy, length);
+		if (*frame) {
+			res = WEBINSPECTOR_PROXY_E_SUCCESS;
+		}
+	}
+
+	return res;
+}
+
+webinspector_proxy_error_t webinspector_proxy_receive(webinspector_proxy_t proxy, char **frame, uint32_t *length, uint32_t timeout_ms)
+{
+	webinspector_proxy_error_t res;
+
+	if (!proxy || !frame || !length) {
+		return WEBINSPECTOR_PROXY_E_INVALID_ARG;
+	}
+	*frame = NULL;
+	*length = 0;
+
+	res = proxy_enter(proxy);
+	if (res != WEBINSPECTOR_PROXY_E_SUCCESS) {
+		return res;
+	}
+	res = receive_frame(proxy, frame, length, timeout_ms);
+	proxy_leave(proxy);
+	return res;
+}
+
+webinspector_proxy_error_t webinspector_proxy_receive_into(webinspector_proxy_t proxy, char *buffer, uint32_t capacity, uint32_t *length, uint32_t timeout_ms)
+{
+	webinspector_proxy_error_t res;
+	char *frame = NULL;
+
+	if (!proxy || !buffer || !length) {
+		return WEBINSPECTOR_PROXY_E_INVALID_ARG;
+	}
+
+	res = proxy_enter(proxy);
+	if (res != WEBINSPECTOR_PROXY_E_SUCCESS) {
+		return res;
+	}
+	/* stash an oversized frame before leaving, as free may run right after */
+	res = receive_frame(proxy, &frame, length, timeout_ms);
+	if (res == WEBINSPECTOR_PROXY_E_SUCCESS && *length > capacity) {
+		/* keep the frame for the next call with a bigger buffer */
+		pthread_mutex_lock(&proxy->mutex);
+		proxy->pending = frame;
+		proxy->pending_length = *length;
+		pthread_mutex_unlock(&proxy->mutex);
+		frame = NULL;
+		res = WEBINSPECTOR_PROXY_E_BUFFER_TOO_SMALL;
+	}
+	proxy_leave(proxy);
+
+	if (res == WEBINSPECTOR_PROXY_E_SUCCESS) {
+		memcpy(buffer, frame, *length);
+	}
+	free(frame);
+	return res;
+}
+
+void webinspector_proxy_free(webinspector_proxy_t proxy)
+{
+	int i;
+
+	if (!proxy) {
+		return;
+	}
+
+	pthread_mutex_lock(&proxy->mutex);
+	proxy->closed = 1;
+	while (proxy->users > 0) {
+		pthread_cond_wait(&proxy->idle, &proxy->mutex);
+	}
+	pthread_mutex_unlock(&proxy->mutex);
+
+	unwatch_device(proxy);
+	if (proxy->inspector) {
+		webinspector_client_free(proxy->inspector);
+	}
+	if (proxy->device) {
+		idevice_free(proxy->device);
+	}
+	free(proxy->pending);
+	free(proxy->udid);
+	plist_free(proxy->screencast_target);
+	if (proxy->console_log) {
+		fclose(proxy->console_log);
+	}
+	har_writer_free(proxy->har);
+	response_cache_free(proxy->cache);
+	while (proxy->cached_reply_count > 0) {
+		plist_free(take_cached_reply(proxy));
+	}
+	for (i = 0; i < MAX_PAGE_TARGETS; i++) {
+		free(proxy->page_target_senders[i]);
+		plist_free(proxy->page_targets[i]);
+	}
+	pthread_cond_destroy(&proxy->idle);
+	pthread_mutex_destroy(&proxy->send_mutex);
+	pthread_mutex_destroy(&proxy->mutex);
+	free(proxy);
+	/* report the session's last bytes now rather than with the next */
+	usb_accounting_flush();
+}
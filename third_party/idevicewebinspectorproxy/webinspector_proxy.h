@@ -0,0 +1,226 @@
+/*
+ * webinspector_proxy.h
+ * Embeddable device side of idevicewebinspectorproxy
+ *
+ * Copyright (c) 2013 Yury Melnichek All Rights Reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef WEBINSPECTOR_PROXY_H
+#define WEBINSPECTOR_PROXY_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+/** Error codes returned by the webinspector_proxy_* functions. */
+typedef enum {
+	WEBINSPECTOR_PROXY_E_SUCCESS         =  0,
+	WEBINSPECTOR_PROXY_E_INVALID_ARG     = -1,
+	WEBINSPECTOR_PROXY_E_NO_DEVICE       = -2,
+	WEBINSPECTOR_PROXY_E_CONNECT_FAILED  = -3,
+	WEBINSPECTOR_PROXY_E_PLIST_ERROR     = -4,
+	WEBINSPECTOR_PROXY_E_SEND_FAILED     = -5,
+	WEBINSPECTOR_PROXY_E_RECEIVE_TIMEOUT = -6,
+	WEBINSPECTOR_PROXY_E_BUFFER_TOO_SMALL = -7,
+	WEBINSPECTOR_PROXY_E_CLOSED          = -8,
+	WEBINSPECTOR_PROXY_E_DEVICE_LOST     = -9,
+	WEBINSPECTOR_PROXY_E_RECEIVE_FAILED  = -10,
+	WEBINSPECTOR_PROXY_E_UNKNOWN_ERROR   = -256
+} webinspector_proxy_error_t;
+
+/** Selector of the frame that reports the device is gone; its argument is empty. */
+#define WEBINSPECTOR_PROXY_DEVICE_LOST_SELECTOR "_rpc_reportDeviceLost:"
+
+typedef struct webinspector_proxy_private webinspector_proxy_private;
+typedef webinspector_proxy_private *webinspector_proxy_t; /**< The proxy session handle. */
+
+/**
+ * Creates a proxy session for the device with the given udid. The web
+ * inspector service itself is started by webinspector_proxy_connect, or
+ * lazily by the first webinspector_proxy_send.
+ *
+ * @param udid The 40-digit udid of the device, or NULL for the first device.
+ * @param proxy Pointer that will be set to the newly allocated session.
+ *
+ * @return WEBINSPECTOR_PROXY_E_SUCCESS on success,
+ *     WEBINSPECTOR_PROXY_E_NO_DEVICE if no such device is attached.
+ */
+webinspector_proxy_error_t webinspector_proxy_new(const char *udid, webinspector_proxy_t *proxy);
+
+/**
+ * Starts the web inspector service on the device. Does nothing if it is
+ * already started.
+ *
+ * @return WEBINSPECTOR_PROXY_E_SUCCESS on success,
+ *     WEBINSPECTOR_PROXY_E_CONNECT_FAILED if the service could not be started.
+ */
+webinspector_proxy_error_t webinspector_proxy_connect(webinspector_proxy_t proxy);
+
+/**
+ * Selects the encoding of frames returned by the receive functions: XML if
+ * xml is non-zero, binary plist (the default) otherwise.
+ */
+void webinspector_proxy_set_xml_output(webinspector_proxy_t proxy, int xml);
+
+/** Enables debug output on stdout if debug is non-zero. */
+void webinspector_proxy_set_debug(webinspector_proxy_t proxy, int debug);
+
+typedef enum {
+	WEBINSPECTOR_PROXY_CONSOLE_DEBUG = 0,
+	WEBINSPECTOR_PROXY_CONSOLE_LOG = 1,
+	WEBINSPECTOR_PROXY_CONSOLE_INFO = 2,
+	WEBINSPECTOR_PROXY_CONSOLE_WARNING = 3,
+	WEBINSPECTOR_PROXY_CONSOLE_ERROR = 4
+} webinspector_proxy_console_level_t;
+
+/**
+ * Diverts console events (Console.messageAdded, Console.messageRepeatCountUpdated,
+ * Console.messagesCleared and Runtime.consoleAPICalled) to the file at path
+ * instead of returning them from the receive functions. Messages of at least
+ * min_level are appended to the file, one per line, as tab-separated fields:
+ * milliseconds since the epoch, application identifier, page (the sender
+ * key of the message), level, and the text with tabs and newlines escaped.
+ * The others are dropped. The file may also be a named pipe. A NULL path
+ * stops diverting console events.
+ *
+ * @return WEBINSPECTOR_PROXY_E_SUCCESS on success, or
+ *    WEBINSPECTOR_PROXY_E_INVALID_ARG if the file can't be opened.
+ */
+webinspector_proxy_error_t webinspector_proxy_set_console_log(webinspector_proxy_t proxy, const char *path, webinspector_proxy_console_level_t min_level);
+
+/**
+ * Diverts the events of the Network domain to a HAR file at path instead of
+ * returning them from the receive functions. The client still enables the
+ * Network domain on the pages it wants captured. Requests are written to the
+ * file as they complete, so the capture can run for a long time; the file is
+ * completed when the capture is stopped or the proxy freed. If include_bodies
+ * is non-zero, the proxy fetches the response body of each request with
+ * Network.getResponseBody, on the client's connection to the page. A NULL
+ * path stops the capture.
+ *
+ * @return WEBINSPECTOR_PROXY_E_SUCCESS on success, or
+ *    WEBINSPECTOR_PROXY_E_INVALID_ARG if the file can't be created.
+ */
+webinspector_proxy_error_t webinspector_proxy_set_har_log(webinspector_proxy_t proxy, const char *path, int include_bodies);
+
+/**
+ * Answers commands whose method is in methods, a comma-separated list such as
+ * "DOM.getDocument,Page.getResourceTree,Runtime.evaluate", from a cache when
+ * the same connection to a page sent a command with the same method and
+ * params before, instead of sending them to the device. The cached reply
+ * gets the id of the new command and is returned by the next receive. Only
+ * list methods without side effects, and evaluate only pure getters.
+ *
+ * Results are kept for at most ttl_ms. They are dropped sooner when the page
+ * reports a change (DOM mutation events, Page.frameNavigated,
+ * Page.loadEventFired, new execution contexts and the like) or the client
+ * sends the page a command of any other method, which may change it. Events
+ * only arrive for the domains the client enabled, so ttl_ms bounds how old a
+ * result can get otherwise. A NULL methods stops caching.
+ *
+ * @return WEBINSPECTOR_PROXY_E_SUCCESS on success, or
+ *    WEBINSPECTOR_PROXY_E_INVALID_ARG if methods is empty or ttl_ms is 0.
+ */
+webinspector_proxy_error_t webinspector_proxy_set_response_cache(webinspector_proxy_t proxy, const char *methods, uint32_t ttl_ms);
+
+/** A Page.screencastFrame event, with its image decoded from base64. */
+typedef struct {
+	const char *data; /**< The JPEG or PNG image, as requested by Page.startScreencast. */
+	uint32_t length;
+	int session_id;
+	/* The frame metadata; 0 if the device left a field out. */
+	double timestamp;
+	double device_width;
+	double device_height;
+	double page_scale_factor;
+	double offset_top;
+	double scroll_offset_x;
+	double scroll_offset_y;
+} webinspector_proxy_screencast_frame_t;
+
+/** Receives screencast frames; the frame is only valid during the call. */
+typedef void (*webinspector_proxy_screencast_cb_t)(const webinspector_proxy_screencast_frame_t *frame, void *user_data);
+
+/**
+ * Diverts Page.screencastFrame events to callback instead of returning them
+ * from the receive functions, which saves encoding, decoding and copying the
+ * base64 images they carry. The proxy acknowledges each frame itself, which
+ * makes the device send the next one, after at least 1/max_fps seconds if
+ * max_fps is not 0. The acknowledgements go to the page the client last sent
+ * Page.startScreencast to, and their replies are dropped.
+ *
+ * Must be called before Page.startScreencast is sent. The callback is
+ * called on the thread that receives, from within the receive functions.
+ * A NULL callback stops diverting frames; a frame that was being handed to
+ * the previous callback may still reach it after this returns.
+ */
+void webinspector_proxy_set_screencast_callback(webinspector_proxy_t proxy, webinspector_proxy_screencast_cb_t callback, void *user_data, uint32_t max_fps);
+
+/**
+ * Sends one frame to the device. The frame is a complete plist, either in
+ * binary ("bplist00") or XML ("<?xml") encoding.
+ *
+ * @return WEBINSPECTOR_PROXY_E_SUCCESS on success,
+ *     WEBINSPECTOR_PROXY_E_PLIST_ERROR if the frame is not a plist,
+ *     WEBINSPECTOR_PROXY_E_SEND_FAILED if the device did not accept it,
+ *     WEBINSPECTOR_PROXY_E_DEVICE_LOST if the device is gone.
+ */
+webinspector_proxy_error_t webinspector_proxy_send(webinspector_proxy_t proxy, const char *frame, uint32_t length);
+
+/**
+ * Receives one frame from the device, waiting at most timeout_ms. The frame
+ * is allocated by the library and must be released with free().
+ *
+ * The device is watched for removal through usbmuxd events (or, if another
+ * component of the process already subscribed to them, by checking that it
+ * is still attached while receives time out). Once it is gone, the next
+ * receive returns a WEBINSPECTOR_PROXY_DEVICE_LOST_SELECTOR message, and
+ * later sends and receives fail with WEBINSPECTOR_PROXY_E_DEVICE_LOST.
+ *
+ * @return WEBINSPECTOR_PROXY_E_SUCCESS on success,
+ *     WEBINSPECTOR_PROXY_E_RECEIVE_TIMEOUT if nothing arrived in time,
+ *     WEBINSPECTOR_PROXY_E_PLIST_ERROR if the device sent a malformed message,
+ *     WEBINSPECTOR_PROXY_E_RECEIVE_FAILED if the connection failed,
+ *     WEBINSPECTOR_PROXY_E_DEVICE_LOST if the device is gone.
+ */
+webinspector_proxy_error_t webinspector_proxy_receive(webinspector_proxy_t proxy, char **frame, uint32_t *length, uint32_t timeout_ms);
+
+/**
+ * Like webinspector_proxy_receive, but copies the frame into a caller-owned
+ * buffer. If the buffer is too small, *length is set to the size required,
+ * the frame is kept, and the next call returns it.
+ *
+ * @return WEBINSPECTOR_PROXY_E_SUCCESS on success,
+ *     WEBINSPECTOR_PROXY_E_BUFFER_TOO_SMALL if capacity < *length,
+ *     or any error of webinspector_proxy_receive.
+ */
+webinspector_proxy_error_t webinspector_proxy_receive_into(webinspector_proxy_t proxy, char *buffer, uint32_t capacity, uint32_t *length, uint32_t timeout_ms);
+
+/**
+ * Closes the session and frees it. May be called while another thread is
+ * blocked in send or receive; those calls return WEBINSPECTOR_PROXY_E_CLOSED
+ * and this call waits for them, at most one receive timeout, before freeing.
+ */
+void webinspector_proxy_free(webinspector_proxy_t proxy);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,208 @@
+/*
+ * webinspector_proxy_jni.c
+ * JNI binding of the webinspector proxy for NativeInspectorSocket
+ *
+ * Copyright (c) 2013 Yury Melnichek All Rights Reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <limits.h>
+#include <stdio.h>
+#include <stdint.h>
+
+#include <jni.h>
+
+#include "webinspector_proxy.h"
+
+/* Must match NativeInspectorSocket.RECEIVE_DEVICE_LOST. */
+#define RECEIVE_DEVICE_LOST INT_MIN
+
+static void throw_io_exception(JNIEnv *env, const char *what, webinspector_proxy_error_t error)
+{
+	char message[128];
+	jclass clazz = (*env)->FindClass(env, "java/io/IOException");
+	if (clazz) {
+		snprintf(message, sizeof(message), "%s failed: %d", what, error);
+		(*env)->ThrowNew(env, clazz, message);
+	}
+}
+
+static webinspector_proxy_t to_proxy(jlong handle)
+{
+	return (webinspector_proxy_t)(intptr_t)handle;
+}
+
+/* The socket receiving on this thread; screencast frames are only delivered from within receives. */
+typedef struct {
+	JNIEnv *env;
+	jobject socket;
+	jmethodID on_screencast_frame;
+} receive_context_t;
+
+static __thread receive_context_t receive_context;
+
+/* Forwards a frame to NativeInspectorSocket.onScreencastFrame. */
+static void on_screencast_frame(const webinspector_proxy_screencast_frame_t *frame, void *user_data)
+{
+	JNIEnv *env = receive_context.env;
+	if (!env || !receive_context.on_screencast_frame || (*env)->ExceptionCheck(env)) {
+		return;
+	}
+	jbyteArray data = (*env)->NewByteArray(env, (jsize)frame->length);
+	if (!data) {
+		return;
+	}
+	(*env)->SetByteArrayRegion(env, data, 0, (jsize)frame->length, (const jbyte *)frame->data);
+	(*env)->CallVoidMethod(env, receive_context.socket, receive_context.on_screencast_frame, data,
+			(jint)frame->session_id, frame->timestamp, frame->device_width, frame->device_height,
+			frame->page_scale_factor, frame->offset_top, frame->scroll_offset_x, frame->scroll_offset_y);
+	(*env)->DeleteLocalRef(env, data);
+}
+
+/* private static native long nativeOpen(String udid) throws IOException; */
+JNIEXPORT jlong JNICALL Java_com_google_iosdevicecontrol_webinspector_NativeInspectorSocket_nativeOpen(JNIEnv *env, jclass clazz, jstring udid)
+{
+	webinspector_proxy_t proxy = NULL;
+	webinspector_proxy_error_t res;
+
+	const char *udid_chars = udid ? (*env)->GetStringUTFChars(env, udid, NULL) : NULL;
+	res = webinspector_proxy_new(udid_chars, &proxy);
+	if (udid_chars) {
+		(*env)->ReleaseStringUTFChars(env, udid, udid_chars);
+	}
+	if (res != WEBINSPECTOR_PROXY_E_SUCCESS) {
+		throw_io_exception(env, "webinspector_proxy_new", res);
+		return 0;
+	}
+
+	res = webinspector_proxy_connect(proxy);
+	if (res != WEBINSPECTOR_PROXY_E_SUCCESS) {
+		webinspector_proxy_free(proxy);
+		throw_io_exception(env, "webinspector_proxy_connect", res);
+		return 0;
+	}
+
+	return (jlong)(intptr_t)proxy;
+}
+
+/* private static native void nativeSend(long handle, ByteBuffer frame, int length) throws IOException; */
+JNIEXPORT void JNICALL Java_com_google_iosdevicecontrol_webinspector_NativeInspectorSocket_nativeSend(JNIEnv *env, jclass clazz, jlong handle, jobject frame, jint length)
+{
+	const char *data = (const char *)(*env)->GetDirectBufferAddress(env, frame);
+	if (!data || length < 0 || length > (*env)->GetDirectBufferCapacity(env, frame)) {
+		throw_io_exception(env, "webinspector_proxy_send", WEBINSPECTOR_PROXY_E_INVALID_ARG);
+		return;
+	}
+
+	webinspector_proxy_error_t res = webinspector_proxy_send(to_proxy(handle), data, (uint32_t)length);
+	if (res != WEBINSPECTOR_PROXY_E_SUCCESS) {
+		throw_io_exception(env, "webinspector_proxy_send", res);
+	}
+}
+
+/* private static native void nativeSetConsoleLog(long handle, String path, int minLevel) throws IOException; */
+JNIEXPORT void JNICALL Java_com_google_iosdevicecontrol_webinspector_NativeInspectorSocket_nativeSetConsoleLog(JNIEnv *env, jclass clazz, jlong handle, jstring path, jint min_level)
+{
+	const char *path_chars = path ? (*env)->GetStringUTFChars(env, path, NULL) : NULL;
+	webinspector_proxy_error_t res = webinspector_proxy_set_console_log(to_proxy(handle), path_chars, (webinspector_proxy_console_level_t)min_level);
+	if (path_chars) {
+		(*env)->ReleaseStringUTFChars(env, path, path_chars);
+	}
+	if (res != WEBINSPECTOR_PROXY_E_SUCCESS) {
+		throw_io_exception(env, "webinspector_proxy_set_console_log", res);
+	}
+}
+
+/* private static native void nativeSetHarLog(long handle, String path, boolean includeBodies) throws IOException; */
+JNIEXPORT void JNICALL Java_com_google_iosdevicecontrol_webinspector_NativeInspectorSocket_nativeSetHarLog(JNIEnv *env, jclass clazz, jlong handle, jstring path, jboolean include_bodies)
+{
+	const char *path_chars = path ? (*env)->GetStringUTFChars(env, path, NULL) : NULL;
+	webinspector_proxy_error_t res = webinspector_proxy_set_har_log(to_proxy(handle), path_chars, include_bodies);
+	if (path_chars) {
+		(*env)->ReleaseStringUTFChars(env, path, path_chars);
+	}
+	if (res != WEBINSPECTOR_PROXY_E_SUCCESS) {
+		throw_io_exception(env, "webinspector_proxy_set_har_log", res);
+	}
+}
+
+/* private static native void nativeSetResponseCache(long handle, String methods, int ttlMillis) throws IOException; */
+JNIEXPORT void JNICALL Java_com_google_iosdevicecontrol_webinspector_NativeInspectorSocket_nativeSetResponseCache(JNIEnv *env, jclass clazz, jlong handle, jstring methods, jint ttl_ms)
+{
+	const char *methods_chars = methods ? (*env)->GetStringUTFChars(env, methods, NULL) : NULL;
+	webinspector_proxy_error_t res = webinspector_proxy_set_response_cache(to_proxy(handle), methods_chars, ttl_ms > 0 ? (uint32_t)ttl_ms : 0);
+	if (methods_chars) {
+		(*env)->ReleaseStringUTFChars(env, methods, methods_chars);
+	}
+	if (res != WEBINSPECTOR_PROXY_E_SUCCESS) {
+		throw_io_exception(env, "webinspector_proxy_set_response_cache", res);
+	}
+}
+
+/* private static native void nativeSetScreencast(long handle, boolean enabled, int maxFramesPerSecond); */
+JNIEXPORT void JNICALL Java_com_google_iosdevicecontrol_webinspector_NativeInspectorSocket_nativeSetScreencast(JNIEnv *env, jclass clazz, jlong handle, jboolean enabled, jint max_fps)
+{
+	webinspector_proxy_set_screencast_callback(to_proxy(handle), enabled ? on_screencast_frame : NULL, NULL, max_fps > 0 ? (uint32_t)max_fps : 0);
+}
+
+/*
+ * private native int nativeReceive(long handle, ByteBuffer frame, int timeoutMillis) throws IOException;
+ *
+ * Returns the frame length, 0 on timeout, the negated required capacity if
+ * the frame does not fit (the frame is then returned by the next call), or
+ * RECEIVE_DEVICE_LOST once the device lost frame has been returned.
+ */
+JNIEXPORT jint JNICALL Java_com_google_iosdevicecontrol_webinspector_NativeInspectorSocket_nativeReceive(JNIEnv *env, jobject self, jlong handle, jobject frame, jint timeout_ms)
+{
+	char *data = (char *)(*env)->GetDirectBufferAddress(env, frame);
+	jlong capacity = (*env)->GetDirectBufferCapacity(env, frame);
+	uint32_t length = 0;
+
+	if (!data || capacity < 0 || timeout_ms < 0) {
+		throw_io_exception(env, "webinspector_proxy_receive", WEBINSPECTOR_PROXY_E_INVALID_ARG);
+		return 0;
+	}
+
+	receive_context.env = env;
+	receive_context.socket = self;
+	receive_context.on_screencast_frame = (*env)->GetMethodID(env, (*env)->GetObjectClass(env, self), "onScreencastFrame", "([BIDDDDDDD)V");
+	webinspector_proxy_error_t res = webinspector_proxy_receive_into(to_proxy(handle), data, (uint32_t)capacity, &length, (uint32_t)timeout_ms);
+	receive_context.env = NULL;
+	receive_context.socket = NULL;
+	if ((*env)->ExceptionCheck(env)) {
+		/* a listener threw; the frame, if any, is returned by the next call */
+		return 0;
+	}
+	switch (res) {
+	case WEBINSPECTOR_PROXY_E_SUCCESS:
+		return (jint)length;
+	case WEBINSPECTOR_PROXY_E_RECEIVE_TIMEOUT:
+		return 0;
+	case WEBINSPECTOR_PROXY_E_BUFFER_TOO_SMALL:
+		return -(jint)length;
+	case WEBINSPECTOR_PROXY_E_DEVICE_LOST:
+		return RECEIVE_DEVICE_LOST;
+	default:
+		throw_io_exception(env, "webinspector_proxy_receive", res);
+		return 0;
+	}
+}
+
+/* private static native void nativeClose(long handle); */
+JNIEXPORT void JNICALL Java_com_google_iosdevicecontrol_webinspector_NativeInspectorSocket_nativeClose(JNIEnv *env, jclass clazz, jlong handle)
+{
+	webinspector_proxy_free(to_proxy(handle));
+}